@@ -0,0 +1,456 @@
+#include "assetstream.h"
+
+#include <cassert>  // assert
+#include <cstdio>   // fprintf
+#include <cstring>  // memcpy
+#include <string>   // std::string
+
+#include "stb/stb_image.h"
+
+#include "jobs.h"
+#include "profiler.h"
+
+enum streamAssetKind
+{
+    STREAM_TEXTURE,
+    STREAM_GEOMETRY
+};
+
+namespace
+{
+    // The same steps as loadTexture, minus the upload: the cached build if the image
+    // hasn't changed, otherwise mips and compression built here and cached for next time
+    bool decodeTexture(const char* filePath, const textureLoadOptions& options, builtTexture& built)
+    {
+        int width, height, channels;
+        if (!stbi_info(filePath, &width, &height, &channels))
+        {
+            return false;
+        }
+
+        textureCompression compression = chooseCompression(channels, options);
+        if (openTextureCache(filePath, compression, options.mipmaps, built))
+        {
+            return true;
+        }
+
+        unsigned char* pixels = stbi_load(filePath, &width, &height, &channels, STBI_rgb_alpha);
+        if (pixels == nullptr)
+        {
+            return false;
+        }
+
+        // One thread -- a background task shouldn't fan out over the frame's job threads
+        buildTexture(pixels, width, height, channels, compression, options.mipmaps, built, 1);
+        writeTextureCache(filePath, options.mipmaps, built);
+
+        stbi_image_free(pixels);
+        return true;
+    }
+}
+
+struct assetStreamer::streamAsset
+{
+    streamAssetKind kind;
+    std::string filePath;
+    meshLoadOptions meshOptions;
+    textureLoadOptions textureOptions;
+    assetState state;
+
+    // filled in by the decode task
+    bool decodeFailed;
+    builtTexture built;
+    meshData mesh;
+
+    // upload progress
+    unsigned level;     // textures: mip level being copied
+    size_t uploaded;    // rows of blocks (or texels) in that level for textures, bytes for geometry
+    GLsync fence;
+
+    // final GL objects
+    texture tex;
+    geometry geo;
+};
+
+bool assetStreamer::init(size_t frameBudget)
+{
+    quitting = false;
+    decodesInFlight = 0;
+    stats = {};
+
+    // Triple-buffered so a frame's copies can still be in flight while we fill the next
+    staging = makeStreamBuffer(GL_COPY_READ_BUFFER, frameBudget, 3);
+
+    // Magenta/black checker so missing textures are obvious
+    const unsigned char checker[] =
+    {
+        255, 0, 255, 255,   0, 0, 0, 255,
+        0, 0, 0, 255,       255, 0, 255, 255
+    };
+    placeholderTexture = makeTexture(2, 2, 4, checker);
+
+    // Small octahedron stands in for meshes that haven't arrived yet
+    vertex octVerts[] =
+    {
+        { {  .5f, 0, 0, 1 }, { 1, 1, 1, 1 }, { 1.0f, .5f }, {  1, 0, 0, 0 } },
+        { { -.5f, 0, 0, 1 }, { 1, 1, 1, 1 }, { 0.0f, .5f }, { -1, 0, 0, 0 } },
+        { { 0,  .5f, 0, 1 }, { 1, 1, 1, 1 }, { .5f, 1.0f }, { 0,  1, 0, 0 } },
+        { { 0, -.5f, 0, 1 }, { 1, 1, 1, 1 }, { .5f, 0.0f }, { 0, -1, 0, 0 } },
+        { { 0, 0,  .5f, 1 }, { 1, 1, 1, 1 }, { .5f, .5f },  { 0, 0,  1, 0 } },
+        { { 0, 0, -.5f, 1 }, { 1, 1, 1, 1 }, { .5f, .5f },  { 0, 0, -1, 0 } }
+    };
+    unsigned int octIndices[] =
+    {
+        0, 2, 4,   2, 1, 4,   1, 3, 4,   3, 0, 4,
+        2, 0, 5,   1, 2, 5,   3, 1, 5,   0, 3, 5
+    };
+    placeholderGeometry = makeGeometry(octVerts, 6, octIndices, 24);
+
+    // stb's flip flag is global, so set it once here rather than from the decode tasks
+    stbi_set_flip_vertically_on_load(true);
+
+    return true;
+}
+
+void assetStreamer::term()
+{
+    // Decodes that haven't started yet bail out -- wait for the rest
+    {
+        std::unique_lock<std::mutex> guard(queueLock);
+        quitting = true;
+        decodeSignal.wait(guard, [this]() { return decodesInFlight == 0; });
+    }
+
+    // Free everything we loaded, finished or not
+    for (std::unique_ptr<streamAsset>& asset : assets)
+    {
+        if (asset->fence != nullptr)
+        {
+            glDeleteSync(asset->fence);
+        }
+        freeBuiltTexture(asset->built);
+        freeMeshData(asset->mesh);
+
+        if (asset->tex.handle != 0)
+        {
+            freeTexture(asset->tex);
+        }
+        if (asset->geo.vao != 0)
+        {
+            freeGeometry(asset->geo);
+        }
+    }
+
+    assets.clear();
+    uploading.clear();
+    fenced.clear();
+    decodedQueue.clear();
+
+    freeTexture(placeholderTexture);
+    freeGeometry(placeholderGeometry);
+    freeStreamBuffer(staging);
+}
+
+assetHandle assetStreamer::enqueue(std::unique_ptr<streamAsset> asset)
+{
+    assetHandle handle = (assetHandle)assets.size();
+    streamAsset* request = asset.get();
+    request->state = ASSET_QUEUED;
+    assets.push_back(std::move(asset));
+
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        ++decodesInFlight;
+    }
+    runBackgroundTask([this, request]() { decodeTask(*request); });
+
+    return handle;
+}
+
+assetHandle assetStreamer::loadTextureAsync(const char* filePath, const textureLoadOptions& options)
+{
+    assert(filePath != nullptr && "File path was invalid.");
+
+    std::unique_ptr<streamAsset> asset(new streamAsset());
+    asset->kind = STREAM_TEXTURE;
+    asset->filePath = filePath;
+    asset->textureOptions = options;
+
+    return enqueue(std::move(asset));
+}
+
+assetHandle assetStreamer::loadGeometryAsync(const char* filePath, const meshLoadOptions& options)
+{
+    assert(filePath != nullptr && "File path was invalid.");
+
+    std::unique_ptr<streamAsset> asset(new streamAsset());
+    asset->kind = STREAM_GEOMETRY;
+    asset->filePath = filePath;
+    asset->meshOptions = options;
+
+    return enqueue(std::move(asset));
+}
+
+void assetStreamer::decodeTask(streamAsset& asset)
+{
+    bool skip;
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        skip = quitting;
+    }
+
+    if (!skip)
+    {
+        decode(asset);
+    }
+
+    std::lock_guard<std::mutex> guard(queueLock);
+    if (!skip)
+    {
+        decodedQueue.push_back(&asset);
+    }
+    if (--decodesInFlight == 0)
+    {
+        decodeSignal.notify_all();
+    }
+}
+
+void assetStreamer::decode(streamAsset& asset)
+{
+    PROFILE_SCOPE("assetStreamer::decode");
+
+    // No GL calls in here -- this runs on a job thread
+    if (asset.kind == STREAM_TEXTURE)
+    {
+        asset.decodeFailed = !decodeTexture(asset.filePath.c_str(), asset.textureOptions, asset.built);
+    }
+    else
+    {
+        asset.decodeFailed = !decodeMesh(asset.filePath.c_str(), asset.meshOptions, asset.mesh);
+    }
+
+    if (asset.decodeFailed)
+    {
+        fprintf(stderr, "[ERROR] could not load %s\n", asset.filePath.c_str());
+    }
+}
+
+bool assetStreamer::upload(streamAsset& asset)
+{
+    if (asset.kind == STREAM_TEXTURE)
+    {
+        const builtTexture& built = asset.built;
+        bool compressed = built.compression != TEXTURE_RGBA8;
+
+        // Every level in turn, smallest copy being one row of blocks (or texels)
+        while (asset.level < built.levelCount)
+        {
+            const textureLevel& level = built.levels[asset.level];
+            unsigned rowHeight = compressed ? 4 : 1;
+            size_t levelRows = (level.height + rowHeight - 1) / rowHeight;
+            size_t rowBytes = (size_t)(level.size / levelRows);
+            assert(rowBytes <= staging.regionSize && "frame budget is smaller than one texture row");
+
+            // as many whole rows as fit in what's left of this frame's budget
+            size_t rows = streamSpaceLeft(staging) / rowBytes;
+            size_t rowsLeft = levelRows - asset.uploaded;
+            rows = rows < rowsLeft ? rows : rowsLeft;
+            if (rows == 0)
+            {
+                return false;
+            }
+
+            size_t offset = allocateStream(staging, rows * rowBytes);
+            if (offset == STREAM_ALLOC_FAILED)
+            {
+                return false;
+            }
+            memcpy(staging.mapped + offset, built.data + level.offset + asset.uploaded * rowBytes, rows * rowBytes);
+
+            // Source the rows from the staging buffer instead of client memory
+            GLint y = (GLint)(asset.uploaded * rowHeight);
+            GLsizei height = (GLsizei)(rows * rowHeight);
+            height = y + height > (GLint)level.height ? (GLsizei)level.height - y : height;
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.handle);
+            glBindTexture(GL_TEXTURE_2D, asset.tex.handle);
+            if (compressed)
+            {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, asset.level, 0, y, level.width, height,
+                                          built.internalFormat, (GLsizei)(rows * rowBytes),
+                                          (void*)offset);       // offset into the staging buffer
+            }
+            else
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, asset.level, 0, y, level.width, height,
+                                GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            asset.uploaded += rows;
+            stats.bytesThisFrame += rows * rowBytes;
+
+            if (asset.uploaded == levelRows)
+            {
+                ++asset.level;
+                asset.uploaded = 0;
+            }
+        }
+
+        return true;
+    }
+
+    // Geometry -- vertex bytes followed by index bytes, copied on the GPU from staging
+    size_t vertBytes = asset.mesh.vertCount * describeVertexFormat(asset.mesh.format).stride;
+    size_t indexBytes = asset.mesh.indxCount * indexTypeSize(asset.mesh.indexType);
+
+    while (asset.uploaded < vertBytes + indexBytes)
+    {
+        bool inVerts = asset.uploaded < vertBytes;
+        size_t sectionStart = inVerts ? 0 : vertBytes;
+        size_t sectionEnd = inVerts ? vertBytes : vertBytes + indexBytes;
+        const unsigned char* source = (const unsigned char*)(inVerts ? asset.mesh.verts : asset.mesh.indices);
+        GLuint destination = inVerts ? asset.geo.vbo : asset.geo.ibo;
+
+        size_t bytes = sectionEnd - asset.uploaded;
+        size_t space = streamSpaceLeft(staging) & ~(size_t)3;
+        bytes = bytes < space ? bytes : space;
+        if (bytes == 0)
+        {
+            return false;
+        }
+
+        size_t offset = allocateStream(staging, bytes);
+        if (offset == STREAM_ALLOC_FAILED)
+        {
+            return false;
+        }
+        memcpy(staging.mapped + offset, source + (asset.uploaded - sectionStart), bytes);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, staging.handle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            offset, asset.uploaded - sectionStart, bytes);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        asset.uploaded += bytes;
+        stats.bytesThisFrame += bytes;
+    }
+
+    return true;
+}
+
+void assetStreamer::tick()
+{
+    PROFILE_GPU_SCOPE("assetStreamer::tick");
+
+    stats.bytesThisFrame = 0;
+
+    // Pick up whatever the decode tasks have finished
+    std::vector<streamAsset*> decoded;
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        decoded.assign(decodedQueue.begin(), decodedQueue.end());
+        decodedQueue.clear();
+    }
+
+    for (streamAsset* asset : decoded)
+    {
+        if (asset->decodeFailed)
+        {
+            asset->state = ASSET_FAILED;
+            continue;
+        }
+
+        // Allocate storage now; the contents arrive over the next few frames
+        if (asset->kind == STREAM_TEXTURE)
+        {
+            asset->tex = makeBuiltTexture(asset->built, false);
+        }
+        else
+        {
+            const meshData& mesh = asset->mesh;
+            asset->geo = makePackedGeometry(nullptr, mesh.vertCount, mesh.format,
+                                            nullptr, mesh.indxCount, mesh.indexType,
+                                            mesh.boundsMin, mesh.boundsMax,
+                                            mesh.lods, mesh.lodCount);
+        }
+
+        asset->state = ASSET_UPLOADING;
+        uploading.push_back(asset);
+    }
+
+    // Copy as much as this frame's budget allows, oldest request first
+    if (!uploading.empty())
+    {
+        unsigned waitsBefore = staging.fenceWaits;
+        beginStreamRegion(staging);
+        stats.stagingWaits += staging.fenceWaits - waitsBefore;
+
+        size_t done = 0;
+        for (streamAsset* asset : uploading)
+        {
+            if (!upload(*asset))
+            {
+                break;  // out of budget
+            }
+
+            // Every copy is issued -- the CPU copy can go and we wait on the GPU
+            freeBuiltTexture(asset->built);
+            freeMeshData(asset->mesh);
+
+            asset->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            asset->state = ASSET_FENCED;
+            fenced.push_back(asset);
+            ++done;
+        }
+        uploading.erase(uploading.begin(), uploading.begin() + done);
+
+        endStreamRegion(staging);
+        stats.bytesTotal += stats.bytesThisFrame;
+    }
+
+    // Swap in anything the GPU has finished with
+    for (size_t i = 0; i < fenced.size();)
+    {
+        streamAsset* asset = fenced[i];
+
+        GLenum status = glClientWaitSync(asset->fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            glDeleteSync(asset->fence);
+            asset->fence = nullptr;
+            asset->state = ASSET_READY;
+            ++stats.assetsReady;
+
+            fenced[i] = fenced.back();
+            fenced.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+assetState assetStreamer::state(assetHandle handle) const
+{
+    assert(handle < assets.size() && "invalid asset handle");
+    return assets[handle]->state;
+}
+
+const texture& assetStreamer::getTexture(assetHandle handle) const
+{
+    assert(handle < assets.size() && assets[handle]->kind == STREAM_TEXTURE && "not a texture handle");
+    const streamAsset& asset = *assets[handle];
+    return asset.state == ASSET_READY ? asset.tex : placeholderTexture;
+}
+
+const geometry& assetStreamer::getGeometry(assetHandle handle) const
+{
+    assert(handle < assets.size() && assets[handle]->kind == STREAM_GEOMETRY && "not a geometry handle");
+    const streamAsset& asset = *assets[handle];
+    return asset.state == ASSET_READY ? asset.geo : placeholderGeometry;
+}
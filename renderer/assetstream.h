@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>	// condition_variable
+#include <deque>				// deque
+#include <memory>				// unique_ptr
+#include <mutex>				// mutex
+#include <vector>				// vector
+
+#include "render.h"			// geometry, texture
+#include "streambuffer.h"	// streamBuffer
+#include "texturebuild.h"	// builtTexture, textureLoadOptions
+
+// Refers to an asset requested from an assetStreamer
+typedef unsigned assetHandle;
+const assetHandle INVALID_ASSET = ~0u;
+
+enum assetState
+{
+	ASSET_QUEUED,		// waiting for (or in) its decode task
+	ASSET_UPLOADING,	// decoded, copying to the GPU a slice per frame
+	ASSET_FENCED,		// all copies issued, waiting for the GPU to finish them
+	ASSET_READY,		// safe to use
+	ASSET_FAILED		// decode failed -- the placeholder stays in use
+};
+
+struct assetStreamStats
+{
+	size_t bytesThisFrame;		// bytes copied into staging during the last tick
+	size_t bytesTotal;
+	unsigned assetsReady;
+	unsigned stagingWaits;		// ticks that blocked on a staging region fence
+};
+
+// Loads textures and meshes in the background. Requests return a handle
+// immediately; job system background tasks decode them and tick() uploads them through a
+// persistently mapped staging buffer under a per-frame byte budget.
+// Until an asset is ready its handle resolves to a placeholder.
+class assetStreamer
+{
+	struct streamAsset;
+
+	std::vector<std::unique_ptr<streamAsset>> assets;
+	std::vector<streamAsset*> uploading;	// main thread only, in request order
+	std::vector<streamAsset*> fenced;		// main thread only, waiting on the GPU
+
+	// decode tasks hand their results back through here
+	std::deque<streamAsset*> decodedQueue;
+	std::mutex queueLock;
+	std::condition_variable decodeSignal;	// a decode finished
+	unsigned decodesInFlight;
+	bool quitting;
+
+	streamBuffer staging;
+	texture placeholderTexture;
+	geometry placeholderGeometry;
+
+	void decodeTask(streamAsset& asset);
+	void decode(streamAsset& asset);
+	bool upload(streamAsset& asset);	// returns true once every byte has been copied
+	assetHandle enqueue(std::unique_ptr<streamAsset> asset);
+
+public:
+	assetStreamStats stats;
+
+	// frameBudget is the most bytes uploaded per tick. Decodes run as background
+	// tasks, so start the job system first or they happen inside the load calls.
+	bool init(size_t frameBudget = 4 * 1024 * 1024);
+	void term();	// also frees every asset it loaded
+
+	// Textures go through the same build stage and cache as loadTexture
+	assetHandle loadTextureAsync(const char* filePath, const textureLoadOptions& options = textureLoadOptions());
+	assetHandle loadGeometryAsync(const char* filePath, const meshLoadOptions& options = meshLoadOptions());
+
+	// Call once per frame on the GL thread
+	void tick();
+
+	assetState state(assetHandle handle) const;
+	const texture& getTexture(assetHandle handle) const;
+	const geometry& getGeometry(assetHandle handle) const;
+};
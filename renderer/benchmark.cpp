@@ -0,0 +1,949 @@
+#include "benchmark.h"
+
+#include <algorithm>    // sort
+#include <cmath>        // cosf, sinf
+#include <cstdio>       // printf
+#include <cstdlib>      // strtoul
+#include <cstring>      // strcmp
+#include <fstream>      // ofstream
+#include <string>       // std::string
+#include <vector>       // vector
+
+#include "glm/ext.hpp"
+
+#include "clusterlights.h"
+#include "context.h"
+#include "culling.h"
+#include "fileio.h"
+#include "instancing.h"
+#include "jobs.h"
+#include "meshbvh.h"
+#include "meshlets.h"
+#include "occlusion.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "render.h"
+#include "renderqueue.h"
+#include "softraster.h"
+#include "uniformblocks.h"
+
+namespace
+{
+    const size_t OCCLUDER_PROPS = 32;   // nearest visible props drawn into the occlusion buffer
+    const unsigned OCCLUDER_LODS = 3;   // occluders use the coarsest of this many levels
+    const size_t RAYCAST_CHECKED = 512; // rays per set compared against testing every triangle
+
+    // Instanced Lambert -- object.model only undoes quantization, the instance places the copy
+    const char* benchVertBody =
+        "layout (location = 0) in vec4 position;\n"
+        "layout (location = 2) in vec2 uv;\n"
+        "layout (location = 3) in vec4 normal;\n"
+        "layout (location = 4) in mat4 instanceTransform;\n"
+        "layout (location = 8) in vec4 instanceColor;\n"
+
+        "out vec2 vUV;\n"
+        "out vec3 vNormal;\n"
+        "out vec4 vTint;\n"
+
+        "void main() { gl_Position = camera.viewProj * instanceTransform * object.model * position;\n"
+        "vUV = uv;\n"
+        "vNormal = mat3(instanceTransform) * normal.xyz;\n"
+        "vTint = instanceColor * object.color; }";
+
+    const char* benchFragBody =
+        "in vec2 vUV;\n"
+        "in vec3 vNormal;\n"
+        "in vec4 vTint;\n"
+        "out vec4 outputColor;\n"
+
+        "layout (location = 3) uniform sampler2D mainTexture;\n"
+
+        "void main() { float lambert = max(0.0, dot(normalize(vNormal), -frame.lightDirection.xyz));\n"
+        "vec3 diffuseColor = texture(mainTexture, vUV).xyz * vTint.xyz * frame.lightDiffuse.xyz * lambert;\n"
+        "outputColor = vec4(frame.ambient.xyz + diffuseColor, 1.0); }";
+
+    // The same, plus every clustered light touching the fragment
+    const char* clusteredVertBody =
+        "layout (location = 0) in vec4 position;\n"
+        "layout (location = 2) in vec2 uv;\n"
+        "layout (location = 3) in vec4 normal;\n"
+        "layout (location = 4) in mat4 instanceTransform;\n"
+        "layout (location = 8) in vec4 instanceColor;\n"
+
+        "out vec2 vUV;\n"
+        "out vec3 vNormal;\n"
+        "out vec4 vTint;\n"
+        "out vec3 vWorld;\n"
+        "out float vViewDepth;\n"
+
+        "void main() { vec4 world = instanceTransform * object.model * position;\n"
+        "gl_Position = camera.viewProj * world;\n"
+        "vWorld = world.xyz;\n"
+        "vViewDepth = -(camera.view * world).z;\n"
+        "vUV = uv;\n"
+        "vNormal = mat3(instanceTransform) * normal.xyz;\n"
+        "vTint = instanceColor * object.color; }";
+
+    const char* clusteredFragBody =
+        "in vec2 vUV;\n"
+        "in vec3 vNormal;\n"
+        "in vec4 vTint;\n"
+        "in vec3 vWorld;\n"
+        "in float vViewDepth;\n"
+        "out vec4 outputColor;\n"
+
+        "layout (location = 3) uniform sampler2D mainTexture;\n"
+
+        "void main() { vec3 n = normalize(vNormal);\n"
+        "vec3 light = frame.lightDiffuse.xyz * max(0.0, dot(n, -frame.lightDirection.xyz));\n"
+        "light += clusteredLight(vWorld, n, gl_FragCoord.xy, vViewDepth);\n"
+        "vec3 diffuseColor = texture(mainTexture, vUV).xyz * vTint.xyz * light;\n"
+        "outputColor = vec4(frame.ambient.xyz + diffuseColor, 1.0); }";
+
+    // Version line, then the shared uniform blocks, then the stage itself
+    std::string withBlocks(const char* body, const char* extra = "")
+    {
+        return std::string("#version 430\n") + UNIFORM_BLOCKS_GLSL + extra + body;
+    }
+
+    double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[index < sorted.size() ? index : sorted.size() - 1];
+    }
+
+    // Binary PPM, top row first
+    bool writePPM(const char* filePath, const std::vector<unsigned char>& rgba, int width, int height)
+    {
+        std::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            fprintf(stderr, "Failed to write image %s\n", filePath);
+            return false;
+        }
+
+        out << "P6\n" << width << " " << height << "\n255\n";
+
+        std::vector<unsigned char> row((size_t)width * 3);
+        for (int y = height - 1; y >= 0; --y)
+        {
+            const unsigned char* src = &rgba[(size_t)y * width * 4];
+            for (int x = 0; x < width; ++x)
+            {
+                row[x * 3 + 0] = src[x * 4 + 0];
+                row[x * 3 + 1] = src[x * 4 + 1];
+                row[x * 3 + 2] = src[x * 4 + 2];
+            }
+            out.write((const char*)row.data(), row.size());
+        }
+
+        return (bool)out;
+    }
+
+    // A grid of props with a little variation so the image is worth checking
+    std::vector<instanceData> makeScene(unsigned grid, float spacing)
+    {
+        std::vector<instanceData> scene(grid * grid);
+        for (unsigned z = 0; z < grid; ++z)
+        {
+            for (unsigned x = 0; x < grid; ++x)
+            {
+                instanceData& prop = scene[z * grid + x];
+                glm::vec3 position((x - (grid - 1) * 0.5f) * spacing, 0.0f, (z - (grid - 1) * 0.5f) * spacing);
+                prop.transform = glm::rotate(glm::translate(glm::identity<glm::mat4>(), position),
+                                             (float)((x * 7 + z * 13) % 16) * 0.39f, glm::vec3(0, 1, 0));
+                prop.color = glm::vec4(0.6f + 0.4f * (x % 3) / 2.0f, 0.6f + 0.4f * (z % 3) / 2.0f, 0.8f, 1.0f);
+            }
+        }
+        return scene;
+    }
+
+    void printFrameTimes(const std::vector<double>& frameMs)
+    {
+        std::vector<double> sorted = frameMs;
+        std::sort(sorted.begin(), sorted.end());
+
+        double total = 0.0;
+        for (double ms : sorted)
+        {
+            total += ms;
+        }
+
+        printf("Frame time ms: avg %.3f  min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+               total / sorted.size(), sorted.front(), percentile(sorted, 0.5), percentile(sorted, 0.9),
+               percentile(sorted, 0.99), sorted.back());
+    }
+
+    // Checksum and optional image of a finished frame
+    void reportFinalFrame(const benchmarkOptions& options, const std::vector<unsigned char>& pixels)
+    {
+        printf("Final frame checksum: %016llx\n", (unsigned long long)hashBytes(pixels.data(), pixels.size()));
+        if (options.imagePath != nullptr && writePPM(options.imagePath, pixels, options.width, options.height))
+        {
+            printf("Final frame written to %s\n", options.imagePath);
+        }
+    }
+
+    // Deterministic camera path -- one slow orbit with a bob, driven by the frame number only
+    glm::mat4 cameraView(unsigned frame, unsigned frameCount, float sceneRadius)
+    {
+        float t = (float)frame / (float)(frameCount > 0 ? frameCount : 1);
+        float angle = glm::two_pi<float>() * t;
+        float radius = sceneRadius * 0.75f;
+
+        glm::vec3 eye(cosf(angle) * radius, 4.0f + 2.0f * sinf(angle * 3.0f), sinf(angle) * radius);
+        glm::vec3 target(cosf(angle + 0.6f) * radius * 0.4f, 0.0f, sinf(angle + 0.6f) * radius * 0.4f);
+        return glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+    }
+
+    // The prop's coarsest level, decoded again with its positions kept on the CPU
+    occluderMesh loadOccluder(const char* meshPath)
+    {
+        meshLoadOptions lodOptions;
+        lodOptions.lodCount = OCCLUDER_LODS;
+        return makeOccluderMesh(loadSoftMesh(meshPath, lodOptions));
+    }
+
+    // The props nearest the camera hide the ones behind them -- returns how many are left visible
+    size_t occludeProps(occlusionBuffer& buffer, const occluderMesh& occluder, const std::vector<instanceData>& scene,
+                        cullBatch& culling, const glm::mat4& viewProj)
+    {
+        // Clip w is the view depth
+        std::vector<std::pair<float, size_t>> nearest;
+        for (size_t i = 0; i < scene.size(); ++i)
+        {
+            if (culling.visible[i])
+            {
+                nearest.push_back(std::make_pair((viewProj * scene[i].transform[3]).w, i));
+            }
+        }
+        size_t occluderCount = std::min(nearest.size(), OCCLUDER_PROPS);
+        std::partial_sort(nearest.begin(), nearest.begin() + occluderCount, nearest.end());
+
+        beginOcclusionFrame(buffer, viewProj);
+        for (size_t i = 0; i < occluderCount; ++i)
+        {
+            addOccluder(buffer, occluder, scene[nearest[i].second].transform);
+        }
+        endOcclusionFrame(buffer);
+
+        return occludeBoxes(buffer, culling);
+    }
+
+    void printOcclusion(const occlusionStats& totals, double frames)
+    {
+        printf("Occlusion per frame: %.1f occluders (%.0f triangles), %.1f tested, %.1f occluded, raster %.3f ms, test %.3f ms\n",
+               totals.occluders / frames, totals.trianglesRasterized / frames, totals.tested / frames,
+               totals.occluded / frames, totals.rasterMs / frames, totals.testMs / frames);
+    }
+
+    void addOcclusionStats(occlusionStats& totals, const occlusionStats& frame)
+    {
+        totals.occluders += frame.occluders;
+        totals.trianglesIn += frame.trianglesIn;
+        totals.trianglesRasterized += frame.trianglesRasterized;
+        totals.tested += frame.tested;
+        totals.occluded += frame.occluded;
+        totals.rasterMs += frame.rasterMs;
+        totals.testMs += frame.testMs;
+    }
+
+    // Lights circling over the props, every fourth a spot aimed at the ground -- frame number only
+    void addBenchLights(clusteredLighting& lighting, unsigned count, unsigned frame, float sceneRadius)
+    {
+        float t = frame / 60.0f;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            // Spread over the disc by the golden angle, each on its own small orbit
+            float ring = sqrtf((i + 0.5f) / count) * sceneRadius;
+            float angle = i * 2.39996323f;
+            float orbit = t * (0.5f + 0.25f * (i % 5));
+            glm::vec3 center(cosf(angle) * ring, 0.0f, sinf(angle) * ring);
+
+            localLight light;
+            light.type = i % 4 == 3 ? LIGHT_SPOT : LIGHT_POINT;
+            light.position = center + glm::vec3(cosf(orbit) * 2.0f, 1.5f + (i % 3), sinf(orbit) * 2.0f);
+            light.range = light.type == LIGHT_SPOT ? 8.0f : 4.0f;
+            light.color = glm::vec3(0.5f + 0.5f * cosf(angle), 0.5f + 0.5f * cosf(angle + 2.1f), 0.5f + 0.5f * cosf(angle + 4.2f)) * 2.0f;
+            light.direction = glm::normalize(glm::vec3(cosf(orbit) * 0.3f, -1.0f, sinf(orbit) * 0.3f));
+            light.innerAngle = 0.3f;
+            light.outerAngle = 0.5f;
+            addLight(lighting, light);
+        }
+    }
+
+    // The same scene and camera path drawn by softraster -- no GL context is needed
+    int runSoftwareBenchmark(const benchmarkOptions& options)
+    {
+        softMesh mesh = loadSoftMesh(options.meshPath);
+        softTexture diffuse = loadSoftTexture(options.texturePath);
+        if (mesh.indices.empty() || diffuse.texels.empty())
+        {
+            fprintf(stderr, "Benchmark: failed to load the scene\n");
+            return 1;
+        }
+
+        const float spacing = 3.0f;
+        unsigned grid = options.grid > 0 ? options.grid : 1;
+        float sceneRadius = grid * spacing * 0.5f + spacing;
+        std::vector<instanceData> scene = makeScene(grid, spacing);
+
+        glm::mat4 camProj = glm::perspective(glm::radians(70.0f), (float)options.width / options.height, 0.1f, 500.0f);
+        softLambertUniforms lighting;
+        lighting.texture = &diffuse;
+        lighting.ambient = glm::vec3(0.1f, 0.1f, 0.1f);
+        lighting.lightDiffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+        lighting.lightDirection = glm::normalize(glm::vec3(-1.0f, -1.0f, -0.5f));
+        softShader lambert = makeSoftLambertShader(lighting);
+
+        softTarget target = makeSoftTarget(options.width, options.height);
+        softRasterizer raster = makeSoftRasterizer(options.threads);
+        cullBatch culling = {};
+        occluderMesh occluder = options.occlusion ? loadOccluder(options.meshPath) : occluderMesh();
+        occlusionBuffer occlusion = makeOcclusionBuffer();
+        occlusionStats occlusionTotals = {};
+
+        std::vector<double> frameMs, transformMs, binMs, rasterMs;
+        frameMs.reserve(options.frames);
+        uint64_t triangles = 0, binEntries = 0, blocksRejected = 0, visibleTotal = 0;
+
+        // No context to tick, so frames are opened and closed here
+        setProfilerEnabled(options.tracePath != nullptr);
+        profilerCpuFrame();
+
+        unsigned totalFrames = options.warmup + options.frames;
+        for (unsigned frame = 0; frame < totalFrames; ++frame)
+        {
+            int64_t frameBegin = profilerNow();
+
+            glm::mat4 viewProj = camProj * cameraView(frame, totalFrames, sceneRadius);
+
+            clearCullBatch(culling);
+            addCullBoxes(culling, mesh.boundsMin, mesh.boundsMax, &scene[0].transform, scene.size(), sizeof(instanceData));
+            size_t visible = cullBoxes(culling, extractFrustum(viewProj));
+            if (options.occlusion)
+            {
+                visible = occludeProps(occlusion, occluder, scene, culling, viewProj);
+            }
+
+            clearSoftTarget(target, glm::vec4(0.25f, 0.25f, 0.25f, 1.0f));
+            beginSoftFrame(raster, target);
+            for (size_t i = 0; i < scene.size(); ++i)
+            {
+                if (culling.visible[i])
+                {
+                    softDraw(raster, mesh, scene[i].transform, viewProj, lambert, scene[i].color);
+                }
+            }
+            endSoftFrame(raster);
+
+            if (frame + 1 == totalFrames)
+            {
+                std::vector<unsigned char> pixels;
+                readSoftTarget(target, pixels);
+                reportFinalFrame(options, pixels);
+            }
+
+            if (frame >= options.warmup)
+            {
+                const softStats& stats = raster.stats;
+                frameMs.push_back((profilerNow() - frameBegin) / 1000000.0);
+                transformMs.push_back(stats.transformMs);
+                binMs.push_back(stats.binMs);
+                rasterMs.push_back(stats.rasterMs);
+                triangles += stats.trianglesBinned;
+                binEntries += stats.binEntries;
+                blocksRejected += stats.blocksRejected;
+                visibleTotal += visible;
+                addOcclusionStats(occlusionTotals, occlusion.stats);
+            }
+
+            profilerCpuFrame();
+        }
+
+        if (options.tracePath != nullptr && exportChromeTrace(options.tracePath))
+        {
+            printf("Trace of the final frame written to %s\n", options.tracePath);
+        }
+
+        if (!frameMs.empty())
+        {
+            double frames = (double)frameMs.size();
+            double transformTotal = 0.0, binTotal = 0.0, rasterTotal = 0.0;
+            for (size_t i = 0; i < frameMs.size(); ++i)
+            {
+                transformTotal += transformMs[i];
+                binTotal += binMs[i];
+                rasterTotal += rasterMs[i];
+            }
+
+            printf("Software benchmark: %u frames (%u warmup) at %dx%d, %u props, %u threads\n", options.frames,
+                   options.warmup, options.width, options.height, grid * grid,
+                   raster.threadCount == 1 ? 1 : jobThreadCount());
+            printFrameTimes(frameMs);
+            printf("Phase ms: transform %.3f  bin %.3f  raster %.3f\n",
+                   transformTotal / frames, binTotal / frames, rasterTotal / frames);
+            printf("Per frame: %.0f triangles binned, %.0f tile entries, %.0f blocks depth-rejected, %.1f visible props\n",
+                   triangles / frames, binEntries / frames, blocksRejected / frames, visibleTotal / frames);
+            if (options.occlusion)
+            {
+                printOcclusion(occlusionTotals, frames);
+            }
+        }
+
+        return 0;
+    }
+
+    // Small deterministic generator for the ray sets
+    uint32_t nextRandom(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    float randomUnit(uint32_t& state)
+    {
+        return (nextRandom(state) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Camera rays over the prop from a point on its bounding sphere, in 2x2 pixel quads so
+    // each packet of four stays together
+    std::vector<bvhRay> makeCoherentRays(size_t count, const glm::vec3& center, float radius)
+    {
+        unsigned side = 2;
+        while ((size_t)side * side < count)
+        {
+            side += 2;
+        }
+
+        glm::vec3 eye = center + glm::normalize(glm::vec3(1.0f, 0.4f, 0.8f)) * radius * 2.0f;
+        glm::vec3 forward = glm::normalize(center - eye);
+        glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0, 1, 0)));
+        glm::vec3 up = glm::cross(right, forward);
+        float extent = 0.6f; // tan of the half angle -- a little wider than the sphere
+
+        std::vector<bvhRay> rays;
+        rays.reserve(count);
+        for (unsigned quad = 0; rays.size() < count; ++quad)
+        {
+            unsigned quadX = quad % (side / 2), quadY = quad / (side / 2);
+            for (unsigned corner = 0; corner < 4 && rays.size() < count; ++corner)
+            {
+                float x = ((quadX * 2 + (corner & 1)) + 0.5f) / side * 2.0f - 1.0f;
+                float y = ((quadY * 2 + (corner >> 1)) + 0.5f) / side * 2.0f - 1.0f;
+                bvhRay ray;
+                ray.origin = eye;
+                ray.direction = glm::normalize(forward + (right * x + up * y) * extent);
+                ray.tMax = 1e30f;
+                rays.push_back(ray);
+            }
+        }
+        return rays;
+    }
+
+    // From random points on the bounding sphere towards random points inside the bounds
+    std::vector<bvhRay> makeIncoherentRays(size_t count, const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t seed)
+    {
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        float radius = glm::length(boundsMax - center);
+
+        std::vector<bvhRay> rays(count);
+        for (bvhRay& ray : rays)
+        {
+            float z = randomUnit(seed) * 2.0f - 1.0f, angle = randomUnit(seed) * glm::two_pi<float>();
+            float ring = sqrtf(1.0f - z * z);
+            ray.origin = center + glm::vec3(cosf(angle) * ring, z, sinf(angle) * ring) * radius;
+
+            glm::vec3 target(boundsMin.x + (boundsMax.x - boundsMin.x) * randomUnit(seed),
+                             boundsMin.y + (boundsMax.y - boundsMin.y) * randomUnit(seed),
+                             boundsMin.z + (boundsMax.z - boundsMin.z) * randomUnit(seed));
+            ray.direction = glm::normalize(target - ray.origin);
+            ray.tMax = 1e30f;
+        }
+        return rays;
+    }
+
+    // Closest hit by testing every triangle -- the reference the BVH is checked against
+    bool bruteForceHit(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const bvhRay& ray, float& t)
+    {
+        t = ray.tMax;
+        bool found = false;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 a = positions[indices[i]];
+            glm::vec3 e1 = positions[indices[i + 1]] - a, e2 = positions[indices[i + 2]] - a;
+            glm::vec3 p = glm::cross(ray.direction, e2);
+            float det = glm::dot(e1, p);
+            if (det == 0.0f)
+            {
+                continue;
+            }
+
+            glm::vec3 s = ray.origin - a, q = glm::cross(s, e1);
+            float u = glm::dot(s, p) / det, v = glm::dot(ray.direction, q) / det, hitT = glm::dot(e2, q) / det;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && hitT > 0.0f && hitT < t)
+            {
+                t = hitT;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Rays against one prop's BVH -- single rays, packets of four and shadow-style any-hit rays
+    int runRaycastBenchmark(const benchmarkOptions& options)
+    {
+        softMesh mesh = loadSoftMesh(options.meshPath);
+        if (mesh.indices.empty())
+        {
+            fprintf(stderr, "Benchmark: failed to load %s\n", options.meshPath);
+            return 1;
+        }
+
+        std::vector<glm::vec3> positions(mesh.vertices.size());
+        for (size_t i = 0; i < positions.size(); ++i)
+        {
+            positions[i] = glm::vec3(mesh.vertices[i].pos);
+        }
+
+        meshBvh bvh = buildMeshBvh(mesh);
+        const bvhStats& stats = bvh.stats;
+        printf("Raycast benchmark: %zu triangles, %zu nodes (%zu leaves), depth %u, SAH cost %.2f, build %.3f ms on %u threads\n",
+               stats.triangles, stats.nodes, stats.leaves, stats.depth, stats.sahCost, stats.buildMs, jobThreadCount());
+
+        glm::vec3 center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+        float radius = glm::length(mesh.boundsMax - center);
+        size_t rayCount = options.raycast;
+
+        struct raySet
+        {
+            const char* name;
+            std::vector<bvhRay> rays;
+        };
+        raySet sets[] =
+        {
+            { "coherent", makeCoherentRays(rayCount, center, radius) },
+            { "incoherent", makeIncoherentRays(rayCount, mesh.boundsMin, mesh.boundsMax, 0x9E3779B9u) },
+        };
+
+        std::vector<bvhHit> hits(rayCount);
+        std::vector<char> occluded(rayCount);
+        unsigned passes = options.frames > 0 ? options.frames : 1;
+        for (raySet& set : sets)
+        {
+            const bvhRay* rays = set.rays.data();
+            double singleMs = 0.0, packetMs = 0.0, anyMs = 0.0;
+            for (unsigned pass = 0; pass < options.warmup + passes; ++pass)
+            {
+                int64_t begin = profilerNow();
+                parallelFor((rayCount + 255) / 256, [&](size_t job)
+                {
+                    for (size_t i = job * 256; i < std::min(rayCount, job * 256 + 256); ++i)
+                    {
+                        intersectRay(bvh, rays[i], hits[i]);
+                    }
+                });
+                int64_t single = profilerNow();
+                intersectRays(bvh, rays, hits.data(), rayCount);
+                int64_t packet = profilerNow();
+                parallelFor((rayCount + 255) / 256, [&](size_t job)
+                {
+                    for (size_t i = job * 256; i < std::min(rayCount, job * 256 + 256); ++i)
+                    {
+                        occluded[i] = isRayOccluded(bvh, rays[i]);
+                    }
+                });
+                int64_t any = profilerNow();
+
+                if (pass >= options.warmup)
+                {
+                    singleMs += (single - begin) / 1000000.0;
+                    packetMs += (packet - single) / 1000000.0;
+                    anyMs += (any - packet) / 1000000.0;
+                }
+            }
+
+            size_t hitCount = 0;
+            for (const bvhHit& hit : hits)
+            {
+                hitCount += hit.triangle != BVH_NO_HIT;
+            }
+
+            // Spot check against every triangle
+            size_t mismatches = 0, checked = std::min(rayCount, RAYCAST_CHECKED);
+            for (size_t i = 0; i < checked; ++i)
+            {
+                size_t r = i * rayCount / checked;
+                float t;
+                bool reference = bruteForceHit(positions, mesh.indices, rays[r], t);
+                bool found = hits[r].triangle != BVH_NO_HIT;
+                if (found != reference || found != (occluded[r] != 0) || (found && fabsf(hits[r].t - t) > 1e-4f * t))
+                {
+                    ++mismatches;
+                }
+            }
+
+            double mrays = rayCount * (double)passes / 1000.0;
+            printf("%s rays: %zu per pass, %.1f%% hit, Mrays/s: single %.2f  packet %.2f  any-hit %.2f, %zu of %zu wrong vs brute force\n",
+                   set.name, rayCount, 100.0 * hitCount / rayCount, mrays / singleMs, mrays / packetMs, mrays / anyMs,
+                   mismatches, checked);
+        }
+
+        // A cheap deformation -- the prop swaying -- then a refit in place of a rebuild
+        glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+        for (glm::vec3& p : positions)
+        {
+            float height = (p.y - mesh.boundsMin.y) / (extent.y > 0.0f ? extent.y : 1.0f);
+            p.x += height * height * extent.x * 0.2f;
+        }
+        refitMeshBvh(bvh, positions.data(), positions.size());
+        meshBvh rebuilt = buildMeshBvh(positions.data(), positions.size(), mesh.indices.data(), mesh.indices.size());
+        printf("Deformed: refit %.3f ms (SAH cost %.2f), rebuild %.3f ms (SAH cost %.2f)\n",
+               bvh.stats.refitMs, bvh.stats.sahCost, rebuilt.stats.buildMs, rebuilt.stats.sahCost);
+
+        return 0;
+    }
+}
+
+bool parseBenchmarkArgs(int argc, char** argv, benchmarkOptions& options)
+{
+    bool requested = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--benchmark") == 0)
+        {
+            requested = true;
+        }
+        else if (strcmp(arg, "--windowed") == 0)
+        {
+            options.headless = false;
+        }
+        else if (strcmp(arg, "--software") == 0)
+        {
+            options.software = true;
+        }
+        else if (strcmp(arg, "--occlusion") == 0)
+        {
+            options.occlusion = true;
+        }
+        else if (strcmp(arg, "--meshlets") == 0)
+        {
+            options.meshlets = true;
+        }
+        else if (value == nullptr)
+        {
+            // Values of the game's own flags (see main.cpp) come through here too
+            if (strncmp(arg, "--", 2) == 0)
+            {
+                fprintf(stderr, "Missing value for %s\n", arg);
+            }
+        }
+        else if (strcmp(arg, "--frames") == 0)
+        {
+            options.frames = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--warmup") == 0)
+        {
+            options.warmup = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--grid") == 0)
+        {
+            options.grid = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--size") == 0)
+        {
+            // WxH
+            char* end = nullptr;
+            options.width = (int)strtoul(value, &end, 10);
+            options.height = (end != nullptr && *end == 'x') ? (int)strtoul(end + 1, nullptr, 10) : options.width;
+            ++i;
+        }
+        else if (strcmp(arg, "--image") == 0)
+        {
+            options.imagePath = value;
+            ++i;
+        }
+        else if (strcmp(arg, "--trace") == 0)
+        {
+            options.tracePath = value;
+            ++i;
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+            options.threads = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--lights") == 0)
+        {
+            options.lights = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--raycast") == 0)
+        {
+            options.raycast = (unsigned)strtoul(value, nullptr, 10);
+            ++i;
+        }
+    }
+
+    return requested;
+}
+
+int runBenchmark(const benchmarkOptions& options)
+{
+    if (options.raycast > 0)
+    {
+        return runRaycastBenchmark(options);
+    }
+
+    if (options.software)
+    {
+        return runSoftwareBenchmark(options);
+    }
+
+    context bench;
+    if (!bench.init(options.width, options.height, "Benchmark", options.headless ? CONTEXT_HEADLESS : CONTEXT_WINDOWED))
+    {
+        fprintf(stderr, "Benchmark: failed to create a context\n");
+        return 1;
+    }
+
+    meshLoadOptions meshOptions;
+    meshOptions.format = VERTEX_FORMAT_COMPACT;
+    meshletMesh propMeshlets;
+    geometry mesh = options.meshlets ? loadMeshletGeometry(options.meshPath, propMeshlets, meshOptions)
+                                     : loadGeometry(options.meshPath, meshOptions);
+    texture diffuse = loadTexture(options.texturePath);
+    bool clustered = options.lights > 0;
+    shader benchShader = clustered
+        ? makeShader(withBlocks(clusteredVertBody).c_str(), withBlocks(clusteredFragBody, CLUSTERED_LIGHTING_GLSL).c_str())
+        : makeShader(withBlocks(benchVertBody).c_str(), withBlocks(benchFragBody).c_str());
+    if (mesh.vao == 0 || diffuse.handle == 0 || benchShader.program == 0)
+    {
+        fprintf(stderr, "Benchmark: failed to load the scene\n");
+        bench.term();
+        return 1;
+    }
+
+    const float spacing = 3.0f;
+    unsigned grid = options.grid > 0 ? options.grid : 1;
+    float sceneRadius = grid * spacing * 0.5f + spacing;
+    std::vector<instanceData> scene = makeScene(grid, spacing);
+
+    const float nearPlane = 0.1f, farPlane = 500.0f;
+    glm::mat4 camProj = glm::perspective(glm::radians(70.0f), (float)options.width / options.height, nearPlane, farPlane);
+    frameBlock lighting;
+    lighting.ambient = glm::vec4(0.1f, 0.1f, 0.1f, 0.0f);
+    lighting.lightDiffuse = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    lighting.lightDirection = glm::vec4(glm::normalize(glm::vec3(-1.0f, -1.0f, -0.5f)), 0.0f);
+
+    // Camera, frame and object blocks all come out of one ring
+    uniformRing uniforms = makeUniformRing(64 * 1024);
+    clusteredLighting lights = {};
+    if (clustered)
+    {
+        lights = makeClusteredLighting(options.lights);
+    }
+
+    instanceBuffer visibleProps = makeInstanceBuffer(scene.size());
+    std::vector<instanceData> visible;
+    cullBatch culling = {};
+    renderQueue queue;
+
+    occluderMesh occluder;
+    if (options.occlusion)
+    {
+        occluder = loadOccluder(options.meshPath);
+    }
+    occlusionBuffer occlusion = makeOcclusionBuffer();
+    occlusionStats occlusionTotals = {};
+    packetTexture textures[] = { { diffuse.handle, 3 } };
+
+    meshletDrawList meshletDraws = {};
+    meshletCullStats meshletTotals = {};
+    size_t meshletCommands = 0;
+    if (options.meshlets)
+    {
+        meshletDraws = makeMeshletDrawList();
+        const meshletBuildStats& built = propMeshlets.stats;
+        printf("Meshlets: %zu for %zu triangles, %.1f vertices and %.1f triangles each, %zu cullable cones, built in %.3f ms\n",
+               built.meshlets, built.triangles, built.averageVertices, built.averageTriangles, built.cullableCones, built.buildMs);
+    }
+
+    std::vector<double> frameMs;
+    frameMs.reserve(options.frames);
+    uint64_t drawCalls = 0, triangles = 0, visibleTotal = 0;
+    uint64_t visibleLights = 0, lightIndices = 0, occupiedClusters = 0;
+    unsigned maxLightsPerCluster = 0;
+    double clusterMs = 0.0;
+
+    setProfilerEnabled(options.tracePath != nullptr);
+
+    unsigned totalFrames = options.warmup + options.frames;
+    for (unsigned frame = 0; frame < totalFrames; ++frame)
+    {
+        int64_t frameBegin = profilerNow();
+        resetDrawCounters();
+
+        glm::mat4 camView = cameraView(frame, totalFrames, sceneRadius);
+
+        beginUniformFrame(uniforms);
+        setCameraBlock(uniforms, makeCameraBlock(camProj, camView));
+        lighting.time = glm::vec4((float)frame / 60.0f, 0.0f, 0.0f, 0.0f);
+        setFrameBlock(uniforms, lighting);
+
+        if (clustered)
+        {
+            beginClusterFrame(lights);
+            addBenchLights(lights, options.lights, frame, sceneRadius);
+            buildClusters(lights, camProj, camView, nearPlane, farPlane, options.width, options.height);
+        }
+
+        // Cull the props, then draw the survivors in one instanced packet
+        clearCullBatch(culling);
+        addCullBoxes(culling, mesh.boundsMin, mesh.boundsMax, &scene[0].transform, scene.size(), sizeof(instanceData));
+        cullBoxes(culling, extractFrustum(camProj * camView));
+        if (options.occlusion)
+        {
+            occludeProps(occlusion, occluder, scene, culling, camProj * camView);
+        }
+
+        visible.clear();
+        for (size_t i = 0; i < scene.size(); ++i)
+        {
+            if (culling.visible[i])
+            {
+                visible.push_back(scene[i]);
+            }
+        }
+        setInstances(visibleProps, visible.data(), visible.size());
+        updateInstanceBuffer(visibleProps);
+
+        // Each visible prop's surviving meshlets, drawn with its instance slot
+        clearMeshletDrawList(meshletDraws);
+        if (options.meshlets && !visible.empty())
+        {
+            glm::vec3 eye = glm::vec3(glm::inverse(camView)[3]);
+            cullMeshletInstances(meshletDraws, propMeshlets, &visible[0].transform, visible.size(), sizeof(instanceData),
+                                 camProj * camView, eye);
+        }
+
+        bench.clear();
+
+        clearRenderQueue(queue);
+        if (!visible.empty() && !options.meshlets)
+        {
+            submitInstanced(queue, RENDER_LAYER_OPAQUE, benchShader, mesh, visibleProps, textures, 1, 0.0f);
+        }
+        sortRenderQueue(queue);
+        executeRenderQueue(queue, &uniforms);
+        if (options.meshlets)
+        {
+            objectBlock object = { positionTransform(mesh), glm::vec4(1.0f) };
+            setObjectBlock(uniforms, object);
+            setUniform(benchShader, 3, diffuse, 0);
+            drawMeshletList(meshletDraws, benchShader, mesh, &visibleProps);
+        }
+        endUniformFrame(uniforms);
+        if (clustered)
+        {
+            endClusterFrame(lights);
+        }
+
+        // Wait for the GPU so the time covers the whole frame, not just submission
+        glFinish();
+
+        // Last frame -- grab it before it's presented
+        if (frame + 1 == totalFrames)
+        {
+            std::vector<unsigned char> pixels;
+            bench.readPixels(pixels);
+            reportFinalFrame(options, pixels);
+        }
+
+        bench.tick();
+
+        if (frame >= options.warmup)
+        {
+            frameMs.push_back((profilerNow() - frameBegin) / 1000000.0);
+            drawCalls += getDrawCounters().drawCalls;
+            triangles += getDrawCounters().triangles;
+            visibleTotal += visible.size();
+
+            const clusterStats& stats = lights.stats;
+            visibleLights += stats.visibleLights;
+            lightIndices += stats.lightIndices;
+            occupiedClusters += stats.occupiedClusters;
+            maxLightsPerCluster = stats.maxLightsPerCluster > maxLightsPerCluster ? stats.maxLightsPerCluster : maxLightsPerCluster;
+            clusterMs += stats.binMs;
+            addOcclusionStats(occlusionTotals, occlusion.stats);
+
+            const meshletCullStats& meshletStats = meshletDraws.stats;
+            meshletTotals.tested += meshletStats.tested;
+            meshletTotals.frustumCulled += meshletStats.frustumCulled;
+            meshletTotals.backfaceCulled += meshletStats.backfaceCulled;
+            meshletTotals.triangles += meshletStats.triangles;
+            meshletTotals.trianglesKept += meshletStats.trianglesKept;
+            meshletTotals.cullMs += meshletStats.cullMs;
+            meshletCommands += meshletDraws.commands.size();
+        }
+    }
+
+    if (options.tracePath != nullptr && exportChromeTrace(options.tracePath))
+    {
+        printf("Trace of the final frame written to %s\n", options.tracePath);
+    }
+
+    // Report
+    if (!frameMs.empty())
+    {
+        double frames = (double)frameMs.size();
+
+        printf("Benchmark: %u frames (%u warmup) at %dx%d, %u props, %s\n", options.frames, options.warmup,
+               options.width, options.height, grid * grid, options.headless ? "headless" : "windowed");
+        printFrameTimes(frameMs);
+        printf("Per frame: %.1f draw calls, %.0f triangles, %.1f visible props\n",
+               drawCalls / frames, triangles / frames, visibleTotal / frames);
+        if (clustered)
+        {
+            printf("Clustered lights: %u lights, %.1f visible, %.0f of %u clusters lit, %.2f lights per lit cluster (max %u), bin %.3f ms\n",
+                   options.lights, visibleLights / frames, occupiedClusters / frames, CLUSTER_COUNT,
+                   occupiedClusters > 0 ? (double)lightIndices / occupiedClusters : 0.0, maxLightsPerCluster, clusterMs / frames);
+        }
+        if (options.occlusion)
+        {
+            printOcclusion(occlusionTotals, frames);
+        }
+        if (options.meshlets)
+        {
+            double culled = meshletTotals.triangles > 0 ? 1.0 - (double)meshletTotals.trianglesKept / meshletTotals.triangles : 0.0;
+            printf("Meshlets per frame: %.0f tested, %.0f back-facing, %.0f outside the frustum, %.1f%% of triangles culled, %.0f commands, cull %.3f ms\n",
+                   meshletTotals.tested / frames, meshletTotals.backfaceCulled / frames, meshletTotals.frustumCulled / frames,
+                   culled * 100.0, meshletCommands / frames, meshletTotals.cullMs / frames);
+        }
+    }
+
+    if (options.meshlets)
+    {
+        freeMeshletDrawList(meshletDraws);
+    }
+    if (clustered)
+    {
+        freeClusteredLighting(lights);
+    }
+    freeUniformRing(uniforms);
+    freeInstanceBuffer(visibleProps);
+    freeShader(benchShader);
+    freeTexture(diffuse);
+    freeGeometry(mesh);
+    bench.term();
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Settings for a benchmark run (see parseBenchmarkArgs for the command line)
+struct benchmarkOptions
+{
+	unsigned frames = 600;			// measured frames
+	unsigned warmup = 60;			// frames rendered before measuring
+	int width = 1280, height = 720;
+	unsigned grid = 32;				// scene is grid x grid spears
+	bool headless = true;
+	const char* meshPath = "res/soulspear.obj";
+	const char* texturePath = "res/terry.png";
+	const char* imagePath = nullptr;	// final frame as a binary PPM
+	const char* tracePath = nullptr;	// Chrome trace of the last frame
+	bool software = false;			// draw with the CPU rasterizer instead of GL
+	unsigned threads = 0;			// job system threads, 0 = one per core
+	unsigned lights = 0;			// clustered point/spot lights moving over the scene (GL only)
+	bool occlusion = false;			// CPU occlusion culling after the frustum test
+	bool meshlets = false;			// cull prop meshlets by normal cone and frustum, draw the rest indirectly (GL only)
+	unsigned raycast = 0;			// rays per pass against the prop's BVH instead of drawing (--frames passes)
+};
+
+// Returns true if the command line asks for a benchmark, filling options from
+//   --benchmark [--frames N] [--warmup N] [--size WxH] [--grid N] [--windowed]
+//               [--image out.ppm] [--trace out.json] [--software] [--threads N]
+//               [--lights N] [--occlusion] [--meshlets] [--raycast N]
+bool parseBenchmarkArgs(int argc, char** argv, benchmarkOptions& options);
+
+// Renders the benchmark scene along a fixed camera path and prints frame time
+// percentiles, draw counts and a checksum of the final frame. Returns the exit code.
+int runBenchmark(const benchmarkOptions& options);
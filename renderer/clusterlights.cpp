@@ -0,0 +1,472 @@
+#include "clusterlights.h"
+
+#include <cassert>  // assert
+#include <cmath>    // logf, powf, floorf
+#include <cstdio>   // fprintf
+#include <cstring>  // memcpy
+
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define CLUSTERS_SSE2 1
+#endif
+
+const char* CLUSTERED_LIGHTING_GLSL =
+    "struct clusterLightData { vec4 positionRange; vec4 color; vec4 direction; vec4 spotAngles; };\n"
+    "layout (std430, binding = 4) readonly buffer clusterLightBuffer { clusterLightData clusterLights[]; };\n"
+    "layout (std430, binding = 5) readonly buffer clusterGridBuffer { uvec4 clusterGridSize; vec4 clusterDepth; vec4 clusterTile; uvec2 clusterRanges[]; };\n"
+    "layout (std430, binding = 6) readonly buffer clusterIndexBuffer { uint clusterLightIndices[]; };\n"
+
+    "vec3 clusteredLight(vec3 worldPos, vec3 normal, vec2 fragCoord, float viewDepth) {\n"
+    "    uvec3 cell = uvec3(uvec2(fragCoord / clusterTile.xy), uint(max(log(viewDepth) * clusterDepth.z + clusterDepth.w, 0.0)));\n"
+    "    cell = min(cell, clusterGridSize.xyz - 1u);\n"
+    "    uvec2 range = clusterRanges[(cell.z * clusterGridSize.y + cell.y) * clusterGridSize.x + cell.x];\n"
+    "    vec3 total = vec3(0.0);\n"
+    "    for (uint i = 0u; i < range.y; ++i) {\n"
+    "        clusterLightData light = clusterLights[clusterLightIndices[range.x + i]];\n"
+    "        vec3 toLight = light.positionRange.xyz - worldPos;\n"
+    "        float distance2 = dot(toLight, toLight);\n"
+    "        float range2 = light.positionRange.w * light.positionRange.w;\n"
+    "        if (distance2 >= range2) continue;\n"
+    "        vec3 direction = toLight * inversesqrt(max(distance2, 1e-8));\n"
+    "        float window = 1.0 - (distance2 * distance2) / (range2 * range2);\n"
+    "        float falloff = window * window / (distance2 + 1.0);\n"
+    "        float spot = smoothstep(light.spotAngles.y, light.spotAngles.x, dot(-direction, light.direction.xyz));\n"
+    "        total += light.color.xyz * max(dot(normal, direction), 0.0) * falloff * spot;\n"
+    "    }\n"
+    "    return total;\n"
+    "}\n";
+
+static_assert(sizeof(clusterLight) == 64, "clusterLight must match its std430 layout");
+
+namespace
+{
+    const unsigned CLUSTER_BUFFER_FRAMES = 3;   // regions in flight, like the uniform ring
+    const size_t LIGHT_JOB_SIZE = 64;
+    const size_t BOUNDS_PADDING = 3;    // SIMD groups may run past the last tile of a row
+
+    // Leads the grid buffer (std430)
+    struct clusterGridHeader
+    {
+        uint32_t size[4];       // tiles x, tiles y, slices, light count
+        float depth[4];         // near, far, slice scale, slice bias
+        float tile[4];          // tile width and height in pixels
+    };
+
+    static_assert(sizeof(clusterGridHeader) == 48, "clusterGridHeader must match its std430 layout");
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    unsigned clusterIndex(unsigned x, unsigned y, unsigned slice)
+    {
+        return (slice * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+    }
+
+    // Depth of the near side of a slice (slice == CLUSTER_SLICES gives the far plane)
+    float sliceDepth(const clusteredLighting& lighting, unsigned slice)
+    {
+        return lighting.nearPlane * powf(lighting.farPlane / lighting.nearPlane, (float)slice / CLUSTER_SLICES);
+    }
+
+    unsigned sliceOf(const clusteredLighting& lighting, float depth)
+    {
+        float slice = logf(depth / lighting.nearPlane) * CLUSTER_SLICES / logf(lighting.farPlane / lighting.nearPlane);
+        return slice <= 0.0f ? 0 : (slice >= CLUSTER_SLICES - 1 ? CLUSTER_SLICES - 1 : (unsigned)slice);
+    }
+
+    // View-space box around every froxel -- depends on the projection only
+    void buildClusterBounds(clusteredLighting& lighting, const glm::mat4& proj)
+    {
+        size_t padded = CLUSTER_COUNT + BOUNDS_PADDING;
+        lighting.boundsMinX.assign(padded, 0.0f);
+        lighting.boundsMinY.assign(padded, 0.0f);
+        lighting.boundsMinZ.assign(padded, 0.0f);
+        lighting.boundsMaxX.assign(padded, -1.0f);
+        lighting.boundsMaxY.assign(padded, -1.0f);
+        lighting.boundsMaxZ.assign(padded, -1.0f);
+
+        for (unsigned slice = 0; slice < CLUSTER_SLICES; ++slice)
+        {
+            float depths[2] = { sliceDepth(lighting, slice), sliceDepth(lighting, slice + 1) };
+            for (unsigned y = 0; y < CLUSTER_TILES_Y; ++y)
+            {
+                float ndcY[2] = { -1.0f + 2.0f * y / CLUSTER_TILES_Y, -1.0f + 2.0f * (y + 1) / CLUSTER_TILES_Y };
+                for (unsigned x = 0; x < CLUSTER_TILES_X; ++x)
+                {
+                    float ndcX[2] = { -1.0f + 2.0f * x / CLUSTER_TILES_X, -1.0f + 2.0f * (x + 1) / CLUSTER_TILES_X };
+
+                    // The eight corners -- a point at depth d lands on ndc n where n = d (x P00 / d - P20) ...
+                    glm::vec3 lo(1e30f), hi(-1e30f);
+                    for (float depth : depths)
+                    {
+                        for (int corner = 0; corner < 4; ++corner)
+                        {
+                            glm::vec3 point(depth * (ndcX[corner & 1] + proj[2][0]) / proj[0][0],
+                                            depth * (ndcY[corner >> 1] + proj[2][1]) / proj[1][1],
+                                            -depth);
+                            lo = glm::min(lo, point);
+                            hi = glm::max(hi, point);
+                        }
+                    }
+
+                    unsigned cluster = clusterIndex(x, y, slice);
+                    lighting.boundsMinX[cluster] = lo.x;
+                    lighting.boundsMinY[cluster] = lo.y;
+                    lighting.boundsMinZ[cluster] = lo.z;
+                    lighting.boundsMaxX[cluster] = hi.x;
+                    lighting.boundsMaxY[cluster] = hi.y;
+                    lighting.boundsMaxZ[cluster] = hi.z;
+                }
+            }
+        }
+
+        lighting.gridProj = proj;
+    }
+
+    // View-space sphere around a light -- spot lights use the tightest sphere around their cone
+    void boundingSphere(const clusterLight& light, const glm::mat4& view, glm::vec3& center, float& radius)
+    {
+        glm::vec3 position(light.positionRange);
+        float range = light.positionRange.w;
+        center = position;
+        radius = range;
+
+        float cosOuter = light.spotAngles.y;
+        if (cosOuter > -1.0f)
+        {
+            glm::vec3 axis(light.direction);
+            if (cosOuter >= 0.70710678f)
+            {
+                // Narrow cone -- the sphere through the apex and the rim
+                float offset = range / (2.0f * cosOuter);
+                center = position + axis * offset;
+                radius = offset;
+            }
+            else if (cosOuter > 0.0f)
+            {
+                // Wide cone -- the sphere around the rim
+                center = position + axis * (range * cosOuter);
+                radius = range * sqrtf(1.0f - cosOuter * cosOuter);
+            }
+        }
+
+        center = glm::vec3(view * glm::vec4(center, 1.0f));
+    }
+
+    // Appends (cluster, light) for every cluster the sphere touches
+    void binLight(const clusteredLighting& lighting, const glm::mat4& proj, uint32_t lightIndex,
+                  const glm::vec3& center, float radius, std::vector<uint32_t>& pairs, uint32_t* counts)
+    {
+        float depth = -center.z;
+        float nearest = depth - radius > lighting.nearPlane ? depth - radius : lighting.nearPlane;
+        float farthest = depth + radius < lighting.farPlane ? depth + radius : lighting.farPlane;
+        if (nearest > farthest)
+        {
+            return;
+        }
+
+        float radius2 = radius * radius;
+        unsigned firstSlice = sliceOf(lighting, nearest), lastSlice = sliceOf(lighting, farthest);
+        for (unsigned slice = firstSlice; slice <= lastSlice; ++slice)
+        {
+            // The part of the sphere's depth range inside this slice
+            float sliceNear = sliceDepth(lighting, slice), sliceFar = sliceDepth(lighting, slice + 1);
+            float depths[2] = { nearest > sliceNear ? nearest : sliceNear, farthest < sliceFar ? farthest : sliceFar };
+
+            // Tiles the box around the sphere projects to -- x / depth is monotonic, so the corners bound it
+            float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+            for (float d : depths)
+            {
+                for (float side : { -radius, radius })
+                {
+                    float ndcX = (center.x + side) * proj[0][0] / d - proj[2][0];
+                    float ndcY = (center.y + side) * proj[1][1] / d - proj[2][1];
+                    minX = ndcX < minX ? ndcX : minX;
+                    maxX = ndcX > maxX ? ndcX : maxX;
+                    minY = ndcY < minY ? ndcY : minY;
+                    maxY = ndcY > maxY ? ndcY : maxY;
+                }
+            }
+            if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+            {
+                continue;
+            }
+
+            int tileX0 = (int)floorf((minX * 0.5f + 0.5f) * CLUSTER_TILES_X);
+            int tileX1 = (int)floorf((maxX * 0.5f + 0.5f) * CLUSTER_TILES_X);
+            int tileY0 = (int)floorf((minY * 0.5f + 0.5f) * CLUSTER_TILES_Y);
+            int tileY1 = (int)floorf((maxY * 0.5f + 0.5f) * CLUSTER_TILES_Y);
+            tileX0 = tileX0 < 0 ? 0 : tileX0;
+            tileY0 = tileY0 < 0 ? 0 : tileY0;
+            tileX1 = tileX1 >= (int)CLUSTER_TILES_X ? CLUSTER_TILES_X - 1 : tileX1;
+            tileY1 = tileY1 >= (int)CLUSTER_TILES_Y ? CLUSTER_TILES_Y - 1 : tileY1;
+
+            for (int tileY = tileY0; tileY <= tileY1; ++tileY)
+            {
+                unsigned rowStart = clusterIndex(0, tileY, slice);
+
+                // Exact sphere/box test, four tiles at a time
+                for (int tileX = tileX0; tileX <= tileX1; tileX += 4)
+                {
+                    unsigned first = rowStart + tileX;
+                    int mask;
+#if CLUSTERS_SSE2
+                    __m128 zero = _mm_setzero_ps();
+                    __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&lighting.boundsMinX[first]), cx),
+                                                      _mm_sub_ps(cx, _mm_loadu_ps(&lighting.boundsMaxX[first]))), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&lighting.boundsMinY[first]), cy),
+                                                      _mm_sub_ps(cy, _mm_loadu_ps(&lighting.boundsMaxY[first]))), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&lighting.boundsMinZ[first]), cz),
+                                                      _mm_sub_ps(cz, _mm_loadu_ps(&lighting.boundsMaxZ[first]))), zero);
+                    __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_set1_ps(radius2)));
+#else
+                    mask = 0;
+                    for (int lane = 0; lane < 4; ++lane)
+                    {
+                        unsigned c = first + lane;
+                        float dx = fmaxf(fmaxf(lighting.boundsMinX[c] - center.x, center.x - lighting.boundsMaxX[c]), 0.0f);
+                        float dy = fmaxf(fmaxf(lighting.boundsMinY[c] - center.y, center.y - lighting.boundsMaxY[c]), 0.0f);
+                        float dz = fmaxf(fmaxf(lighting.boundsMinZ[c] - center.z, center.z - lighting.boundsMaxZ[c]), 0.0f);
+                        mask |= (dx * dx + dy * dy + dz * dz <= radius2) << lane;
+                    }
+#endif
+                    // Lanes past the last tile belong to the next row
+                    int lanes = tileX1 - tileX + 1;
+                    mask &= lanes >= 4 ? 0xF : (1 << lanes) - 1;
+
+                    for (int lane = 0; lane < 4; ++lane)
+                    {
+                        if (mask & (1 << lane))
+                        {
+                            pairs.push_back(first + lane);
+                            pairs.push_back(lightIndex);
+                            ++counts[first + lane];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+clusteredLighting makeClusteredLighting(size_t lightCapacity, size_t indexCapacity)
+{
+    clusteredLighting lighting = {};
+    lighting.lightCapacity = lightCapacity;
+    lighting.indexCapacity = indexCapacity;
+    lighting.lights.reserve(lightCapacity);
+    lighting.clusterRanges.resize(CLUSTER_COUNT * 2);
+
+    GLint alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    lighting.alignment = alignment > 0 ? (size_t)alignment : 256;
+
+    // Lights, grid and indices, each starting on an aligned offset
+    size_t regionSize = alignUp(lightCapacity * sizeof(clusterLight), lighting.alignment) +
+                        alignUp(sizeof(clusterGridHeader) + CLUSTER_COUNT * 2 * sizeof(uint32_t), lighting.alignment) +
+                        alignUp(indexCapacity * sizeof(uint32_t), lighting.alignment);
+    lighting.buffer = makeStreamBuffer(GL_SHADER_STORAGE_BUFFER, regionSize, CLUSTER_BUFFER_FRAMES);
+
+    return lighting;
+}
+
+void freeClusteredLighting(clusteredLighting& lighting)
+{
+    freeStreamBuffer(lighting.buffer);
+
+    lighting = {};
+}
+
+void beginClusterFrame(clusteredLighting& lighting)
+{
+    beginStreamRegion(lighting.buffer);
+    lighting.lights.clear();
+}
+
+bool addLight(clusteredLighting& lighting, const localLight& light)
+{
+    if (lighting.lights.size() >= lighting.lightCapacity)
+    {
+        return false;
+    }
+
+    clusterLight record;
+    record.positionRange = glm::vec4(light.position, light.range);
+    record.color = glm::vec4(light.color, 0.0f);
+    if (light.type == LIGHT_SPOT)
+    {
+        record.direction = glm::vec4(light.direction, 0.0f);
+        record.spotAngles = glm::vec4(cosf(light.innerAngle), cosf(light.outerAngle), 0.0f, 0.0f);
+    }
+    else
+    {
+        // Every direction passes the cone test
+        record.direction = glm::vec4(0.0f);
+        record.spotAngles = glm::vec4(-1.0f, -2.0f, 0.0f, 0.0f);
+    }
+
+    lighting.lights.push_back(record);
+    return true;
+}
+
+void buildClusters(clusteredLighting& lighting, const glm::mat4& proj, const glm::mat4& view,
+                   float nearPlane, float farPlane, int screenWidth, int screenHeight)
+{
+    PROFILE_SCOPE("buildClusters");
+    int64_t begin = profilerNow();
+
+    if (lighting.boundsMinX.empty() || !(lighting.gridProj == proj) ||
+        lighting.nearPlane != nearPlane || lighting.farPlane != farPlane)
+    {
+        lighting.nearPlane = nearPlane;
+        lighting.farPlane = farPlane;
+        buildClusterBounds(lighting, proj);
+    }
+
+    // Bin in parallel -- each job counts its own pairs per cluster
+    size_t lightCount = lighting.lights.size();
+    size_t jobCount = (lightCount + LIGHT_JOB_SIZE - 1) / LIGHT_JOB_SIZE;
+    if (lighting.jobPairs.size() < jobCount)
+    {
+        lighting.jobPairs.resize(jobCount);
+    }
+    lighting.jobCounts.assign(jobCount * CLUSTER_COUNT, 0);
+
+    parallelFor(jobCount, [&](size_t job)
+    {
+        std::vector<uint32_t>& pairs = lighting.jobPairs[job];
+        uint32_t* counts = &lighting.jobCounts[job * CLUSTER_COUNT];
+        pairs.clear();
+
+        size_t end = (job + 1) * LIGHT_JOB_SIZE < lightCount ? (job + 1) * LIGHT_JOB_SIZE : lightCount;
+        for (size_t i = job * LIGHT_JOB_SIZE; i < end; ++i)
+        {
+            glm::vec3 center;
+            float radius;
+            boundingSphere(lighting.lights[i], view, center, radius);
+            binLight(lighting, proj, (uint32_t)i, center, radius, pairs, counts);
+        }
+    });
+
+    // Turn the counts into where each job writes in each cluster's list -- jobs stay in light order
+    uint32_t total = 0;
+    clusterStats& stats = lighting.stats;
+    stats.occupiedClusters = 0;
+    stats.maxLightsPerCluster = 0;
+    for (unsigned cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+    {
+        uint32_t start = total;
+        for (size_t job = 0; job < jobCount; ++job)
+        {
+            uint32_t& count = lighting.jobCounts[job * CLUSTER_COUNT + cluster];
+            uint32_t jobCountHere = count;
+            count = total;
+            total += jobCountHere;
+        }
+
+        uint32_t lightsHere = total - start;
+        lighting.clusterRanges[cluster * 2] = start;
+        lighting.clusterRanges[cluster * 2 + 1] = lightsHere;
+        stats.occupiedClusters += lightsHere > 0 ? 1 : 0;
+        stats.maxLightsPerCluster = lightsHere > stats.maxLightsPerCluster ? lightsHere : stats.maxLightsPerCluster;
+    }
+
+    lighting.lightIndices.resize(total);
+    parallelFor(jobCount, [&](size_t job)
+    {
+        const std::vector<uint32_t>& pairs = lighting.jobPairs[job];
+        uint32_t* cursor = &lighting.jobCounts[job * CLUSTER_COUNT];
+        for (size_t i = 0; i < pairs.size(); i += 2)
+        {
+            lighting.lightIndices[cursor[pairs[i]]++] = pairs[i + 1];
+        }
+    });
+
+    // Lists past the index capacity are cut short
+    stats.overflowed = total > lighting.indexCapacity;
+    if (stats.overflowed)
+    {
+        for (unsigned cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+        {
+            uint32_t start = lighting.clusterRanges[cluster * 2];
+            uint32_t& count = lighting.clusterRanges[cluster * 2 + 1];
+            count = start >= lighting.indexCapacity ? 0 : (start + count > lighting.indexCapacity ? (uint32_t)lighting.indexCapacity - start : count);
+        }
+        fprintf(stderr, "[WARNING] %u cluster light indices don't fit in %zu\n", total, lighting.indexCapacity);
+    }
+
+    stats.lights = lightCount;
+    stats.lightIndices = total;
+    stats.averageLightsPerCluster = stats.occupiedClusters > 0 ? (float)total / stats.occupiedClusters : 0.0f;
+    stats.visibleLights = 0;
+    {
+        // Only what survived the overflow trim -- the shader never sees the rest
+        std::vector<uint8_t> seen(lightCount, 0);
+        for (unsigned cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+        {
+            uint32_t start = lighting.clusterRanges[cluster * 2];
+            uint32_t count = lighting.clusterRanges[cluster * 2 + 1];
+            for (uint32_t i = start; i < start + count; ++i)
+            {
+                uint32_t light = lighting.lightIndices[i];
+                stats.visibleLights += seen[light] == 0 ? 1 : 0;
+                seen[light] = 1;
+            }
+        }
+    }
+
+    // Upload all three into this frame's region and bind them
+    size_t indexCount = total < lighting.indexCapacity ? total : lighting.indexCapacity;
+    size_t lightBytes = lightCount * sizeof(clusterLight);
+    size_t gridBytes = sizeof(clusterGridHeader) + CLUSTER_COUNT * 2 * sizeof(uint32_t);
+    size_t indexBytes = indexCount * sizeof(uint32_t);
+
+    // Empty ranges can't be bound, so every buffer gets at least one element
+    size_t lightOffset = allocateStream(lighting.buffer, lightBytes > 0 ? lightBytes : sizeof(clusterLight), lighting.alignment);
+    size_t gridOffset = allocateStream(lighting.buffer, gridBytes, lighting.alignment);
+    size_t indexOffset = allocateStream(lighting.buffer, indexBytes > 0 ? indexBytes : sizeof(uint32_t), lighting.alignment);
+    assert(lightOffset != STREAM_ALLOC_FAILED && gridOffset != STREAM_ALLOC_FAILED && indexOffset != STREAM_ALLOC_FAILED &&
+           "beginClusterFrame wasn't called, or buildClusters ran twice in a frame");
+
+    clusterGridHeader header;
+    header.size[0] = CLUSTER_TILES_X;
+    header.size[1] = CLUSTER_TILES_Y;
+    header.size[2] = CLUSTER_SLICES;
+    header.size[3] = (uint32_t)lightCount;
+    float sliceScale = CLUSTER_SLICES / logf(farPlane / nearPlane);
+    header.depth[0] = nearPlane;
+    header.depth[1] = farPlane;
+    header.depth[2] = sliceScale;
+    header.depth[3] = -logf(nearPlane) * sliceScale;
+    header.tile[0] = (float)screenWidth / CLUSTER_TILES_X;
+    header.tile[1] = (float)screenHeight / CLUSTER_TILES_Y;
+    header.tile[2] = 0.0f;
+    header.tile[3] = 0.0f;
+
+    unsigned char* mapped = lighting.buffer.mapped;
+    memcpy(mapped + lightOffset, lighting.lights.data(), lightBytes);
+    memcpy(mapped + gridOffset, &header, sizeof(header));
+    memcpy(mapped + gridOffset + sizeof(header), lighting.clusterRanges.data(), CLUSTER_COUNT * 2 * sizeof(uint32_t));
+    memcpy(mapped + indexOffset, lighting.lightIndices.data(), indexBytes);
+
+    GLuint handle = lighting.buffer.handle;
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_BINDING, handle, (GLintptr)lightOffset,
+                      (GLsizeiptr)(lightBytes > 0 ? lightBytes : sizeof(clusterLight)));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, handle, (GLintptr)gridOffset, (GLsizeiptr)gridBytes);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, handle, (GLintptr)indexOffset,
+                      (GLsizeiptr)(indexBytes > 0 ? indexBytes : sizeof(uint32_t)));
+
+    stats.binMs = (profilerNow() - begin) / 1000000.0;
+}
+
+void endClusterFrame(clusteredLighting& lighting)
+{
+    endStreamRegion(lighting.buffer);
+}
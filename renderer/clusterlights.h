@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (vec3, vec4, mat4)
+
+#include "streambuffer.h"	// streamBuffer
+
+// Storage bindings the fragment shader reads lights from (3 is the material records)
+const GLuint CLUSTER_LIGHT_BINDING = 4;
+const GLuint CLUSTER_GRID_BINDING = 5;
+const GLuint CLUSTER_INDEX_BINDING = 6;
+
+// Froxel grid -- screen tiles by exponential depth slices
+const unsigned CLUSTER_TILES_X = 16;
+const unsigned CLUSTER_TILES_Y = 9;
+const unsigned CLUSTER_SLICES = 24;
+const unsigned CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+// GLSL buffers plus clusteredLight(worldPos, normal, fragCoord, viewDepth), which returns
+// the summed diffuse of every light in the fragment's cluster
+extern const char* CLUSTERED_LIGHTING_GLSL;
+
+enum lightType
+{
+	LIGHT_POINT,
+	LIGHT_SPOT
+};
+
+struct localLight
+{
+	lightType type;
+	glm::vec3 position;		// world space
+	float range;			// no light past this distance
+	glm::vec3 color;		// premultiplied by intensity
+	glm::vec3 direction;	// spot axis, normalized
+	float innerAngle;		// spot full-intensity half-angle, radians
+	float outerAngle;		// spot cutoff half-angle, radians
+};
+
+// One light as the shader sees it (std430, 64 bytes)
+struct clusterLight
+{
+	glm::vec4 positionRange;	// xyz = world position, w = range
+	glm::vec4 color;			// xyz, w unused
+	glm::vec4 direction;		// xyz = spot axis
+	glm::vec4 spotAngles;		// x = cos inner, y = cos outer (-2 for point lights)
+};
+
+// Occupancy after the last binning pass
+struct clusterStats
+{
+	size_t lights;
+	size_t visibleLights;		// touched at least one cluster
+	size_t lightIndices;		// cluster/light pairs
+	unsigned occupiedClusters;
+	unsigned maxLightsPerCluster;
+	float averageLightsPerCluster;	// over occupied clusters
+	bool overflowed;			// more pairs than indexCapacity -- some lights were dropped
+	double binMs;
+};
+
+struct clusteredLighting
+{
+	size_t lightCapacity;
+	size_t indexCapacity;
+
+	std::vector<clusterLight> lights;
+
+	// View-space bounds of every cluster, rebuilt when the projection changes
+	glm::mat4 gridProj;
+	float nearPlane, farPlane;
+	std::vector<float> boundsMinX, boundsMinY, boundsMinZ;
+	std::vector<float> boundsMaxX, boundsMaxY, boundsMaxZ;
+
+	// Binning output -- offset/count per cluster into lightIndices
+	std::vector<uint32_t> clusterRanges;
+	std::vector<uint32_t> lightIndices;
+
+	// Per-job scratch for the parallel bin
+	std::vector<std::vector<uint32_t>> jobPairs;
+	std::vector<uint32_t> jobCounts;
+
+	streamBuffer buffer;		// lights, grid and indices for each in-flight frame
+	size_t alignment;			// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+
+	clusterStats stats;
+};
+
+clusteredLighting makeClusteredLighting(size_t lightCapacity = 4096, size_t indexCapacity = 256 * 1024);
+void freeClusteredLighting(clusteredLighting& lighting);
+
+// Starts a frame -- waits for the GPU to finish with this frame's buffer region and clears the lights
+void beginClusterFrame(clusteredLighting& lighting);
+// Returns false once lightCapacity lights have been added this frame
+bool addLight(clusteredLighting& lighting, const localLight& light);
+// Bins the frame's lights, uploads them and binds the three buffers. near/far must match proj.
+void buildClusters(clusteredLighting& lighting, const glm::mat4& proj, const glm::mat4& view,
+	float nearPlane, float farPlane, int screenWidth, int screenHeight);
+// Fences the region -- call after the frame's last draw
+void endClusterFrame(clusteredLighting& lighting);
@@ -5,33 +5,144 @@
 #include <cstdio>     // printf
 #include <cassert>
 
+#include <chrono>     // steady_clock
+
 // Project libraries
 #include "glew/GL/glew.h"   // Must come before glfw
 #include "glfw/glfw3.h"
 
+// Headless contexts on Linux build boxes go through surfaceless EGL (Mesa llvmpipe works);
+// everywhere else they're a hidden GLFW window, optionally on OSMesa (GLFW 3.3+)
+#ifdef CONTEXT_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "profiler.h"
+
 void APIENTRY errorCallBack(GLenum source, GLenum type, GLuint id, 
     GLenum serverity, GLsizei length, const GLchar* message, const void* userParam)
 {
     fprintf(stderr, message);
 }
 
-bool context::init(int width, int height, const char *title)
+namespace
 {
-    // Initialize glfw
-    int glfwStatus = glfwInit();
-    // Test for errors w/ if statement
-    if (glfwStatus == GLFW_FALSE)
+    double clockSeconds()
     {
-        printf("GLFW ERROR");
-        return false;
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+#ifdef CONTEXT_USE_EGL
+    // Creates a 4.3 core context with no surface at all -- nothing to present to
+    bool createSurfacelessContext(void*& displayOut, void*& contextOut)
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+        EGLDisplay display = getPlatformDisplay != nullptr
+            ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+            : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+        {
+            printf("EGL ERROR: no display");
+            return false;
+        }
+
+        const EGLint configAttribs[] =
+        {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0 ||
+            !eglBindAPI(EGL_OPENGL_API))
+        {
+            printf("EGL ERROR: no OpenGL config");
+            eglTerminate(display);
+            return false;
+        }
+
+        const EGLint contextAttribs[] =
+        {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext eglContext = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+        {
+            printf("EGL ERROR: context creation failed");
+            eglTerminate(display);
+            return false;
+        }
+
+        displayOut = display;
+        contextOut = eglContext;
+        return true;
+    }
+#endif
+}
+
+bool context::init(int width, int height, const char *title, contextMode mode)
+{
+    this->mode = mode;
+    this->width = width;
+    this->height = height;
+    window = nullptr;
+    framebuffer = colorBuffer = depthBuffer = 0;
+    eglDisplay = eglContext = nullptr;
+    startTime = clockSeconds();
+    frameInterval = nextPresent = lastPresent = 0;
+    lastFrameMs = 0.0f;
+
+#ifdef CONTEXT_USE_EGL
+    if (mode == CONTEXT_HEADLESS)
+    {
+        // No window system at all -- skip GLFW entirely
+        if (!createSurfacelessContext(eglDisplay, eglContext))
+        {
+            return false;
+        }
     }
-    // Or use assert based error checking (will crash program)
-    assert(glfwStatus != GLFW_FALSE && "GLFW ERROR");
+    else
+#endif
+    {
+        // Initialize glfw
+        int glfwStatus = glfwInit();
+        // Test for errors w/ if statement
+        if (glfwStatus == GLFW_FALSE)
+        {
+            printf("GLFW ERROR");
+            return false;
+        }
+        // Or use assert based error checking (will crash program)
+        assert(glfwStatus != GLFW_FALSE && "GLFW ERROR");
+
+        if (mode == CONTEXT_HEADLESS)
+        {
+            // A window we never show -- rendering goes to the framebuffer below
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef CONTEXT_USE_OSMESA
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+        }
 
-    window = glfwCreateWindow(width, height, title, nullptr, nullptr);
-    glfwMakeContextCurrent(window);
+        window = glfwCreateWindow(width, height, title, nullptr, nullptr);
+        if (window == nullptr)
+        {
+            printf("GLFW ERROR: window creation failed");
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+    }
 
-    // Initialize glew
+    // Initialize glew (core contexts need experimental mode to load everything;
+    // surfaceless EGL needs a GLEW built with GLEW_EGL)
+    glewExperimental = GL_TRUE;
     int glewStatus = glewInit();
     if (glewStatus != GLEW_OK)
     {
@@ -56,6 +167,10 @@ bool context::init(int width, int height, const char *title)
     glDebugMessageCallback(errorCallBack, nullptr);
     glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, 0, true);
 
+    // Profiler scopes push debug groups -- don't echo every one of them
+    glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, 0, false);
+    glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0, 0, false);
+
     glEnable(GL_CULL_FACE);   // ogl defaults to off
     glCullFace(GL_BACK);      // cull back faces
     glFrontFace(GL_CCW);      // ccw faces are front faces
@@ -67,19 +182,99 @@ bool context::init(int width, int height, const char *title)
     // Set up defaults
     glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
 
+    // Headless contexts draw into their own framebuffer (a surfaceless context has no default one)
+    if (mode == CONTEXT_HEADLESS)
+    {
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            printf("FRAMEBUFFER ERROR");
+            return false;
+        }
+
+        // Stays bound for the life of the context
+        glViewport(0, 0, width, height);
+    }
+
     // Return true if no errors
     return true;
 }
 
 void context::tick()
 {
+    // Hold the frame until its slot comes round -- polling after the wait keeps input fresh
+    if (frameInterval > 0)
+    {
+        int64_t now = profilerNow();
+        if (now < nextPresent)
+        {
+            sleepUntil(nextPresent);
+        }
+        else if (now - nextPresent > frameInterval)
+        {
+            nextPresent = now;      // too far behind to catch up
+        }
+        nextPresent += frameInterval;
+    }
+
     // Update GLFW
-    glfwPollEvents();           // update events, input, etc.
-    glfwSwapBuffers(window);    // update window (the one in Windows)
+    if (mode == CONTEXT_WINDOWED)
+    {
+        glfwPollEvents();           // update events, input, etc.
+        glfwSwapBuffers(window);    // update window (the one in Windows)
+    }
+    else
+    {
+        // Nothing to present -- just make sure the frame is submitted
+        glFlush();
+    }
+
+    int64_t presented = profilerNow();
+    lastFrameMs = lastPresent != 0 ? (presented - lastPresent) / 1000000.0f : 0.0f;
+    lastPresent = presented;
+
+    // Close out the frame's profile
+    profilerFrame();
 }
 
 void context::term()
 {
+    // Profiler queries belong to the context
+    termProfiler();
+
+    if (framebuffer != 0)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        framebuffer = colorBuffer = depthBuffer = 0;
+    }
+
+#ifdef CONTEXT_USE_EGL
+    if (eglDisplay != nullptr)
+    {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(eglDisplay, eglContext);
+        eglTerminate(eglDisplay);
+        eglDisplay = eglContext = nullptr;
+        return;
+    }
+#endif
+
     // Clean up window
     glfwDestroyWindow(window);
     window = nullptr;
@@ -97,15 +292,51 @@ void context::clear()
 
 bool context::shouldClose() const
 {
-    return glfwWindowShouldClose(window);
+    // Headless runs end when the caller says so
+    return window != nullptr && mode == CONTEXT_WINDOWED && glfwWindowShouldClose(window);
 }
 
 float context::time() const
 {
-    return (float)glfwGetTime();
+    return (float)(clockSeconds() - startTime);
 }
 
 void context::resetTime(float resetValue = 0.0)
 {
-    glfwSetTime(resetValue);
+    startTime = clockSeconds() - resetValue;
+}
+
+bool context::isHeadless() const
+{
+    return mode == CONTEXT_HEADLESS;
+}
+
+void context::setSwapInterval(int interval)
+{
+    // Swaps only happen through GLFW windows -- headless frames are never presented
+    if (window != nullptr && mode == CONTEXT_WINDOWED)
+    {
+        glfwSwapInterval(interval);
+    }
+}
+
+void context::setFrameRateLimit(float framesPerSecond)
+{
+    frameInterval = framesPerSecond > 0.0f ? (int64_t)(1000000000.0 / framesPerSecond) : 0;
+    nextPresent = 0;
+}
+
+float context::frameMs() const
+{
+    return lastFrameMs;
+}
+
+void context::readPixels(std::vector<unsigned char>& pixels) const
+{
+    pixels.resize((size_t)width * height * 4);
+
+    // Headless reads the offscreen color buffer, windowed the back buffer (so call before tick)
+    glReadBuffer(mode == CONTEXT_HEADLESS ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
 }
\ No newline at end of file
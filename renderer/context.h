@@ -1,12 +1,39 @@
 #pragma once
 
+#include <cstdint>	// int64_t
+#include <vector>	// vector
+
+// How the context presents what it renders
+enum contextMode
+{
+	CONTEXT_WINDOWED,	// visible GLFW window
+	CONTEXT_HEADLESS	// no window -- renders into an offscreen framebuffer
+};
+
 class context
 {
 	// Forward declaration
 	struct GLFWwindow *window;
 
+	contextMode mode;
+	int width, height;
+
+	// Headless rendering target
+	unsigned int framebuffer, colorBuffer, depthBuffer;
+
+	// EGL handles when headless on a surfaceless EGL display
+	void* eglDisplay;
+	void* eglContext;
+	double startTime;
+
+	// Frame pacing, on the profiler clock
+	int64_t frameInterval;		// nanoseconds between presents, 0 = as fast as possible
+	int64_t nextPresent;		// deadline for the next present
+	int64_t lastPresent;
+	float lastFrameMs;
+
 public:
-	bool init(int width, int height, const char *title);
+	bool init(int width, int height, const char *title, contextMode mode = CONTEXT_WINDOWED);
 	void tick();
 	void term();   // terminate
 	void clear();
@@ -15,5 +42,19 @@ public:
 
 	float time() const;
 	void resetTime(float resetValue);
-};
 
+	bool isHeadless() const;
+
+	// Refreshes to wait for on each buffer swap: 0 = off, 1 = vsync, -1 = adaptive (late frames
+	// swap at once) where the driver supports it. Only windowed contexts ever wait on a swap.
+	void setSwapInterval(int interval);
+	// Caps how often tick presents (0 = no cap). Frames are paced against fixed deadlines,
+	// so the gaps between them stay even; a frame that runs more than one interval late
+	// starts a new rhythm instead of being followed by a burst.
+	void setFrameRateLimit(float framesPerSecond);
+	// Time between the last two presents
+	float frameMs() const;
+
+	// Reads back the frame being rendered as tightly packed RGBA8, bottom row first (call before tick)
+	void readPixels(std::vector<unsigned char>& pixels) const;
+};
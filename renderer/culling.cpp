@@ -0,0 +1,351 @@
+#include "culling.h"
+
+#include <cmath>    // fabsf
+
+#include "parallel.h"
+#include "profiler.h"
+#include "render.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>  // AVX
+#define CULLING_AVX 1
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define CULLING_SSE2 1
+#endif
+
+namespace
+{
+    const size_t CULL_PADDING = 8;
+    const size_t CULL_JOB_SIZE = 4096;      // boxes per job (a multiple of CULL_PADDING)
+    const size_t TRANSFORM_JOB_SIZE = 1024;
+
+    static_assert(CULL_JOB_SIZE % CULL_PADDING == 0, "jobs must not split a SIMD group");
+
+    void pushBox(cullBatch& batch, const glm::vec3& center, const glm::vec3& extent)
+    {
+        batch.centerX.push_back(center.x);
+        batch.centerY.push_back(center.y);
+        batch.centerZ.push_back(center.z);
+        batch.extentX.push_back(extent.x);
+        batch.extentY.push_back(extent.y);
+        batch.extentZ.push_back(extent.z);
+    }
+
+    // Drops the padding added by the last cullBoxes
+    void trimBatch(cullBatch& batch)
+    {
+        batch.centerX.resize(batch.count);
+        batch.centerY.resize(batch.count);
+        batch.centerZ.resize(batch.count);
+        batch.extentX.resize(batch.count);
+        batch.extentY.resize(batch.count);
+        batch.extentZ.resize(batch.count);
+    }
+
+    // Tops the arrays up to a whole number of SIMD lanes with boxes that fail every plane
+    void padBatch(cullBatch& batch)
+    {
+        size_t padded = (batch.count + CULL_PADDING - 1) / CULL_PADDING * CULL_PADDING;
+        batch.centerX.resize(padded, NAN);
+        batch.centerY.resize(padded, NAN);
+        batch.centerZ.resize(padded, NAN);
+        batch.extentX.resize(padded, 0.0f);
+        batch.extentY.resize(padded, 0.0f);
+        batch.extentZ.resize(padded, 0.0f);
+    }
+
+    // Tests boxes [begin, end) -- both multiples of CULL_PADDING -- and returns how many are visible
+    size_t cullRange(cullBatch& batch, const frustum& frust, size_t begin, size_t end)
+    {
+        size_t visibleCount = 0;
+
+        const float* cx = batch.centerX.data();
+        const float* cy = batch.centerY.data();
+        const float* cz = batch.centerZ.data();
+        const float* ex = batch.extentX.data();
+        const float* ey = batch.extentY.data();
+        const float* ez = batch.extentZ.data();
+
+#if CULLING_AVX
+        // Eight boxes per iteration, one plane at a time
+        for (size_t i = begin; i < end; i += 8)
+        {
+            __m256 centerX = _mm256_loadu_ps(cx + i), centerY = _mm256_loadu_ps(cy + i), centerZ = _mm256_loadu_ps(cz + i);
+            __m256 extentX = _mm256_loadu_ps(ex + i), extentY = _mm256_loadu_ps(ey + i), extentZ = _mm256_loadu_ps(ez + i);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (const glm::vec4& plane : frust.planes)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(centerX, _mm256_set1_ps(plane.x)),
+                                                              _mm256_mul_ps(centerY, _mm256_set1_ps(plane.y))),
+                                                _mm256_add_ps(_mm256_mul_ps(centerZ, _mm256_set1_ps(plane.z)),
+                                                              _mm256_set1_ps(plane.w)));
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extentX, _mm256_set1_ps(fabsf(plane.x))),
+                                                           _mm256_mul_ps(extentY, _mm256_set1_ps(fabsf(plane.y)))),
+                                             _mm256_mul_ps(extentZ, _mm256_set1_ps(fabsf(plane.z))));
+
+                // NaN padding compares false, so padded lanes are never inside
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                uint8_t laneVisible = (uint8_t)((mask >> lane) & 1);
+                batch.visible[i + lane] = laneVisible;
+                visibleCount += laneVisible;
+            }
+        }
+#elif CULLING_SSE2
+        // Four boxes per iteration, one plane at a time
+        for (size_t i = begin; i < end; i += 4)
+        {
+            __m128 centerX = _mm_loadu_ps(cx + i), centerY = _mm_loadu_ps(cy + i), centerZ = _mm_loadu_ps(cz + i);
+            __m128 extentX = _mm_loadu_ps(ex + i), extentY = _mm_loadu_ps(ey + i), extentZ = _mm_loadu_ps(ez + i);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (const glm::vec4& plane : frust.planes)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)),
+                                                        _mm_mul_ps(centerY, _mm_set1_ps(plane.y))),
+                                             _mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)),
+                                                        _mm_set1_ps(plane.w)));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(fabsf(plane.x))),
+                                                     _mm_mul_ps(extentY, _mm_set1_ps(fabsf(plane.y)))),
+                                          _mm_mul_ps(extentZ, _mm_set1_ps(fabsf(plane.z))));
+
+                // NaN padding compares false, so padded lanes are never inside
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                uint8_t laneVisible = (uint8_t)((mask >> lane) & 1);
+                batch.visible[i + lane] = laneVisible;
+                visibleCount += laneVisible;
+            }
+        }
+#else
+        for (size_t i = begin; i < end; ++i)
+        {
+            bool inside = true;
+            for (const glm::vec4& plane : frust.planes)
+            {
+                float distance = cx[i] * plane.x + cy[i] * plane.y + cz[i] * plane.z + plane.w;
+                float reach = ex[i] * fabsf(plane.x) + ey[i] * fabsf(plane.y) + ez[i] * fabsf(plane.z);
+                inside = inside && distance + reach >= 0.0f;
+            }
+            batch.visible[i] = inside ? 1 : 0;
+            visibleCount += inside ? 1 : 0;
+        }
+#endif
+
+        return visibleCount;
+    }
+
+    // Arvo -- the new extent on each axis is the extent projected through |M|
+    void transformBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model,
+                      glm::vec3& worldCenter, glm::vec3& worldExtent)
+    {
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+        worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            worldExtent[axis] = fabsf(model[0][axis]) * extent.x +
+                                fabsf(model[1][axis]) * extent.y +
+                                fabsf(model[2][axis]) * extent.z;
+        }
+    }
+
+    glm::vec4 normalizePlane(const glm::vec4& plane)
+    {
+        float length = glm::length(glm::vec3(plane));
+        return plane / length;
+    }
+}
+
+frustum extractFrustum(const glm::mat4& viewProj)
+{
+    // Gribb/Hartmann -- each plane is the w row plus or minus one of the others
+    glm::vec4 rowX(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+    glm::vec4 rowY(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+    glm::vec4 rowZ(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+    glm::vec4 rowW(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+    frustum frust;
+    frust.planes[0] = normalizePlane(rowW + rowX);  // left
+    frust.planes[1] = normalizePlane(rowW - rowX);  // right
+    frust.planes[2] = normalizePlane(rowW + rowY);  // bottom
+    frust.planes[3] = normalizePlane(rowW - rowY);  // top
+    frust.planes[4] = normalizePlane(rowW + rowZ);  // near (GL clip space, z in [-w, w])
+    frust.planes[5] = normalizePlane(rowW - rowZ);  // far
+
+    return frust;
+}
+
+bool isSphereVisible(const frustum& frust, const glm::vec3& center, float radius)
+{
+    for (const glm::vec4& plane : frust.planes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isBoxVisible(const frustum& frust, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+    for (const glm::vec4& plane : frust.planes)
+    {
+        // distance of the center, plus how far the box reaches toward the plane
+        float reach = extent.x * fabsf(plane.x) + extent.y * fabsf(plane.y) + extent.z * fabsf(plane.z);
+        if (glm::dot(glm::vec3(plane), center) + plane.w + reach < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isBoxVisible(const frustum& frust, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+{
+    glm::vec3 worldCenter, worldExtent;
+    transformBox(boundsMin, boundsMax, model, worldCenter, worldExtent);
+    return isBoxVisible(frust, worldCenter - worldExtent, worldCenter + worldExtent);
+}
+
+bool isBoxVisible(const frustum& frust, const geometry& geo, const glm::mat4& model)
+{
+    return isBoxVisible(frust, geo.boundsMin, geo.boundsMax, model);
+}
+
+void clearCullBatch(cullBatch& batch)
+{
+    batch.centerX.clear();
+    batch.centerY.clear();
+    batch.centerZ.clear();
+    batch.extentX.clear();
+    batch.extentY.clear();
+    batch.extentZ.clear();
+    batch.visible.clear();
+    batch.count = 0;
+}
+
+size_t addCullBox(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    // Drop the padding from the last cull before appending
+    if (batch.centerX.size() != batch.count)
+    {
+        trimBatch(batch);
+    }
+
+    pushBox(batch, (boundsMin + boundsMax) * 0.5f, (boundsMax - boundsMin) * 0.5f);
+    return batch.count++;
+}
+
+size_t addCullBox(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+{
+    glm::vec3 worldCenter, worldExtent;
+    transformBox(boundsMin, boundsMax, model, worldCenter, worldExtent);
+    return addCullBox(batch, worldCenter - worldExtent, worldCenter + worldExtent);
+}
+
+size_t addCullBoxes(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                    const glm::mat4* models, size_t count, size_t stride)
+{
+    PROFILE_SCOPE("addCullBoxes");
+
+    if (batch.centerX.size() != batch.count)
+    {
+        trimBatch(batch);
+    }
+
+    size_t first = batch.count;
+    batch.count += count;
+    batch.centerX.resize(batch.count);
+    batch.centerY.resize(batch.count);
+    batch.centerZ.resize(batch.count);
+    batch.extentX.resize(batch.count);
+    batch.extentY.resize(batch.count);
+    batch.extentZ.resize(batch.count);
+
+    // Every box lands in its own slot, so the jobs never touch the same element
+    size_t jobCount = (count + TRANSFORM_JOB_SIZE - 1) / TRANSFORM_JOB_SIZE;
+    parallelFor(jobCount, [&](size_t job)
+    {
+        size_t end = (job + 1) * TRANSFORM_JOB_SIZE < count ? (job + 1) * TRANSFORM_JOB_SIZE : count;
+        for (size_t i = job * TRANSFORM_JOB_SIZE; i < end; ++i)
+        {
+            const glm::mat4& model = *(const glm::mat4*)((const char*)models + i * stride);
+
+            glm::vec3 center, extent;
+            transformBox(boundsMin, boundsMax, model, center, extent);
+
+            size_t at = first + i;
+            batch.centerX[at] = center.x;
+            batch.centerY[at] = center.y;
+            batch.centerZ[at] = center.z;
+            batch.extentX[at] = extent.x;
+            batch.extentY[at] = extent.y;
+            batch.extentZ[at] = extent.z;
+        }
+    });
+
+    return first;
+}
+
+size_t addCullBox(cullBatch& batch, const geometry& geo, const glm::mat4& model)
+{
+    return addCullBox(batch, geo.boundsMin, geo.boundsMax, model);
+}
+
+size_t cullBoxes(cullBatch& batch, const frustum& frust)
+{
+    PROFILE_SCOPE("cullBoxes");
+
+    trimBatch(batch);
+    padBatch(batch);
+
+    size_t padded = batch.centerX.size();
+    batch.visible.resize(padded);
+
+    // Big batches are split across the job threads
+    size_t visibleCount = 0;
+    if (padded <= CULL_JOB_SIZE)
+    {
+        visibleCount = cullRange(batch, frust, 0, padded);
+    }
+    else
+    {
+        size_t jobCount = (padded + CULL_JOB_SIZE - 1) / CULL_JOB_SIZE;
+        std::vector<size_t> jobVisible(jobCount);
+        parallelFor(jobCount, [&](size_t job)
+        {
+            size_t begin = job * CULL_JOB_SIZE;
+            size_t end = begin + CULL_JOB_SIZE < padded ? begin + CULL_JOB_SIZE : padded;
+            jobVisible[job] = cullRange(batch, frust, begin, end);
+        });
+
+        for (size_t count : jobVisible)
+        {
+            visibleCount += count;
+        }
+    }
+
+    batch.visible.resize(batch.count);
+
+    batch.stats.tested = batch.count;
+    batch.stats.visible = visibleCount;
+    batch.stats.culled = batch.count - visibleCount;
+
+    return visibleCount;
+}
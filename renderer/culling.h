@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t
+#include <vector>			// vector
+
+#include "glm/glm.hpp"		// glm math types (vec3, vec4, mat4)
+
+struct geometry;
+
+// Six planes (left, right, bottom, top, near, far) with normals pointing inward
+struct frustum
+{
+	glm::vec4 planes[6];	// xyz = normal, w = distance
+};
+
+// Visible/culled counts from the last cullBoxes call
+struct cullStats
+{
+	size_t tested;
+	size_t visible;
+	size_t culled;
+};
+
+// World-space boxes stored structure-of-arrays so 4 (SSE) or 8 (AVX) are tested at once.
+// Arrays are padded to a multiple of 8 with boxes that are never visible.
+struct cullBatch
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	size_t count;
+
+	std::vector<uint8_t> visible;	// one flag per box after cullBoxes
+	cullStats stats;
+};
+
+// Planes of the volume clip space maps to -- pass proj * view for a world-space frustum
+frustum extractFrustum(const glm::mat4& viewProj);
+
+// Single-object tests for when there is no batch to hand
+bool isSphereVisible(const frustum& frust, const glm::vec3& center, float radius);
+bool isBoxVisible(const frustum& frust, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+// Object-space box transformed by model, as addCullBox does
+bool isBoxVisible(const frustum& frust, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model);
+bool isBoxVisible(const frustum& frust, const geometry& geo, const glm::mat4& model);
+
+void clearCullBatch(cullBatch& batch);
+// Adds a world-space box -- returns its index in the batch
+size_t addCullBox(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+// Adds an object-space box transformed by model (the result encloses the rotated box)
+size_t addCullBox(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model);
+size_t addCullBox(cullBatch& batch, const geometry& geo, const glm::mat4& model);
+// Adds one object-space box under many transforms, spread over the job threads. stride is
+// the byte distance between matrices, so the transforms can sit inside larger records.
+// Returns the index of the first box.
+size_t addCullBoxes(cullBatch& batch, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	const glm::mat4* models, size_t count, size_t stride = sizeof(glm::mat4));
+
+// Tests every box against the frustum -- fills batch.visible and returns the visible count.
+// Big batches are split across the job threads.
+size_t cullBoxes(cullBatch& batch, const frustum& frust);
@@ -0,0 +1,172 @@
+#include "dynamicgeometry.h"
+
+#include <cassert>  // assert
+
+#include "profiler.h"
+#include "render.h"
+
+namespace
+{
+    // countDraw counts triangles as indices / 3 -- turn a draw of any primitive into the
+    // equivalent triangle-list count, so lines and points add a call but no triangles
+    uint64_t triangleListCount(GLenum primitive, size_t count)
+    {
+        switch (primitive)
+        {
+        case GL_TRIANGLES:
+            return count;
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN:
+            return count >= 3 ? (uint64_t)(count - 2) * 3 : 0;
+        default:
+            return 0;
+        }
+    }
+}
+
+dynamicGeometry makeDynamicGeometry(const vertexFormat& format, size_t maxVertices, size_t maxIndices,
+                                    GLenum primitive, unsigned frames)
+{
+    assert(format.position == POSITION_FLOAT && "dynamic geometry needs float positions");
+    assert(maxVertices > 0 && "dynamic geometry needs room for vertices");
+
+    vertexLayout layout = describeVertexFormat(format);
+
+    dynamicGeometry newGeo = {};
+    newGeo.format = format;
+    newGeo.stride = layout.stride;
+    newGeo.primitive = primitive;
+    newGeo.maxVertices = maxVertices;
+    newGeo.maxIndices = maxIndices;
+
+    // One region per frame in flight, written through the persistent mapping
+    newGeo.vertices = makeStreamBuffer(GL_ARRAY_BUFFER, maxVertices * layout.stride, frames);
+    if (maxIndices > 0)
+    {
+        newGeo.indices = makeStreamBuffer(GL_ELEMENT_ARRAY_BUFFER, maxIndices * sizeof(unsigned int), frames);
+    }
+
+    // Attributes address the whole buffer -- draws pick the region with a base vertex
+    glGenVertexArrays(1, &newGeo.vao);
+    glBindVertexArray(newGeo.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, newGeo.vertices.handle);
+    if (maxIndices > 0)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newGeo.indices.handle);
+    }
+
+    for (GLuint i = 0; i < layout.attributeCount; ++i)
+    {
+        const vertexAttribute& attrib = layout.attributes[i];
+
+        glEnableVertexAttribArray(attrib.location);
+        glVertexAttribPointer(attrib.location, attrib.components, attrib.type, attrib.normalized,
+                              layout.stride, (void*)(size_t)attrib.offset);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    return newGeo;
+}
+
+void freeDynamicGeometry(dynamicGeometry& geo)
+{
+    freeStreamBuffer(geo.vertices);
+    if (geo.indices.handle != 0)
+    {
+        freeStreamBuffer(geo.indices);
+    }
+    glDeleteVertexArrays(1, &geo.vao);
+
+    geo = {};
+}
+
+dynamicMapping mapDynamicGeometry(dynamicGeometry& geo)
+{
+    PROFILE_SCOPE("mapDynamicGeometry");
+
+    // Moves on to the next region, blocking only if its fence hasn't signalled
+    beginStreamRegion(geo.vertices);
+    size_t vertexOffset = allocateStream(geo.vertices, geo.maxVertices * geo.stride, geo.stride);
+    geo.firstVertex = vertexOffset / geo.stride;
+
+    dynamicMapping mapping = {};
+    mapping.vertices = geo.vertices.mapped + vertexOffset;
+    mapping.maxVertices = geo.maxVertices;
+
+    if (geo.indices.handle != 0)
+    {
+        beginStreamRegion(geo.indices);
+        geo.indexOffset = allocateStream(geo.indices, geo.maxIndices * sizeof(unsigned int), sizeof(unsigned int));
+
+        mapping.indices = (unsigned int*)(geo.indices.mapped + geo.indexOffset);
+        mapping.maxIndices = geo.maxIndices;
+    }
+
+    geo.mapped = true;
+    geo.vertCount = 0;
+    geo.indxCount = 0;
+
+    return mapping;
+}
+
+void commitDynamicGeometry(dynamicGeometry& geo, size_t vertCount, size_t indxCount)
+{
+    assert(geo.mapped && "commit without a map");
+    assert(vertCount <= geo.maxVertices && indxCount <= geo.maxIndices && "wrote past the mapping");
+
+    // Coherent mapping -- the writes are already visible, there is nothing to flush
+    geo.vertCount = vertCount;
+    geo.indxCount = indxCount;
+}
+
+void drawDynamic(const shader& shad, dynamicGeometry& geo)
+{
+    if (!geo.mapped || geo.vertCount == 0)
+    {
+        return;
+    }
+
+    PROFILE_GPU_SCOPE("drawDynamic");
+
+    // Specify which shader
+    glUseProgram(shad.program);
+
+    // Specify which VAO
+    glBindVertexArray(geo.vao);
+
+    // Formats without vertex colors read white from the generic attribute
+    if (geo.format.color == COLOR_NONE)
+    {
+        glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    if (geo.indices.handle != 0)
+    {
+        glDrawElementsBaseVertex(geo.primitive, (GLsizei)geo.indxCount, GL_UNSIGNED_INT,
+                                 (const void*)geo.indexOffset, (GLint)geo.firstVertex);
+        countDraw(triangleListCount(geo.primitive, geo.indxCount));
+    }
+    else
+    {
+        glDrawArrays(geo.primitive, (GLint)geo.firstVertex, (GLsizei)geo.vertCount);
+        countDraw(triangleListCount(geo.primitive, geo.vertCount));
+    }
+
+    // The region is in use until this draw retires (a later draw just moves the fence)
+    endStreamRegion(geo.vertices);
+    if (geo.indices.handle != 0)
+    {
+        endStreamRegion(geo.indices);
+    }
+}
+
+dynamicGeometryStats getDynamicGeometryStats(const dynamicGeometry& geo)
+{
+    dynamicGeometryStats stats;
+    stats.framesMapped = geo.vertices.regionsBegun;
+    stats.fenceWaits = geo.vertices.fenceWaits + geo.indices.fenceWaits;
+    return stats;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>			// size_t
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+
+#include "streambuffer.h"	// streamBuffer
+#include "vertexformat.h"	// vertexFormat
+
+struct shader;
+
+// Geometry the CPU rewrites every frame (particles, debug lines, UI, skinning results).
+// Vertices and indices live in persistently mapped buffers split into one region per
+// frame in flight, so writing never waits on a draw that is still reading.
+struct dynamicGeometry
+{
+	GLuint vao;
+	streamBuffer vertices;
+	streamBuffer indices;		// handle is 0 for non-indexed geometry
+
+	vertexFormat format;
+	GLuint stride;
+	GLenum primitive;			// GL_TRIANGLES, GL_LINES, GL_POINTS, ...
+	size_t maxVertices;			// per frame
+	size_t maxIndices;
+
+	// this frame's region
+	bool mapped;
+	size_t firstVertex;			// of the region, in vertices
+	size_t indexOffset;			// of the region, in bytes
+	size_t vertCount, indxCount;	// committed for drawing
+};
+
+// Where to write this frame's data
+struct dynamicMapping
+{
+	void* vertices;				// maxVertices in the geometry's vertex format
+	unsigned int* indices;		// maxIndices, relative to the first vertex (nullptr if not indexed)
+	size_t maxVertices, maxIndices;
+};
+
+// Fence-wait telemetry for a dynamic geometry
+struct dynamicGeometryStats
+{
+	unsigned framesMapped;
+	unsigned fenceWaits;		// maps that had to block on the GPU
+};
+
+// Positions must be POSITION_FLOAT (quantized formats need bounds known up front).
+// maxIndices = 0 makes non-indexed geometry.
+dynamicGeometry makeDynamicGeometry(const vertexFormat& format, size_t maxVertices, size_t maxIndices = 0,
+	GLenum primitive = GL_TRIANGLES, unsigned frames = 3);
+void freeDynamicGeometry(dynamicGeometry& geo);
+
+// Starts a new frame's data, waiting only if the GPU still reads that region
+dynamicMapping mapDynamicGeometry(dynamicGeometry& geo);
+// Publishes what was written -- nothing is copied, the GPU reads the mapping directly
+void commitDynamicGeometry(dynamicGeometry& geo, size_t vertCount, size_t indxCount = 0);
+
+// Draws the committed data and fences the region behind it
+void drawDynamic(const shader& shad, dynamicGeometry& geo);
+
+dynamicGeometryStats getDynamicGeometryStats(const dynamicGeometry& geo);
@@ -0,0 +1,226 @@
+#include "fileio.h"
+
+#include <atomic>     // atomic
+#include <cstdio>     // remove, rename
+#include <cstring>    // memcpy
+#include <fstream>    // ifstream
+#include <sys/stat.h> // stat, mkdir
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <unistd.h>   // close, getpid
+#endif
+
+mappedFile mapFile(const char* filePath)
+{
+    mappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return {};
+    }
+
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(fileHandle, &fileSize);
+
+    // Zero-length files can't be mapped -- hand back an empty (but valid) view
+    if (fileSize.QuadPart == 0)
+    {
+        CloseHandle(fileHandle);
+        return {};
+    }
+
+    HANDLE mapHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapHandle == nullptr)
+    {
+        CloseHandle(fileHandle);
+        return {};
+    }
+
+    file.data = (const unsigned char*)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+    if (file.data == nullptr)
+    {
+        CloseHandle(mapHandle);
+        CloseHandle(fileHandle);
+        return {};
+    }
+
+    file.size = (size_t)fileSize.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mapHandle = mapHandle;
+#else
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return {};
+    }
+
+    void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps its own reference to the file
+
+    if (data == MAP_FAILED)
+    {
+        return {};
+    }
+
+    file.data = (const unsigned char*)data;
+    file.size = (size_t)info.st_size;
+#endif
+
+    return file;
+}
+
+void unmapFile(mappedFile& file)
+{
+    if (file.data != nullptr)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(file.data);
+        CloseHandle((HANDLE)file.mapHandle);
+        CloseHandle((HANDLE)file.fileHandle);
+#else
+        munmap((void*)file.data, file.size);
+#endif
+    }
+
+    file = {};
+}
+
+bool getFileStamp(const char* filePath, fileStamp& stamp)
+{
+#ifdef _WIN32
+    struct _stat64 info = {};
+    if (_stat64(filePath, &info) != 0)
+    {
+        return false;
+    }
+#else
+    struct stat info = {};
+    if (stat(filePath, &info) != 0)
+    {
+        return false;
+    }
+#endif
+
+    stamp.modifiedTime = (uint64_t)info.st_mtime;
+    stamp.size = (uint64_t)info.st_size;
+    return true;
+}
+
+bool readFile(const char* filePath, std::string& contents)
+{
+    std::ifstream in(filePath, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    {
+        return false;
+    }
+
+    // Size it once, then read it all in one go
+    std::streamsize size = in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    contents.resize((size_t)size);
+    if (size > 0 && !in.read(&contents[0], size))
+    {
+        contents.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool makeDirectory(const char* dirPath)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(dirPath, nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    struct stat info = {};
+    return mkdir(dirPath, 0755) == 0 || (stat(dirPath, &info) == 0 && S_ISDIR(info.st_mode));
+#endif
+}
+
+bool replaceFile(const char* srcPath, const char* destPath)
+{
+#ifdef _WIN32
+    return MoveFileExA(srcPath, destPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(srcPath, destPath) == 0;
+#endif
+}
+
+std::string uniqueTempPath(const std::string& filePath)
+{
+    static std::atomic<uint32_t> counter(0);
+
+#ifdef _WIN32
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = (unsigned long)getpid();
+#endif
+
+    return filePath + "." + std::to_string(processId) + "." + std::to_string(counter.fetch_add(1)) + ".tmp";
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    // Word-at-a-time multiply/xorshift mix -- plenty for detecting changed files
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    uint64_t hash = seed ^ (size * prime);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+
+        word *= prime;
+        word ^= word >> 32;
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+
+    // Fold in the remaining tail bytes
+    uint64_t tail = 0;
+    for (size_t j = 0; i + j < size; ++j)
+    {
+        tail |= (uint64_t)bytes[i + j] << (8 * j);
+    }
+    hash = (hash ^ (tail * prime)) * prime;
+
+    // Final avalanche
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+bool hashFile(const char* filePath, uint64_t& hash)
+{
+    mappedFile file = mapFile(filePath);
+    if (file.data == nullptr)
+    {
+        return false;
+    }
+
+    hash = hashBytes(file.data, file.size);
+    unmapFile(file);
+    return true;
+}
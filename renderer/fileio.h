@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>		// size_t
+#include <cstdint>		// uint64_t
+#include <string>		// std::string
+
+// A read-only view of a file mapped into memory
+struct mappedFile
+{
+	const unsigned char* data;	// first byte of the file (nullptr if not mapped)
+	size_t size;				// size of the file in bytes
+
+	void* fileHandle;			// OS handles -- only used by unmapFile
+	void* mapHandle;
+};
+
+// Size and last-modified time of a file on disk
+struct fileStamp
+{
+	uint64_t modifiedTime;
+	uint64_t size;
+};
+
+// Functions to map and unmap a file
+mappedFile mapFile(const char* filePath);
+void unmapFile(mappedFile& file);
+
+// Returns false if the file does not exist
+bool getFileStamp(const char* filePath, fileStamp& stamp);
+
+// Reads a whole file with a single read -- returns false if it can't be opened
+bool readFile(const char* filePath, std::string& contents);
+
+// Creates a directory if it doesn't exist yet (parents must exist)
+bool makeDirectory(const char* dirPath);
+
+// Replaces destPath with srcPath (used to publish files written to a temp path)
+bool replaceFile(const char* srcPath, const char* destPath);
+// A temp path next to filePath that no other thread or process is writing -- use it with
+// replaceFile so two writers of the same file never publish each other's half-written data
+std::string uniqueTempPath(const std::string& filePath);
+
+// 64-bit non-cryptographic hash over a range of bytes
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+// Hashes a whole file -- returns false if it can't be read
+bool hashFile(const char* filePath, uint64_t& hash);
@@ -0,0 +1,569 @@
+#include "geometryarena.h"
+
+#include <algorithm>    // sort, lower_bound
+#include <cassert>      // assert
+#include <cstdint>      // uint16_t, uint32_t
+
+#include "glm/ext.hpp"
+
+#include "instancing.h"
+#include "profiler.h"
+#include "render.h"
+
+namespace
+{
+    // Points a pool's VAO at its vertex buffer and the shared index buffer
+    void setupPoolVao(const arenaPool& pool, GLuint ibo)
+    {
+        vertexLayout layout = describeVertexFormat(pool.format);
+
+        glBindVertexArray(pool.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+        for (GLuint i = 0; i < layout.attributeCount; ++i)
+        {
+            const vertexAttribute& attrib = layout.attributes[i];
+
+            glEnableVertexAttribArray(attrib.location);
+            glVertexAttribPointer(attrib.location, attrib.components, attrib.type, attrib.normalized,
+                                  layout.stride, (void*)(size_t)attrib.offset);
+        }
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    // Makes a buffer of newBytes holding a copy of the first oldBytes of source
+    GLuint growBuffer(GLuint source, size_t oldBytes, size_t newBytes)
+    {
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+
+        if (oldBytes > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, source);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &source);
+
+        return grown;
+    }
+
+    // Moves bytes to a lower offset in the same buffer. Copies within one buffer
+    // may not overlap, so it goes in pieces no larger than the distance moved.
+    void moveBufferRange(GLuint buffer, size_t from, size_t to, size_t bytes)
+    {
+        assert(to < from && "ranges only ever move down");
+
+        size_t step = from - to;
+
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        for (size_t done = 0; done < bytes; done += step)
+        {
+            size_t piece = bytes - done < step ? bytes - done : step;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from + done, to + done, piece);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    unsigned findPool(geometryArena& arena, const vertexFormat& format)
+    {
+        for (unsigned i = 0; i < arena.pools.size(); ++i)
+        {
+            if (arena.pools[i].format == format)
+            {
+                return i;
+            }
+        }
+
+        // First mesh in this format -- give it its own vertex buffer and VAO
+        arenaPool pool = {};
+        pool.format = format;
+        pool.stride = describeVertexFormat(format).stride;
+        pool.vertices = makeRangeAllocator(arena.poolCapacity);
+
+        glGenVertexArrays(1, &pool.vao);
+        glGenBuffers(1, &pool.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+        glBufferData(GL_ARRAY_BUFFER, arena.poolCapacity * pool.stride, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        setupPoolVao(pool, arena.ibo);
+        attachInstanceLayout(pool.vao);
+
+        arena.pools.push_back(pool);
+        return (unsigned)arena.pools.size() - 1;
+    }
+
+    size_t growSize(size_t capacity, size_t needed)
+    {
+        return capacity * 2 > capacity + needed ? capacity * 2 : capacity + needed;
+    }
+
+    size_t allocateVertices(geometryArena& arena, arenaPool& pool, size_t count)
+    {
+        size_t offset = allocateRange(pool.vertices, count);
+        if (offset != RANGE_ALLOC_FAILED)
+        {
+            return offset;
+        }
+
+        size_t oldCapacity = pool.vertices.capacity;
+        size_t newCapacity = growSize(oldCapacity, count);
+
+        pool.vbo = growBuffer(pool.vbo, oldCapacity * pool.stride, newCapacity * pool.stride);
+        extendRangeAllocator(pool.vertices, newCapacity);
+        setupPoolVao(pool, arena.ibo);
+
+        return allocateRange(pool.vertices, count);
+    }
+
+    size_t allocateIndices(geometryArena& arena, size_t count)
+    {
+        size_t offset = allocateRange(arena.indices, count);
+        if (offset != RANGE_ALLOC_FAILED)
+        {
+            return offset;
+        }
+
+        size_t oldCapacity = arena.indices.capacity;
+        size_t newCapacity = growSize(oldCapacity, count);
+
+        arena.ibo = growBuffer(arena.ibo, oldCapacity * sizeof(uint32_t), newCapacity * sizeof(uint32_t));
+        extendRangeAllocator(arena.indices, newCapacity);
+
+        // The element buffer is VAO state -- every pool needs to see the new one
+        for (const arenaPool& pool : arena.pools)
+        {
+            setupPoolVao(pool, arena.ibo);
+        }
+
+        return allocateRange(arena.indices, count);
+    }
+}
+
+rangeAllocator makeRangeAllocator(size_t capacity)
+{
+    rangeAllocator alloc = {};
+    alloc.capacity = capacity;
+    if (capacity > 0)
+    {
+        alloc.freeRanges.push_back({ 0, capacity });
+    }
+    return alloc;
+}
+
+size_t allocateRange(rangeAllocator& alloc, size_t count)
+{
+    assert(count > 0 && "zero-sized allocation");
+
+    // Best fit keeps big ranges intact for big meshes
+    size_t best = alloc.freeRanges.size();
+    for (size_t i = 0; i < alloc.freeRanges.size(); ++i)
+    {
+        size_t size = alloc.freeRanges[i].count;
+        if (size >= count && (best == alloc.freeRanges.size() || size < alloc.freeRanges[best].count))
+        {
+            best = i;
+            if (size == count)
+            {
+                break;  // can't do better than exact
+            }
+        }
+    }
+
+    if (best == alloc.freeRanges.size())
+    {
+        return RANGE_ALLOC_FAILED;
+    }
+
+    freeRange& range = alloc.freeRanges[best];
+    size_t offset = range.offset;
+    range.offset += count;
+    range.count -= count;
+    if (range.count == 0)
+    {
+        alloc.freeRanges.erase(alloc.freeRanges.begin() + best);
+    }
+
+    alloc.used += count;
+    return offset;
+}
+
+void releaseRange(rangeAllocator& alloc, size_t offset, size_t count)
+{
+    assert(offset + count <= alloc.capacity && "range out of bounds");
+    assert(alloc.used >= count && "released more than was allocated");
+
+    alloc.used -= count;
+
+    // Insert in offset order, then merge with whichever neighbours touch it
+    auto next = std::lower_bound(alloc.freeRanges.begin(), alloc.freeRanges.end(), offset,
+                                 [](const freeRange& range, size_t value) { return range.offset < value; });
+    auto inserted = alloc.freeRanges.insert(next, { offset, count });
+
+    auto after = inserted + 1;
+    if (after != alloc.freeRanges.end() && inserted->offset + inserted->count == after->offset)
+    {
+        inserted->count += after->count;
+        alloc.freeRanges.erase(after);
+    }
+
+    if (inserted != alloc.freeRanges.begin())
+    {
+        auto before = inserted - 1;
+        if (before->offset + before->count == inserted->offset)
+        {
+            before->count += inserted->count;
+            alloc.freeRanges.erase(inserted);
+        }
+    }
+}
+
+void extendRangeAllocator(rangeAllocator& alloc, size_t newCapacity)
+{
+    assert(newCapacity >= alloc.capacity && "allocators only grow");
+
+    size_t added = newCapacity - alloc.capacity;
+    size_t oldCapacity = alloc.capacity;
+    alloc.capacity = newCapacity;
+
+    if (added > 0)
+    {
+        // Hand the new space over through releaseRange so it joins a trailing free range
+        alloc.used += added;
+        releaseRange(alloc, oldCapacity, added);
+    }
+}
+
+geometryArena makeGeometryArena(size_t vertexCapacity, size_t indexCapacity)
+{
+    geometryArena arena = {};
+    arena.poolCapacity = vertexCapacity > 0 ? vertexCapacity : 1;
+    arena.indices = makeRangeAllocator(indexCapacity > 0 ? indexCapacity : 1);
+
+    glGenBuffers(1, &arena.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, arena.indices.capacity * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    return arena;
+}
+
+void freeGeometryArena(geometryArena& arena)
+{
+    for (arenaPool& pool : arena.pools)
+    {
+        glDeleteBuffers(1, &pool.vbo);
+        glDeleteVertexArrays(1, &pool.vao);
+    }
+    glDeleteBuffers(1, &arena.ibo);
+
+    arena = {};
+}
+
+arenaHandle addArenaMesh(geometryArena& arena, const meshData& mesh)
+{
+    if (mesh.vertCount == 0 || mesh.indxCount == 0)
+    {
+        return INVALID_ARENA_MESH;
+    }
+
+    unsigned poolIndex = findPool(arena, mesh.format);
+    arenaPool& pool = arena.pools[poolIndex];
+
+    arenaMesh newMesh = {};
+    newMesh.pool = poolIndex;
+    newMesh.vertexCount = mesh.vertCount;
+    newMesh.indexCount = mesh.indxCount;
+    newMesh.firstVertex = allocateVertices(arena, pool, mesh.vertCount);
+    newMesh.firstIndex = allocateIndices(arena, mesh.indxCount);
+    newMesh.live = true;
+    newMesh.lodCount = mesh.lodCount > 0 ? mesh.lodCount : 1;
+    for (unsigned i = 0; i < newMesh.lodCount; ++i)
+    {
+        newMesh.lods[i] = mesh.lodCount > 0 ? mesh.lods[i] : meshLod{ 0, (uint32_t)mesh.indxCount, 0.0f };
+    }
+    computeQuantization(mesh.format, mesh.boundsMin, mesh.boundsMax, newMesh.posScale, newMesh.posOffset);
+    newMesh.boundsMin = mesh.boundsMin;
+    newMesh.boundsMax = mesh.boundsMax;
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, newMesh.firstVertex * pool.stride, mesh.vertCount * pool.stride, mesh.verts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Every pool shares one index type so any mix of meshes can go in one multi-draw
+    std::vector<uint32_t> wide;
+    const void* indices = mesh.indices;
+    if (mesh.indexType == GL_UNSIGNED_SHORT)
+    {
+        const uint16_t* narrow = (const uint16_t*)mesh.indices;
+        wide.assign(narrow, narrow + mesh.indxCount);
+        indices = wide.data();
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.ibo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, newMesh.firstIndex * sizeof(uint32_t), mesh.indxCount * sizeof(uint32_t), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // Reuse a slot left by a removed mesh if there is one
+    if (!arena.freeHandles.empty())
+    {
+        arenaHandle handle = arena.freeHandles.back();
+        arena.freeHandles.pop_back();
+        arena.meshes[handle] = newMesh;
+        return handle;
+    }
+
+    arena.meshes.push_back(newMesh);
+    return (arenaHandle)arena.meshes.size() - 1;
+}
+
+arenaHandle loadArenaMesh(geometryArena& arena, const char* filePath, const meshLoadOptions& options)
+{
+    meshData mesh;
+    if (!decodeMesh(filePath, options, mesh))
+    {
+        return INVALID_ARENA_MESH;
+    }
+
+    arenaHandle handle = addArenaMesh(arena, mesh);
+    freeMeshData(mesh);
+
+    return handle;
+}
+
+void removeArenaMesh(geometryArena& arena, arenaHandle handle)
+{
+    assert(handle < arena.meshes.size() && arena.meshes[handle].live && "invalid arena mesh");
+
+    arenaMesh& mesh = arena.meshes[handle];
+    releaseRange(arena.pools[mesh.pool].vertices, mesh.firstVertex, mesh.vertexCount);
+    releaseRange(arena.indices, mesh.firstIndex, mesh.indexCount);
+
+    mesh = {};
+    arena.freeHandles.push_back(handle);
+}
+
+void defragmentArena(geometryArena& arena)
+{
+    PROFILE_GPU_SCOPE("defragmentArena");
+
+    std::vector<arenaMesh*> live;
+
+    // Vertices -- indices are relative to firstVertex, so they survive the move untouched
+    for (unsigned poolIndex = 0; poolIndex < arena.pools.size(); ++poolIndex)
+    {
+        arenaPool& pool = arena.pools[poolIndex];
+
+        live.clear();
+        for (arenaMesh& mesh : arena.meshes)
+        {
+            if (mesh.live && mesh.pool == poolIndex)
+            {
+                live.push_back(&mesh);
+            }
+        }
+        std::sort(live.begin(), live.end(),
+                  [](const arenaMesh* a, const arenaMesh* b) { return a->firstVertex < b->firstVertex; });
+
+        size_t cursor = 0;
+        for (arenaMesh* mesh : live)
+        {
+            if (mesh->firstVertex != cursor)
+            {
+                moveBufferRange(pool.vbo, mesh->firstVertex * pool.stride, cursor * pool.stride,
+                                mesh->vertexCount * pool.stride);
+                mesh->firstVertex = cursor;
+            }
+            cursor += mesh->vertexCount;
+        }
+
+        pool.vertices = makeRangeAllocator(pool.vertices.capacity);
+        if (cursor > 0)
+        {
+            allocateRange(pool.vertices, cursor);
+        }
+    }
+
+    // Indices
+    live.clear();
+    for (arenaMesh& mesh : arena.meshes)
+    {
+        if (mesh.live)
+        {
+            live.push_back(&mesh);
+        }
+    }
+    std::sort(live.begin(), live.end(),
+              [](const arenaMesh* a, const arenaMesh* b) { return a->firstIndex < b->firstIndex; });
+
+    size_t cursor = 0;
+    for (arenaMesh* mesh : live)
+    {
+        if (mesh->firstIndex != cursor)
+        {
+            moveBufferRange(arena.ibo, mesh->firstIndex * sizeof(uint32_t), cursor * sizeof(uint32_t),
+                            mesh->indexCount * sizeof(uint32_t));
+            mesh->firstIndex = cursor;
+        }
+        cursor += mesh->indexCount;
+    }
+
+    arena.indices = makeRangeAllocator(arena.indices.capacity);
+    if (cursor > 0)
+    {
+        allocateRange(arena.indices, cursor);
+    }
+}
+
+arenaStats getArenaStats(const geometryArena& arena)
+{
+    arenaStats stats = {};
+    stats.meshes = arena.meshes.size() - arena.freeHandles.size();
+
+    for (const arenaPool& pool : arena.pools)
+    {
+        stats.vertexBytes += pool.vertices.used * pool.stride;
+        stats.vertexCapacityBytes += pool.vertices.capacity * pool.stride;
+        stats.freeRanges += pool.vertices.freeRanges.size();
+    }
+
+    stats.indexBytes = arena.indices.used * sizeof(uint32_t);
+    stats.indexCapacityBytes = arena.indices.capacity * sizeof(uint32_t);
+    stats.freeRanges += arena.indices.freeRanges.size();
+
+    return stats;
+}
+
+glm::mat4 arenaPositionTransform(const geometryArena& arena, arenaHandle handle)
+{
+    assert(handle < arena.meshes.size() && arena.meshes[handle].live && "invalid arena mesh");
+
+    const arenaMesh& mesh = arena.meshes[handle];
+    return glm::scale(glm::translate(glm::identity<glm::mat4>(), mesh.posOffset), mesh.posScale);
+}
+
+arenaBatch makeArenaBatch()
+{
+    arenaBatch batch = {};
+    glGenBuffers(1, &batch.indirectBuffer);
+    return batch;
+}
+
+void freeArenaBatch(arenaBatch& batch)
+{
+    glDeleteBuffers(1, &batch.indirectBuffer);
+
+    batch = {};
+}
+
+void clearArenaBatch(arenaBatch& batch)
+{
+    // keep the bucket allocations for next frame
+    for (auto& bucket : batch.buckets)
+    {
+        bucket.clear();
+    }
+}
+
+void addToBatch(arenaBatch& batch, const geometryArena& arena, arenaHandle handle,
+                GLuint baseInstance, GLuint instanceCount, unsigned lod)
+{
+    assert(handle < arena.meshes.size() && arena.meshes[handle].live && "invalid arena mesh");
+
+    const arenaMesh& mesh = arena.meshes[handle];
+    assert(lod < mesh.lodCount && "arena mesh has no such LOD");
+    if (batch.buckets.size() <= mesh.pool)
+    {
+        batch.buckets.resize(mesh.pool + 1);
+    }
+
+    drawElementsIndirectCommand command;
+    command.count = mesh.lods[lod].indexCount;
+    command.instanceCount = instanceCount;
+    command.firstIndex = (GLuint)mesh.firstIndex + mesh.lods[lod].firstIndex;
+    command.baseVertex = (GLint)mesh.firstVertex;
+    command.baseInstance = baseInstance;
+
+    batch.buckets[mesh.pool].push_back(command);
+}
+
+void drawArenaBatch(arenaBatch& batch, const shader& shad, const geometryArena& arena, const instanceBuffer& instances)
+{
+    PROFILE_GPU_SCOPE("drawArenaBatch");
+
+    batch.commands = 0;
+    batch.drawCalls = 0;
+
+    // Lay every bucket out back to back so the commands go up in one upload
+    batch.packed.clear();
+    for (const auto& bucket : batch.buckets)
+    {
+        batch.packed.insert(batch.packed.end(), bucket.begin(), bucket.end());
+    }
+    if (batch.packed.empty())
+    {
+        return;
+    }
+
+    size_t bytes = batch.packed.size() * sizeof(drawElementsIndirectCommand);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirectBuffer);
+    if (bytes > batch.indirectCapacity)
+    {
+        batch.indirectCapacity = bytes * 2;
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, batch.indirectCapacity, nullptr, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, batch.packed.data());
+
+    // Specify which shader
+    glUseProgram(shad.program);
+
+    size_t offset = 0;
+    for (unsigned poolIndex = 0; poolIndex < batch.buckets.size(); ++poolIndex)
+    {
+        size_t count = batch.buckets[poolIndex].size();
+        if (count == 0)
+        {
+            continue;
+        }
+
+        const arenaPool& pool = arena.pools[poolIndex];
+        glBindVertexArray(pool.vao);
+        bindInstanceAttributes(instances.handle);
+
+        // Formats without vertex colors read white from the generic attribute
+        if (pool.format.color == COLOR_NONE)
+        {
+            glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+        }
+
+        // Every mesh in this format in one call
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                    (const void*)(offset * sizeof(drawElementsIndirectCommand)),
+                                    (GLsizei)count, 0);
+
+        // One API call covering every command in the bucket
+        for (size_t i = 0; i < count; ++i)
+        {
+            const drawElementsIndirectCommand& command = batch.buckets[poolIndex][i];
+            countDraw(command.count, command.instanceCount, 0);
+        }
+        countDraw(0, 0);
+
+        offset += count;
+        batch.commands += (unsigned)count;
+        ++batch.drawCalls;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
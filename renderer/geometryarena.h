@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (vec3, mat4)
+
+#include "render.h"			// meshLod, MESH_MAX_LODS
+#include "vertexformat.h"	// vertexFormat
+
+struct instanceBuffer;
+struct meshData;
+struct meshLoadOptions;
+struct shader;
+
+const size_t RANGE_ALLOC_FAILED = ~(size_t)0;
+
+// A run of unused elements inside a rangeAllocator
+struct freeRange
+{
+	size_t offset, count;
+};
+
+// Best-fit free-list sub-allocator over [0, capacity) -- units are whatever the caller counts in
+struct rangeAllocator
+{
+	size_t capacity;
+	size_t used;
+	std::vector<freeRange> freeRanges;	// sorted by offset, never adjacent (coalesced on free)
+};
+
+rangeAllocator makeRangeAllocator(size_t capacity);
+// Returns the offset of count free elements, or RANGE_ALLOC_FAILED
+size_t allocateRange(rangeAllocator& alloc, size_t count);
+void releaseRange(rangeAllocator& alloc, size_t offset, size_t count);
+// Adds space at the end (after the backing buffer has grown)
+void extendRangeAllocator(rangeAllocator& alloc, size_t newCapacity);
+
+typedef unsigned arenaHandle;
+const arenaHandle INVALID_ARENA_MESH = ~0u;
+
+// Layout of glMultiDrawElementsIndirect's command buffer
+struct drawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// One vertex format's share of the arena -- a vertex buffer and the VAO that reads it
+struct arenaPool
+{
+	vertexFormat format;
+	GLuint vao, vbo;
+	GLuint stride;
+	rangeAllocator vertices;
+};
+
+// A mesh living in the arena as vertex and index ranges
+struct arenaMesh
+{
+	unsigned pool;
+	size_t firstVertex, vertexCount;
+	size_t firstIndex, indexCount;	// indices are relative to firstVertex
+	unsigned lodCount;
+	meshLod lods[MESH_MAX_LODS];	// firstIndex of each level is relative to the mesh's
+
+	glm::vec3 posScale, posOffset;	// undoes position quantization
+	glm::vec3 boundsMin, boundsMax;	// object-space AABB for culling
+	bool live;
+};
+
+// Large shared buffers that many meshes are sub-allocated from. Every mesh
+// with the same vertex format shares a VAO, so they can be drawn together.
+struct geometryArena
+{
+	std::vector<arenaPool> pools;
+	GLuint ibo;						// one index buffer (32-bit indices) shared by every pool
+	rangeAllocator indices;
+
+	std::vector<arenaMesh> meshes;
+	std::vector<arenaHandle> freeHandles;
+
+	size_t poolCapacity;			// initial vertex capacity for new pools
+};
+
+// Occupancy of an arena's buffers
+struct arenaStats
+{
+	size_t meshes;
+	size_t vertexBytes, vertexCapacityBytes;
+	size_t indexBytes, indexCapacityBytes;
+	size_t freeRanges;				// holes across all buffers -- high counts mean defragmentArena will help
+};
+
+geometryArena makeGeometryArena(size_t vertexCapacity, size_t indexCapacity);
+void freeGeometryArena(geometryArena& arena);
+
+// Copies a decoded mesh into the arena -- returns INVALID_ARENA_MESH on failure
+arenaHandle addArenaMesh(geometryArena& arena, const meshData& mesh);
+arenaHandle loadArenaMesh(geometryArena& arena, const char* filePath, const meshLoadOptions& options);
+void removeArenaMesh(geometryArena& arena, arenaHandle handle);
+
+// Slides every live mesh down to close the holes left by removed ones
+void defragmentArena(geometryArena& arena);
+arenaStats getArenaStats(const geometryArena& arena);
+
+// Undoes position quantization -- fold it into the mesh's instance transforms
+glm::mat4 arenaPositionTransform(const geometryArena& arena, arenaHandle handle);
+
+// Indirect draw commands bucketed by pool, drawn with one call per pool
+struct arenaBatch
+{
+	std::vector<std::vector<drawElementsIndirectCommand>> buckets;	// indexed by pool
+	std::vector<drawElementsIndirectCommand> packed;				// buckets laid end to end for upload
+	GLuint indirectBuffer;
+	size_t indirectCapacity;
+
+	// telemetry for the last drawArenaBatch
+	unsigned commands;
+	unsigned drawCalls;
+};
+
+arenaBatch makeArenaBatch();
+void freeArenaBatch(arenaBatch& batch);
+void clearArenaBatch(arenaBatch& batch);
+
+// Queues instanceCount copies of a mesh. Per-draw transforms come from the
+// instance buffer, starting at baseInstance. lod picks the detail level.
+void addToBatch(arenaBatch& batch, const geometryArena& arena, arenaHandle handle,
+	GLuint baseInstance, GLuint instanceCount = 1, unsigned lod = 0);
+// Issues one glMultiDrawElementsIndirect per non-empty pool
+void drawArenaBatch(arenaBatch& batch, const shader& shad, const geometryArena& arena, const instanceBuffer& instances);
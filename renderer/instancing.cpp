@@ -0,0 +1,241 @@
+#include "instancing.h"
+
+#include <algorithm>    // sort
+#include <cassert>      // assert
+#include <cstddef>      // offsetof
+
+#include "profiler.h"
+#include "render.h"
+
+const char* INSTANCE_ATTRIBUTES_GLSL =
+    "layout (location = 4) in mat4 instanceTransform;\n"
+    "layout (location = 8) in vec4 instanceColor;\n";
+
+namespace
+{
+    // Dirty ranges closer than this are uploaded as one -- a few wasted bytes beat another call
+    const size_t INSTANCE_MERGE_GAP = 32;
+
+    void growInstanceBuffer(instanceBuffer& buffer, size_t count)
+    {
+        if (count <= buffer.capacity)
+        {
+            return;
+        }
+
+        // Grow geometrically; the old contents are re-uploaded from the CPU copy
+        size_t capacity = buffer.capacity * 2 > count ? buffer.capacity * 2 : count;
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.handle);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(instanceData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        buffer.capacity = capacity;
+        markInstancesDirty(buffer, 0, buffer.instances.size());
+    }
+}
+
+instanceBuffer makeInstanceBuffer(size_t capacity)
+{
+    instanceBuffer newBuffer = {};
+    newBuffer.capacity = capacity > 0 ? capacity : 1;
+    newBuffer.instances.reserve(newBuffer.capacity);
+
+    glGenBuffers(1, &newBuffer.handle);
+    glBindBuffer(GL_ARRAY_BUFFER, newBuffer.handle);
+    glBufferData(GL_ARRAY_BUFFER, newBuffer.capacity * sizeof(instanceData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return newBuffer;
+}
+
+void freeInstanceBuffer(instanceBuffer& buffer)
+{
+    glDeleteBuffers(1, &buffer.handle);
+
+    buffer = {};
+}
+
+void setInstances(instanceBuffer& buffer, const instanceData* instances, size_t count)
+{
+    buffer.instances.assign(instances, instances + count);
+    buffer.dirty.clear();
+    markInstancesDirty(buffer, 0, count);
+}
+
+void setInstances(instanceBuffer& buffer, const glm::mat4* transforms, size_t count)
+{
+    buffer.instances.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        buffer.instances[i].transform = transforms[i];
+        buffer.instances[i].color = glm::vec4(1.0f);
+    }
+
+    buffer.dirty.clear();
+    markInstancesDirty(buffer, 0, count);
+}
+
+void setInstanceTransform(instanceBuffer& buffer, size_t index, const glm::mat4& transform)
+{
+    assert(index < buffer.instances.size() && "instance index out of range");
+
+    buffer.instances[index].transform = transform;
+    markInstancesDirty(buffer, index, 1);
+}
+
+void setInstanceColor(instanceBuffer& buffer, size_t index, const glm::vec4& color)
+{
+    assert(index < buffer.instances.size() && "instance index out of range");
+
+    buffer.instances[index].color = color;
+    markInstancesDirty(buffer, index, 1);
+}
+
+void markInstancesDirty(instanceBuffer& buffer, size_t first, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Extend the last range when edits arrive in order (the common case)
+    if (!buffer.dirty.empty())
+    {
+        instanceRange& last = buffer.dirty.back();
+        if (first >= last.first && first <= last.first + last.count)
+        {
+            size_t end = first + count > last.first + last.count ? first + count : last.first + last.count;
+            last.count = end - last.first;
+            return;
+        }
+    }
+
+    buffer.dirty.push_back({ first, count });
+}
+
+void updateInstanceBuffer(instanceBuffer& buffer)
+{
+    PROFILE_GPU_SCOPE("updateInstanceBuffer");
+
+    buffer.uploadedInstances = 0;
+    buffer.uploadCalls = 0;
+
+    growInstanceBuffer(buffer, buffer.instances.size());
+
+    if (buffer.dirty.empty())
+    {
+        return;
+    }
+
+    std::sort(buffer.dirty.begin(), buffer.dirty.end(),
+              [](const instanceRange& a, const instanceRange& b) { return a.first < b.first; });
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.handle);
+
+    size_t instanceCount = buffer.instances.size();
+    size_t i = 0;
+    while (i < buffer.dirty.size())
+    {
+        // Merge every following range that overlaps or sits within the gap
+        size_t begin = buffer.dirty[i].first;
+        size_t end = begin + buffer.dirty[i].count;
+        for (++i; i < buffer.dirty.size() && buffer.dirty[i].first <= end + INSTANCE_MERGE_GAP; ++i)
+        {
+            size_t rangeEnd = buffer.dirty[i].first + buffer.dirty[i].count;
+            end = rangeEnd > end ? rangeEnd : end;
+        }
+
+        // Ranges may point past the end if instances were removed since
+        end = end < instanceCount ? end : instanceCount;
+        if (begin >= end)
+        {
+            continue;
+        }
+
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        begin * sizeof(instanceData),
+                        (end - begin) * sizeof(instanceData),
+                        &buffer.instances[begin]);
+
+        buffer.uploadedInstances += end - begin;
+        ++buffer.uploadCalls;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    buffer.dirty.clear();
+}
+
+void attachInstanceLayout(GLuint vao)
+{
+    // Separate format/binding so a draw only has to swap the buffer, not re-describe it
+    glBindVertexArray(vao);
+
+    for (GLuint column = 0; column < 4; ++column)
+    {
+        GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+        glVertexAttribFormat(location, 4, GL_FLOAT, GL_FALSE, (GLuint)(column * sizeof(glm::vec4)));
+        glVertexAttribBinding(location, INSTANCE_BINDING);
+    }
+    glVertexAttribFormat(INSTANCE_COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, (GLuint)offsetof(instanceData, color));
+    glVertexAttribBinding(INSTANCE_COLOR_LOCATION, INSTANCE_BINDING);
+
+    // Advance once per instance rather than once per vertex
+    glVertexBindingDivisor(INSTANCE_BINDING, 1);
+
+    glBindVertexArray(0);
+}
+
+void bindInstanceAttributes(GLuint instanceBufferHandle)
+{
+    glBindVertexBuffer(INSTANCE_BINDING, instanceBufferHandle, 0, sizeof(instanceData));
+    for (GLuint location = INSTANCE_TRANSFORM_LOCATION; location <= INSTANCE_COLOR_LOCATION; ++location)
+    {
+        glEnableVertexAttribArray(location);
+    }
+}
+
+void drawInstanced(const shader& shad, const geometry& geo, const instanceBuffer& buffer,
+                   size_t first, size_t count, unsigned lod)
+{
+    PROFILE_GPU_SCOPE("drawInstanced");
+
+    assert(lod < geo.lodCount && "geometry has no such LOD");
+
+    size_t instanceCount = buffer.instances.size();
+    assert(first <= instanceCount && "first instance out of range");
+    assert(buffer.dirty.empty() && "instance buffer has changes that were never uploaded");
+
+    if (count == 0)
+    {
+        count = instanceCount - first;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Specify which shader
+    glUseProgram(shad.program);
+
+    // Specify which VAO, then point its instance binding at this buffer
+    glBindVertexArray(geo.vao);
+    bindInstanceAttributes(buffer.handle);
+
+    // Geometry without vertex colors reads white from the generic attribute
+    if (geo.format.color == COLOR_NONE)
+    {
+        glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    // One call for every copy -- gl_InstanceID counts from 0, the base instance offsets the fetch
+    const meshLod& level = geo.lods[lod];
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES,
+                                        level.indexCount,
+                                        geo.indexType,
+                                        (void*)((size_t)level.firstIndex * indexTypeSize(geo.indexType)),
+                                        (GLsizei)count,
+                                        (GLuint)first);
+
+    countDraw(level.indexCount, count);
+}
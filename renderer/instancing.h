@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (mat4, vec4)
+
+struct geometry;
+struct shader;
+
+// Per-instance attributes follow the per-vertex ones (0-3)
+const GLuint INSTANCE_TRANSFORM_LOCATION = 4;	// mat4 -- takes locations 4, 5, 6 and 7
+const GLuint INSTANCE_COLOR_LOCATION = 8;		// vec4
+const GLuint INSTANCE_BINDING = 15;				// vertex buffer binding the instance data is read from
+
+// GLSL declarations for the per-instance attributes
+extern const char* INSTANCE_ATTRIBUTES_GLSL;
+
+// Everything one copy of a mesh needs (80 bytes)
+struct instanceData
+{
+	glm::mat4 transform;	// object to world
+	glm::vec4 color;		// tint -- or material parameters, the shader decides
+};
+
+// A range of instances [first, first + count) that changed on the CPU
+struct instanceRange
+{
+	size_t first, count;
+};
+
+// Per-instance data for instanced draws. The CPU copy is edited freely; only
+// the ranges marked dirty are uploaded by updateInstanceBuffer.
+struct instanceBuffer
+{
+	GLuint handle;
+	size_t capacity;	// instances the GPU buffer can hold
+
+	std::vector<instanceData> instances;
+	std::vector<instanceRange> dirty;
+
+	// telemetry for the last update
+	size_t uploadedInstances;
+	unsigned uploadCalls;
+};
+
+instanceBuffer makeInstanceBuffer(size_t capacity);
+void freeInstanceBuffer(instanceBuffer& buffer);
+
+// Replaces every instance (marks the whole buffer dirty)
+void setInstances(instanceBuffer& buffer, const instanceData* instances, size_t count);
+// Same, for callers that only have transforms -- color is white
+void setInstances(instanceBuffer& buffer, const glm::mat4* transforms, size_t count);
+
+// Edits a single instance in place
+void setInstanceTransform(instanceBuffer& buffer, size_t index, const glm::mat4& transform);
+void setInstanceColor(instanceBuffer& buffer, size_t index, const glm::vec4& color);
+// Flags instances the caller wrote through buffer.instances directly
+void markInstancesDirty(instanceBuffer& buffer, size_t first, size_t count);
+
+// Uploads the dirty ranges (merging nearby ones) -- call once per frame before drawing
+void updateInstanceBuffer(instanceBuffer& buffer);
+
+// Describes the instance attributes on a geometry's VAO (called by makePackedGeometry)
+void attachInstanceLayout(GLuint vao);
+
+// Points the bound VAO's instance attributes at a buffer
+void bindInstanceAttributes(GLuint instanceBufferHandle);
+
+// Draws count instances starting at first with a single call (count = 0 draws the rest)
+void drawInstanced(const shader& shad, const geometry& geo, const instanceBuffer& buffer,
+	size_t first = 0, size_t count = 0, unsigned lod = 0);
@@ -0,0 +1,447 @@
+#include "jobs.h"
+
+#include <cassert>              // assert
+#include <condition_variable>   // condition_variable
+#include <cstdio>               // fprintf
+#include <cstring>              // memcpy
+#include <deque>                // deque
+#include <memory>               // unique_ptr
+#include <mutex>                // mutex, lock_guard
+#include <thread>               // thread
+#include <vector>               // vector
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>            // pthread_setaffinity_np
+#include <sched.h>              // cpu_set_t
+#endif
+
+#include "profiler.h"
+
+namespace
+{
+    const unsigned IDLE_SPINS = 64;     // empty scans before a worker goes to sleep
+
+    static_assert((JOB_DEQUE_SIZE & (JOB_DEQUE_SIZE - 1)) == 0, "deque size must be a power of two");
+    static_assert((JOB_POOL_SIZE & (JOB_POOL_SIZE - 1)) == 0, "pool size must be a power of two");
+
+    // Chase-Lev deque (the C11 formulation of Le et al.) -- the owner pushes and pops
+    // at the bottom, thieves take from the top
+    struct jobDeque
+    {
+        // Kept a cache line apart so thieves and the owner don't fight over one line
+        std::atomic<int64_t> top{ 0 };
+        char topPadding[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> bottom{ 0 };
+        char bottomPadding[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<job*> ring[JOB_DEQUE_SIZE];
+
+        bool push(job* j)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            if (b - t >= (int64_t)JOB_DEQUE_SIZE)
+            {
+                return false;
+            }
+
+            ring[b & (JOB_DEQUE_SIZE - 1)].store(j, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        job* pop()
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                // Empty
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            job* j = ring[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_acquire);
+            if (t == b)
+            {
+                // Last one -- race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    j = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return j;
+        }
+
+        job* steal()
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+            {
+                return nullptr;
+            }
+
+            job* j = ring[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_acquire);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return j;
+        }
+    };
+
+    struct jobThread
+    {
+        jobDeque deque;
+        job pool[JOB_POOL_SIZE];
+        unsigned poolNext = 0;
+        unsigned index = 0;
+        uint32_t random = 0;    // picks the first victim to steal from
+    };
+
+    jobSystemOptions config;
+    std::vector<std::unique_ptr<jobThread>> threads;
+    std::vector<std::thread> workers;
+    std::atomic<bool> running(false);
+    std::atomic<bool> quitting(false);
+    thread_local jobThread* localThread = nullptr;
+
+    // Idle workers sleep until the epoch moves
+    std::mutex sleepLock;
+    std::condition_variable sleepSignal;
+    std::atomic<uint64_t> workEpoch(0);
+    std::atomic<unsigned> sleepers(0);
+
+    std::mutex backgroundLock;
+    std::condition_variable backgroundDone;
+    std::deque<std::function<void()>> backgroundTasks;
+    unsigned backgroundPending = 0;     // queued or running, guarded by backgroundLock
+
+    void wakeWorkers(bool all)
+    {
+        workEpoch.fetch_add(1);
+        if (sleepers.load() > 0)
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            if (all)
+            {
+                sleepSignal.notify_all();
+            }
+            else
+            {
+                sleepSignal.notify_one();
+            }
+        }
+    }
+
+    void pinThread(unsigned core)
+    {
+#ifdef _WIN32
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % CPU_SETSIZE, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)core;
+#endif
+    }
+
+    void finishJob(job* j)
+    {
+        // The last one out tells the parent
+        while (j != nullptr && j->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            j = j->parent;
+        }
+    }
+
+    void executeJob(job* j, const jobThread& thread)
+    {
+        int64_t begin = config.timingHook != nullptr ? profilerNow() : 0;
+        {
+            profileScope scope(j->name);
+            j->fn(*j, j->data);
+        }
+        if (config.timingHook != nullptr)
+        {
+            config.timingHook({ j->name, thread.index, begin, profilerNow() }, config.timingUser);
+        }
+
+        finishJob(j);
+    }
+
+    // Own deque first (newest work, still in cache), then the others' oldest
+    job* findJob(jobThread& self)
+    {
+        job* found = self.deque.pop();
+        if (found != nullptr)
+        {
+            return found;
+        }
+
+        unsigned count = (unsigned)threads.size();
+        self.random = self.random * 1664525u + 1013904223u;
+        unsigned start = (self.random >> 16) % count;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            unsigned victim = (start + i) % count;
+            if (victim != self.index && (found = threads[victim]->deque.steal()) != nullptr)
+            {
+                return found;
+            }
+        }
+        return nullptr;
+    }
+
+    bool runBackgroundTaskOnce()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> guard(backgroundLock);
+            if (backgroundTasks.empty())
+            {
+                return false;
+            }
+            task = std::move(backgroundTasks.front());
+            backgroundTasks.pop_front();
+        }
+
+        {
+            PROFILE_SCOPE("backgroundTask");
+            task();
+        }
+
+        std::lock_guard<std::mutex> guard(backgroundLock);
+        if (--backgroundPending == 0)
+        {
+            backgroundDone.notify_all();
+        }
+        return true;
+    }
+
+    void workerLoop(unsigned index)
+    {
+        jobThread& self = *threads[index];
+        localThread = &self;
+        if (config.pinThreads)
+        {
+            pinThread(index);
+        }
+
+        unsigned idle = 0;
+        while (!quitting.load(std::memory_order_relaxed))
+        {
+            // Read before looking so work queued during the search still wakes us
+            uint64_t epoch = workEpoch.load();
+
+            job* next = findJob(self);
+            if (next != nullptr)
+            {
+                executeJob(next, self);
+                idle = 0;
+                continue;
+            }
+
+            if (runBackgroundTaskOnce())
+            {
+                idle = 0;
+                continue;
+            }
+
+            if (++idle < IDLE_SPINS)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            sleepers.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> guard(sleepLock);
+                sleepSignal.wait(guard, [epoch]() { return workEpoch.load() != epoch || quitting.load(); });
+            }
+            sleepers.fetch_sub(1);
+            idle = 0;
+        }
+
+        localThread = nullptr;
+    }
+
+    // Stops the workers at exit if nobody called termJobSystem, before the state above is torn down
+    struct jobSystemGuard
+    {
+        ~jobSystemGuard() { termJobSystem(); }
+    } exitGuard;
+}
+
+bool initJobSystem(const jobSystemOptions& options)
+{
+    if (running.load())
+    {
+        fprintf(stderr, "[ERROR] job system is already running\n");
+        return false;
+    }
+
+    config = options;
+    unsigned count = options.threadCount > 0 ? options.threadCount : std::thread::hardware_concurrency();
+    count = count > 0 ? count : 1;
+
+    threads.clear();
+    for (unsigned i = 0; i < count; ++i)
+    {
+        threads.emplace_back(new jobThread());
+        jobThread& thread = *threads.back();
+        thread.index = i;
+        thread.random = i * 2654435761u + 1;
+        for (job& slot : thread.pool)
+        {
+            slot.unfinished.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    quitting.store(false);
+    running.store(true);
+
+    localThread = threads[0].get();
+    if (options.pinThreads)
+    {
+        pinThread(0);
+    }
+
+    for (unsigned i = 1; i < count; ++i)
+    {
+        workers.emplace_back(workerLoop, i);
+    }
+
+    return true;
+}
+
+void termJobSystem()
+{
+    if (!running.load())
+    {
+        return;
+    }
+    assert(localThread == threads[0].get() && "stop the job system from the thread that started it");
+
+    // Let decodes and the like finish -- their results may still be waited on
+    {
+        std::unique_lock<std::mutex> guard(backgroundLock);
+        backgroundDone.wait(guard, []() { return backgroundPending == 0; });
+    }
+
+    quitting.store(true);
+    wakeWorkers(true);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+
+    running.store(false);
+    localThread = nullptr;
+    threads.clear();
+}
+
+bool isJobSystemRunning()
+{
+    return running.load(std::memory_order_relaxed);
+}
+
+unsigned jobThreadCount()
+{
+    return isJobSystemRunning() ? (unsigned)threads.size() : 1;
+}
+
+unsigned currentJobThread()
+{
+    return localThread != nullptr ? localThread->index : ~0u;
+}
+
+job* createJob(const char* name, jobFn fn, const void* data, size_t dataSize, job* parent)
+{
+    assert(localThread != nullptr && "jobs can only be created on job threads");
+    assert(name != nullptr && fn != nullptr);
+    assert(dataSize <= JOB_DATA_SIZE && "job data is too big");
+
+    jobThread& self = *localThread;
+    job* created = &self.pool[self.poolNext++ & (JOB_POOL_SIZE - 1)];
+    assert(created->unfinished.load(std::memory_order_relaxed) == 0 && "job pool exhausted -- too many jobs alive");
+
+    created->fn = fn;
+    created->parent = parent;
+    created->name = name;
+    created->unfinished.store(1, std::memory_order_relaxed);
+    if (dataSize > 0)
+    {
+        memcpy(created->data, data, dataSize);
+    }
+
+    if (parent != nullptr)
+    {
+        parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return created;
+}
+
+void runJob(job* j)
+{
+    assert(localThread != nullptr && "jobs can only be run from job threads");
+
+    // A full deque means plenty of queued work already -- just do this one now
+    if (!localThread->deque.push(j))
+    {
+        executeJob(j, *localThread);
+        return;
+    }
+
+    wakeWorkers(false);
+}
+
+void waitJob(job* j)
+{
+    assert(localThread != nullptr && "jobs can only be waited on from job threads");
+
+    jobThread& self = *localThread;
+    while (j->unfinished.load(std::memory_order_acquire) > 0)
+    {
+        // Help out rather than block -- but never with background work, which could take far longer
+        job* next = findJob(self);
+        if (next != nullptr)
+        {
+            executeJob(next, self);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void runBackgroundTask(std::function<void()> task)
+{
+    if (!isJobSystemRunning() || threads.size() < 2)
+    {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(backgroundLock);
+        backgroundTasks.push_back(std::move(task));
+        ++backgroundPending;
+    }
+    wakeWorkers(false);
+}
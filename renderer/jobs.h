@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>			// atomic
+#include <cstddef>			// size_t
+#include <cstdint>			// int64_t
+#include <functional>		// function
+#include <new>				// placement new
+#include <type_traits>		// is_trivially_copyable, is_trivially_destructible
+
+// Jobs each thread can queue before runJob runs them inline (power of two)
+const unsigned JOB_DEQUE_SIZE = 4096;
+// Jobs each thread can have alive at once -- slots are reused round-robin
+const unsigned JOB_POOL_SIZE = 4096;
+// Bytes of closure a job carries inline
+const size_t JOB_DATA_SIZE = 96;
+
+struct job;
+typedef void (*jobFn)(job& self, const void* data);
+
+// A unit of work. It counts as finished once its function has returned and every
+// child created with it as the parent has finished too. 128 bytes, two cache lines.
+struct job
+{
+	jobFn fn;
+	job* parent;
+	const char* name;				// string literal, shown by the profiler and timing hook
+	std::atomic<int> unfinished;	// itself plus running children
+	alignas(16) unsigned char data[JOB_DATA_SIZE];
+};
+
+// Reported for every job when a timing hook is installed
+struct jobTiming
+{
+	const char* name;
+	unsigned thread;		// 0 is the thread that called initJobSystem
+	int64_t begin, end;		// nanoseconds on the profiler clock
+};
+
+typedef void (*jobTimingFn)(const jobTiming& timing, void* user);
+
+struct jobSystemOptions
+{
+	unsigned threadCount = 0;		// including the calling thread, 0 = one per core
+	bool pinThreads = false;		// bind thread i to core i
+	jobTimingFn timingHook = nullptr;
+	void* timingUser = nullptr;
+};
+
+// Starts the workers. The calling thread becomes job thread 0 and is the only
+// other thread that may create or wait on jobs.
+bool initJobSystem(const jobSystemOptions& options = jobSystemOptions());
+// Waits for background tasks, then stops the workers
+void termJobSystem();
+
+bool isJobSystemRunning();
+// Threads that run jobs, including the one that started the system (1 when not running)
+unsigned jobThreadCount();
+// Index of the calling job thread, or ~0u for threads outside the system
+unsigned currentJobThread();
+
+// Allocates a job from the calling thread's pool -- data is copied into the job
+job* createJob(const char* name, jobFn fn, const void* data = nullptr, size_t dataSize = 0, job* parent = nullptr);
+
+namespace jobDetail
+{
+	template<typename Fn>
+	void callClosure(job& self, const void* data)
+	{
+		(*static_cast<const Fn*>(data))(self);
+	}
+}
+
+// Wraps a closure called as fn(job& self). Captures must fit in the job and be
+// trivially copyable -- capture by reference or pointer.
+template<typename Fn>
+job* createJob(const char* name, const Fn& fn, job* parent = nullptr)
+{
+	static_assert(sizeof(Fn) <= JOB_DATA_SIZE, "closure is too big to store in a job");
+	static_assert(std::is_trivially_copyable<Fn>::value && std::is_trivially_destructible<Fn>::value,
+		"job closures are copied as bytes and never destroyed");
+
+	job* created = createJob(name, &jobDetail::callClosure<Fn>, nullptr, 0, parent);
+	new (created->data) Fn(fn);
+	return created;
+}
+
+// Queues a job on the calling thread -- idle threads steal from the far end
+void runJob(job* j);
+// Runs other jobs until j and all of its children have finished
+void waitJob(job* j);
+
+// Long-running work (file decode and the like) that should never hold up a frame.
+// Only idle workers pick these up, and never a thread that is waiting on a job.
+// Without a running job system (or without workers) the task runs before this returns.
+void runBackgroundTask(std::function<void()> task);
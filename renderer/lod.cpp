@@ -0,0 +1,476 @@
+#include "lod.h"
+
+#include <algorithm>    // sort, min, max
+#include <cmath>        // sqrtf
+
+#include "meshopt.h"    // optimizeVertexCache
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE
+
+namespace
+{
+    // Symmetric 4x4 plane quadric -- error(p) = p'Ap + 2b'p + c
+    struct quadric
+    {
+        float a00, a01, a02, a11, a12, a22;
+        float b0, b1, b2;
+        float c;
+        float weight;   // total area that went in
+    };
+
+    void addPlane(quadric& q, const glm::vec3& n, float d, float weight)
+    {
+        q.a00 += weight * n.x * n.x;
+        q.a01 += weight * n.x * n.y;
+        q.a02 += weight * n.x * n.z;
+        q.a11 += weight * n.y * n.y;
+        q.a12 += weight * n.y * n.z;
+        q.a22 += weight * n.z * n.z;
+        q.b0 += weight * n.x * d;
+        q.b1 += weight * n.y * d;
+        q.b2 += weight * n.z * d;
+        q.c += weight * d * d;
+        q.weight += weight;
+    }
+
+    void addQuadric(quadric& q, const quadric& other)
+    {
+        q.a00 += other.a00;
+        q.a01 += other.a01;
+        q.a02 += other.a02;
+        q.a11 += other.a11;
+        q.a12 += other.a12;
+        q.a22 += other.a22;
+        q.b0 += other.b0;
+        q.b1 += other.b1;
+        q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    // Area-weighted mean squared distance from p to the planes in q
+    float quadricError(const quadric& q, const glm::vec3& p)
+    {
+        float rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+        float ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+        float rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+
+        float error = p.x * rx + p.y * ry + p.z * rz + 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+        error = error < 0.0f ? 0.0f : error;    // rounding
+
+        return q.weight > 0.0f ? error / q.weight : 0.0f;
+    }
+
+    // One half-edge collapse: vertex `from` moves onto vertex `to`
+    struct collapse
+    {
+        unsigned from, to;
+        float cost;
+    };
+
+    // Groups vertices that share a position -- more than one per position means a seam
+    void findWedges(const std::vector<glm::vec3>& positions, std::vector<unsigned>& remap, std::vector<unsigned>& wedgeCount)
+    {
+        size_t count = positions.size();
+        std::vector<unsigned> order(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            order[i] = (unsigned)i;
+        }
+
+        auto less = [&](unsigned a, unsigned b)
+        {
+            const glm::vec3& pa = positions[a];
+            const glm::vec3& pb = positions[b];
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            return pa.z < pb.z;
+        };
+        std::sort(order.begin(), order.end(), less);
+
+        remap.assign(count, 0);
+        wedgeCount.assign(count, 0);
+        for (size_t i = 0; i < count;)
+        {
+            size_t end = i + 1;
+            while (end < count && positions[order[end]] == positions[order[i]])
+            {
+                ++end;
+            }
+
+            unsigned canonical = order[i];
+            for (size_t j = i; j < end; ++j)
+            {
+                remap[order[j]] = canonical;
+            }
+            wedgeCount[canonical] = (unsigned)(end - i);
+
+            i = end;
+        }
+    }
+
+    // Marks positions that sit on an edge used by only one triangle
+    void findBorders(const unsigned* indices, size_t indxCount, const std::vector<unsigned>& remap,
+                     std::vector<bool>& border)
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve(indxCount);
+        for (size_t i = 0; i < indxCount; i += 3)
+        {
+            for (int e = 0; e < 3; ++e)
+            {
+                uint64_t a = remap[indices[i + e]];
+                uint64_t b = remap[indices[i + (e + 1) % 3]];
+                edges.push_back(a << 32 | b);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        for (uint64_t edge : edges)
+        {
+            uint64_t reverse = edge << 32 | edge >> 32;
+            if (!std::binary_search(edges.begin(), edges.end(), reverse))
+            {
+                border[(unsigned)(edge >> 32)] = true;
+                border[(unsigned)edge] = true;
+            }
+        }
+    }
+
+    float lengthSquared(const glm::vec2& v)
+    {
+        return v.x * v.x + v.y * v.y;
+    }
+
+    float lengthSquared(const glm::vec3& v)
+    {
+        return v.x * v.x + v.y * v.y + v.z * v.z;
+    }
+}
+
+float simplifyMesh(const vertex* verts, size_t vertCount, const unsigned int* indices, size_t indxCount,
+                   size_t targetIndxCount, std::vector<unsigned int>& result, const simplifyOptions& options)
+{
+    PROFILE_SCOPE("simplifyMesh");
+
+    result.assign(indices, indices + indxCount);
+    if (vertCount == 0 || indxCount <= targetIndxCount)
+    {
+        return 0.0f;
+    }
+
+    // Work in a unit box so the error weights mean the same thing for every mesh
+    glm::vec3 boundsMin, boundsMax;
+    computeBounds(verts, vertCount, boundsMin, boundsMax);
+    glm::vec3 size = boundsMax - boundsMin;
+    float extent = std::max(size.x, std::max(size.y, size.z));
+    float invExtent = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+    std::vector<glm::vec3> positions(vertCount);
+    for (size_t i = 0; i < vertCount; ++i)
+    {
+        positions[i] = (glm::vec3(verts[i].pos) - boundsMin) * invExtent;
+    }
+
+    // Seams (a position with several attribute sets) and open borders never move
+    std::vector<unsigned> remap, wedgeCount;
+    findWedges(positions, remap, wedgeCount);
+
+    std::vector<bool> border(vertCount, false);
+    findBorders(indices, indxCount, remap, border);
+
+    std::vector<bool> locked(vertCount);
+    for (size_t i = 0; i < vertCount; ++i)
+    {
+        locked[i] = wedgeCount[remap[i]] > 1 || border[remap[i]];
+    }
+
+    // Every triangle's plane goes into its corners' quadrics, weighted by area
+    std::vector<quadric> quadrics(vertCount, quadric{});
+    for (size_t i = 0; i < indxCount; i += 3)
+    {
+        const glm::vec3& p0 = positions[indices[i]];
+        const glm::vec3& p1 = positions[indices[i + 1]];
+        const glm::vec3& p2 = positions[indices[i + 2]];
+
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = sqrtf(lengthSquared(normal));
+        if (length == 0.0f)
+        {
+            continue;
+        }
+        normal /= length;
+
+        float area = length * 0.5f;
+        float d = -glm::dot(normal, p0);
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            addPlane(quadrics[indices[i + corner]], normal, d, area);
+        }
+    }
+
+    float maxCost = options.maxError * options.maxError;
+    float worstCost = 0.0f;
+
+    std::vector<unsigned> triangleStart(vertCount + 1), triangleList;
+    std::vector<collapse> collapses;
+    std::vector<unsigned> collapseTarget(vertCount);
+    std::vector<bool> touched(vertCount);
+
+    auto collapseCost = [&](unsigned from, unsigned to)
+    {
+        const vertex& a = verts[from];
+        const vertex& b = verts[to];
+        glm::vec3 normalDrift = glm::vec3(a.normal) - glm::vec3(b.normal);
+
+        // attribute drift matters in proportion to how far the vertex travels
+        float drift = options.uvWeight * lengthSquared(a.uv - b.uv) + options.normalWeight * lengthSquared(normalDrift);
+        float travel = lengthSquared(positions[to] - positions[from]);
+
+        return quadricError(quadrics[from], positions[to]) + drift * travel;
+    };
+
+    // Collapses run in passes: rank every edge, then take the cheapest non-overlapping ones
+    while (result.size() > targetIndxCount)
+    {
+        size_t triangleCount = result.size() / 3;
+
+        // vertex -> triangles adjacency for this pass
+        std::fill(triangleStart.begin(), triangleStart.end(), 0);
+        for (unsigned index : result)
+        {
+            ++triangleStart[index + 1];
+        }
+        for (size_t i = 0; i < vertCount; ++i)
+        {
+            triangleStart[i + 1] += triangleStart[i];
+        }
+        triangleList.resize(result.size());
+        std::vector<unsigned> fill(triangleStart.begin(), triangleStart.end() - 1);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            triangleList[fill[result[i]]++] = (unsigned)(i / 3);
+        }
+
+        // the cheaper legal direction of every edge
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int e = 0; e < 3; ++e)
+            {
+                unsigned a = result[i + e];
+                unsigned b = result[i + (e + 1) % 3];
+
+                // interior edges show up twice -- only keep the one with a < b (borders are locked anyway)
+                if (a > b || remap[a] == remap[b])
+                {
+                    continue;
+                }
+
+                collapse best = { 0, 0, maxCost + 1.0f };
+                if (!locked[a])
+                {
+                    best = { a, b, collapseCost(a, b) };
+                }
+                if (!locked[b])
+                {
+                    float cost = collapseCost(b, a);
+                    if (cost < best.cost)
+                    {
+                        best = { b, a, cost };
+                    }
+                }
+                if (best.cost <= maxCost)
+                {
+                    collapses.push_back(best);
+                }
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const collapse& x, const collapse& y) { return x.cost < y.cost; });
+
+        // take collapses cheapest first, never two that touch the same neighbourhood in one pass
+        for (size_t i = 0; i < vertCount; ++i)
+        {
+            collapseTarget[i] = (unsigned)i;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        size_t trianglesToRemove = (result.size() - targetIndxCount) / 3;
+        size_t removed = 0;
+
+        // a collapse removes about two triangles -- cap the pass near the cost of the last one we need
+        // so expensive collapses wait for a later pass instead of displacing cheap ones
+        float passLimit = 0.0f;
+        if (!collapses.empty())
+        {
+            size_t needed = std::min(collapses.size() - 1, trianglesToRemove / 2);
+            passLimit = collapses[needed].cost * 1.5f;
+        }
+
+        for (const collapse& candidate : collapses)
+        {
+            if (removed >= trianglesToRemove || candidate.cost > passLimit)
+            {
+                break;
+            }
+            if (touched[candidate.from] || touched[candidate.to])
+            {
+                continue;
+            }
+
+            // reject collapses that would flip a triangle over
+            bool flips = false;
+            size_t dying = 0;
+            const glm::vec3& target = positions[candidate.to];
+            for (unsigned t = triangleStart[candidate.from]; t < triangleStart[candidate.from + 1] && !flips; ++t)
+            {
+                const unsigned* tri = &result[triangleList[t] * 3];
+                if (tri[0] == candidate.to || tri[1] == candidate.to || tri[2] == candidate.to)
+                {
+                    ++dying;
+                    continue;
+                }
+
+                glm::vec3 corners[3], moved[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    corners[c] = positions[tri[c]];
+                    moved[c] = tri[c] == candidate.from ? target : corners[c];
+                }
+
+                glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            // claim the whole one-ring so the flip test above stays true
+            for (unsigned t = triangleStart[candidate.from]; t < triangleStart[candidate.from + 1]; ++t)
+            {
+                const unsigned* tri = &result[triangleList[t] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+
+            collapseTarget[candidate.from] = candidate.to;
+            addQuadric(quadrics[candidate.to], quadrics[candidate.from]);
+            worstCost = std::max(worstCost, candidate.cost);
+            removed += dying;
+        }
+
+        if (removed == 0)
+        {
+            break;  // everything left is locked or over budget
+        }
+
+        // apply the collapses and drop the triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < triangleCount; ++i)
+        {
+            unsigned a = collapseTarget[result[i * 3]];
+            unsigned b = collapseTarget[result[i * 3 + 1]];
+            unsigned c = collapseTarget[result[i * 3 + 2]];
+            if (a == b || b == c || c == a)
+            {
+                continue;
+            }
+
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    return sqrtf(worstCost) * extent;
+}
+
+unsigned buildLodChain(const std::vector<vertex>& verts, std::vector<unsigned int>& indices,
+                       unsigned lodCount, float reduction, meshLod* lods)
+{
+    PROFILE_SCOPE("buildLodChain");
+
+    lodCount = std::max(1u, std::min(lodCount, MESH_MAX_LODS));
+
+    lods[0] = { 0, (uint32_t)indices.size(), 0.0f };
+
+    // Every level simplifies the full mesh, so they are independent -- build them in parallel
+    std::vector<std::vector<unsigned int>> levels(lodCount);
+    std::vector<float> errors(lodCount, 0.0f);
+    parallelFor(lodCount - 1, [&](size_t i)
+    {
+        size_t level = i + 1;
+        size_t target = (size_t)(indices.size() * powf(reduction, (float)level)) / 3 * 3;
+        errors[level] = simplifyMesh(verts.data(), verts.size(), indices.data(), indices.size(), target, levels[level]);
+        optimizeVertexCache(levels[level], verts.size());
+    });
+
+    // Keep the levels that are meaningfully smaller than the one before
+    unsigned count = 1;
+    float error = 0.0f;
+    for (unsigned level = 1; level < lodCount; ++level)
+    {
+        const std::vector<unsigned int>& levelIndices = levels[level];
+        if (levelIndices.empty() || levelIndices.size() * 10 > (size_t)lods[count - 1].indexCount * 9)
+        {
+            break;
+        }
+
+        // errors must not shrink as levels get coarser or selection would skip around
+        error = std::max(error, errors[level]);
+
+        lods[count] = { (uint32_t)indices.size(), (uint32_t)levelIndices.size(), error };
+        indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+        ++count;
+    }
+
+    return count;
+}
+
+float lodPixelScale(const glm::mat4& proj, float viewportHeight)
+{
+    return proj[1][1] * viewportHeight * 0.5f;
+}
+
+unsigned selectLod(const geometry& geo, const glm::mat4& model, const glm::vec3& cameraPosition,
+                   float pixelScale, unsigned currentLod, const lodSelectOptions& options)
+{
+    if (geo.lodCount <= 1)
+    {
+        return 0;
+    }
+
+    // Errors scale with the largest axis of the model matrix
+    float scale = sqrtf(std::max(lengthSquared(glm::vec3(model[0])),
+                        std::max(lengthSquared(glm::vec3(model[1])), lengthSquared(glm::vec3(model[2])))));
+
+    // Distance to the nearest point of the bounding sphere (clamped when inside it)
+    glm::vec3 center = glm::vec3(model * glm::vec4(geo.sphereCenter, 1.0f));
+    float distance = sqrtf(lengthSquared(center - cameraPosition)) - geo.sphereRadius * scale;
+    distance = std::max(distance, 1e-3f);
+
+    float pixelsPerUnit = pixelScale * scale / distance;
+    auto pixelError = [&](unsigned lod) { return geo.lods[lod].error * pixelsPerUnit; };
+
+    unsigned lod = std::min(currentLod, geo.lodCount - 1);
+
+    // Coarsen while the next level is comfortably under the threshold...
+    float coarsenBelow = options.threshold * (1.0f - options.hysteresis);
+    while (lod + 1 < geo.lodCount && pixelError(lod + 1) <= coarsenBelow)
+    {
+        ++lod;
+    }
+
+    // ...and refine while the current one is clearly over it
+    float refineAbove = options.threshold * (1.0f + options.hysteresis);
+    while (lod > 0 && pixelError(lod) > refineAbove)
+    {
+        --lod;
+    }
+
+    return lod;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>		// vector
+
+#include "glm/glm.hpp"	// glm math types (vec3, mat4)
+
+#include "render.h"		// vertex, geometry, meshLod
+
+// Tuning for simplifyMesh
+struct simplifyOptions
+{
+	float maxError = 0.05f;		// largest collapse error allowed, relative to the mesh extent
+	float uvWeight = 1.0f;		// cost of a unit of UV drift, relative to a unit of (normalized) distance
+	float normalWeight = 0.5f;	// cost of a unit of normal drift
+};
+
+// Quadric error metric edge-collapse simplification. Vertices on UV/normal seams
+// and open borders are locked so the silhouette and texture layout hold. Writes
+// at most targetIndxCount indices (if the error budget allows) into result and
+// returns the object-space error of the worst collapse taken.
+float simplifyMesh(const vertex* verts, size_t vertCount, const unsigned int* indices, size_t indxCount,
+	size_t targetIndxCount, std::vector<unsigned int>& result, const simplifyOptions& options = simplifyOptions());
+
+// Appends up to lodCount - 1 simplified levels (each `reduction` the triangles of the
+// last) after the full-resolution indices. Levels index the same vertices. Stops
+// early once simplification stops paying off. Returns the number of levels in lods.
+unsigned buildLodChain(const std::vector<vertex>& verts, std::vector<unsigned int>& indices,
+	unsigned lodCount, float reduction, meshLod* lods);
+
+// Screen-space LOD selection
+struct lodSelectOptions
+{
+	float threshold = 1.0f;		// pixels of error that are acceptable
+	float hysteresis = 0.25f;	// fraction of threshold a level must clear before switching
+};
+
+// Pixels covered by one object-space unit at distance 1 -- proj[1][1] * viewportHeight / 2
+float lodPixelScale(const glm::mat4& proj, float viewportHeight);
+
+// Picks the coarsest level whose projected error stays under the threshold. Pass the
+// level chosen last frame as currentLod so small camera moves do not flip between levels.
+unsigned selectLod(const geometry& geo, const glm::mat4& model, const glm::vec3& cameraPosition,
+	float pixelScale, unsigned currentLod, const lodSelectOptions& options = lodSelectOptions());
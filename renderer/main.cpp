@@ -1,14 +1,123 @@
+#include "benchmark.h"
 #include "context.h"
+#include "culling.h"
+#include "instancing.h"
+#include "jobs.h"
+#include "lod.h"
+#include "profiler.h"
 #include "render.h"
+#include "renderqueue.h"
+#include "shadercache.h"
+#include "simthread.h"
+#include "transforms.h"
+#include "uniformblocks.h"
 
 #include "glm/ext.hpp"
 
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <string>
+#include <vector>
 
-int main()
+namespace
 {
+	const size_t RING_SPEARS = 64;
+
+	// The game's state -- owned by the simulation thread, which hands copies to the renderer
+	struct ringState
+	{
+		float spin[RING_SPEARS];	// each ring spear's angle about y
+	};
+
+	// How the interactive loop runs (the benchmark has its own options)
+	struct gameOptions
+	{
+		bool pipelined = true;			// game logic on the simulation thread, not inline once a frame
+		int swapInterval = 1;			// see context::setSwapInterval
+		float frameRateLimit = 0.0f;	// see context::setFrameRateLimit
+		const char* tracePath = nullptr;	// profile the run, print timings and write the last frame's trace here
+	};
+
+	// --logic thread|inline  --swap-interval N  --fps N  --trace out.json
+	gameOptions parseGameArgs(int argc, char** argv)
+	{
+		gameOptions options;
+		for (int i = 1; i + 1 < argc; ++i)
+		{
+			const char* arg = argv[i];
+			const char* value = argv[i + 1];
+
+			if (strcmp(arg, "--logic") == 0)
+			{
+				options.pipelined = strcmp(value, "inline") != 0;
+			}
+			else if (strcmp(arg, "--swap-interval") == 0)
+			{
+				options.swapInterval = atoi(value);
+			}
+			else if (strcmp(arg, "--fps") == 0)
+			{
+				options.frameRateLimit = strtof(value, nullptr);
+			}
+			else if (strcmp(arg, "--trace") == 0)
+			{
+				options.tracePath = value;
+			}
+		}
+		return options;
+	}
+
+	struct ringSimulation
+	{
+		ringState state;
+		tripleBuffer<simSnapshot<ringState>> snapshots;
+	};
+
+	// One fixed step: the spear under the clock hand turns to match the time
+	void tickRing(double tickSeconds, double time, uint64_t tick, void* user)
+	{
+		ringSimulation& ring = *(ringSimulation*)user;
+		ringState previous = ring.state;
+
+		size_t spun = (size_t)(time * 10.0) % RING_SPEARS;
+		ring.state.spin[spun] = (float)time;
+
+		simSnapshot<ringState>& snapshot = writeSlot(ring.snapshots);
+		snapshot.previous = previous;
+		snapshot.current = ring.state;
+		snapshot.previousTime = time - tickSeconds;
+		snapshot.currentTime = time;
+		snapshot.tick = tick + 1;
+		publish(ring.snapshots);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	// Run the benchmark instead of the game when asked to
+	benchmarkOptions bench;
+	bool benchmarking = parseBenchmarkArgs(argc, argv, bench);
+
+	// Loading, culling and the software rasterizer all hand work to these threads
+	jobSystemOptions jobOptions;
+	jobOptions.threadCount = bench.threads;
+	initJobSystem(jobOptions);
+
+	if (benchmarking)
+	{
+		int result = runBenchmark(bench);
+		termJobSystem();
+		return result;
+	}
+
+	gameOptions loop = parseGameArgs(argc, argv);
+
 	context game;
 	game.init(512, 512, "Jesse Engine");
+	setProfilerEnabled(loop.tracePath != nullptr);
 
 	// Vertices
 	vertex triVerts[] =
@@ -33,7 +142,10 @@ int main()
 	// Make the geometry
 	geometry triangle = makeGeometry(triVerts, 3, triIndices, 3);
 	geometry quad = makeGeometry(quadVerts, 4, quadIndices, 6);
-	geometry spearObj = loadGeometry("res\\soulspear.obj");
+	meshLoadOptions spearOptions;
+	spearOptions.format = VERTEX_FORMAT_COMPACT;
+	spearOptions.lodCount = 4;
+	geometry spearObj = loadGeometry("res\\soulspear.obj", spearOptions);
 
 	// load up textures
 	texture terry = loadTexture("res\\terry.png");
@@ -78,88 +190,216 @@ int main()
 		"void main() { gl_Position = proj * view * model * position;\n"
 					   "vColor = color\nvUV = uv};";
 
+	// The light shaders read camera, lighting and model from the shared uniform blocks
+	// (see uniformblocks.h), whose declarations go in front of each stage
+
 	// Source for light vertex shader
 	const char* lightVertShader =
-		"#version 430\n"
 		"layout (location = 0) in vec4 position;\n"		// in from vertex data
-		"layout (location = 1) in vec4 color\n"
 		"layout (location = 2) in vec2 uv;\n"
 		"layout (location = 3) in vec4 normal;\n"
 
-		"layout (location = 0) uniform mat4 proj;\n"	// proj
-		"layout (location = 1) uniform mat4 view;\n"	// view
-		"layout (location = 2) uniform mat4 model;\n"	// model
+		"out vec2 vUV;\n"
+		"out vec3 vNormal;\n"
 
-		"layout (location = 4) uniform float time;\n"
+		"void main() { gl_Position = camera.viewProj * object.model * position;\n"
+		"vUV = uv;\nvNormal = normal.xyz; }";
+
+	// Source for instanced light vertex shader -- model only undoes quantization,
+	// the per-instance transform places each copy in the world
+	const char* lightInstancedVertShader =
+		"layout (location = 0) in vec4 position;\n"
+		"layout (location = 2) in vec2 uv;\n"
+		"layout (location = 3) in vec4 normal;\n"
+		"layout (location = 4) in mat4 instanceTransform;\n"
 
 		"out vec2 vUV;\n"
 		"out vec3 vNormal;\n"
 
-		"void main() { gl_Position = proj * view * model * position;\n"
-		"vUV = uv\nvNormal = normal.xyz};";
+		"void main() { gl_Position = camera.viewProj * instanceTransform * object.model * position;\n"
+		"vUV = uv;\nvNormal = mat3(instanceTransform) * normal.xyz; }";
 
 	// Source for light fragment shader
 	const char* lightFragShader =
-		"#version 430\n"
 		"in vec2 vUV;\n"
 		"in vec3 vNormal;\n"
 		"out vec4 outputColor;\n"
 
 		"layout (location = 3) uniform sampler2D mainTexture;\n"  // material diffuse
-		"layout (location = 5) uniform vec3 ambient;\n"	// environmental ambient
-		"layout (location = 6) uniform vec3 lightDiffuse;\n"	// light diffuse
-		"layout (location = 7) uniform vec3 lightDirection;\n"	// light direction
 
-		"void main() { vec3 ambientColor = ambient\n"
-		"float lambert = max (0.0f, dot(vNormal, -lightDirection))\n"
-		"vec3 diffuseColor = texture(mainTexture, vUV).xyz * lightDiffuse * lambert\n"
-		"outputColor = vec4(ambientColor + diffuseColor, 1.0f); }";
+		"void main() { float lambert = max(0.0, dot(normalize(vNormal), -frame.lightDirection.xyz));\n"
+		"vec3 diffuseColor = texture(mainTexture, vUV).xyz * frame.lightDiffuse.xyz * lambert;\n"
+		"outputColor = vec4(frame.ambient.xyz + diffuseColor, 1.0); }";
+
+	std::string blocksHeader = std::string("#version 430\n") + UNIFORM_BLOCKS_GLSL;
+	std::string lightVertSource = blocksHeader + lightVertShader;
+	std::string lightInstancedVertSource = blocksHeader + lightInstancedVertShader;
+	std::string lightFragSource = blocksHeader + lightFragShader;
 
 	// Make the shader
 	shader basicShader = makeShader(basicVertShader, basicFragShader);
 	shader mvpShader = makeShader(mvpVertShader, basicFragShader);
-	shader lightShader = loadShader(lightVertShader, lightFragShader);
+	shader lightShader = makeShader(lightVertSource.c_str(), lightFragSource.c_str());
+	shader lightInstancedShader = makeShader(lightInstancedVertSource.c_str(), lightFragSource.c_str());
+
+	const shaderCacheStats& shaderStats = getShaderCacheStats();
+	printf("Shader cache: %u hits, %u misses, %u rejected\n", shaderStats.hits, shaderStats.misses, shaderStats.rejected);
 
 	light sun = { {-1, 0, 0}, {1,1,1} };
 
 	// Set up matrices
 	glm::mat4 camProj = glm::perspective(glm::radians(80.0f), 512.f / 512.f, 0.1f, 100.0f);
-	glm::mat4 camView = glm::lookAt(glm::vec3(1, 1, 3), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-
-	glm::mat4 triModel = glm::identity<glm::mat4>();
+	glm::vec3 camPosition(1, 1, 3);
+	glm::mat4 camView = glm::lookAt(camPosition, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+
+	// The scene -- a lone spear at the origin, and a root the ring of spears hangs off
+	const size_t spearCount = RING_SPEARS;
+	transformHierarchy scene = makeTransformHierarchy(spearCount + 2);
+	transformHandle spearNode = addTransform(scene);
+	transformHandle ringNode = addTransform(scene);
+	std::vector<transformHandle> ringSpears(spearCount);
+	for (size_t i = 0; i < spearCount; ++i)
+	{
+		float angle = glm::two_pi<float>() * i / spearCount;
+		ringSpears[i] = addTransform(scene, ringNode, glm::vec3(cosf(angle), 0, sinf(angle)) * 6.0f);
+	}
+	updateTransforms(scene);
 
 	//setUniform(mvpShader, 0, camProj);
 	//setUniform(mvpShader, 1, camView);
-	//setUniform(mvpShader, 2, triModel);
-
-	setUniform(lightShader, 0, camProj);
-	setUniform(lightShader, 1, camView);
-
-	setUniform(lightShader, 2, triModel);
-
-	setUniform(lightShader, 3, terry, 0);
-
-	setUniform(lightShader, 5, { 0.1f, 0.1f, 0.1f });	// ambient light level
-	setUniform(lightShader, 6, sun.color);	
-	setUniform(lightShader, 7, sun.direction);
+	//setUniform(mvpShader, 2, getWorldMatrix(scene, spearNode));
+
+	// Camera and lighting go out once a frame through the ring, and models go out per draw
+	// from the render queue -- no program needs its own copy
+	uniformRing uniforms = makeUniformRing(16 * 1024);
+	cameraBlock camBlock = makeCameraBlock(camProj, camView);
+	frameBlock lighting = {};
+	lighting.ambient = glm::vec4(0.1f, 0.1f, 0.1f, 0.0f);	// ambient light level
+	lighting.lightDiffuse = glm::vec4(sun.color, 0.0f);
+	lighting.lightDirection = glm::vec4(sun.direction, 0.0f);
+
+	// The ring is drawn with one call
+	instanceBuffer spearInstances = makeInstanceBuffer(spearCount);
+	std::vector<glm::mat4> spearTransforms(spearCount);
+	for (size_t i = 0; i < spearCount; ++i)
+	{
+		spearTransforms[i] = getWorldMatrix(scene, ringSpears[i]);
+	}
+	setInstances(spearInstances, spearTransforms.data(), spearCount);
+
+	renderQueue frameQueue;
+	frustum camFrustum = extractFrustum(camProj * camView);
+	packetTexture spearTextures[] = { { terry.handle, 3 } };
+
+	// Detail levels are picked by projected error -- last frame's choice is kept to stop popping
+	float lodScale = lodPixelScale(camProj, 512.0f);
+	unsigned spearLod = 0, ringLod = 0;
+
+	// Game logic ticks at a fixed rate on its own thread, and each frame draws the state
+	// interpolated between its last two snapshots -- slow frames no longer slow the game
+	// down, and vsync no longer holds up the logic. With --logic inline it runs once a frame.
+	const bool pipelined = loop.pipelined;
+	ringSimulation ring = {};
+	initTripleBuffer(ring.snapshots);
+	simThread simulation;
+	if (pipelined)
+	{
+		startSimThread(simulation, tickRing, &ring);
+	}
+	std::vector<float> shownSpin(spearCount, 0.0f);
 
+	game.setSwapInterval(loop.swapInterval);
+	game.setFrameRateLimit(loop.frameRateLimit);
 
 	while (!game.shouldClose())
 	{
 		game.tick();
-
-		// Implement game logic here
-		//triModel = glm::rotate(triModel, glm::radians(1.0f), glm::vec3(0, 1, 0));
-
 		game.clear();
 
 		// Implement render logic here
-		setUniform(lightShader, 2, triModel);
-		setUniform(lightShader, 4, game.time());
+		beginUniformFrame(uniforms);
+		setCameraBlock(uniforms, camBlock);
+		lighting.time = glm::vec4(game.time(), 0.0f, 0.0f, 0.0f);
+		setFrameBlock(uniforms, lighting);
+
+		// Only the world matrices that moved are recomputed and re-uploaded
+		if (pipelined)
+		{
+			const simSnapshot<ringState>& snapshot = readLatest(ring.snapshots);
+			float alpha = snapshotAlpha(snapshot, simRenderTime(simulation));
+			for (size_t i = 0; i < spearCount; ++i)
+			{
+				float spin = glm::mix(snapshot.previous.spin[i], snapshot.current.spin[i], alpha);
+				if (spin != shownSpin[i])
+				{
+					setLocalRotation(scene, ringSpears[i], glm::angleAxis(spin, glm::vec3(0, 1, 0)));
+					shownSpin[i] = spin;
+				}
+			}
+		}
+		else
+		{
+			// Spin one spear a frame
+			size_t spun = (size_t)(game.time() * 10.0f) % spearCount;
+			setLocalRotation(scene, ringSpears[spun], glm::angleAxis(game.time(), glm::vec3(0, 1, 0)));
+		}
+		updateTransforms(scene);
+		for (size_t i = 0; i < spearCount; ++i)
+		{
+			if (worldChanged(scene, ringSpears[i]))
+			{
+				setInstanceTransform(spearInstances, i, getWorldMatrix(scene, ringSpears[i]));
+			}
+		}
+		updateInstanceBuffer(spearInstances);
+
+		// Everything goes through the queue so binds get sorted and deduplicated
+		clearRenderQueue(frameQueue);
+		const glm::mat4& spearModel = getWorldMatrix(scene, spearNode);
+		if (isBoxVisible(camFrustum, spearObj, spearModel))
+		{
+			spearLod = selectLod(spearObj, spearModel, camPosition, lodScale, spearLod);
+			submitDraw(frameQueue, RENDER_LAYER_OPAQUE, lightShader, spearObj, spearModel, spearTextures, 1, 3.3f, spearLod);
+		}
+
+		// The ring goes out in one call, so every spear in it shares the level of the first
+		ringLod = selectLod(spearObj, getWorldMatrix(scene, ringSpears[0]), camPosition, lodScale, ringLod);
+		submitInstanced(frameQueue, RENDER_LAYER_OPAQUE, lightInstancedShader, spearObj, spearInstances, spearTextures, 1, 6.0f,
+			0, 0, ringLod);
+		sortRenderQueue(frameQueue);
+		executeRenderQueue(frameQueue, &uniforms);
+		endUniformFrame(uniforms);
+	}
+
+	if (pipelined)
+	{
+		stopSimThread(simulation);
 
-		draw(lightShader, spearObj);
+		uint64_t ticks = simulation.stats.ticks.load();
+		printf("Simulation: %llu ticks (%llu dropped), avg %.3fms max %.3fms\n", (unsigned long long)ticks,
+			(unsigned long long)simulation.stats.droppedTicks.load(),
+			ticks > 0 ? simulation.stats.tickNanoseconds.load() / 1000000.0 / ticks : 0.0,
+			simulation.stats.maxTickNanoseconds.load() / 1000000.0);
 	}
 
+	// Report where the time went
+	if (loop.tracePath != nullptr)
+	{
+		std::vector<profileStat> frameStats;
+		getProfileStats(frameStats);
+		for (const profileStat& stat : frameStats)
+		{
+			printf("%-24s %s min %.3fms avg %.3fms p99 %.3fms\n", stat.name, stat.gpu ? "GPU" : "CPU", stat.minMs, stat.avgMs, stat.p99Ms);
+		}
+		if (exportChromeTrace(loop.tracePath))
+		{
+			printf("Trace of the final frame written to %s\n", loop.tracePath);
+		}
+	}
+
+	freeInstanceBuffer(spearInstances);
+	freeUniformRing(uniforms);
+
 	freeGeometry(triangle);
 	freeGeometry(quad);
 	//freeGeometry(triObj);
@@ -169,6 +409,7 @@ int main()
 	freeShader(mvpShader);
 
 	game.term();
+	termJobSystem();
 
 	return 0;
 }
\ No newline at end of file
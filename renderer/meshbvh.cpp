@@ -0,0 +1,1053 @@
+#include "meshbvh.h"
+
+#include <algorithm>    // partition, nth_element, min, max
+#include <atomic>       // atomic
+#include <cassert>      // assert
+#include <cmath>        // fabsf, copysignf
+#include <cstdio>       // fprintf
+#include <cstring>      // memcpy
+#include <limits>       // numeric_limits
+
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE, profilerNow
+#include "softraster.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define MESHBVH_SSE2 1
+#endif
+
+static_assert(sizeof(bvhNode) == 32, "bvhNode should stay two to a cache line");
+
+namespace
+{
+    const unsigned MAX_BINS = 32;
+    const uint32_t PARALLEL_BUILD_SIZE = 4096;  // subtrees at least this big get their own job
+    const uint32_t PARALLEL_BIN_SIZE = 65536;   // nodes at least this big are binned across the job threads
+    const uint32_t BIN_CHUNK_SIZE = 16384;
+    const size_t RAY_JOB_SIZE = 256;            // rays per intersectRays job (a multiple of 4)
+    const size_t REFIT_JOB_SIZE = 4096;
+    const int STACK_SIZE = 64;                  // traversal stack entries before falling back to the heap
+    const unsigned MAX_BUILD_DEPTH = STACK_SIZE - 1;    // levels -- packet traversal needs one entry more
+    const float MIN_DIRECTION = 1e-20f;         // keeps 1 / direction finite
+
+    struct box
+    {
+        float lo[3], hi[3];
+    };
+
+    box emptyBox()
+    {
+        return { { 1e30f, 1e30f, 1e30f }, { -1e30f, -1e30f, -1e30f } };
+    }
+
+    void grow(box& b, const float* p)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            b.lo[axis] = std::min(b.lo[axis], p[axis]);
+            b.hi[axis] = std::max(b.hi[axis], p[axis]);
+        }
+    }
+
+    void grow(box& b, const box& other)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            b.lo[axis] = std::min(b.lo[axis], other.lo[axis]);
+            b.hi[axis] = std::max(b.hi[axis], other.hi[axis]);
+        }
+    }
+
+    float halfArea(const box& b)
+    {
+        float x = b.hi[0] - b.lo[0], y = b.hi[1] - b.lo[1], z = b.hi[2] - b.lo[2];
+        return x < 0.0f ? 0.0f : x * y + y * z + z * x;
+    }
+
+    struct bin
+    {
+        box bounds;
+        uint32_t count;
+    };
+
+    typedef bin axisBins[3][MAX_BINS];
+
+    // Everything the recursive build shares
+    struct buildContext
+    {
+        const bvhBuildOptions* options;
+        unsigned binCount;
+        bool parallel;
+
+        std::vector<box> triangleBounds;
+        std::vector<float> centroids;       // three per triangle
+        std::vector<uint32_t> ids;
+        std::vector<bvhNode> nodes;         // in allocation order -- laid out depth first at the end
+        std::atomic<uint32_t> nodeCount;
+    };
+
+    void setNodeBounds(bvhNode& node, const box& bounds)
+    {
+        node.boundsMin = glm::vec3(bounds.lo[0], bounds.lo[1], bounds.lo[2]);
+        node.boundsMax = glm::vec3(bounds.hi[0], bounds.hi[1], bounds.hi[2]);
+    }
+
+    // Bounds of the triangles and of their centroids over ids[first, end)
+    void rangeBounds(const buildContext& ctx, uint32_t first, uint32_t end, box& bounds, box& centroidBounds)
+    {
+        bounds = emptyBox();
+        centroidBounds = emptyBox();
+        for (uint32_t i = first; i < end; ++i)
+        {
+            uint32_t id = ctx.ids[i];
+            grow(bounds, ctx.triangleBounds[id]);
+            grow(centroidBounds, &ctx.centroids[id * 3]);
+        }
+    }
+
+    int binOf(float centroid, float lo, float scale, unsigned binCount)
+    {
+        int index = (int)((centroid - lo) * scale);
+        return index < (int)binCount ? index : (int)binCount - 1;
+    }
+
+    // Drops ids[first, end) into bins along all three axes
+    void binRange(const buildContext& ctx, uint32_t first, uint32_t end, const box& centroidBounds,
+                  const float* scale, axisBins& bins)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (unsigned b = 0; b < ctx.binCount; ++b)
+            {
+                bins[axis][b].bounds = emptyBox();
+                bins[axis][b].count = 0;
+            }
+        }
+
+        for (uint32_t i = first; i < end; ++i)
+        {
+            uint32_t id = ctx.ids[i];
+            const float* centroid = &ctx.centroids[id * 3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bin& target = bins[axis][binOf(centroid[axis], centroidBounds.lo[axis], scale[axis], ctx.binCount)];
+                grow(target.bounds, ctx.triangleBounds[id]);
+                ++target.count;
+            }
+        }
+    }
+
+    // Cheapest split of the bins by SAH -- returns its cost, or infinity if nothing can be split
+    // (or every split's cost overflows, which huge coordinates can do)
+    float bestSplit(const buildContext& ctx, const axisBins& bins, const float* scale, int& bestAxis, unsigned& bestBin)
+    {
+        float bestCost = std::numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (scale[axis] == 0.0f)
+            {
+                continue;
+            }
+
+            // Sweep from the right, then from the left -- a split after bin b puts bins [0, b] on the left
+            float rightArea[MAX_BINS];
+            uint32_t rightCount[MAX_BINS];
+            box right = emptyBox();
+            uint32_t count = 0;
+            for (unsigned b = ctx.binCount - 1; b > 0; --b)
+            {
+                grow(right, bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                rightArea[b - 1] = halfArea(right);
+                rightCount[b - 1] = count;
+            }
+
+            box left = emptyBox();
+            count = 0;
+            for (unsigned b = 0; b + 1 < ctx.binCount; ++b)
+            {
+                grow(left, bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                float cost = halfArea(left) * count + rightArea[b] * rightCount[b];
+                if (count > 0 && rightCount[b] > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+        return bestCost;
+    }
+
+    unsigned ceilLog2(uint32_t value)
+    {
+        unsigned log = 0;
+        while (log < 32 && (1ull << log) < value)
+        {
+            ++log;
+        }
+        return log;
+    }
+
+    // Splits ids[first, first + count) in half at the median centroid along the widest axis
+    uint32_t medianSplit(buildContext& ctx, uint32_t first, uint32_t count, const box& centroidBounds)
+    {
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+        {
+            if (centroidBounds.hi[a] - centroidBounds.lo[a] > centroidBounds.hi[axis] - centroidBounds.lo[axis])
+            {
+                axis = a;
+            }
+        }
+
+        const float* centroids = ctx.centroids.data();
+        uint32_t* ids = &ctx.ids[first];
+        std::nth_element(ids, ids + count / 2, ids + count, [&](uint32_t a, uint32_t b)
+        {
+            return centroids[a * 3 + axis] < centroids[b * 3 + axis];
+        });
+        return count / 2;
+    }
+
+    // Binned SAH split of ids[first, first + count) -- false if the node should stay a leaf
+    bool chooseSplit(buildContext& ctx, uint32_t first, uint32_t count, const box& bounds, const box& centroidBounds,
+                     bool wide, uint32_t& leftCount)
+    {
+        uint32_t end = first + count;
+        size_t chunkCount = (count + BIN_CHUNK_SIZE - 1) / BIN_CHUNK_SIZE;
+
+        float scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = centroidBounds.hi[axis] - centroidBounds.lo[axis];
+            scale[axis] = extent > 0.0f ? ctx.binCount / extent : 0.0f;
+        }
+
+        axisBins bins;
+        if (wide)
+        {
+            std::vector<axisBins> chunkBins(chunkCount);
+            parallelFor(chunkCount, [&](size_t chunk)
+            {
+                uint32_t chunkFirst = first + (uint32_t)chunk * BIN_CHUNK_SIZE;
+                binRange(ctx, chunkFirst, std::min(end, chunkFirst + BIN_CHUNK_SIZE), centroidBounds, scale, chunkBins[chunk]);
+            });
+
+            memcpy(bins, chunkBins[0], sizeof(bins));
+            for (size_t chunk = 1; chunk < chunkCount; ++chunk)
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    for (unsigned b = 0; b < ctx.binCount; ++b)
+                    {
+                        grow(bins[axis][b].bounds, chunkBins[chunk][axis][b].bounds);
+                        bins[axis][b].count += chunkBins[chunk][axis][b].count;
+                    }
+                }
+            }
+        }
+        else
+        {
+            binRange(ctx, first, end, centroidBounds, scale, bins);
+        }
+
+        // Split only if it's expected to beat testing every triangle here
+        int axis = 0;
+        unsigned splitBin = 0;
+        float area = halfArea(bounds);
+        float sahCost = bestSplit(ctx, bins, scale, axis, splitBin);
+        bool found = sahCost < std::numeric_limits<float>::infinity() && area > 0.0f;
+        if (found && ctx.options->traversalCost + sahCost / area < (float)count)
+        {
+            float lo = centroidBounds.lo[axis], axisScale = scale[axis];
+            unsigned binCount = ctx.binCount;
+            const float* centroids = ctx.centroids.data();
+            uint32_t* middle = std::partition(&ctx.ids[first], &ctx.ids[first] + count, [&](uint32_t id)
+            {
+                return binOf(centroids[id * 3 + axis], lo, axisScale, binCount) <= (int)splitBin;
+            });
+            leftCount = (uint32_t)(middle - &ctx.ids[first]);
+        }
+        else if (count <= ctx.options->maxLeafTriangles)
+        {
+            return false;
+        }
+        else
+        {
+            // Too big for a leaf with no split worth making (stacked centroids, say) -- just halve it
+            leftCount = count / 2;
+        }
+        return true;
+    }
+
+    // depth counts levels, the root being 1
+    void buildNode(buildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, unsigned depth)
+    {
+        uint32_t end = first + count;
+        bool wide = ctx.parallel && count >= PARALLEL_BIN_SIZE;
+        size_t chunkCount = (count + BIN_CHUNK_SIZE - 1) / BIN_CHUNK_SIZE;
+
+        box bounds, centroidBounds;
+        if (wide)
+        {
+            std::vector<box> chunkBounds(chunkCount), chunkCentroids(chunkCount);
+            parallelFor(chunkCount, [&](size_t chunk)
+            {
+                uint32_t chunkFirst = first + (uint32_t)chunk * BIN_CHUNK_SIZE;
+                rangeBounds(ctx, chunkFirst, std::min(end, chunkFirst + BIN_CHUNK_SIZE), chunkBounds[chunk], chunkCentroids[chunk]);
+            });
+
+            bounds = emptyBox();
+            centroidBounds = emptyBox();
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                grow(bounds, chunkBounds[chunk]);
+                grow(centroidBounds, chunkCentroids[chunk]);
+            }
+        }
+        else
+        {
+            rangeBounds(ctx, first, end, bounds, centroidBounds);
+        }
+
+        bvhNode& node = ctx.nodes[nodeIndex];
+        setNodeBounds(node, bounds);
+        node.leftFirst = first;
+        node.count = count;
+        if (count == 1)
+        {
+            return;
+        }
+
+        // Skewed input can make SAH peel off one triangle a level. Once that would outgrow the
+        // traversal stack, halving finishes the subtree in the levels that are left.
+        uint32_t leftCount;
+        if (depth + ceilLog2(count) >= MAX_BUILD_DEPTH)
+        {
+            if (count <= ctx.options->maxLeafTriangles)
+            {
+                return;
+            }
+            leftCount = medianSplit(ctx, first, count, centroidBounds);
+        }
+        else if (!chooseSplit(ctx, first, count, bounds, centroidBounds, wide, leftCount))
+        {
+            return;
+        }
+
+        uint32_t left = ctx.nodeCount.fetch_add(2);
+        node.leftFirst = left;
+        node.count = 0;
+
+        if (ctx.parallel && count >= PARALLEL_BUILD_SIZE)
+        {
+            parallelFor(2, [&](size_t child)
+            {
+                if (child == 0)
+                {
+                    buildNode(ctx, left, first, leftCount, depth + 1);
+                }
+                else
+                {
+                    buildNode(ctx, left + 1, first + leftCount, count - leftCount, depth + 1);
+                }
+            });
+        }
+        else
+        {
+            buildNode(ctx, left, first, leftCount, depth + 1);
+            buildNode(ctx, left + 1, first + leftCount, count - leftCount, depth + 1);
+        }
+    }
+
+    float nodeArea(const bvhNode& node)
+    {
+        glm::vec3 e = node.boundsMax - node.boundsMin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    // Copies the tree depth first with each pair of children together, and gathers the stats
+    void layoutNodes(const buildContext& ctx, meshBvh& bvh)
+    {
+        struct pending
+        {
+            uint32_t from, to;
+            unsigned depth;
+        };
+
+        bvh.nodes.resize(ctx.nodeCount.load());
+        std::vector<pending> stack;
+        stack.push_back({ 0, 0, 1 });
+        uint32_t next = 1;
+
+        float rootArea = nodeArea(ctx.nodes[0]);
+
+        bvhStats& stats = bvh.stats;
+        stats.nodes = bvh.nodes.size();
+        stats.leaves = 0;
+        stats.depth = 0;
+        stats.sahCost = 0.0f;
+
+        while (!stack.empty())
+        {
+            pending at = stack.back();
+            stack.pop_back();
+
+            bvhNode node = ctx.nodes[at.from];
+            float probability = rootArea > 0.0f ? nodeArea(node) / rootArea : 1.0f;
+
+            stats.depth = std::max(stats.depth, at.depth);
+            if (node.count > 0)
+            {
+                ++stats.leaves;
+                stats.sahCost += probability * node.count;
+            }
+            else
+            {
+                stats.sahCost += probability * ctx.options->traversalCost;
+
+                // Right goes on the stack first so the left subtree is laid out first
+                uint32_t pair = next;
+                next += 2;
+                stack.push_back({ node.leftFirst + 1, pair + 1, at.depth + 1 });
+                stack.push_back({ node.leftFirst, pair, at.depth + 1 });
+                node.leftFirst = pair;
+            }
+            bvh.nodes[at.to] = node;
+        }
+    }
+
+    // Refreshes the triangle arrays for BVH triangles [begin, end) from the mesh
+    void storeTriangles(meshBvh& bvh, const glm::vec3* positions, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint32_t triangle = bvh.triangleIds[i];
+            const glm::vec3& a = positions[bvh.indices[triangle * 3]];
+            const glm::vec3& b = positions[bvh.indices[triangle * 3 + 1]];
+            const glm::vec3& c = positions[bvh.indices[triangle * 3 + 2]];
+            bvh.v0x[i] = a.x;
+            bvh.v0y[i] = a.y;
+            bvh.v0z[i] = a.z;
+            bvh.e1x[i] = b.x - a.x;
+            bvh.e1y[i] = b.y - a.y;
+            bvh.e1z[i] = b.z - a.z;
+            bvh.e2x[i] = c.x - a.x;
+            bvh.e2y[i] = c.y - a.y;
+            bvh.e2z[i] = c.z - a.z;
+        }
+    }
+
+    // A ray with what the slab test needs
+    struct rayInfo
+    {
+        float origin[3], direction[3], invDirection[3];
+    };
+
+    rayInfo prepareRay(const bvhRay& ray)
+    {
+        rayInfo info;
+        float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+        float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float d = fabsf(direction[axis]) < MIN_DIRECTION ? copysignf(MIN_DIRECTION, direction[axis]) : direction[axis];
+            info.origin[axis] = origin[axis];
+            info.direction[axis] = direction[axis];
+            info.invDirection[axis] = 1.0f / d;
+        }
+        return info;
+    }
+
+    // Distance to where the ray enters the node, or 1e30 if it misses it before tMax
+    float enterNode(const bvhNode& node, const rayInfo& ray, float tMax)
+    {
+#if MESHBVH_SSE2
+        __m128 origin = _mm_setr_ps(ray.origin[0], ray.origin[1], ray.origin[2], 0.0f);
+        __m128 inv = _mm_setr_ps(ray.invDirection[0], ray.invDirection[1], ray.invDirection[2], 0.0f);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.boundsMin.x, node.boundsMin.y, node.boundsMin.z, 0.0f), origin), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.boundsMax.x, node.boundsMax.y, node.boundsMax.z, 0.0f), origin), inv);
+        __m128 tNear = _mm_min_ps(t0, t1), tFar = _mm_max_ps(t0, t1);
+
+        // Largest entry and smallest exit over x, y and z
+        __m128 enter = _mm_max_ss(_mm_max_ss(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 1, 1, 1))),
+                                  _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 2, 2, 2)));
+        __m128 exit = _mm_min_ss(_mm_min_ss(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 1, 1, 1))),
+                                 _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 2, 2, 2)));
+        float entry = std::max(_mm_cvtss_f32(enter), 0.0f);
+        float leave = std::min(_mm_cvtss_f32(exit), tMax);
+#else
+        float lo[3] = { node.boundsMin.x, node.boundsMin.y, node.boundsMin.z };
+        float hi[3] = { node.boundsMax.x, node.boundsMax.y, node.boundsMax.z };
+        float entry = 0.0f, leave = tMax;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (lo[axis] - ray.origin[axis]) * ray.invDirection[axis];
+            float t1 = (hi[axis] - ray.origin[axis]) * ray.invDirection[axis];
+            entry = std::max(entry, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+#endif
+        return entry <= leave ? entry : 1e30f;
+    }
+
+    // Closest hit among a leaf's triangles, four at a time -- returns true if tMax shrank
+    bool intersectLeaf(const meshBvh& bvh, const bvhNode& leaf, const rayInfo& ray, float& tMax, bvhHit& hit)
+    {
+        bool found = false;
+        uint32_t end = leaf.leftFirst + leaf.count;
+#if MESHBVH_SSE2
+        __m128 ox = _mm_set1_ps(ray.origin[0]), oy = _mm_set1_ps(ray.origin[1]), oz = _mm_set1_ps(ray.origin[2]);
+        __m128 dx = _mm_set1_ps(ray.direction[0]), dy = _mm_set1_ps(ray.direction[1]), dz = _mm_set1_ps(ray.direction[2]);
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+        for (uint32_t i = leaf.leftFirst; i < end; i += 4)
+        {
+            __m128 e1x = _mm_loadu_ps(&bvh.e1x[i]), e1y = _mm_loadu_ps(&bvh.e1y[i]), e1z = _mm_loadu_ps(&bvh.e1z[i]);
+            __m128 e2x = _mm_loadu_ps(&bvh.e2x[i]), e2y = _mm_loadu_ps(&bvh.e2y[i]), e2z = _mm_loadu_ps(&bvh.e2z[i]);
+
+            // Moller-Trumbore
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 invDet = _mm_div_ps(one, det);
+
+            __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(&bvh.v0x[i]));
+            __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(&bvh.v0y[i]));
+            __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(&bvh.v0z[i]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+            // Degenerate (and padding) triangles have det == 0 and fail every compare through the NaNs
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                                       _mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, v), one), _mm_cmpneq_ps(det, zero)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+
+            int mask = _mm_movemask_ps(inside);
+            uint32_t lanes = end - i;
+            mask &= lanes >= 4 ? 0xF : (1 << lanes) - 1;
+            if (mask == 0)
+            {
+                continue;
+            }
+
+            float ts[4], us[4], vs[4];
+            _mm_storeu_ps(ts, t);
+            _mm_storeu_ps(us, u);
+            _mm_storeu_ps(vs, v);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if ((mask >> lane & 1) && ts[lane] < tMax)
+                {
+                    tMax = ts[lane];
+                    hit.t = ts[lane];
+                    hit.u = us[lane];
+                    hit.v = vs[lane];
+                    hit.triangle = i + lane;
+                    found = true;
+                }
+            }
+        }
+#else
+        for (uint32_t i = leaf.leftFirst; i < end; ++i)
+        {
+            glm::vec3 e1(bvh.e1x[i], bvh.e1y[i], bvh.e1z[i]), e2(bvh.e2x[i], bvh.e2y[i], bvh.e2z[i]);
+            glm::vec3 d(ray.direction[0], ray.direction[1], ray.direction[2]);
+            glm::vec3 p = glm::cross(d, e2);
+            float det = glm::dot(e1, p);
+            if (det == 0.0f)
+            {
+                continue;
+            }
+
+            float invDet = 1.0f / det;
+            glm::vec3 s = glm::vec3(ray.origin[0], ray.origin[1], ray.origin[2]) - glm::vec3(bvh.v0x[i], bvh.v0y[i], bvh.v0z[i]);
+            float u = glm::dot(s, p) * invDet;
+            glm::vec3 q = glm::cross(s, e1);
+            float v = glm::dot(d, q) * invDet;
+            float t = glm::dot(e2, q) * invDet;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < tMax)
+            {
+                tMax = t;
+                hit.t = t;
+                hit.u = u;
+                hit.v = v;
+                hit.triangle = i;
+                found = true;
+            }
+        }
+#endif
+        return found;
+    }
+
+    // Nearest child first. With anyHit the walk stops at the first triangle hit.
+    bool traverse(const meshBvh& bvh, const bvhRay& ray, bvhHit& hit, bool anyHit)
+    {
+        hit.triangle = BVH_NO_HIT;
+        if (bvh.nodes.empty())
+        {
+            return false;
+        }
+
+        rayInfo info = prepareRay(ray);
+        float tMax = ray.tMax;
+        if (enterNode(bvh.nodes[0], info, tMax) == 1e30f)
+        {
+            return false;
+        }
+
+        // The build keeps trees shallower than the stack -- the heap only backs up odd trees
+        uint32_t localStack[STACK_SIZE];
+        std::vector<uint32_t> heapStack;
+        uint32_t* stack = localStack;
+        if (bvh.stats.depth > (unsigned)STACK_SIZE)
+        {
+            heapStack.resize(bvh.stats.depth);
+            stack = heapStack.data();
+        }
+        int stackSize = 0;
+        uint32_t nodeIndex = 0;
+        for (;;)
+        {
+            const bvhNode& node = bvh.nodes[nodeIndex];
+            if (node.count > 0)
+            {
+                if (intersectLeaf(bvh, node, info, tMax, hit) && anyHit)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                float leftEntry = enterNode(bvh.nodes[node.leftFirst], info, tMax);
+                float rightEntry = enterNode(bvh.nodes[node.leftFirst + 1], info, tMax);
+                uint32_t nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+                if (rightEntry < leftEntry)
+                {
+                    std::swap(leftEntry, rightEntry);
+                    std::swap(nearChild, farChild);
+                }
+
+                if (leftEntry != 1e30f)
+                {
+                    if (rightEntry != 1e30f)
+                    {
+                        stack[stackSize++] = farChild;     // at most one entry per level above this one
+                    }
+                    nodeIndex = nearChild;
+                    continue;
+                }
+            }
+
+            // Pop until a node is still worth entering -- the hit may have moved closer since it was pushed
+            bool found = false;
+            while (stackSize > 0)
+            {
+                nodeIndex = stack[--stackSize];
+                if (enterNode(bvh.nodes[nodeIndex], info, tMax) != 1e30f)
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                break;
+            }
+        }
+
+        if (hit.triangle == BVH_NO_HIT)
+        {
+            return false;
+        }
+        hit.triangle = bvh.triangleIds[hit.triangle];
+        return true;
+    }
+
+#if MESHBVH_SSE2
+    // Four rays walking the tree together, one per lane
+    struct rayPacket
+    {
+        __m128 ox, oy, oz;
+        __m128 dx, dy, dz;
+        __m128 ix, iy, iz;
+        __m128 tMax;
+        __m128 u, v;
+        __m128i triangle;
+    };
+
+    // Entry distance per lane (1e30 for lanes that miss)
+    __m128 enterNodePacket(const bvhNode& node, const rayPacket& packet)
+    {
+        __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), packet.ox), packet.ix);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), packet.ox), packet.ix);
+        __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), packet.oy), packet.iy);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), packet.oy), packet.iy);
+        __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), packet.oz), packet.iz);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), packet.oz), packet.iz);
+
+        __m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                                  _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+        __m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                                  _mm_min_ps(_mm_max_ps(tz0, tz1), packet.tMax));
+        __m128 hits = _mm_cmple_ps(entry, leave);
+        return _mm_or_ps(_mm_and_ps(hits, entry), _mm_andnot_ps(hits, _mm_set1_ps(1e30f)));
+    }
+
+    // Nearest lane's entry, 1e30 if every lane misses
+    float nearestLane(__m128 entry)
+    {
+        __m128 m = _mm_min_ps(entry, _mm_shuffle_ps(entry, entry, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(m);
+    }
+
+    void intersectLeafPacket(const meshBvh& bvh, const bvhNode& leaf, rayPacket& packet)
+    {
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; ++i)
+        {
+            __m128 e1x = _mm_set1_ps(bvh.e1x[i]), e1y = _mm_set1_ps(bvh.e1y[i]), e1z = _mm_set1_ps(bvh.e1z[i]);
+            __m128 e2x = _mm_set1_ps(bvh.e2x[i]), e2y = _mm_set1_ps(bvh.e2y[i]), e2z = _mm_set1_ps(bvh.e2z[i]);
+
+            __m128 px = _mm_sub_ps(_mm_mul_ps(packet.dy, e2z), _mm_mul_ps(packet.dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(packet.dz, e2x), _mm_mul_ps(packet.dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(packet.dx, e2y), _mm_mul_ps(packet.dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 invDet = _mm_div_ps(one, det);
+
+            __m128 tx = _mm_sub_ps(packet.ox, _mm_set1_ps(bvh.v0x[i]));
+            __m128 ty = _mm_sub_ps(packet.oy, _mm_set1_ps(bvh.v0y[i]));
+            __m128 tz = _mm_sub_ps(packet.oz, _mm_set1_ps(bvh.v0z[i]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(packet.dx, qx), _mm_mul_ps(packet.dy, qy)), _mm_mul_ps(packet.dz, qz)), invDet);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                                       _mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, v), one), _mm_cmpneq_ps(det, zero)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, packet.tMax)));
+            if (_mm_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+
+            packet.tMax = _mm_or_ps(_mm_and_ps(inside, t), _mm_andnot_ps(inside, packet.tMax));
+            packet.u = _mm_or_ps(_mm_and_ps(inside, u), _mm_andnot_ps(inside, packet.u));
+            packet.v = _mm_or_ps(_mm_and_ps(inside, v), _mm_andnot_ps(inside, packet.v));
+            __m128i hitMask = _mm_castps_si128(inside);
+            packet.triangle = _mm_or_si128(_mm_and_si128(hitMask, _mm_set1_epi32((int)i)), _mm_andnot_si128(hitMask, packet.triangle));
+        }
+    }
+
+    // Up to four rays at once -- lanes past count are dead from the start
+    void tracePacket(const meshBvh& bvh, const bvhRay* rays, bvhHit* hits, size_t count)
+    {
+        float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], ix[4], iy[4], iz[4], tMax[4];
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            bvhRay ray = lane < count ? rays[lane] : bvhRay{ glm::vec3(0.0f), -1.0f, glm::vec3(1.0f) };
+            rayInfo info = prepareRay(ray);
+            ox[lane] = info.origin[0];
+            oy[lane] = info.origin[1];
+            oz[lane] = info.origin[2];
+            dx[lane] = info.direction[0];
+            dy[lane] = info.direction[1];
+            dz[lane] = info.direction[2];
+            ix[lane] = info.invDirection[0];
+            iy[lane] = info.invDirection[1];
+            iz[lane] = info.invDirection[2];
+            tMax[lane] = ray.tMax;
+        }
+
+        rayPacket packet;
+        packet.ox = _mm_loadu_ps(ox);
+        packet.oy = _mm_loadu_ps(oy);
+        packet.oz = _mm_loadu_ps(oz);
+        packet.dx = _mm_loadu_ps(dx);
+        packet.dy = _mm_loadu_ps(dy);
+        packet.dz = _mm_loadu_ps(dz);
+        packet.ix = _mm_loadu_ps(ix);
+        packet.iy = _mm_loadu_ps(iy);
+        packet.iz = _mm_loadu_ps(iz);
+        packet.tMax = _mm_loadu_ps(tMax);
+        packet.u = _mm_setzero_ps();
+        packet.v = _mm_setzero_ps();
+        packet.triangle = _mm_set1_epi32((int)BVH_NO_HIT);
+
+        // A pop and two pushes per level -- one entry more than the tree has levels
+        uint32_t localStack[STACK_SIZE];
+        std::vector<uint32_t> heapStack;
+        uint32_t* stack = localStack;
+        if (bvh.stats.depth + 1 > (unsigned)STACK_SIZE)
+        {
+            heapStack.resize(bvh.stats.depth + 1);
+            stack = heapStack.data();
+        }
+        int stackSize = 0;
+        if (!bvh.nodes.empty() && nearestLane(enterNodePacket(bvh.nodes[0], packet)) != 1e30f)
+        {
+            stack[stackSize++] = 0;
+        }
+
+        while (stackSize > 0)
+        {
+            const bvhNode& node = bvh.nodes[stack[--stackSize]];
+
+            // Recheck -- lanes may have found closer hits since this was pushed
+            if (nearestLane(enterNodePacket(node, packet)) == 1e30f)
+            {
+                continue;
+            }
+
+            if (node.count > 0)
+            {
+                intersectLeafPacket(bvh, node, packet);
+                continue;
+            }
+
+            float leftEntry = nearestLane(enterNodePacket(bvh.nodes[node.leftFirst], packet));
+            float rightEntry = nearestLane(enterNodePacket(bvh.nodes[node.leftFirst + 1], packet));
+            uint32_t nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+            if (rightEntry < leftEntry)
+            {
+                std::swap(leftEntry, rightEntry);
+                std::swap(nearChild, farChild);
+            }
+
+            if (rightEntry != 1e30f)
+            {
+                stack[stackSize++] = farChild;
+            }
+            if (leftEntry != 1e30f)
+            {
+                stack[stackSize++] = nearChild;
+            }
+        }
+
+        float t[4], u[4], v[4];
+        uint32_t triangle[4];
+        _mm_storeu_ps(t, packet.tMax);
+        _mm_storeu_ps(u, packet.u);
+        _mm_storeu_ps(v, packet.v);
+        _mm_storeu_si128((__m128i*)triangle, packet.triangle);
+        for (size_t lane = 0; lane < count && lane < 4; ++lane)
+        {
+            bvhHit& hit = hits[lane];
+            hit.triangle = triangle[lane] == BVH_NO_HIT ? BVH_NO_HIT : bvh.triangleIds[triangle[lane]];
+            hit.t = t[lane];
+            hit.u = u[lane];
+            hit.v = v[lane];
+        }
+    }
+#endif
+}
+
+meshBvh buildMeshBvh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+                     const bvhBuildOptions& options)
+{
+    PROFILE_SCOPE("buildMeshBvh");
+    int64_t begin = profilerNow();
+
+    assert(indexCount % 3 == 0);
+    meshBvh bvh;
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        fprintf(stderr, "[ERROR] can't build a BVH without triangles\n");
+        return bvh;
+    }
+
+    buildContext ctx;
+    ctx.options = &options;
+    ctx.binCount = std::max(2u, std::min(options.bins, MAX_BINS));
+    ctx.parallel = isJobSystemRunning() && currentJobThread() != ~0u && jobThreadCount() > 1;
+    ctx.triangleBounds.resize(triangleCount);
+    ctx.centroids.resize(triangleCount * 3);
+    ctx.ids.resize(triangleCount);
+    ctx.nodes.resize(triangleCount * 2 - 1);
+    ctx.nodeCount.store(1);
+
+    size_t chunkCount = (triangleCount + BIN_CHUNK_SIZE - 1) / BIN_CHUNK_SIZE;
+    parallelFor(chunkCount, [&](size_t chunk)
+    {
+        size_t end = std::min(triangleCount, (chunk + 1) * BIN_CHUNK_SIZE);
+        for (size_t t = chunk * BIN_CHUNK_SIZE; t < end; ++t)
+        {
+            box& bounds = ctx.triangleBounds[t];
+            bounds = emptyBox();
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t index = indices[t * 3 + corner];
+                assert(index < positionCount);
+                float p[3] = { positions[index].x, positions[index].y, positions[index].z };
+                grow(bounds, p);
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                ctx.centroids[t * 3 + axis] = (bounds.lo[axis] + bounds.hi[axis]) * 0.5f;
+            }
+            ctx.ids[t] = (uint32_t)t;
+        }
+    }, ctx.parallel ? 0 : 1);
+
+    buildNode(ctx, 0, 0, (uint32_t)triangleCount, 1);
+    layoutNodes(ctx, bvh);
+
+    bvh.indices.assign(indices, indices + indexCount);
+    bvh.triangleIds = std::move(ctx.ids);
+
+    // Three spare triangles with zero edges so the last leaf can be read four at a time
+    size_t padded = triangleCount + 3;
+    for (std::vector<float>* array : { &bvh.v0x, &bvh.v0y, &bvh.v0z, &bvh.e1x, &bvh.e1y, &bvh.e1z, &bvh.e2x, &bvh.e2y, &bvh.e2z })
+    {
+        array->assign(padded, 0.0f);
+    }
+    storeTriangles(bvh, positions, 0, triangleCount);
+
+    bvh.options = options;
+    bvh.stats.triangles = triangleCount;
+    bvh.stats.refitMs = 0.0;
+    bvh.stats.buildMs = (profilerNow() - begin) / 1000000.0;
+    return bvh;
+}
+
+meshBvh buildMeshBvh(const softMesh& mesh, const bvhBuildOptions& options)
+{
+    std::vector<glm::vec3> positions(mesh.vertices.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        positions[i] = glm::vec3(mesh.vertices[i].pos);
+    }
+
+    const meshLod& full = mesh.lods[0];
+    std::vector<uint32_t> indices(mesh.indices.begin() + full.firstIndex, mesh.indices.begin() + full.firstIndex + full.indexCount);
+    return buildMeshBvh(positions.data(), positions.size(), indices.data(), indices.size(), options);
+}
+
+meshBvh loadMeshBvh(const char* filePath, const meshLoadOptions& options, const bvhBuildOptions& bvhOptions)
+{
+    softMesh mesh = loadSoftMesh(filePath, options);
+    if (mesh.indices.empty())
+    {
+        return {};
+    }
+    return buildMeshBvh(mesh, bvhOptions);
+}
+
+void refitMeshBvh(meshBvh& bvh, const glm::vec3* positions, size_t positionCount)
+{
+    PROFILE_SCOPE("refitMeshBvh");
+    int64_t begin = profilerNow();
+
+    size_t triangleCount = bvh.triangleIds.size();
+    (void)positionCount;
+    if (bvh.nodes.empty())
+    {
+        return;
+    }
+    assert(bvh.indices.empty() || *std::max_element(bvh.indices.begin(), bvh.indices.end()) < positionCount);
+
+    size_t jobCount = (triangleCount + REFIT_JOB_SIZE - 1) / REFIT_JOB_SIZE;
+    parallelFor(jobCount, [&](size_t job)
+    {
+        storeTriangles(bvh, positions, job * REFIT_JOB_SIZE, std::min(triangleCount, (job + 1) * REFIT_JOB_SIZE));
+    });
+
+    // Leaves from their triangles, spread over the job threads
+    size_t nodeJobs = (bvh.nodes.size() + REFIT_JOB_SIZE - 1) / REFIT_JOB_SIZE;
+    parallelFor(nodeJobs, [&](size_t job)
+    {
+        size_t end = std::min(bvh.nodes.size(), (job + 1) * REFIT_JOB_SIZE);
+        for (size_t n = job * REFIT_JOB_SIZE; n < end; ++n)
+        {
+            bvhNode& node = bvh.nodes[n];
+            if (node.count == 0)
+            {
+                continue;
+            }
+
+            box bounds = emptyBox();
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+            {
+                float a[3] = { bvh.v0x[i], bvh.v0y[i], bvh.v0z[i] };
+                float b[3] = { a[0] + bvh.e1x[i], a[1] + bvh.e1y[i], a[2] + bvh.e1z[i] };
+                float c[3] = { a[0] + bvh.e2x[i], a[1] + bvh.e2y[i], a[2] + bvh.e2z[i] };
+                grow(bounds, a);
+                grow(bounds, b);
+                grow(bounds, c);
+            }
+            setNodeBounds(node, bounds);
+        }
+    });
+
+    // Then interior nodes bottom up -- children always come after their parent
+    for (size_t n = bvh.nodes.size(); n-- > 0;)
+    {
+        bvhNode& node = bvh.nodes[n];
+        if (node.count == 0)
+        {
+            const bvhNode& left = bvh.nodes[node.leftFirst];
+            const bvhNode& right = bvh.nodes[node.leftFirst + 1];
+            node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+            node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+        }
+    }
+
+    // The tree is the same but its cost isn't -- it drifts as the mesh moves away from the build pose
+    float rootArea = nodeArea(bvh.nodes[0]);
+    float sahCost = 0.0f;
+    for (const bvhNode& node : bvh.nodes)
+    {
+        float probability = rootArea > 0.0f ? nodeArea(node) / rootArea : 1.0f;
+        sahCost += probability * (node.count > 0 ? (float)node.count : bvh.options.traversalCost);
+    }
+    bvh.stats.sahCost = sahCost;
+
+    bvh.stats.refitMs = (profilerNow() - begin) / 1000000.0;
+}
+
+bool intersectRay(const meshBvh& bvh, const bvhRay& ray, bvhHit& hit)
+{
+    return traverse(bvh, ray, hit, false);
+}
+
+bool isRayOccluded(const meshBvh& bvh, const bvhRay& ray)
+{
+    bvhHit hit;
+    return traverse(bvh, ray, hit, true);
+}
+
+void intersectRays(const meshBvh& bvh, const bvhRay* rays, bvhHit* hits, size_t count)
+{
+    PROFILE_SCOPE("intersectRays");
+
+    size_t jobCount = (count + RAY_JOB_SIZE - 1) / RAY_JOB_SIZE;
+    parallelFor(jobCount, [&](size_t job)
+    {
+        size_t end = std::min(count, (job + 1) * RAY_JOB_SIZE);
+#if MESHBVH_SSE2
+        for (size_t i = job * RAY_JOB_SIZE; i < end; i += 4)
+        {
+            tracePacket(bvh, rays + i, hits + i, end - i);
+        }
+#else
+        for (size_t i = job * RAY_JOB_SIZE; i < end; ++i)
+        {
+            intersectRay(bvh, rays[i], hits[i]);
+        }
+#endif
+    });
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t
+#include <vector>			// vector
+
+#include "glm/glm.hpp"		// glm math types (vec3)
+
+#include "render.h"			// meshLoadOptions
+
+struct softMesh;
+
+const uint32_t BVH_NO_HIT = ~0u;
+
+// 32 bytes. Leaves have count > 0 and leftFirst is their first triangle; interior nodes
+// have count == 0 and leftFirst is the left child, with the right one right after it.
+struct bvhNode
+{
+	glm::vec3 boundsMin;
+	uint32_t leftFirst;
+	glm::vec3 boundsMax;
+	uint32_t count;
+};
+
+struct bvhRay
+{
+	glm::vec3 origin;
+	float tMax;				// hits at or past this distance are ignored
+	glm::vec3 direction;	// needn't be normalized -- t is in units of its length
+};
+
+struct bvhHit
+{
+	float t;
+	float u, v;				// barycentrics of the second and third corner
+	uint32_t triangle;		// index into the mesh's triangles, BVH_NO_HIT if nothing was hit
+};
+
+struct bvhBuildOptions
+{
+	unsigned bins = 16;					// SAH candidates per axis
+	unsigned maxLeafTriangles = 8;		// bigger leaves are always split
+	float traversalCost = 1.0f;			// cost of visiting a node, relative to one triangle test
+};
+
+struct bvhStats
+{
+	size_t triangles;
+	size_t nodes;
+	size_t leaves;
+	unsigned depth;
+	float sahCost;			// expected cost of a random ray, in triangle tests (updated by refits)
+	double buildMs, refitMs;
+};
+
+// Triangles from one mesh under a bounding volume hierarchy, for picking, line of sight
+// and other gameplay rays. Nodes are stored depth first, so children always come after
+// their parent.
+struct meshBvh
+{
+	std::vector<bvhNode> nodes;
+	std::vector<uint32_t> indices;		// the mesh's corners, kept for refits
+	std::vector<uint32_t> triangleIds;	// BVH order -> mesh triangle
+
+	// Triangles in BVH order as v0 + u e1 + v e2, structure-of-arrays so four are
+	// tested at once. Padded with three triangles that are never hit.
+	std::vector<float> v0x, v0y, v0z;
+	std::vector<float> e1x, e1y, e1z;
+	std::vector<float> e2x, e2y, e2z;
+
+	bvhBuildOptions options;			// what it was built with
+	bvhStats stats;
+};
+
+// Binned SAH build. Big subtrees are built on the job threads when called from one;
+// the tree is the same either way.
+meshBvh buildMeshBvh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+	const bvhBuildOptions& options = bvhBuildOptions());
+// Full-resolution level of a mesh
+meshBvh buildMeshBvh(const softMesh& mesh, const bvhBuildOptions& options = bvhBuildOptions());
+// Decodes through the same path (and mesh cache) as loadGeometry -- positions match the GL mesh in object space
+meshBvh loadMeshBvh(const char* filePath, const meshLoadOptions& options = meshLoadOptions(),
+	const bvhBuildOptions& bvhOptions = bvhBuildOptions());
+
+// Moves the vertices of a deforming mesh and recomputes every bound, keeping the tree.
+// Faster than a rebuild, but the tree gets worse the further things move from the build pose.
+void refitMeshBvh(meshBvh& bvh, const glm::vec3* positions, size_t positionCount);
+
+// Closest hit along the ray. Returns false (and hit.triangle == BVH_NO_HIT) on a miss.
+bool intersectRay(const meshBvh& bvh, const bvhRay& ray, bvhHit& hit);
+// True if anything lies along the ray before tMax -- stops at the first hit
+bool isRayOccluded(const meshBvh& bvh, const bvhRay& ray);
+// Closest hits for many rays, spread over the job threads. Rays are traced four at a
+// time, so neighbours in the array should start close together and point the same way.
+void intersectRays(const meshBvh& bvh, const bvhRay* rays, bvhHit* hits, size_t count);
@@ -0,0 +1,199 @@
+#include "meshcache.h"
+
+#include <cstdio>   // fprintf, remove
+#include <cstring>  // memcmp
+#include <fstream>  // ofstream
+
+namespace
+{
+    // Payload sections start on 16-byte boundaries within the file
+    const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Records the layout of a vertex format -- matches makePackedGeometry
+    void describeVertex(const vertexFormat& format, meshCacheHeader& header)
+    {
+        vertexLayout layout = describeVertexFormat(format);
+
+        header.vertexStride = layout.stride;
+        header.attributeCount = layout.attributeCount;
+        for (GLuint i = 0; i < layout.attributeCount; ++i)
+        {
+            const vertexAttribute& attrib = layout.attributes[i];
+            header.attributes[i] = { attrib.location, (uint32_t)attrib.components, attrib.type,
+                                     attrib.normalized, attrib.offset };
+        }
+    }
+}
+
+std::string meshCachePath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".meshcache";
+}
+
+bool openMeshCache(const char* sourcePath, uint32_t processFlags, const vertexFormat& format,
+                   meshCacheView& view)
+{
+    view = {};
+
+    // The cache is only usable while the source is unchanged
+    fileStamp sourceStamp = {};
+    if (!getFileStamp(sourcePath, sourceStamp))
+    {
+        return false;
+    }
+
+    std::string cachePath = meshCachePath(sourcePath);
+    mappedFile file = mapFile(cachePath.c_str());
+    if (file.data == nullptr)
+    {
+        return false;   // no cache yet
+    }
+
+    // Validate the header before trusting any of it
+    const meshCacheHeader* header = (const meshCacheHeader*)file.data;
+    meshCacheHeader expected = {};
+    describeVertex(format, expected);
+
+    bool valid = file.size >= sizeof(meshCacheHeader) &&
+                 header->magic == MESH_CACHE_MAGIC &&
+                 header->version == MESH_CACHE_VERSION &&
+                 header->sourceTime == sourceStamp.modifiedTime &&
+                 header->sourceSize == sourceStamp.size &&
+                 header->processFlags == processFlags &&
+                 header->vertexStride == expected.vertexStride &&
+                 header->attributeCount == expected.attributeCount &&
+                 memcmp(header->attributes, expected.attributes, sizeof(expected.attributes)) == 0 &&
+                 (header->indexType == GL_UNSIGNED_SHORT || header->indexType == GL_UNSIGNED_INT);
+
+    // Make sure the payload actually fits in the file
+    if (valid)
+    {
+        uint64_t vertexBytes = (uint64_t)header->vertexCount * header->vertexStride;
+        uint64_t indexBytes = (uint64_t)header->indexCount * indexTypeSize(header->indexType);
+
+        valid = header->vertexOffset + vertexBytes <= file.size &&
+                header->indexOffset + indexBytes <= file.size;
+    }
+
+    // The levels have to cover the index payload exactly
+    if (valid)
+    {
+        valid = header->lodCount >= 1 && header->lodCount <= MESH_CACHE_MAX_LODS;
+
+        uint64_t lodIndices = 0;
+        for (uint32_t i = 0; valid && i < header->lodCount; ++i)
+        {
+            lodIndices += header->lodIndexCounts[i];
+        }
+        valid = valid && lodIndices == header->indexCount;
+    }
+
+    // Timestamps can survive a content change (copies, checkouts) so check the hash too
+    uint64_t sourceHash = 0;
+    if (valid)
+    {
+        valid = hashFile(sourcePath, sourceHash) && sourceHash == header->sourceHash;
+    }
+
+    if (!valid)
+    {
+        unmapFile(file);
+        return false;
+    }
+
+    view.file = file;
+    view.header = header;
+    view.vertices = file.data + header->vertexOffset;
+    view.indices = file.data + header->indexOffset;
+
+    return true;
+}
+
+void closeMeshCache(meshCacheView& view)
+{
+    unmapFile(view.file);
+    view = {};
+}
+
+bool writeMeshCache(const char* sourcePath, uint32_t processFlags, const vertexFormat& format,
+                    const void* packedVerts, size_t vertCount,
+                    const void* packedIndices, size_t indxCount, GLenum indexType,
+                    const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                    const uint32_t* lodIndexCounts, const float* lodErrors, uint32_t lodCount)
+{
+    // Stamp the cache with the state of the source file
+    meshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.processFlags = processFlags;
+
+    fileStamp sourceStamp = {};
+    if (!getFileStamp(sourcePath, sourceStamp) || !hashFile(sourcePath, header.sourceHash))
+    {
+        return false;
+    }
+    header.sourceTime = sourceStamp.modifiedTime;
+    header.sourceSize = sourceStamp.size;
+
+    describeVertex(format, header);
+
+    header.boundsMin[0] = boundsMin.x;
+    header.boundsMin[1] = boundsMin.y;
+    header.boundsMin[2] = boundsMin.z;
+    header.boundsMax[0] = boundsMax.x;
+    header.boundsMax[1] = boundsMax.y;
+    header.boundsMax[2] = boundsMax.z;
+
+    header.lodCount = lodCount < MESH_CACHE_MAX_LODS ? lodCount : MESH_CACHE_MAX_LODS;
+    for (uint32_t i = 0; i < header.lodCount; ++i)
+    {
+        header.lodIndexCounts[i] = lodIndexCounts[i];
+        header.lodErrors[i] = lodErrors[i];
+    }
+
+    // Lay out the payload after the header
+    header.vertexCount = (uint32_t)vertCount;
+    header.indexCount = (uint32_t)indxCount;
+    header.indexType = indexType;
+
+    uint64_t vertexBytes = (uint64_t)vertCount * header.vertexStride;
+    uint64_t indexBytes = (uint64_t)indxCount * indexTypeSize(indexType);
+    header.vertexOffset = alignUp(sizeof(meshCacheHeader), MESH_CACHE_ALIGNMENT);
+    header.indexOffset = alignUp(header.vertexOffset + vertexBytes, MESH_CACHE_ALIGNMENT);
+
+    // Write to a temp file first so a crash never leaves a half-written cache behind
+    std::string cachePath = meshCachePath(sourcePath);
+    std::string tempPath = uniqueTempPath(cachePath);
+
+    std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        fprintf(stderr, "[WARNING] could not write mesh cache %s\n", cachePath.c_str());
+        return false;
+    }
+
+    const char padding[MESH_CACHE_ALIGNMENT] = {};
+
+    out.write((const char*)&header, sizeof(header));
+    out.write(padding, header.vertexOffset - sizeof(header));
+    out.write((const char*)packedVerts, vertexBytes);
+    out.write(padding, header.indexOffset - (header.vertexOffset + vertexBytes));
+    out.write((const char*)packedIndices, indexBytes);
+
+    bool ok = out.good();
+    out.close();
+
+    if (!ok || !replaceFile(tempPath.c_str(), cachePath.c_str()))
+    {
+        fprintf(stderr, "[WARNING] could not write mesh cache %s\n", cachePath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>		// uint32_t, uint64_t
+#include <string>		// std::string
+
+#include "fileio.h"		// mappedFile, fileStamp
+#include "vertexformat.h"	// vertexFormat
+
+// Binary mesh cache -- written the first time an OBJ is parsed so later
+// loads can map the file and upload straight from it
+const uint32_t MESH_CACHE_MAGIC = 0x4853454D;	// "MESH"
+const uint32_t MESH_CACHE_VERSION = 4;
+const uint32_t MESH_CACHE_MAX_ATTRIBUTES = 8;
+const uint32_t MESH_CACHE_MAX_LODS = 8;
+
+// Processing steps baked into a cache -- a cache is only reused for the same steps
+const uint32_t MESH_PROCESS_OPTIMIZE = 1 << 0;
+// LOD generation settings are folded into the flags: level count, then reduction in percent
+const uint32_t MESH_PROCESS_LOD_COUNT_SHIFT = 8;
+const uint32_t MESH_PROCESS_LOD_REDUCTION_SHIFT = 16;
+
+// Describes one vertex attribute stored in the cache
+struct meshCacheAttribute
+{
+	uint32_t location;		// shader attribute location
+	uint32_t components;	// number of things
+	uint32_t type;			// GLenum type of things
+	uint32_t normalized;	// GL_TRUE / GL_FALSE
+	uint32_t offset;		// byte offset within a vertex
+};
+
+// Fixed-size header at the start of every cache file
+struct meshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	// Source file this cache was built from
+	uint64_t sourceTime;
+	uint64_t sourceSize;
+	uint64_t sourceHash;
+	uint32_t processFlags;	// MESH_PROCESS_* steps applied after parsing
+	uint32_t reserved;
+
+	// Vertex layout descriptor
+	uint32_t vertexStride;
+	uint32_t attributeCount;
+	meshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+
+	// Object-space bounds
+	float boundsMin[3];
+	float boundsMax[3];
+
+	// Detail levels -- stored back to back in the index payload
+	uint32_t lodCount;
+	uint32_t lodIndexCounts[MESH_CACHE_MAX_LODS];
+	float lodErrors[MESH_CACHE_MAX_LODS];
+
+	// Payload (offsets are from the start of the file)
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t indexType;		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	uint32_t padding;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+// A validated, memory-mapped cache file
+struct meshCacheView
+{
+	mappedFile file;
+	const meshCacheHeader* header;
+	const void* vertices;	// points into the mapping
+	const void* indices;	// points into the mapping
+};
+
+// Path of the cache file that sits next to a source mesh
+std::string meshCachePath(const char* sourcePath);
+
+// Maps the cache for sourcePath -- returns false if it is missing, stale, malformed
+// or was built with different processing or vertex format
+bool openMeshCache(const char* sourcePath, uint32_t processFlags, const vertexFormat& format,
+	meshCacheView& view);
+void closeMeshCache(meshCacheView& view);
+
+// Writes a cache for sourcePath from vertex/index data already packed into format
+bool writeMeshCache(const char* sourcePath, uint32_t processFlags, const vertexFormat& format,
+	const void* packedVerts, size_t vertCount,
+	const void* packedIndices, size_t indxCount, GLenum indexType,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	const uint32_t* lodIndexCounts, const float* lodErrors, uint32_t lodCount);
@@ -0,0 +1,419 @@
+#include "meshlets.h"
+
+#include <algorithm>    // min, max
+#include <cassert>      // assert
+#include <cmath>        // sqrtf
+#include <cstdio>       // fprintf
+
+#include "culling.h"
+#include "instancing.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace
+{
+    const uint32_t NO_MESHLET = ~0u;
+    const float MIN_CONE_SPREAD = 0.1f;    // cones wider than about 84 degrees never cull, so don't bother
+    const size_t INSTANCES_PER_JOB = 16;
+
+    // Cluster being grown
+    struct openMeshlet
+    {
+        std::vector<uint32_t> triangles;
+        std::vector<uint32_t> vertices;
+        glm::vec3 normalSum;
+    };
+
+    // Bounding sphere around the vertices, and the cone around the triangle normals
+    void finishMeshlet(meshlet& out, const openMeshlet& open, const glm::vec3* positions,
+                       const std::vector<glm::vec3>& normals)
+    {
+        glm::vec3 lo = positions[open.vertices[0]], hi = lo;
+        for (uint32_t v : open.vertices)
+        {
+            lo = glm::min(lo, positions[v]);
+            hi = glm::max(hi, positions[v]);
+        }
+
+        out.center = (lo + hi) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (uint32_t v : open.vertices)
+        {
+            glm::vec3 offset = positions[v] - out.center;
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+        out.radius = sqrtf(radiusSquared);
+
+        // The cone is as wide as the normal furthest from the average
+        out.coneAxis = glm::vec3(0.0f);
+        out.coneCutoff = 1.0f;
+        float length = glm::length(open.normalSum);
+        if (length <= 0.0f)
+        {
+            return;
+        }
+
+        glm::vec3 axis = open.normalSum / length;
+        float minDot = 1.0f;
+        for (uint32_t t : open.triangles)
+        {
+            if (glm::dot(normals[t], normals[t]) > 0.0f)
+            {
+                minDot = std::min(minDot, glm::dot(normals[t], axis));
+            }
+        }
+
+        if (minDot > MIN_CONE_SPREAD)
+        {
+            out.coneAxis = axis;
+            out.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+    }
+
+    // Appends commands for the meshlets of one copy that survive -- the work behind both cull entry points
+    size_t cullInstance(std::vector<drawElementsIndirectCommand>& commands, meshletCullStats& stats, const meshletMesh& mesh,
+                        const glm::mat4& model, const glm::mat4& viewProj, const glm::vec3& eye, GLuint baseInstance)
+    {
+        // Everything happens in object space -- the planes of viewProj * model already are
+        frustum frust = extractFrustum(viewProj * model);
+        glm::vec3 localEye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+
+        size_t kept = 0;
+        for (const meshlet& m : mesh.meshlets)
+        {
+            ++stats.tested;
+            stats.triangles += m.triangleCount;
+
+            glm::vec3 toCenter = m.center - localEye;
+            if (glm::dot(toCenter, m.coneAxis) >= m.coneCutoff * glm::length(toCenter) + m.radius)
+            {
+                ++stats.backfaceCulled;
+                continue;
+            }
+            if (!isSphereVisible(frust, m.center, m.radius))
+            {
+                ++stats.frustumCulled;
+                continue;
+            }
+
+            kept += m.triangleCount;
+
+            // Grow the last command when this meshlet carries straight on from it
+            if (!commands.empty())
+            {
+                drawElementsIndirectCommand& last = commands.back();
+                if (last.baseInstance == baseInstance && last.firstIndex + last.count == m.firstIndex)
+                {
+                    last.count += m.triangleCount * 3;
+                    continue;
+                }
+            }
+
+            drawElementsIndirectCommand command;
+            command.count = m.triangleCount * 3;
+            command.instanceCount = 1;
+            command.firstIndex = m.firstIndex;
+            command.baseVertex = 0;
+            command.baseInstance = baseInstance;
+            commands.push_back(command);
+        }
+
+        stats.trianglesKept += kept;
+        return kept;
+    }
+}
+
+meshletMesh buildMeshlets(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+                          float coneWeight)
+{
+    PROFILE_SCOPE("buildMeshlets");
+    int64_t begin = profilerNow();
+
+    assert(indexCount % 3 == 0);
+    meshletMesh result = {};
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        fprintf(stderr, "[ERROR] can't build meshlets without triangles\n");
+        return result;
+    }
+
+    // Triangles around each vertex, packed (offsets[v] to offsets[v + 1])
+    std::vector<uint32_t> offsets(positionCount + 1, 0);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        assert(indices[i] < positionCount);
+        ++offsets[indices[i] + 1];
+    }
+    for (size_t v = 0; v < positionCount; ++v)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    // Unit face normals, zero for degenerate triangles
+    std::vector<glm::vec3> normals(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        glm::vec3 a = positions[indices[t * 3]];
+        glm::vec3 n = glm::cross(positions[indices[t * 3 + 1]] - a, positions[indices[t * 3 + 2]] - a);
+        float length = glm::length(n);
+        normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+    }
+
+    std::vector<bool> used(triangleCount, false);
+    std::vector<uint32_t> owner(positionCount, NO_MESHLET);    // meshlet that last took each vertex
+    result.indices.reserve(indexCount);
+
+    openMeshlet open;
+    open.triangles.reserve(MESHLET_MAX_TRIANGLES);
+    open.vertices.reserve(MESHLET_MAX_VERTICES);
+    size_t seed = 0, emitted = 0;
+
+    while (emitted < triangleCount)
+    {
+        uint32_t id = (uint32_t)result.meshlets.size();
+
+        // Start from the first free triangle -- cache-optimized index order keeps these local
+        while (used[seed])
+        {
+            ++seed;
+        }
+        open.triangles.clear();
+        open.vertices.clear();
+        open.normalSum = glm::vec3(0.0f);
+        uint32_t next = (uint32_t)seed;
+
+        while (next != NO_MESHLET)
+        {
+            used[next] = true;
+            open.triangles.push_back(next);
+            open.normalSum += normals[next];
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t v = indices[next * 3 + corner];
+                if (owner[v] != id)
+                {
+                    owner[v] = id;
+                    open.vertices.push_back(v);
+                }
+            }
+            if (open.triangles.size() == MESHLET_MAX_TRIANGLES)
+            {
+                break;
+            }
+
+            // The free neighbour adding the fewest vertices, leaning towards the meshlet's facing
+            float axisLength = glm::length(open.normalSum);
+            glm::vec3 axis = axisLength > 0.0f ? open.normalSum / axisLength : glm::vec3(0.0f);
+            float bestScore = 1e30f;
+            next = NO_MESHLET;
+            for (uint32_t v : open.vertices)
+            {
+                for (uint32_t a = offsets[v]; a < offsets[v + 1]; ++a)
+                {
+                    uint32_t candidate = adjacency[a];
+                    if (used[candidate])
+                    {
+                        continue;
+                    }
+
+                    unsigned added = (owner[indices[candidate * 3]] != id) + (owner[indices[candidate * 3 + 1]] != id) +
+                                     (owner[indices[candidate * 3 + 2]] != id);
+                    if (open.vertices.size() + added > MESHLET_MAX_VERTICES)
+                    {
+                        continue;
+                    }
+
+                    float score = added - coneWeight * glm::dot(normals[candidate], axis);
+                    if (score < bestScore)
+                    {
+                        bestScore = score;
+                        next = candidate;
+                    }
+                }
+            }
+        }
+
+        meshlet out;
+        out.firstIndex = (uint32_t)result.indices.size();
+        out.triangleCount = (uint32_t)open.triangles.size();
+        out.vertexCount = (uint32_t)open.vertices.size();
+        for (uint32_t t : open.triangles)
+        {
+            result.indices.insert(result.indices.end(), indices + t * 3, indices + t * 3 + 3);
+        }
+        finishMeshlet(out, open, positions, normals);
+        result.meshlets.push_back(out);
+        emitted += open.triangles.size();
+    }
+
+    meshletBuildStats& stats = result.stats;
+    stats.meshlets = result.meshlets.size();
+    stats.triangles = triangleCount;
+    size_t vertexTotal = 0;
+    for (const meshlet& m : result.meshlets)
+    {
+        vertexTotal += m.vertexCount;
+        stats.cullableCones += m.coneCutoff < 1.0f;
+    }
+    stats.averageVertices = (float)vertexTotal / stats.meshlets;
+    stats.averageTriangles = (float)triangleCount / stats.meshlets;
+    stats.buildMs = (profilerNow() - begin) / 1000000.0;
+
+    return result;
+}
+
+geometry loadMeshletGeometry(const char* filePath, meshletMesh& meshlets, const meshLoadOptions& options)
+{
+    // Decoded in the full format for float positions -- makeGeometry packs them into options.format
+    meshLoadOptions fullOptions = options;
+    fullOptions.format = VERTEX_FORMAT_FULL;
+
+    meshData data;
+    if (!decodeMesh(filePath, fullOptions, data))
+    {
+        meshlets = {};
+        return {};
+    }
+
+    const vertex* verts = (const vertex*)data.verts;
+    std::vector<glm::vec3> positions(data.vertCount);
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        positions[i] = glm::vec3(verts[i].pos);
+    }
+
+    // Only the full-resolution level is split
+    const meshLod& full = data.lods[0];
+    std::vector<uint32_t> indices(full.indexCount);
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        size_t index = full.firstIndex + i;
+        indices[i] = data.indexType == GL_UNSIGNED_SHORT ? ((const uint16_t*)data.indices)[index]
+                                                         : ((const uint32_t*)data.indices)[index];
+    }
+
+    meshlets = buildMeshlets(positions.data(), positions.size(), indices.data(), indices.size());
+
+    geometry geo = makeGeometry(verts, data.vertCount, meshlets.indices.data(), meshlets.indices.size(), options.format);
+    freeMeshData(data);
+
+    return geo;
+}
+
+meshletDrawList makeMeshletDrawList()
+{
+    meshletDrawList list = {};
+    glGenBuffers(1, &list.indirectBuffer);
+    return list;
+}
+
+void freeMeshletDrawList(meshletDrawList& list)
+{
+    glDeleteBuffers(1, &list.indirectBuffer);
+
+    list = {};
+}
+
+void clearMeshletDrawList(meshletDrawList& list)
+{
+    list.commands.clear();
+    list.stats = {};
+}
+
+size_t cullMeshlets(meshletDrawList& list, const meshletMesh& mesh, const glm::mat4& model, const glm::mat4& viewProj,
+                    const glm::vec3& eye, GLuint baseInstance)
+{
+    int64_t begin = profilerNow();
+    size_t kept = cullInstance(list.commands, list.stats, mesh, model, viewProj, eye, baseInstance);
+    list.stats.cullMs += (profilerNow() - begin) / 1000000.0;
+    return kept;
+}
+
+size_t cullMeshletInstances(meshletDrawList& list, const meshletMesh& mesh, const glm::mat4* models, size_t count,
+                            size_t stride, const glm::mat4& viewProj, const glm::vec3& eye, GLuint firstInstance)
+{
+    PROFILE_SCOPE("cullMeshletInstances");
+    int64_t begin = profilerNow();
+
+    // Each job fills its own list, then they're joined in instance order so the commands don't depend on the threads
+    size_t jobCount = (count + INSTANCES_PER_JOB - 1) / INSTANCES_PER_JOB;
+    std::vector<std::vector<drawElementsIndirectCommand>> jobCommands(jobCount);
+    std::vector<meshletCullStats> jobStats(jobCount, meshletCullStats());
+    const unsigned char* base = (const unsigned char*)models;
+
+    parallelFor(jobCount, [&](size_t job)
+    {
+        size_t end = std::min(count, (job + 1) * INSTANCES_PER_JOB);
+        for (size_t i = job * INSTANCES_PER_JOB; i < end; ++i)
+        {
+            const glm::mat4& model = *(const glm::mat4*)(base + i * stride);
+            cullInstance(jobCommands[job], jobStats[job], mesh, model, viewProj, eye, firstInstance + (GLuint)i);
+        }
+    });
+
+    size_t kept = 0;
+    meshletCullStats& stats = list.stats;
+    for (size_t job = 0; job < jobCount; ++job)
+    {
+        list.commands.insert(list.commands.end(), jobCommands[job].begin(), jobCommands[job].end());
+        stats.tested += jobStats[job].tested;
+        stats.frustumCulled += jobStats[job].frustumCulled;
+        stats.backfaceCulled += jobStats[job].backfaceCulled;
+        stats.triangles += jobStats[job].triangles;
+        stats.trianglesKept += jobStats[job].trianglesKept;
+        kept += jobStats[job].trianglesKept;
+    }
+
+    stats.cullMs += (profilerNow() - begin) / 1000000.0;
+    return kept;
+}
+
+void drawMeshletList(meshletDrawList& list, const shader& shad, const geometry& geo, const instanceBuffer* instances)
+{
+    PROFILE_GPU_SCOPE("drawMeshletList");
+
+    if (list.commands.empty())
+    {
+        return;
+    }
+
+    size_t bytes = list.commands.size() * sizeof(drawElementsIndirectCommand);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list.indirectBuffer);
+    if (bytes > list.indirectCapacity)
+    {
+        list.indirectCapacity = bytes * 2;
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, list.indirectCapacity, nullptr, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, list.commands.data());
+
+    glUseProgram(shad.program);
+    glBindVertexArray(geo.vao);
+    if (instances != nullptr)
+    {
+        bindInstanceAttributes(instances->handle);
+    }
+
+    // Geometry without vertex colors reads white from the generic attribute
+    if (geo.format.color == COLOR_NONE)
+    {
+        glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    glMultiDrawElementsIndirect(GL_TRIANGLES, geo.indexType, nullptr, (GLsizei)list.commands.size(), 0);
+
+    // One API call covering every command
+    for (const drawElementsIndirectCommand& command : list.commands)
+    {
+        countDraw(command.count, command.instanceCount, 0);
+    }
+    countDraw(0, 0);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
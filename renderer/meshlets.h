@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t, uint64_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (vec3, mat4)
+
+#include "geometryarena.h"	// drawElementsIndirectCommand
+#include "render.h"			// geometry, meshLoadOptions
+
+struct instanceBuffer;
+struct shader;
+
+// Sizes that fit mesh-shader hardware -- 124 triangles leaves room for a 4-byte count in 128 * 3 bytes
+const unsigned MESHLET_MAX_VERTICES = 64;
+const unsigned MESHLET_MAX_TRIANGLES = 124;
+
+// A cluster of neighbouring triangles, drawn as one run of the regrouped index buffer
+struct meshlet
+{
+	uint32_t firstIndex;
+	uint32_t triangleCount;
+	uint32_t vertexCount;		// distinct vertices, at most MESHLET_MAX_VERTICES
+
+	glm::vec3 center;			// object-space bounding sphere
+	float radius;
+
+	// Normal cone: every triangle faces away from an eye where
+	// dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius.
+	// Meshlets facing too many ways have a zero axis and a cutoff of 1, and never pass.
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+struct meshletBuildStats
+{
+	size_t meshlets;
+	size_t triangles;
+	float averageVertices, averageTriangles;
+	size_t cullableCones;		// meshlets narrow enough to ever be back-face culled
+	double buildMs;
+};
+
+// A mesh split into meshlets. indices holds the mesh's triangles regrouped so each
+// meshlet is contiguous -- upload them in place of the original order.
+struct meshletMesh
+{
+	std::vector<meshlet> meshlets;
+	std::vector<uint32_t> indices;
+	meshletBuildStats stats;
+};
+
+// Grows each meshlet from a seed triangle through its neighbours, preferring ones that add
+// the fewest new vertices. coneWeight trades some of that for triangles facing the same way,
+// which gives tighter cones (more back-face culling) at the cost of a few more meshlets.
+meshletMesh buildMeshlets(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+	float coneWeight = 0.25f);
+// Loads a mesh, splits its full-resolution level into meshlets and uploads it with the
+// regrouped indices. The geometry has a single level.
+geometry loadMeshletGeometry(const char* filePath, meshletMesh& meshlets, const meshLoadOptions& options = meshLoadOptions());
+
+// Work from the cullMeshlets calls since the last clearMeshletDrawList
+struct meshletCullStats
+{
+	size_t tested;
+	size_t frustumCulled;
+	size_t backfaceCulled;
+	uint64_t triangles, trianglesKept;
+	double cullMs;
+};
+
+// The meshlets that survived culling as indirect draws, with neighbouring survivors
+// of the same instance merged into one command
+struct meshletDrawList
+{
+	std::vector<drawElementsIndirectCommand> commands;
+	GLuint indirectBuffer;
+	size_t indirectCapacity;
+
+	meshletCullStats stats;
+};
+
+meshletDrawList makeMeshletDrawList();
+void freeMeshletDrawList(meshletDrawList& list);
+// Forgets the commands and stats (keeps the allocations)
+void clearMeshletDrawList(meshletDrawList& list);
+
+// Tests every meshlet of one copy of the mesh against the frustum and the eye, and appends
+// commands for the survivors. eye is the world-space camera position. The cone test assumes
+// model doesn't scale unevenly. Returns the triangles kept.
+size_t cullMeshlets(meshletDrawList& list, const meshletMesh& mesh, const glm::mat4& model, const glm::mat4& viewProj,
+	const glm::vec3& eye, GLuint baseInstance = 0);
+
+// The same for many copies at once, spread over the job threads. stride is the byte distance
+// between matrices; copy i draws with instance firstInstance + i. Commands come out in copy order.
+size_t cullMeshletInstances(meshletDrawList& list, const meshletMesh& mesh, const glm::mat4* models, size_t count,
+	size_t stride, const glm::mat4& viewProj, const glm::vec3& eye, GLuint firstInstance = 0);
+
+// Draws every command in one glMultiDrawElementsIndirect from geo's buffers. With an
+// instance buffer, each command's baseInstance picks its instance attributes.
+void drawMeshletList(meshletDrawList& list, const shader& shad, const geometry& geo,
+	const instanceBuffer* instances = nullptr);
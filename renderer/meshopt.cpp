@@ -0,0 +1,297 @@
+#include "meshopt.h"
+
+#include <cassert>  // assert
+#include <cmath>    // powf
+#include <cstring>  // memcmp
+
+#include "fileio.h" // hashBytes
+
+namespace
+{
+    // Tuning values from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    const int FORSYTH_CACHE_SIZE = 32;
+    const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+    const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+    const unsigned int INVALID_INDEX = ~0u;
+
+    float forsythScore(int cachePosition, unsigned remainingValence)
+    {
+        // no triangles left to use this vertex -- it doesn't matter anymore
+        if (remainingValence == 0)
+        {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+            {
+                // used by the last triangle -- fixed score so strips don't get favored
+                score = FORSYTH_LAST_TRI_SCORE;
+            }
+            else
+            {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = powf(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+            }
+        }
+
+        // boost vertices with few triangles left so they get finished off
+        score += FORSYTH_VALENCE_BOOST_SCALE * powf((float)remainingValence, -FORSYTH_VALENCE_BOOST_POWER);
+
+        return score;
+    }
+}
+
+void weldVertices(std::vector<vertex>& verts, std::vector<unsigned int>& indices)
+{
+    // open-addressed table of unique vertices, kept under half full
+    size_t tableSize = 1;
+    while (tableSize < verts.size() * 2)
+    {
+        tableSize *= 2;
+    }
+    std::vector<unsigned int> table(tableSize, INVALID_INDEX);
+
+    std::vector<vertex> unique;
+    unique.reserve(verts.size());
+
+    std::vector<unsigned int> remap(verts.size());
+
+    for (size_t i = 0; i < verts.size(); ++i)
+    {
+        size_t slot = hashBytes(&verts[i], sizeof(vertex)) & (tableSize - 1);
+
+        // probe until we find a match or an empty slot
+        while (table[slot] != INVALID_INDEX &&
+               memcmp(&unique[table[slot]], &verts[i], sizeof(vertex)) != 0)
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        if (table[slot] == INVALID_INDEX)
+        {
+            table[slot] = (unsigned int)unique.size();
+            unique.push_back(verts[i]);
+        }
+
+        remap[i] = table[slot];
+    }
+
+    for (unsigned int& index : indices)
+    {
+        index = remap[index];
+    }
+
+    verts.swap(unique);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertCount)
+{
+    assert(indices.size() % 3 == 0 && "index count must be a multiple of 3");
+
+    size_t triCount = indices.size() / 3;
+    if (triCount == 0)
+    {
+        return;
+    }
+
+    // build vertex -> triangle adjacency
+    std::vector<unsigned> remaining(vertCount, 0);
+    for (unsigned int index : indices)
+    {
+        ++remaining[index];
+    }
+
+    std::vector<unsigned> adjacencyOffset(vertCount + 1, 0);
+    for (size_t v = 0; v < vertCount; ++v)
+    {
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+    }
+
+    std::vector<unsigned> adjacency(indices.size());
+    std::vector<unsigned> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < triCount; ++t)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            adjacency[fill[indices[t * 3 + k]]++] = (unsigned)t;
+        }
+    }
+
+    // initial scores
+    std::vector<int> cachePosition(vertCount, -1);
+    std::vector<float> vertScore(vertCount);
+    for (size_t v = 0; v < vertCount; ++v)
+    {
+        vertScore[v] = forsythScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triScore(triCount);
+    std::vector<char> emitted(triCount, 0);
+    int bestTri = 0;
+    for (size_t t = 0; t < triCount; ++t)
+    {
+        triScore[t] = vertScore[indices[t * 3 + 0]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+        if (triScore[t] > triScore[bestTri])
+        {
+            bestTri = (int)t;
+        }
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    unsigned cache[FORSYTH_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t scanCursor = 0;
+
+    while (output.size() < indices.size())
+    {
+        // nothing in the cache is useful -- take the next unemitted triangle
+        if (bestTri < 0)
+        {
+            while (emitted[scanCursor])
+            {
+                ++scanCursor;
+            }
+            bestTri = (int)scanCursor;
+        }
+
+        const unsigned* tri = &indices[bestTri * 3];
+        output.insert(output.end(), tri, tri + 3);
+        emitted[bestTri] = 1;
+
+        // remove the triangle from its vertices' adjacency lists
+        for (size_t k = 0; k < 3; ++k)
+        {
+            unsigned v = tri[k];
+            unsigned* begin = &adjacency[adjacencyOffset[v]];
+            unsigned* end = begin + remaining[v];
+            for (unsigned* it = begin; it != end; ++it)
+            {
+                if (*it == (unsigned)bestTri)
+                {
+                    *it = *(end - 1);
+                    break;
+                }
+            }
+            --remaining[v];
+        }
+
+        // push the triangle's vertices to the front of the cache
+        unsigned newCache[FORSYTH_CACHE_SIZE + 3];
+        int newCount = 0;
+        for (size_t k = 0; k < 3; ++k)
+        {
+            newCache[newCount++] = tri[k];
+        }
+        for (int i = 0; i < cacheCount; ++i)
+        {
+            unsigned v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+            {
+                newCache[newCount++] = v;
+            }
+        }
+
+        // rescore everything that moved (including anything pushed out)
+        for (int i = 0; i < newCount; ++i)
+        {
+            unsigned v = newCache[i];
+            cachePosition[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            vertScore[v] = forsythScore(cachePosition[v], remaining[v]);
+        }
+
+        // pick the best triangle touching the cache
+        bestTri = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < newCount; ++i)
+        {
+            unsigned v = newCache[i];
+            for (unsigned a = 0; a < remaining[v]; ++a)
+            {
+                unsigned t = adjacency[adjacencyOffset[v] + a];
+                triScore[t] = vertScore[indices[t * 3 + 0]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+                if (triScore[t] > bestScore)
+                {
+                    bestScore = triScore[t];
+                    bestTri = (int)t;
+                }
+            }
+        }
+
+        cacheCount = newCount < FORSYTH_CACHE_SIZE ? newCount : FORSYTH_CACHE_SIZE;
+        for (int i = 0; i < cacheCount; ++i)
+        {
+            cache[i] = newCache[i];
+        }
+    }
+
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(std::vector<vertex>& verts, std::vector<unsigned int>& indices)
+{
+    std::vector<unsigned int> remap(verts.size(), INVALID_INDEX);
+    std::vector<vertex> ordered;
+    ordered.reserve(verts.size());
+
+    // number vertices in the order they're first used (unreferenced ones are dropped)
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == INVALID_INDEX)
+        {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(verts[index]);
+        }
+        index = remap[index];
+    }
+
+    verts.swap(ordered);
+}
+
+meshOptStats optimizeMesh(std::vector<vertex>& verts, std::vector<unsigned int>& indices)
+{
+    meshOptStats stats = {};
+    stats.vertsBefore = verts.size();
+    stats.acmrBefore = computeACMR(indices.data(), indices.size(), verts.size());
+
+    weldVertices(verts, indices);
+    optimizeVertexCache(indices, verts.size());
+    optimizeVertexFetch(verts, indices);
+
+    stats.vertsAfter = verts.size();
+    stats.acmrAfter = computeACMR(indices.data(), indices.size(), verts.size());
+
+    return stats;
+}
+
+float computeACMR(const unsigned int* indices, size_t indxCount, size_t vertCount, unsigned cacheSize)
+{
+    if (indxCount < 3)
+    {
+        return 0.0f;
+    }
+
+    // a vertex is still cached if fewer than cacheSize misses happened since it was loaded
+    std::vector<unsigned> loadedAt(vertCount, 0);
+    unsigned clock = cacheSize + 1;
+    size_t misses = 0;
+
+    for (size_t i = 0; i < indxCount; ++i)
+    {
+        unsigned int index = indices[i];
+        if (clock - loadedAt[index] > cacheSize)
+        {
+            loadedAt[index] = clock++;
+            ++misses;
+        }
+    }
+
+    return (float)misses / (float)(indxCount / 3);
+}
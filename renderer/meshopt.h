@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>		// vector
+
+#include "render.h"		// vertex
+
+// Size of the FIFO post-transform cache simulated when measuring ACMR
+const unsigned MESH_OPT_CACHE_SIZE = 16;
+
+// Before/after numbers reported by optimizeMesh
+struct meshOptStats
+{
+	size_t vertsBefore, vertsAfter;
+	float acmrBefore, acmrAfter;	// average cache miss ratio (misses per triangle)
+};
+
+// Merges vertices with identical pos/color/uv/normal and rewrites the indices
+void weldVertices(std::vector<vertex>& verts, std::vector<unsigned int>& indices);
+
+// Reorders triangles for the post-transform vertex cache (Forsyth)
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertCount);
+
+// Reorders vertices into the order they are first referenced by the indices
+void optimizeVertexFetch(std::vector<vertex>& verts, std::vector<unsigned int>& indices);
+
+// Runs welding, cache and fetch optimization in that order
+meshOptStats optimizeMesh(std::vector<vertex>& verts, std::vector<unsigned int>& indices);
+
+// Average cache miss ratio of an index buffer for a FIFO cache of cacheSize entries
+float computeACMR(const unsigned int* indices, size_t indxCount, size_t vertCount,
+	unsigned cacheSize = MESH_OPT_CACHE_SIZE);
@@ -0,0 +1,420 @@
+#include "objloader.h"
+
+#include <atomic>   // atomic
+#include <cstdio>   // fprintf
+#include <cstdint>  // int64_t
+
+#include "fileio.h"   // mapFile
+#include "parallel.h" // parallelFor
+#include "profiler.h" // PROFILE_SCOPE
+
+namespace
+{
+    // Chunks smaller than this aren't worth handing to another thread
+    const size_t OBJ_MIN_CHUNK_SIZE = 256 * 1024;
+
+    const int OBJ_MISSING = -1;
+
+    // A line-aligned slice of the file and everything parsed out of it
+    struct objChunk
+    {
+        const char* begin;
+        const char* end;
+
+        // counts (first pass) and where this chunk's attributes start globally
+        size_t positionCount, uvCount, normalCount;
+        size_t positionBase, uvBase, normalBase;
+
+        // triangulated face corners as (position, uv, normal) indices
+        std::vector<int> corners;
+        size_t cornerBase;
+
+        bool failed;
+    };
+
+    const char* skipSpaces(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    const char* skipLine(const char* p, const char* end)
+    {
+        while (p < end && *p != '\n')
+        {
+            ++p;
+        }
+        return p < end ? p + 1 : end;
+    }
+
+    bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Fast decimal parser -- handles sign, fraction and exponent but not inf/nan
+    float parseFloat(const char*& p, const char* end)
+    {
+        static const double powersOf10[] =
+        {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        p = skipSpaces(p, end);
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        // gather up to 19 significant digits into an integer mantissa
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+
+        for (; p < end && isDigit(*p); ++p)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+            }
+            else
+            {
+                ++exponent;
+            }
+        }
+
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && isDigit(*p); ++p)
+            {
+                if (digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                    --exponent;
+                }
+            }
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negativeExponent = *p == '-';
+                ++p;
+            }
+
+            int value = 0;
+            for (; p < end && isDigit(*p); ++p)
+            {
+                value = value < 10000 ? value * 10 + (*p - '0') : value;
+            }
+            exponent += negativeExponent ? -value : value;
+        }
+
+        double result = (double)mantissa;
+        while (exponent > 22)
+        {
+            result *= 1e22;
+            exponent -= 22;
+        }
+        while (exponent < -22)
+        {
+            result /= 1e22;
+            exponent += 22;
+        }
+        result = exponent >= 0 ? result * powersOf10[exponent] : result / powersOf10[-exponent];
+
+        return (float)(negative ? -result : result);
+    }
+
+    int parseInt(const char*& p, const char* end)
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        int value = 0;
+        for (; p < end && isDigit(*p); ++p)
+        {
+            value = value * 10 + (*p - '0');
+        }
+        return negative ? -value : value;
+    }
+
+    // Converts a 1-based (or negative, relative) OBJ index into a 0-based one
+    int resolveIndex(int index, size_t countSoFar, bool& failed)
+    {
+        int64_t resolved = index > 0 ? (int64_t)index - 1 : (int64_t)countSoFar + index;
+        if (index == 0 || resolved < 0 || resolved >= (int64_t)countSoFar)
+        {
+            failed = true;
+            return OBJ_MISSING;
+        }
+        return (int)resolved;
+    }
+
+    // First pass -- count attribute records so every chunk knows its global offsets
+    void countChunk(objChunk& chunk)
+    {
+        const char* end = chunk.end;
+        for (const char* p = chunk.begin; p < end; p = skipLine(p, end))
+        {
+            p = skipSpaces(p, end);
+            if (end - p < 2 || *p != 'v')
+            {
+                continue;
+            }
+
+            if (p[1] == ' ' || p[1] == '\t')
+            {
+                ++chunk.positionCount;
+            }
+            else if (end - p >= 3 && (p[2] == ' ' || p[2] == '\t'))
+            {
+                chunk.uvCount += p[1] == 't';
+                chunk.normalCount += p[1] == 'n';
+            }
+        }
+    }
+
+    // Second pass -- parse attributes straight into the shared arrays and triangulate faces
+    void parseChunk(objChunk& chunk, std::vector<glm::vec3>& positions,
+                    std::vector<glm::vec2>& uvs, std::vector<glm::vec3>& normals)
+    {
+        size_t positionCount = chunk.positionBase;
+        size_t uvCount = chunk.uvBase;
+        size_t normalCount = chunk.normalBase;
+
+        std::vector<int> face;
+        const char* end = chunk.end;
+
+        for (const char* p = chunk.begin; p < end; p = skipLine(p, end))
+        {
+            p = skipSpaces(p, end);
+            if (end - p < 2)
+            {
+                continue;
+            }
+
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p += 1;
+                glm::vec3& pos = positions[positionCount++];
+                pos.x = parseFloat(p, end);
+                pos.y = parseFloat(p, end);
+                pos.z = parseFloat(p, end);
+            }
+            else if (p[0] == 'v' && p[1] == 't' && end - p >= 3 && (p[2] == ' ' || p[2] == '\t'))
+            {
+                p += 2;
+                glm::vec2& uv = uvs[uvCount++];
+                uv.x = parseFloat(p, end);
+                uv.y = parseFloat(p, end);
+            }
+            else if (p[0] == 'v' && p[1] == 'n' && end - p >= 3 && (p[2] == ' ' || p[2] == '\t'))
+            {
+                p += 2;
+                glm::vec3& normal = normals[normalCount++];
+                normal.x = parseFloat(p, end);
+                normal.y = parseFloat(p, end);
+                normal.z = parseFloat(p, end);
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                // gather corners as v, v/vt, v//vn or v/vt/vn
+                face.clear();
+                p += 1;
+                for (;;)
+                {
+                    p = skipSpaces(p, end);
+                    if (p >= end || !(isDigit(*p) || *p == '-' || *p == '+'))
+                    {
+                        break;
+                    }
+
+                    int pos = resolveIndex(parseInt(p, end), positionCount, chunk.failed);
+                    int uv = OBJ_MISSING;
+                    int normal = OBJ_MISSING;
+
+                    if (p < end && *p == '/')
+                    {
+                        ++p;
+                        if (p < end && *p != '/')
+                        {
+                            uv = resolveIndex(parseInt(p, end), uvCount, chunk.failed);
+                        }
+                        if (p < end && *p == '/')
+                        {
+                            ++p;
+                            normal = resolveIndex(parseInt(p, end), normalCount, chunk.failed);
+                        }
+                    }
+
+                    face.push_back(pos);
+                    face.push_back(uv);
+                    face.push_back(normal);
+                }
+
+                // fan-triangulate quads and n-gons
+                size_t cornerCount = face.size() / 3;
+                for (size_t i = 1; i + 1 < cornerCount; ++i)
+                {
+                    chunk.corners.insert(chunk.corners.end(), &face[0], &face[0] + 3);
+                    chunk.corners.insert(chunk.corners.end(), &face[i * 3], &face[i * 3] + 6);
+                }
+            }
+
+            // anything else (o, g, s, usemtl, comments...) is skipped
+        }
+    }
+}
+
+bool loadObj(const char* filePath, objMesh& mesh, unsigned threadCount)
+{
+    PROFILE_SCOPE("loadObj");
+
+    mesh = {};
+
+    mappedFile file = mapFile(filePath);
+    if (file.data == nullptr)
+    {
+        fprintf(stderr, "[ERROR] could not open %s\n", filePath);
+        return false;
+    }
+
+    if (threadCount == 0)
+    {
+        threadCount = defaultThreadCount();
+    }
+
+    // Split the file into line-aligned chunks, a few per thread for balance
+    const char* fileBegin = (const char*)file.data;
+    const char* fileEnd = fileBegin + file.size;
+
+    size_t chunkSize = file.size / (threadCount * 4) + 1;
+    chunkSize = chunkSize > OBJ_MIN_CHUNK_SIZE ? chunkSize : OBJ_MIN_CHUNK_SIZE;
+
+    std::vector<objChunk> chunks;
+    for (const char* p = fileBegin; p < fileEnd;)
+    {
+        objChunk chunk = {};
+        chunk.begin = p;
+        chunk.end = (size_t)(fileEnd - p) > chunkSize ? skipLine(p + chunkSize, fileEnd) : fileEnd;
+        chunks.push_back(chunk);
+        p = chunk.end;
+    }
+
+    // Count records, then hand each chunk its global attribute offsets
+    parallelFor(chunks.size(), [&](size_t i) { countChunk(chunks[i]); }, threadCount);
+
+    size_t positionTotal = 0, uvTotal = 0, normalTotal = 0;
+    for (objChunk& chunk : chunks)
+    {
+        chunk.positionBase = positionTotal;
+        chunk.uvBase = uvTotal;
+        chunk.normalBase = normalTotal;
+        positionTotal += chunk.positionCount;
+        uvTotal += chunk.uvCount;
+        normalTotal += chunk.normalCount;
+    }
+
+    std::vector<glm::vec3> positions(positionTotal);
+    std::vector<glm::vec2> uvs(uvTotal);
+    std::vector<glm::vec3> normals(normalTotal);
+
+    parallelFor(chunks.size(), [&](size_t i) { parseChunk(chunks[i], positions, uvs, normals); }, threadCount);
+
+    unmapFile(file);
+
+    // Work out where each chunk's triangles land in the final arrays
+    size_t cornerTotal = 0;
+    for (objChunk& chunk : chunks)
+    {
+        if (chunk.failed)
+        {
+            fprintf(stderr, "[ERROR] %s references vertex data that doesn't exist\n", filePath);
+            return false;
+        }
+
+        chunk.cornerBase = cornerTotal;
+        cornerTotal += chunk.corners.size() / 3;
+    }
+
+    mesh.vertices.resize(cornerTotal);
+    mesh.indices.resize(cornerTotal);
+
+    std::atomic<bool> anyUVs(false);
+    std::atomic<bool> allNormals(true);
+
+    // Expand corners into vertices
+    parallelFor(chunks.size(), [&](size_t c)
+    {
+        const objChunk& chunk = chunks[c];
+        bool chunkUVs = false;
+        bool chunkNormals = true;
+
+        for (size_t tri = 0; tri < chunk.corners.size(); tri += 9)
+        {
+            const int* corner = &chunk.corners[tri];
+
+            // face normal for corners that don't have one
+            glm::vec3 p0 = positions[corner[0]];
+            glm::vec3 p1 = positions[corner[3]];
+            glm::vec3 p2 = positions[corner[6]];
+            glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+            float faceLength = glm::length(faceNormal);
+            faceNormal = faceLength > 0.0f ? faceNormal / faceLength : glm::vec3(0, 0, 1);
+
+            for (size_t k = 0; k < 3; ++k)
+            {
+                int pos = corner[k * 3 + 0];
+                int uv = corner[k * 3 + 1];
+                int normal = corner[k * 3 + 2];
+
+                size_t out = chunk.cornerBase + tri / 3 + k;
+                glm::vec2 texCoord = uv != OBJ_MISSING ? uvs[uv] : glm::vec2(0.0f);
+                glm::vec3 norm = normal != OBJ_MISSING ? normals[normal] : faceNormal;
+
+                mesh.vertices[out] =
+                {
+                    { positions[pos], 1.0f },   // vertex position
+                    { 1.0f, 1.0f, 1.0f, 1.0f }, // vertex color
+                    texCoord,                   // texture coordinates
+                    { norm, 0.0f }              // vertex normal
+                };
+                mesh.indices[out] = (unsigned int)out;
+
+                chunkUVs = chunkUVs || uv != OBJ_MISSING;
+                chunkNormals = chunkNormals && normal != OBJ_MISSING;
+            }
+        }
+
+        if (chunkUVs)
+        {
+            anyUVs = true;
+        }
+        if (!chunkNormals)
+        {
+            allNormals = false;
+        }
+    }, threadCount);
+
+    mesh.hasUVs = anyUVs;
+    mesh.hasNormals = allNormals;
+
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>		// vector
+
+#include "render.h"		// vertex
+
+// Triangulated mesh data read from an OBJ file (one vertex per face corner)
+struct objMesh
+{
+	std::vector<vertex> vertices;
+	std::vector<unsigned int> indices;
+
+	bool hasUVs;		// false if no face referenced a texture coordinate
+	bool hasNormals;	// false if any face was missing normals (flat normals were generated)
+};
+
+// Parses every shape in an OBJ file across threadCount threads (0 = one per core).
+// Quads and n-gons are fan-triangulated; missing UVs read as (0, 0) and missing
+// normals are replaced by the face normal. Returns false if the file can't be
+// read or references out-of-range indices.
+bool loadObj(const char* filePath, objMesh& mesh, unsigned threadCount = 0);
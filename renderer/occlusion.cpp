@@ -0,0 +1,627 @@
+#include "occlusion.h"
+
+#include <algorithm>    // min, max
+#include <cassert>      // assert
+#include <cmath>        // floorf, ceilf
+
+#include "culling.h"
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE, profilerNow
+#include "softraster.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define OCCLUSION_SSE2 1
+#endif
+
+namespace
+{
+    const int BAND_TILE_ROWS = 2;           // tile rows rasterized per job
+    const size_t TEST_JOB_SIZE = 1024;      // boxes per occludeBoxes job
+    const int MAX_TEST_CELLS = 4;           // a box reads at most 4x4 pyramid cells
+    const uint32_t FULL_MASK = ~0u;
+
+    // A vertex in clip space
+    struct clipVertex
+    {
+        float x, y, z, w;
+    };
+
+    clipVertex lerpVertex(const clipVertex& a, const clipVertex& b, float t)
+    {
+        return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+    }
+
+    // Projects a clipped triangle and builds its edges and depth plane. Back faces
+    // (clockwise on screen, as GL_CULL_FACE removes them) and empty triangles are dropped.
+    bool setupTriangle(const clipVertex* v, const occlusionBuffer& buffer, occluderTriangle& tri)
+    {
+        float sx[3], sy[3], sz[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            float invW = 1.0f / v[i].w;
+            sx[i] = (v[i].x * invW * 0.5f + 0.5f) * buffer.width;
+            sy[i] = (v[i].y * invW * 0.5f + 0.5f) * buffer.height;
+            sz[i] = v[i].z * invW * 0.5f + 0.5f;
+        }
+
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if (!(area > 0.0f))
+        {
+            return false;
+        }
+
+        // Pixels whose centers can be inside
+        tri.minX = std::max(0, (int)ceilf(std::min(sx[0], std::min(sx[1], sx[2])) - 0.5f));
+        tri.maxX = std::min(buffer.width - 1, (int)floorf(std::max(sx[0], std::max(sx[1], sx[2])) - 0.5f));
+        tri.minY = std::max(0, (int)ceilf(std::min(sy[0], std::min(sy[1], sy[2])) - 0.5f));
+        tri.maxY = std::min(buffer.height - 1, (int)floorf(std::max(sy[0], std::max(sy[1], sy[2])) - 0.5f));
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+        {
+            return false;
+        }
+
+        // Edge i is opposite vertex i, so E_i / area is vertex i's barycentric -- and depth
+        // is the barycentric blend of the vertex depths, a plane in screen space
+        float invArea = 1.0f / area;
+        tri.depthPlane[0] = tri.depthPlane[1] = tri.depthPlane[2] = 0.0f;
+        for (int i = 0; i < 3; ++i)
+        {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            tri.edgeA[i] = sy[a] - sy[b];
+            tri.edgeB[i] = sx[b] - sx[a];
+            tri.edgeC[i] = sx[a] * sy[b] - sy[a] * sx[b];
+
+            tri.depthPlane[0] += sz[i] * tri.edgeC[i] * invArea;
+            tri.depthPlane[1] += sz[i] * tri.edgeA[i] * invArea;
+            tri.depthPlane[2] += sz[i] * tri.edgeB[i] * invArea;
+        }
+        tri.maxDepth = std::max(sz[0], std::max(sz[1], sz[2]));
+
+        return true;
+    }
+
+    // Transforms one occluder, clips it against the near plane and sets up what's left
+    void setupOccluder(occlusionBuffer& buffer, size_t index)
+    {
+        const occluderMesh& mesh = *buffer.occluders[index];
+        glm::mat4 m = buffer.viewProj * buffer.occluderModels[index];
+
+        std::vector<clipVertex> clip(mesh.positions.size());
+#if OCCLUSION_SSE2
+        // One column per axis -- a vertex is three multiply-adds
+        __m128 column[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            column[c] = _mm_setr_ps(m[c][0], m[c][1], m[c][2], m[c][3]);
+        }
+        for (size_t i = 0; i < mesh.positions.size(); ++i)
+        {
+            const glm::vec3& p = mesh.positions[i];
+            __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column[0], _mm_set1_ps(p.x)), _mm_mul_ps(column[1], _mm_set1_ps(p.y))),
+                                       _mm_add_ps(_mm_mul_ps(column[2], _mm_set1_ps(p.z)), column[3]));
+            _mm_storeu_ps(&clip[i].x, result);
+        }
+#else
+        for (size_t i = 0; i < mesh.positions.size(); ++i)
+        {
+            glm::vec4 p = m * glm::vec4(mesh.positions[i], 1.0f);
+            clip[i] = { p.x, p.y, p.z, p.w };
+        }
+#endif
+
+        std::vector<occluderTriangle>& triangles = buffer.occluderTriangles[index];
+        triangles.clear();
+
+        occluderTriangle tri;
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+        {
+            clipVertex corners[3] = { clip[mesh.indices[t]], clip[mesh.indices[t + 1]], clip[mesh.indices[t + 2]] };
+
+            // Entirely outside one clip plane -- nothing to do
+            uint32_t outside = ~0u;
+            bool crossesNear = false;
+            for (const clipVertex& v : corners)
+            {
+                outside &= (v.x < -v.w) | (v.x > v.w) << 1 | (v.y < -v.w) << 2 | (v.y > v.w) << 3 |
+                           (v.z < -v.w) << 4 | (v.z > v.w) << 5;
+                crossesNear |= v.z < -v.w;
+            }
+            if (outside != 0)
+            {
+                continue;
+            }
+
+            if (!crossesNear)
+            {
+                if (setupTriangle(corners, buffer, tri))
+                {
+                    triangles.push_back(tri);
+                }
+                continue;
+            }
+
+            // Clip against the near plane (z >= -w) -- the other planes are handled by the bounds
+            clipVertex polygon[4];
+            int polygonSize = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                const clipVertex& a = corners[c];
+                const clipVertex& b = corners[(c + 1) % 3];
+                float da = a.z + a.w, db = b.z + b.w;
+
+                if (da >= 0.0f)
+                {
+                    polygon[polygonSize++] = a;
+                }
+                if ((da >= 0.0f) != (db >= 0.0f))
+                {
+                    polygon[polygonSize++] = lerpVertex(a, b, da / (da - db));
+                }
+            }
+
+            for (int p = 1; p + 1 < polygonSize; ++p)
+            {
+                clipVertex piece[3] = { polygon[0], polygon[p], polygon[p + 1] };
+                if (setupTriangle(piece, buffer, tri))
+                {
+                    triangles.push_back(tri);
+                }
+            }
+        }
+    }
+
+    // Which of the tile's 32 pixel centers the triangle covers, bit = row * 8 + column
+    uint32_t coverageMask(const occluderTriangle& tri, int tileX, int tileY)
+    {
+        float x0 = tileX * OCCLUSION_TILE_WIDTH + 0.5f;
+        float y0 = tileY * OCCLUSION_TILE_HEIGHT + 0.5f;
+        uint32_t mask = 0;
+
+#if OCCLUSION_SSE2
+        __m128 zero = _mm_setzero_ps();
+        __m128 left = _mm_setr_ps(x0, x0 + 1.0f, x0 + 2.0f, x0 + 3.0f);
+        __m128 right = _mm_add_ps(left, _mm_set1_ps(4.0f));
+        __m128 leftEdge[3], rightEdge[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            __m128 a = _mm_set1_ps(tri.edgeA[e]);
+            __m128 c = _mm_set1_ps(tri.edgeB[e] * y0 + tri.edgeC[e]);
+            leftEdge[e] = _mm_add_ps(_mm_mul_ps(a, left), c);
+            rightEdge[e] = _mm_add_ps(_mm_mul_ps(a, right), c);
+        }
+
+        for (int row = 0; row < OCCLUSION_TILE_HEIGHT; ++row)
+        {
+            __m128 insideLeft = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(leftEdge[0], zero), _mm_cmpge_ps(leftEdge[1], zero)),
+                                           _mm_cmpge_ps(leftEdge[2], zero));
+            __m128 insideRight = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(rightEdge[0], zero), _mm_cmpge_ps(rightEdge[1], zero)),
+                                            _mm_cmpge_ps(rightEdge[2], zero));
+            mask |= (uint32_t)(_mm_movemask_ps(insideLeft) | _mm_movemask_ps(insideRight) << 4) << (row * OCCLUSION_TILE_WIDTH);
+
+            // Step down a row
+            for (int e = 0; e < 3; ++e)
+            {
+                __m128 b = _mm_set1_ps(tri.edgeB[e]);
+                leftEdge[e] = _mm_add_ps(leftEdge[e], b);
+                rightEdge[e] = _mm_add_ps(rightEdge[e], b);
+            }
+        }
+#else
+        for (int row = 0; row < OCCLUSION_TILE_HEIGHT; ++row)
+        {
+            float y = y0 + row;
+            for (int column = 0; column < OCCLUSION_TILE_WIDTH; ++column)
+            {
+                float x = x0 + column;
+                bool inside = true;
+                for (int e = 0; e < 3; ++e)
+                {
+                    inside = inside && tri.edgeA[e] * x + tri.edgeB[e] * y + tri.edgeC[e] >= 0.0f;
+                }
+                mask |= (uint32_t)inside << (row * OCCLUSION_TILE_WIDTH + column);
+            }
+        }
+#endif
+
+        return mask;
+    }
+
+    // Folds one triangle into a tile, keeping both depths conservative
+    void updateTile(occlusionTile& tile, uint32_t mask, float depth)
+    {
+        // Much nearer than the working layer -- start a new layer rather than dragging this one back
+        if (tile.layerDepth - depth > tile.farDepth - tile.layerDepth)
+        {
+            tile.layerDepth = 0.0f;
+            tile.mask = 0;
+        }
+
+        tile.layerDepth = std::max(tile.layerDepth, depth);
+        tile.mask |= mask;
+
+        // Every pixel is covered by something no farther than the layer
+        if (tile.mask == FULL_MASK)
+        {
+            tile.farDepth = std::min(tile.farDepth, tile.layerDepth);
+            tile.layerDepth = 0.0f;
+            tile.mask = 0;
+        }
+    }
+
+    // Rasterizes every occluder over tile rows [firstRow, lastRow], in submission order
+    void rasterBand(occlusionBuffer& buffer, int firstRow, int lastRow)
+    {
+        int bandMinY = firstRow * OCCLUSION_TILE_HEIGHT;
+        int bandMaxY = (lastRow + 1) * OCCLUSION_TILE_HEIGHT - 1;
+
+        for (const std::vector<occluderTriangle>& triangles : buffer.occluderTriangles)
+        {
+            for (const occluderTriangle& tri : triangles)
+            {
+                if (tri.maxY < bandMinY || tri.minY > bandMaxY)
+                {
+                    continue;
+                }
+
+                int tileY0 = std::max(firstRow, tri.minY / OCCLUSION_TILE_HEIGHT);
+                int tileY1 = std::min(lastRow, tri.maxY / OCCLUSION_TILE_HEIGHT);
+                int tileX0 = tri.minX / OCCLUSION_TILE_WIDTH, tileX1 = tri.maxX / OCCLUSION_TILE_WIDTH;
+
+                for (int tileY = tileY0; tileY <= tileY1; ++tileY)
+                {
+                    for (int tileX = tileX0; tileX <= tileX1; ++tileX)
+                    {
+                        occlusionTile& tile = buffer.tiles[tileY * buffer.tilesX + tileX];
+
+                        // Farthest the plane gets over the tile's pixel centers, never past the farthest vertex
+                        float x0 = tileX * OCCLUSION_TILE_WIDTH + 0.5f, x1 = x0 + OCCLUSION_TILE_WIDTH - 1.0f;
+                        float y0 = tileY * OCCLUSION_TILE_HEIGHT + 0.5f, y1 = y0 + OCCLUSION_TILE_HEIGHT - 1.0f;
+                        float depth = tri.depthPlane[0] + tri.depthPlane[1] * (tri.depthPlane[1] > 0.0f ? x1 : x0) +
+                                      tri.depthPlane[2] * (tri.depthPlane[2] > 0.0f ? y1 : y0);
+                        depth = std::min(depth, tri.maxDepth);
+
+                        // Behind everything the tile already hides
+                        if (depth >= tile.farDepth)
+                        {
+                            continue;
+                        }
+
+                        uint32_t mask = coverageMask(tri, tileX, tileY);
+                        if (mask != 0)
+                        {
+                            updateTile(tile, mask, depth);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void buildPyramid(occlusionBuffer& buffer)
+    {
+        for (size_t i = 0; i < buffer.tiles.size(); ++i)
+        {
+            buffer.pyramid[i] = buffer.tiles[i].farDepth;
+        }
+
+        for (size_t level = 1; level < buffer.levelOffset.size(); ++level)
+        {
+            const float* src = &buffer.pyramid[buffer.levelOffset[level - 1]];
+            float* dst = &buffer.pyramid[buffer.levelOffset[level]];
+            int srcWidth = buffer.levelWidth[level - 1], srcHeight = buffer.levelHeight[level - 1];
+
+            for (int y = 0; y < buffer.levelHeight[level]; ++y)
+            {
+                // Odd sizes repeat the last row/column
+                int y0 = y * 2, y1 = std::min(y * 2 + 1, srcHeight - 1);
+                for (int x = 0; x < buffer.levelWidth[level]; ++x)
+                {
+                    int x0 = x * 2, x1 = std::min(x * 2 + 1, srcWidth - 1);
+                    dst[y * buffer.levelWidth[level] + x] = std::max(std::max(src[y0 * srcWidth + x0], src[y0 * srcWidth + x1]),
+                                                                     std::max(src[y1 * srcWidth + x0], src[y1 * srcWidth + x1]));
+                }
+            }
+        }
+    }
+
+    // Screen rectangle (in pixels) and nearest depth of a world box -- false if it crosses the near plane
+    bool projectBox(const glm::mat4& m, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                    float& minX, float& minY, float& maxX, float& maxY, float& minDepth)
+    {
+#if OCCLUSION_SSE2
+        // Corners 0-3 share z = min, 4-7 z = max
+        __m128 cornerX = _mm_setr_ps(boundsMin.x, boundsMax.x, boundsMin.x, boundsMax.x);
+        __m128 cornerY = _mm_setr_ps(boundsMin.y, boundsMin.y, boundsMax.y, boundsMax.y);
+
+        __m128 lowX = _mm_set1_ps(1e30f), lowY = _mm_set1_ps(1e30f), lowZ = _mm_set1_ps(1e30f);
+        __m128 highX = _mm_set1_ps(-1e30f), highY = _mm_set1_ps(-1e30f);
+        __m128 behind = _mm_setzero_ps();
+        for (float z : { boundsMin.z, boundsMax.z })
+        {
+            __m128 cornerZ = _mm_set1_ps(z);
+            __m128 clip[4];
+            for (int row = 0; row < 4; ++row)
+            {
+                clip[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][row]), cornerX), _mm_mul_ps(_mm_set1_ps(m[1][row]), cornerY)),
+                                       _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][row]), cornerZ), _mm_set1_ps(m[3][row])));
+            }
+
+            behind = _mm_or_ps(behind, _mm_cmplt_ps(_mm_add_ps(clip[2], clip[3]), _mm_setzero_ps()));
+            __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), clip[3]);
+            __m128 x = _mm_mul_ps(clip[0], invW), y = _mm_mul_ps(clip[1], invW), depth = _mm_mul_ps(clip[2], invW);
+            lowX = _mm_min_ps(lowX, x);
+            lowY = _mm_min_ps(lowY, y);
+            lowZ = _mm_min_ps(lowZ, depth);
+            highX = _mm_max_ps(highX, x);
+            highY = _mm_max_ps(highY, y);
+        }
+        if (_mm_movemask_ps(behind) != 0)
+        {
+            return false;
+        }
+
+        float lanes[5][4];
+        _mm_storeu_ps(lanes[0], lowX);
+        _mm_storeu_ps(lanes[1], lowY);
+        _mm_storeu_ps(lanes[2], highX);
+        _mm_storeu_ps(lanes[3], highY);
+        _mm_storeu_ps(lanes[4], lowZ);
+        float ndc[5];
+        for (int i = 0; i < 5; ++i)
+        {
+            bool lowest = i != 2 && i != 3;
+            ndc[i] = lanes[i][0];
+            for (int lane = 1; lane < 4; ++lane)
+            {
+                ndc[i] = lowest ? std::min(ndc[i], lanes[i][lane]) : std::max(ndc[i], lanes[i][lane]);
+            }
+        }
+#else
+        float ndc[5] = { 1e30f, 1e30f, -1e30f, -1e30f, 1e30f };
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec4 clip = m * glm::vec4(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y,
+                                           corner & 4 ? boundsMax.z : boundsMin.z, 1.0f);
+            if (clip.z + clip.w < 0.0f)
+            {
+                return false;
+            }
+
+            float invW = 1.0f / clip.w;
+            ndc[0] = std::min(ndc[0], clip.x * invW);
+            ndc[1] = std::min(ndc[1], clip.y * invW);
+            ndc[2] = std::max(ndc[2], clip.x * invW);
+            ndc[3] = std::max(ndc[3], clip.y * invW);
+            ndc[4] = std::min(ndc[4], clip.z * invW);
+        }
+#endif
+
+        minX = ndc[0] * 0.5f + 0.5f;
+        minY = ndc[1] * 0.5f + 0.5f;
+        maxX = ndc[2] * 0.5f + 0.5f;
+        maxY = ndc[3] * 0.5f + 0.5f;
+        minDepth = ndc[4] * 0.5f + 0.5f;
+        return true;
+    }
+}
+
+occluderMesh makeOccluderMesh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount)
+{
+    assert(indexCount % 3 == 0);
+
+    occluderMesh mesh;
+    mesh.positions.assign(positions, positions + positionCount);
+    mesh.indices.assign(indices, indices + indexCount);
+    return mesh;
+}
+
+occluderMesh makeOccluderMesh(const softMesh& mesh, unsigned lod)
+{
+    // What loadSoftMesh returns when decoding fails
+    if (mesh.lodCount == 0 || mesh.indices.empty())
+    {
+        return {};
+    }
+
+    const meshLod& level = mesh.lods[lod < mesh.lodCount ? lod : mesh.lodCount - 1];
+
+    // Only the vertices the level uses, renumbered
+    occluderMesh occluder;
+    std::vector<uint32_t> remap(mesh.vertices.size(), ~0u);
+    occluder.indices.reserve(level.indexCount);
+    for (uint32_t i = 0; i < level.indexCount; ++i)
+    {
+        unsigned index = mesh.indices[level.firstIndex + i];
+        if (remap[index] == ~0u)
+        {
+            remap[index] = (uint32_t)occluder.positions.size();
+            occluder.positions.push_back(glm::vec3(mesh.vertices[index].pos));
+        }
+        occluder.indices.push_back(remap[index]);
+    }
+
+    return occluder;
+}
+
+occlusionBuffer makeOcclusionBuffer(int width, int height)
+{
+    occlusionBuffer buffer = {};
+    buffer.tilesX = std::max(1, (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH);
+    buffer.tilesY = std::max(1, (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT);
+    buffer.width = buffer.tilesX * OCCLUSION_TILE_WIDTH;
+    buffer.height = buffer.tilesY * OCCLUSION_TILE_HEIGHT;
+    buffer.tiles.resize((size_t)buffer.tilesX * buffer.tilesY);
+
+    // Halve until one cell is left
+    int levelWidth = buffer.tilesX, levelHeight = buffer.tilesY;
+    size_t offset = 0;
+    for (;;)
+    {
+        buffer.levelOffset.push_back(offset);
+        buffer.levelWidth.push_back(levelWidth);
+        buffer.levelHeight.push_back(levelHeight);
+        offset += (size_t)levelWidth * levelHeight;
+        if (levelWidth == 1 && levelHeight == 1)
+        {
+            break;
+        }
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+    buffer.pyramid.assign(offset, 1.0f);
+
+    return buffer;
+}
+
+void beginOcclusionFrame(occlusionBuffer& buffer, const glm::mat4& viewProj)
+{
+    buffer.viewProj = viewProj;
+    buffer.occluders.clear();
+    buffer.occluderModels.clear();
+
+    for (occlusionTile& tile : buffer.tiles)
+    {
+        tile.mask = 0;
+        tile.layerDepth = 0.0f;
+        tile.farDepth = 1.0f;
+    }
+
+    buffer.stats = {};
+}
+
+void addOccluder(occlusionBuffer& buffer, const occluderMesh& mesh, const glm::mat4& model)
+{
+    buffer.occluders.push_back(&mesh);
+    buffer.occluderModels.push_back(model);
+}
+
+void endOcclusionFrame(occlusionBuffer& buffer)
+{
+    PROFILE_SCOPE("endOcclusionFrame");
+    int64_t begin = profilerNow();
+
+    size_t occluderCount = buffer.occluders.size();
+    if (buffer.occluderTriangles.size() < occluderCount)
+    {
+        buffer.occluderTriangles.resize(occluderCount);
+    }
+    for (size_t i = occluderCount; i < buffer.occluderTriangles.size(); ++i)
+    {
+        buffer.occluderTriangles[i].clear();
+    }
+
+    parallelFor(occluderCount, [&](size_t i)
+    {
+        setupOccluder(buffer, i);
+    });
+
+    // Bands of tile rows never share a tile, so they need no locking
+    int bandCount = (buffer.tilesY + BAND_TILE_ROWS - 1) / BAND_TILE_ROWS;
+    parallelFor((size_t)bandCount, [&](size_t band)
+    {
+        int firstRow = (int)band * BAND_TILE_ROWS;
+        rasterBand(buffer, firstRow, std::min(firstRow + BAND_TILE_ROWS, buffer.tilesY) - 1);
+    });
+
+    buildPyramid(buffer);
+
+    buffer.stats.occluders = occluderCount;
+    for (size_t i = 0; i < occluderCount; ++i)
+    {
+        buffer.stats.trianglesIn += buffer.occluders[i]->indices.size() / 3;
+        buffer.stats.trianglesRasterized += buffer.occluderTriangles[i].size();
+    }
+    buffer.stats.rasterMs = (profilerNow() - begin) / 1000000.0;
+}
+
+bool isBoxOccluded(const occlusionBuffer& buffer, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    float minX, minY, maxX, maxY, minDepth;
+    if (!projectBox(buffer.viewProj, boundsMin, boundsMax, minX, minY, maxX, maxY, minDepth))
+    {
+        return false;
+    }
+
+    // Off screen is the frustum test's business
+    if (maxX < 0.0f || minX > 1.0f || maxY < 0.0f || minY > 1.0f)
+    {
+        return false;
+    }
+
+    int tileX0 = std::max(0, (int)(minX * buffer.width) / OCCLUSION_TILE_WIDTH);
+    int tileY0 = std::max(0, (int)(minY * buffer.height) / OCCLUSION_TILE_HEIGHT);
+    int tileX1 = std::min(buffer.tilesX - 1, (int)(maxX * buffer.width) / OCCLUSION_TILE_WIDTH);
+    int tileY1 = std::min(buffer.tilesY - 1, (int)(maxY * buffer.height) / OCCLUSION_TILE_HEIGHT);
+
+    // Coarsest where the rectangle is still a handful of cells
+    size_t level = 0;
+    while ((tileX1 - tileX0 >= MAX_TEST_CELLS || tileY1 - tileY0 >= MAX_TEST_CELLS) && level + 1 < buffer.levelOffset.size())
+    {
+        tileX0 >>= 1;
+        tileY0 >>= 1;
+        tileX1 >>= 1;
+        tileY1 >>= 1;
+        ++level;
+    }
+
+    // Hidden only if the box's nearest point is behind everything over it
+    const float* cells = &buffer.pyramid[buffer.levelOffset[level]];
+    int levelWidth = buffer.levelWidth[level];
+    for (int y = tileY0; y <= tileY1; ++y)
+    {
+        for (int x = tileX0; x <= tileX1; ++x)
+        {
+            if (cells[y * levelWidth + x] >= minDepth)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t occludeBoxes(occlusionBuffer& buffer, cullBatch& batch)
+{
+    PROFILE_SCOPE("occludeBoxes");
+    int64_t begin = profilerNow();
+
+    size_t jobCount = (batch.count + TEST_JOB_SIZE - 1) / TEST_JOB_SIZE;
+    std::vector<size_t> jobTested(jobCount, 0), jobOccluded(jobCount, 0);
+    parallelFor(jobCount, [&](size_t job)
+    {
+        size_t end = std::min((job + 1) * TEST_JOB_SIZE, batch.count);
+        for (size_t i = job * TEST_JOB_SIZE; i < end; ++i)
+        {
+            if (!batch.visible[i])
+            {
+                continue;
+            }
+
+            glm::vec3 center(batch.centerX[i], batch.centerY[i], batch.centerZ[i]);
+            glm::vec3 extent(batch.extentX[i], batch.extentY[i], batch.extentZ[i]);
+            ++jobTested[job];
+            if (isBoxOccluded(buffer, center - extent, center + extent))
+            {
+                batch.visible[i] = 0;
+                ++jobOccluded[job];
+            }
+        }
+    });
+
+    size_t tested = 0, occluded = 0;
+    for (size_t job = 0; job < jobCount; ++job)
+    {
+        tested += jobTested[job];
+        occluded += jobOccluded[job];
+    }
+
+    buffer.stats.tested += tested;
+    buffer.stats.occluded += occluded;
+    buffer.stats.testMs += (profilerNow() - begin) / 1000000.0;
+
+    batch.stats.visible = tested - occluded;
+    batch.stats.culled = batch.count - batch.stats.visible;
+
+    return batch.stats.visible;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t
+#include <vector>			// vector
+
+#include "glm/glm.hpp"		// glm math types (vec3, mat4)
+
+struct cullBatch;
+struct softMesh;
+
+// Occluders are drawn into 8x4 pixel tiles. Each tile keeps a coverage mask and two depths
+// instead of per-pixel depth (after Hasselgren et al., "Masked Software Occlusion Culling"):
+// every pixel in the tile is known to be hidden beyond farDepth, and the masked pixels
+// beyond layerDepth. When the mask fills up the layer becomes the new farDepth.
+const int OCCLUSION_TILE_WIDTH = 8;
+const int OCCLUSION_TILE_HEIGHT = 4;
+
+// Positions only -- usually a coarse LOD. Triangles should lie inside the visible
+// surface, since anything sticking out can hide objects that are really in view.
+struct occluderMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+occluderMesh makeOccluderMesh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount);
+// lod past the end of the chain picks the coarsest level. A mesh that failed to load gives an empty occluder.
+occluderMesh makeOccluderMesh(const softMesh& mesh, unsigned lod = ~0u);
+
+struct occlusionTile
+{
+	uint32_t mask;			// pixels covered by the working layer, bit = row * 8 + column
+	float layerDepth;		// farthest depth in the working layer
+	float farDepth;			// farthest depth anywhere in the tile
+};
+
+// A set-up occluder triangle, in buffer pixels
+struct occluderTriangle
+{
+	float edgeA[3], edgeB[3], edgeC[3];	// E(x, y) = A x + B y + C, positive inside
+	float depthPlane[3];				// depth = [0] + [1] x + [2] y
+	float maxDepth;						// farthest vertex
+	int minX, minY, maxX, maxY;			// pixel bounds, clipped to the buffer
+};
+
+// Work from the last endOcclusionFrame and the tests since
+struct occlusionStats
+{
+	size_t occluders;
+	size_t trianglesIn;
+	size_t trianglesRasterized;		// survived clipping and back-face culling
+	size_t tested;
+	size_t occluded;
+	double rasterMs, testMs;
+};
+
+struct occlusionBuffer
+{
+	int width, height;			// pixels, whole tiles
+	int tilesX, tilesY;
+	glm::mat4 viewProj;
+
+	// Queued for this frame
+	std::vector<const occluderMesh*> occluders;
+	std::vector<glm::mat4> occluderModels;
+
+	std::vector<occlusionTile> tiles;
+
+	// farDepth of the tiles, then each level halving the one before (max of 2x2) down to 1x1
+	std::vector<float> pyramid;
+	std::vector<size_t> levelOffset;
+	std::vector<int> levelWidth, levelHeight;
+
+	// Per-occluder triangle setup, so rasterization order never depends on the threads
+	std::vector<std::vector<occluderTriangle>> occluderTriangles;
+
+	occlusionStats stats;
+};
+
+// The size is rounded up to whole tiles. Small buffers (a few hundred pixels across) are the point.
+occlusionBuffer makeOcclusionBuffer(int width = 256, int height = 128);
+
+// Clears the buffer and starts queuing occluders seen through viewProj
+void beginOcclusionFrame(occlusionBuffer& buffer, const glm::mat4& viewProj);
+// The mesh must stay alive until endOcclusionFrame
+void addOccluder(occlusionBuffer& buffer, const occluderMesh& mesh, const glm::mat4& model);
+// Rasterizes the occluders (bands of tiles across the job threads) and builds the pyramid
+void endOcclusionFrame(occlusionBuffer& buffer);
+
+// True if the world-space box is certainly hidden. Boxes crossing the near plane never are.
+bool isBoxOccluded(const occlusionBuffer& buffer, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+// Clears batch.visible for every visible box the buffer hides and returns how many are left.
+// Run it after cullBoxes so only boxes inside the frustum are tested.
+size_t occludeBoxes(occlusionBuffer& buffer, cullBatch& batch);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>		// atomic
+#include <cstddef>		// size_t
+#include <thread>		// thread
+#include <vector>		// vector
+
+#include "jobs.h"		// createJob, runJob, waitJob
+
+// Number of threads to use when the caller doesn't care (one per core)
+inline unsigned defaultThreadCount()
+{
+	if (isJobSystemRunning())
+	{
+		return jobThreadCount();
+	}
+
+	unsigned count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+namespace parallelDetail
+{
+	// Batches per job thread -- enough slack for stealing to even out uneven indices
+	const size_t BATCHES_PER_THREAD = 4;
+
+	template<typename Fn>
+	struct range
+	{
+		const Fn* fn;
+		size_t begin, end;
+		size_t grain;
+	};
+
+	// Splits off the upper half as a child until the range is one batch, then runs it
+	template<typename Fn>
+	void runRange(job& self, const void* data)
+	{
+		range<Fn> work = *static_cast<const range<Fn>*>(data);
+		while (work.end - work.begin > work.grain)
+		{
+			size_t middle = work.begin + (work.end - work.begin) / 2;
+			range<Fn> upper = { work.fn, middle, work.end, work.grain };
+			runJob(createJob("parallelFor", &runRange<Fn>, &upper, sizeof(upper), &self));
+			work.end = middle;
+		}
+
+		for (size_t i = work.begin; i < work.end; ++i)
+		{
+			(*work.fn)(i);
+		}
+	}
+}
+
+// Runs fn(i) for every i in [0, count) and returns once every index is done.
+// On a job thread the range is split into jobs that idle threads steal, and the caller
+// helps until they finish. threadCount = 1 runs inline; any other value uses every job
+// thread. Threads outside the job system fall back to threadCount plain threads (0 = one per core).
+template<typename Fn>
+void parallelFor(size_t count, const Fn& fn, unsigned threadCount = 0)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	if (threadCount == 1 || count == 1)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			fn(i);
+		}
+		return;
+	}
+
+	if (isJobSystemRunning() && currentJobThread() != ~0u)
+	{
+		size_t batches = jobThreadCount() * parallelDetail::BATCHES_PER_THREAD;
+		size_t grain = count / batches > 0 ? count / batches : 1;
+
+		parallelDetail::range<Fn> all = { &fn, 0, count, grain };
+		job* root = createJob("parallelFor", &parallelDetail::runRange<Fn>, &all, sizeof(all));
+		runJob(root);
+		waitJob(root);
+		return;
+	}
+
+	if (threadCount == 0)
+	{
+		threadCount = defaultThreadCount();
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+		{
+			fn(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < threadCount && t < count; ++t)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
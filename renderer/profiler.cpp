@@ -0,0 +1,436 @@
+#include "profiler.h"
+
+#include <algorithm>    // sort
+#include <chrono>       // steady_clock
+#include <cstdio>       // fprintf
+#include <cstring>      // strcmp
+#include <fstream>      // ofstream
+#include <memory>       // unique_ptr
+#include <mutex>        // mutex, lock_guard
+#include <thread>       // sleep_for, yield
+
+#include "glew/GL/glew.h"
+
+std::atomic<bool> profilerEnabled(false);
+
+namespace
+{
+    const unsigned GPU_CALIBRATION_INTERVAL = 60;   // frames between GPU/CPU clock syncs
+    const unsigned GPU_QUERY_GROWTH = 64;
+    const int64_t SLEEP_SPIN_NANOSECONDS = 2000000; // sleepUntil yields through the last 2 ms
+
+    // Single producer (the owning thread), single consumer (profilerFrame)
+    struct profileRing
+    {
+        profileEvent events[PROFILE_RING_SIZE];
+        std::atomic<uint32_t> head{ 0 };    // written by the owner
+        std::atomic<uint32_t> tail{ 0 };    // written by the collector
+        unsigned thread = 0;
+        unsigned depth = 0;
+        unsigned dropped = 0;
+    };
+
+    std::mutex ringMutex;   // only guards the list of rings -- taken once per thread and once per frame
+    std::vector<std::unique_ptr<profileRing>> rings;
+    thread_local profileRing* localRing = nullptr;
+
+    profileRing* threadRing()
+    {
+        if (localRing == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(ringMutex);
+            rings.emplace_back(new profileRing());
+            localRing = rings.back().get();
+            localRing->thread = (unsigned)rings.size() - 1;
+        }
+        return localRing;
+    }
+
+    // A GPU span waiting on its timestamp queries
+    struct gpuEvent
+    {
+        const char* name;
+        GLuint beginQuery, endQuery;
+        unsigned depth;
+    };
+
+    struct gpuFrame
+    {
+        std::vector<gpuEvent> events;
+        std::vector<GLuint> queries;
+        size_t queriesUsed = 0;
+    };
+
+    gpuFrame gpuFrames[PROFILE_GPU_FRAMES];
+    unsigned gpuFrameIndex = 0;
+    unsigned gpuDepth = 0;
+    unsigned framesSinceCalibration = GPU_CALIBRATION_INTERVAL;
+    int64_t gpuClockOffset = 0;     // add to a GPU timestamp to get profiler time
+    unsigned gpuFramesDropped = 0;
+
+    std::vector<profileEvent> collected;
+    std::vector<profileEvent> completedFrame;
+    int64_t frameStart = 0;
+
+    // Per-frame totals for one scope name
+    struct scopeHistory
+    {
+        const char* name;
+        bool gpu;
+        double samples[PROFILE_HISTORY];
+        bool present[PROFILE_HISTORY];
+    };
+    std::vector<scopeHistory> histories;
+    unsigned historyFrame = 0;
+
+    const char* FRAME_SCOPE_NAME = "frame";
+
+    GLuint takeQuery(gpuFrame& frame)
+    {
+        if (frame.queriesUsed == frame.queries.size())
+        {
+            size_t oldSize = frame.queries.size();
+            frame.queries.resize(oldSize + GPU_QUERY_GROWTH);
+            glGenQueries(GPU_QUERY_GROWTH, &frame.queries[oldSize]);
+        }
+        return frame.queries[frame.queriesUsed++];
+    }
+
+    // Reads back a frame's queries if the GPU is done with them, then recycles the frame
+    void resolveGpuFrame(gpuFrame& frame)
+    {
+        if (!frame.events.empty())
+        {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(frame.events.back().endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if (available)
+            {
+                for (const gpuEvent& event : frame.events)
+                {
+                    GLuint64 begin = 0, end = 0;
+                    glGetQueryObjectui64v(event.beginQuery, GL_QUERY_RESULT, &begin);
+                    glGetQueryObjectui64v(event.endQuery, GL_QUERY_RESULT, &end);
+
+                    profileEvent resolved;
+                    resolved.name = event.name;
+                    resolved.begin = (int64_t)begin + gpuClockOffset;
+                    resolved.end = (int64_t)end + gpuClockOffset;
+                    resolved.thread = PROFILE_GPU_THREAD;
+                    resolved.depth = event.depth;
+                    collected.push_back(resolved);
+                }
+            }
+            else
+            {
+                // Still in flight after PROFILE_GPU_FRAMES -- waiting would stall us, so let it go
+                ++gpuFramesDropped;
+            }
+        }
+
+        frame.events.clear();
+        frame.queriesUsed = 0;
+    }
+
+    scopeHistory& findHistory(const char* name, bool gpu)
+    {
+        for (scopeHistory& history : histories)
+        {
+            if (history.gpu == gpu && (history.name == name || strcmp(history.name, name) == 0))
+            {
+                return history;
+            }
+        }
+
+        scopeHistory history = {};
+        history.name = name;
+        history.gpu = gpu;
+        histories.push_back(history);
+        return histories.back();
+    }
+
+    void recordHistory(const std::vector<profileEvent>& events)
+    {
+        unsigned slot = historyFrame % PROFILE_HISTORY;
+        for (scopeHistory& history : histories)
+        {
+            history.samples[slot] = 0.0;
+            history.present[slot] = false;
+        }
+
+        // A scope hit several times in a frame counts as its total
+        for (const profileEvent& event : events)
+        {
+            scopeHistory& history = findHistory(event.name, event.thread == PROFILE_GPU_THREAD);
+            history.samples[slot] += (event.end - event.begin) / 1000000.0;
+            history.present[slot] = true;
+        }
+
+        ++historyFrame;
+    }
+
+    // Writes a string literal as a JSON string
+    void writeJsonString(std::ofstream& out, const char* text)
+    {
+        out << '"';
+        for (const char* c = text; *c != '\0'; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                out << '\\';
+            }
+            out << *c;
+        }
+        out << '"';
+    }
+
+    // The frame itself, on the thread that closes it, then every thread's ring
+    void collectCpuEvents(int64_t now)
+    {
+        if (frameStart != 0)
+        {
+            profileEvent frameEvent;
+            frameEvent.name = FRAME_SCOPE_NAME;
+            frameEvent.begin = frameStart;
+            frameEvent.end = now;
+            frameEvent.thread = threadRing()->thread;
+            frameEvent.depth = 0;
+            collected.push_back(frameEvent);
+        }
+
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for (auto& ring : rings)
+        {
+            uint32_t head = ring->head.load(std::memory_order_acquire);
+            uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail)
+            {
+                collected.push_back(ring->events[tail % PROFILE_RING_SIZE]);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+        }
+    }
+
+    // Publishes what was collected as the completed frame and opens the next
+    void completeFrame(int64_t now)
+    {
+        recordHistory(collected);
+        completedFrame.swap(collected);
+        collected.clear();
+
+        frameStart = now;
+    }
+}
+
+void setProfilerEnabled(bool enabled)
+{
+    profilerEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t profilerNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void sleepUntil(int64_t deadline)
+{
+    int64_t remaining = deadline - profilerNow();
+    if (remaining > SLEEP_SPIN_NANOSECONDS)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - SLEEP_SPIN_NANOSECONDS));
+    }
+    while (profilerNow() < deadline)
+    {
+        std::this_thread::yield();
+    }
+}
+
+void profileScope::begin(const char* name)
+{
+    profileRing* ring = threadRing();
+    ++ring->depth;
+
+    scopeName = name;
+    start = profilerNow();
+}
+
+void profileScope::end()
+{
+    int64_t finish = profilerNow();
+    profileRing* ring = threadRing();
+    --ring->depth;
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+    if (head - tail >= PROFILE_RING_SIZE)
+    {
+        ++ring->dropped;    // collector hasn't caught up -- lose this one rather than block
+        return;
+    }
+
+    profileEvent& event = ring->events[head % PROFILE_RING_SIZE];
+    event.name = scopeName;
+    event.begin = start;
+    event.end = finish;
+    event.thread = ring->thread;
+    event.depth = ring->depth;
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void gpuProfileScope::begin(const char* name)
+{
+    gpuFrame& frame = gpuFrames[gpuFrameIndex];
+
+    gpuEvent event;
+    event.name = name;
+    event.beginQuery = takeQuery(frame);
+    event.endQuery = takeQuery(frame);
+    event.depth = gpuDepth++;
+
+    // Timestamps rather than GL_TIME_ELAPSED -- elapsed queries can't nest
+    glQueryCounter(event.beginQuery, GL_TIMESTAMP);
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+
+    eventIndex = (unsigned)frame.events.size();
+    frame.events.push_back(event);
+}
+
+void gpuProfileScope::end()
+{
+    gpuFrame& frame = gpuFrames[gpuFrameIndex];
+
+    glPopDebugGroup();
+    glQueryCounter(frame.events[eventIndex].endQuery, GL_TIMESTAMP);
+    --gpuDepth;
+}
+
+void profilerFrame()
+{
+    int64_t now = profilerNow();
+
+    if (!isProfilerEnabled())
+    {
+        frameStart = now;
+        return;
+    }
+
+    collectCpuEvents(now);
+
+    // Line the GPU clock up with ours every so often -- it drifts slowly
+    if (++framesSinceCalibration >= GPU_CALIBRATION_INTERVAL)
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuClockOffset = profilerNow() - (int64_t)gpuNow;
+        framesSinceCalibration = 0;
+    }
+
+    // Move to the oldest GPU frame, whose queries should be done by now
+    gpuFrameIndex = (gpuFrameIndex + 1) % PROFILE_GPU_FRAMES;
+    resolveGpuFrame(gpuFrames[gpuFrameIndex]);
+
+    completeFrame(now);
+}
+
+void profilerCpuFrame()
+{
+    int64_t now = profilerNow();
+
+    if (!isProfilerEnabled())
+    {
+        frameStart = now;
+        return;
+    }
+
+    collectCpuEvents(now);
+    completeFrame(now);
+}
+
+const std::vector<profileEvent>& lastFrameEvents()
+{
+    return completedFrame;
+}
+
+void getProfileStats(std::vector<profileStat>& stats)
+{
+    stats.clear();
+
+    std::vector<double> samples;
+    for (const scopeHistory& history : histories)
+    {
+        samples.clear();
+        unsigned window = historyFrame < PROFILE_HISTORY ? historyFrame : PROFILE_HISTORY;
+        for (unsigned i = 0; i < window; ++i)
+        {
+            if (history.present[i])
+            {
+                samples.push_back(history.samples[i]);
+            }
+        }
+        if (samples.empty())
+        {
+            continue;
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        double total = 0.0;
+        for (double sample : samples)
+        {
+            total += sample;
+        }
+
+        profileStat stat;
+        stat.name = history.name;
+        stat.gpu = history.gpu;
+        stat.frames = (unsigned)samples.size();
+        stat.minMs = samples.front();
+        stat.avgMs = total / samples.size();
+        stat.p99Ms = samples[(samples.size() * 99 + 99) / 100 - 1];
+        stats.push_back(stat);
+    }
+}
+
+bool exportChromeTrace(const char* filePath)
+{
+    std::ofstream out(filePath, std::ios::trunc);
+    if (!out)
+    {
+        fprintf(stderr, "Failed to write trace %s\n", filePath);
+        return false;
+    }
+
+    // Complete ("X") events in microseconds; GPU spans get their own track
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << PROFILE_GPU_THREAD
+        << ",\"args\":{\"name\":\"GPU\"}}";
+
+    out.precision(3);
+    out << std::fixed;
+    for (const profileEvent& event : completedFrame)
+    {
+        out << ",\n{\"name\":";
+        writeJsonString(out, event.name);
+        out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+            << ",\"ts\":" << event.begin / 1000.0
+            << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+    }
+    out << "\n]}\n";
+
+    return (bool)out;
+}
+
+void termProfiler()
+{
+    for (gpuFrame& frame : gpuFrames)
+    {
+        if (!frame.queries.empty())
+        {
+            glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+        }
+        frame = gpuFrame();
+    }
+    gpuDepth = 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>			// atomic
+#include <cstdint>			// int64_t, uint32_t
+#include <vector>			// vector
+
+// Events each thread can record per frame before the oldest are dropped
+const uint32_t PROFILE_RING_SIZE = 4096;
+// Frames of GPU latency before timer queries are read back
+const unsigned PROFILE_GPU_FRAMES = 3;
+// Frames the rolling statistics cover
+const unsigned PROFILE_HISTORY = 120;
+
+// One timed span -- names must be string literals (only the pointer is stored)
+struct profileEvent
+{
+	const char* name;
+	int64_t begin, end;		// nanoseconds on the profiler clock
+	unsigned thread;		// index of the recording thread (PROFILE_GPU_THREAD for GPU spans)
+	unsigned depth;			// nesting level within the thread
+};
+
+const unsigned PROFILE_GPU_THREAD = ~0u;
+
+// Rolling timings for one scope name over the last PROFILE_HISTORY frames
+struct profileStat
+{
+	const char* name;
+	bool gpu;
+	unsigned frames;		// frames in the window that recorded this scope
+	double minMs, avgMs, p99Ms;
+};
+
+// Checked by every scope -- when false a scope costs one relaxed load
+extern std::atomic<bool> profilerEnabled;
+
+void setProfilerEnabled(bool enabled);
+inline bool isProfilerEnabled() { return profilerEnabled.load(std::memory_order_relaxed); }
+
+// Nanoseconds on the profiler clock
+int64_t profilerNow();
+// Sleeps until profilerNow() reaches deadline. OS sleeps overshoot by a millisecond or
+// more, so the last stretch is spent yielding instead.
+void sleepUntil(int64_t deadline);
+
+// Closes the current frame (collecting every thread's events and resolved GPU
+// timings) and opens the next. context::tick calls this once per frame.
+void profilerFrame();
+// The same for loops without a GL context (the software rasterizer) -- CPU events only
+void profilerCpuFrame();
+
+// Events of the last completed frame (CPU spans, plus GPU spans from PROFILE_GPU_FRAMES ago)
+const std::vector<profileEvent>& lastFrameEvents();
+void getProfileStats(std::vector<profileStat>& stats);
+
+// Writes the last completed frame as Chrome trace-event JSON (load in chrome://tracing or Perfetto)
+bool exportChromeTrace(const char* filePath);
+
+// Frees the GPU queries -- call before the GL context goes away
+void termProfiler();
+
+// Times the enclosing scope on the calling thread
+class profileScope
+{
+public:
+	explicit profileScope(const char* name)
+	{
+		if (isProfilerEnabled())
+		{
+			begin(name);
+		}
+	}
+	~profileScope()
+	{
+		if (scopeName != nullptr)
+		{
+			end();
+		}
+	}
+
+	profileScope(const profileScope&) = delete;
+	profileScope& operator=(const profileScope&) = delete;
+
+private:
+	void begin(const char* name);
+	void end();
+
+	const char* scopeName = nullptr;
+	int64_t start = 0;
+};
+
+// Times the enclosing scope on the GPU with timestamp queries, and labels it
+// with a KHR_debug group for graphics debuggers. Render thread only.
+class gpuProfileScope
+{
+public:
+	explicit gpuProfileScope(const char* name)
+	{
+		if (isProfilerEnabled())
+		{
+			begin(name);
+		}
+	}
+	~gpuProfileScope()
+	{
+		if (eventIndex != ~0u)
+		{
+			end();
+		}
+	}
+
+	gpuProfileScope(const gpuProfileScope&) = delete;
+	gpuProfileScope& operator=(const gpuProfileScope&) = delete;
+
+private:
+	void begin(const char* name);
+	void end();
+
+	unsigned eventIndex = ~0u;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing block
+#define PROFILE_SCOPE(name) profileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+// Times the rest of the enclosing block on both the CPU and the GPU
+#define PROFILE_GPU_SCOPE(name) PROFILE_SCOPE(name); gpuProfileScope PROFILE_CONCAT(gpuProfileScope_, __LINE__)(name)
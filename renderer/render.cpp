@@ -3,90 +3,213 @@
 #include <vector>   // std::vector
 #include <cassert>  // assert
 #include <cstddef>  // c-style function calls like fprintf
-#include <string>   // std::string, std::getline
-#include <fstream>  // fstream
+#include <cstdio>   // printf
+#include <string>   // std::string
+#include <limits>   // numeric_limits
 
 #include "glm/ext.hpp"
-#include "tinyobjloader/tiny_obj_loader.h"
 #include "stb/stb_image.h"
 
-geometry loadGeometry(const char* filePath)
+#include "instancing.h"
+#include "lod.h"
+#include "meshcache.h"
+#include "meshopt.h"
+#include "objloader.h"
+#include "profiler.h"
+#include "shadercache.h"
+
+geometry loadGeometry(const char* filePath, const meshLoadOptions& options)
 {
-    // load up all of the data from the file
-    tinyobj::attrib_t vertexAttributes;
+    meshData mesh;
+    if (!decodeMesh(filePath, options, mesh))
+    {
+        return {};  // return empty geo -- indicating failure
+    }
 
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string error;
+    // Return the geometry using the decoded data
+    geometry newGeo = makePackedGeometry(mesh.verts, mesh.vertCount, mesh.format,
+                                         mesh.indices, mesh.indxCount, mesh.indexType,
+                                         mesh.boundsMin, mesh.boundsMax,
+                                         mesh.lods, mesh.lodCount);
+    freeMeshData(mesh);
 
-    // double-check that everything's OK
-    // bool success = tinyobj::LoadObj(&vertexAttributes, &shapes, &materials, &error, filePath);
+    return newGeo;
+}
 
-    //if (!success)
-    //{
-    //    fprintf(stderr, error.c_str());
-    //    return {};  // return empty geo -- indicating failure
-    //}
+bool decodeMesh(const char* filePath, const meshLoadOptions& options, meshData& mesh)
+{
+    PROFILE_SCOPE("decodeMesh");
+
+    static_assert(MESH_CACHE_MAX_LODS == MESH_MAX_LODS, "mesh cache and meshData disagree on LOD count");
 
-    // get mesh data
-    std::vector<vertex> vertices;
-    std::vector<unsigned int> indices;
+    unsigned lodCount = options.lodCount < 1 ? 1 : (options.lodCount > MESH_MAX_LODS ? MESH_MAX_LODS : options.lodCount);
 
-    // form geometry data out of the mesh data provided by tinyobj
-    size_t offset = 0;
-    for (size_t i = 0; i < shapes[0].mesh.num_face_vertices.size(); ++i)
+    uint32_t processFlags = options.optimize ? MESH_PROCESS_OPTIMIZE : 0;
+    if (lodCount > 1)
     {
-        unsigned char faceVertices = shapes[0].mesh.num_face_vertices[i];
+        uint32_t reductionPercent = (uint32_t)(options.lodReduction * 100.0f + 0.5f) & 0xFF;
+        processFlags |= lodCount << MESH_PROCESS_LOD_COUNT_SHIFT | reductionPercent << MESH_PROCESS_LOD_REDUCTION_SHIFT;
+    }
 
-        assert(faceVertices == 3 && "unsupported number of face vertices");
+    mesh = {};
+    mesh.format = options.format;
 
-        // Iterate over vertex data
-        for (unsigned char j = 0; j < faceVertices; ++j)
+    // use the binary cache if the source hasn't changed since it was written
+    meshCacheView cached;
+    if (openMeshCache(filePath, processFlags, options.format, cached))
+    {
+        const meshCacheHeader& header = *cached.header;
+
+        // point straight into the mapped file -- no parsing, no copies
+        mesh.verts = cached.vertices;
+        mesh.indices = cached.indices;
+        mesh.vertCount = header.vertexCount;
+        mesh.indxCount = header.indexCount;
+        mesh.indexType = header.indexType;
+        mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+        mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+        mesh.cacheFile = cached.file;  // kept mapped until freeMeshData
+
+        mesh.lodCount = header.lodCount;
+        uint32_t firstIndex = 0;
+        for (unsigned i = 0; i < mesh.lodCount; ++i)
         {
-            tinyobj::index_t idx = shapes[0].mesh.indices[offset + j];
-
-            // position
-            tinyobj::real_t posX = vertexAttributes.vertices[3 * idx.vertex_index + 0];
-            tinyobj::real_t posY = vertexAttributes.vertices[3 * idx.vertex_index + 1];
-            tinyobj::real_t posZ = vertexAttributes.vertices[3 * idx.vertex_index + 2];
-
-            // vertex colors
-            tinyobj::real_t colR = 1.0f;
-            tinyobj::real_t colG = 1.0f;
-            tinyobj::real_t colB = 1.0f;
-
-            // UVs
-            tinyobj::real_t texU = vertexAttributes.texcoords[2 * idx.texcoord_index + 0];
-            tinyobj::real_t texV = vertexAttributes.texcoords[2 * idx.texcoord_index + 1];
-
-            // normal
-            tinyobj::real_t norX = vertexAttributes.normals[3 * idx.normal_index + 0];
-            tinyobj::real_t norY = vertexAttributes.normals[3 * idx.normal_index + 1];
-            tinyobj::real_t norZ = vertexAttributes.normals[3 * idx.normal_index + 2];
-
-            vertices.push_back(
-                vertex
-                {
-                    {posX, posY, posZ, 1.0f},   // vertex position
-                    {colR, colG, colB, 1.0f},   // vertex color
-                    {texU, texV},               // texture coordinates
-                    {norX, norY, norZ, 0.0f}    // vertex normal
-                }
-            );
-            indices.push_back(faceVertices * i + j);
+            mesh.lods[i] = { firstIndex, header.lodIndexCounts[i], header.lodErrors[i] };
+            firstIndex += header.lodIndexCounts[i];
         }
-        offset += faceVertices;
+
+        return true;
+    }
+
+    // load up all of the data from the file (parsed across all cores)
+    objMesh obj;
+    if (!loadObj(filePath, obj))
+    {
+        return false;
+    }
+
+    std::vector<vertex>& vertices = obj.vertices;
+    std::vector<unsigned int>& indices = obj.indices;
+
+    // share identical vertices and reorder for the post-transform cache
+    if (options.optimize)
+    {
+        meshOptStats stats = optimizeMesh(vertices, indices);
+
+        if (options.reportStats)
+        {
+            printf("%s: %zu -> %zu vertices, ACMR %.3f -> %.3f\n", filePath,
+                   stats.vertsBefore, stats.vertsAfter, stats.acmrBefore, stats.acmrAfter);
+        }
+    }
+
+    // simplified levels go after the full-resolution indices, sharing the vertices
+    mesh.lodCount = buildLodChain(vertices, indices, lodCount, options.lodReduction, mesh.lods);
+
+    if (options.reportStats && mesh.lodCount > 1)
+    {
+        for (unsigned i = 0; i < mesh.lodCount; ++i)
+        {
+            printf("%s: LOD %u -- %u triangles, error %.4f\n", filePath, i, mesh.lods[i].indexCount / 3, mesh.lods[i].error);
+        }
+    }
+
+    // object-space bounds (also used to quantize positions)
+    computeBounds(vertices.data(), vertices.size(), mesh.boundsMin, mesh.boundsMax);
+
+    // convert to the requested layout
+    packVertices(vertices.data(), vertices.size(), options.format, mesh.boundsMin, mesh.boundsMax, mesh.vertStorage);
+    mesh.indexType = packIndices(indices.data(), indices.size(), vertices.size(), mesh.indexStorage);
+
+    mesh.verts = mesh.vertStorage.data();
+    mesh.indices = mesh.indexStorage.data();
+    mesh.vertCount = vertices.size();
+    mesh.indxCount = indices.size();
+
+    // save the parsed mesh so the next load can skip all of this
+    uint32_t lodIndexCounts[MESH_MAX_LODS];
+    float lodErrors[MESH_MAX_LODS];
+    for (unsigned i = 0; i < mesh.lodCount; ++i)
+    {
+        lodIndexCounts[i] = mesh.lods[i].indexCount;
+        lodErrors[i] = mesh.lods[i].error;
     }
 
-    // Return makeGeometry using the data from tinyobj
-    return makeGeometry(vertices.data(), vertices.size(), indices.data(), indices.size());
+    writeMeshCache(filePath, processFlags, options.format,
+                   mesh.verts, mesh.vertCount,
+                   mesh.indices, mesh.indxCount, mesh.indexType,
+                   mesh.boundsMin, mesh.boundsMax,
+                   lodIndexCounts, lodErrors, mesh.lodCount);
+
+    return true;
+}
+
+void freeMeshData(meshData& mesh)
+{
+    unmapFile(mesh.cacheFile);
+    mesh = {};
 }
 
-geometry makeGeometry(vertex* verts, size_t vertCount, unsigned int* indices, size_t indxCount)
+geometry makeGeometry(const vertex* verts, size_t vertCount, const unsigned int* indices, size_t indxCount,
+                      const vertexFormat& format)
 {
+    glm::vec3 boundsMin, boundsMax;
+    computeBounds(verts, vertCount, boundsMin, boundsMax);
+
+    // Narrow the indices if we can
+    std::vector<unsigned char> packedIndices;
+    GLenum indexType = packIndices(indices, indxCount, vertCount, packedIndices);
+
+    // The full format is the vertex struct, so it can go up as-is
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        return makePackedGeometry(verts, vertCount, format, packedIndices.data(), indxCount, indexType,
+                                  boundsMin, boundsMax);
+    }
+
+    std::vector<unsigned char> packedVerts;
+    packVertices(verts, vertCount, format, boundsMin, boundsMax, packedVerts);
+
+    return makePackedGeometry(packedVerts.data(), vertCount, format, packedIndices.data(), indxCount, indexType,
+                              boundsMin, boundsMax);
+}
+
+geometry makePackedGeometry(const void* packedVerts, size_t vertCount, const vertexFormat& format,
+                            const void* packedIndices, size_t indxCount, GLenum indexType,
+                            const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                            const meshLod* lods, unsigned lodCount)
+{
+    PROFILE_GPU_SCOPE("upload geometry");
+
+    vertexLayout layout = describeVertexFormat(format);
+
     // Make an instance of geometry
     geometry newGeo = {};
-    newGeo.size = indxCount;
+    newGeo.indexType = indexType;
+    newGeo.format = format;
+    computeQuantization(format, boundsMin, boundsMax, newGeo.posScale, newGeo.posOffset);
+
+    // Bounds for culling -- the sphere encloses the box
+    newGeo.boundsMin = boundsMin;
+    newGeo.boundsMax = boundsMax;
+    newGeo.sphereCenter = (boundsMin + boundsMax) * 0.5f;
+    newGeo.sphereRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+    // Without a chain the whole index buffer is the only level
+    if (lods == nullptr || lodCount == 0)
+    {
+        newGeo.lodCount = 1;
+        newGeo.lods[0] = { 0, (uint32_t)indxCount, 0.0f };
+    }
+    else
+    {
+        newGeo.lodCount = lodCount < MESH_MAX_LODS ? lodCount : MESH_MAX_LODS;
+        for (unsigned i = 0; i < newGeo.lodCount; ++i)
+        {
+            newGeo.lods[i] = lods[i];
+        }
+    }
+    newGeo.size = newGeo.lods[0].indexCount;
 
     // Generate buffers and VAO
     glGenBuffers(1, &newGeo.vbo);   // 1 specifies number of buffer objects
@@ -99,49 +222,31 @@ geometry makeGeometry(vertex* verts, size_t vertCount, unsigned int* indices, si
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newGeo.ibo);  // bind IBO
 
     // Populate the buffers
-    glBufferData(GL_ARRAY_BUFFER, vertCount * sizeof(vertex), verts, GL_STATIC_DRAW);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indxCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
-
-    auto off = offsetof(vertex, pos);
+    glBufferData(GL_ARRAY_BUFFER, vertCount * layout.stride, packedVerts, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indxCount * indexTypeSize(indexType), packedIndices, GL_STATIC_DRAW);
 
     // Describe the data contained within the buffers
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,                // position
-                          4,                // number of things
-                          GL_FLOAT,         // type of things in the thing
-                          GL_FALSE,         // normalize this or not
-                          sizeof(vertex),   // byte offset between vertices
-                          (void*)0);        // byte offset within a vertex to get this data
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,                 // vertex color
-                          4,                 // number of things
-                          GL_FLOAT,          // type of things in the thing
-                          GL_FALSE,          // normalize this or not
-                          sizeof(vertex),    // byte offset between vertices
-                          (void*)16);        // byte offset within a vertex to get this data
-
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2,                  // uv
-                          2,                  // number of things
-                          GL_FLOAT,           // type of things in the thing
-                          GL_FALSE,           // normalize this or not
-                          sizeof(vertex),     // byte offset between vertices
-                          (void*)32);         // byte offset within a vertex to get this data
-
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3,                                    // normals
-                          4,                                    // how many things? (xyzw)
-                          GL_FLOAT,                             // what types of things? floats
-                          GL_FALSE,                             // normalize this? no
-                          sizeof(vertex),                       // how much data to skip to get to the next set of UV data?
-                          (void*)offsetof(vertex, normal));     // byte offset within a vertex to get to this data - 40
+    for (GLuint i = 0; i < layout.attributeCount; ++i)
+    {
+        const vertexAttribute& attrib = layout.attributes[i];
+
+        glEnableVertexAttribArray(attrib.location);
+        glVertexAttribPointer(attrib.location,          // attribute location (pos, color, uv, normal)
+                              attrib.components,        // number of things
+                              attrib.type,              // type of things in the thing
+                              attrib.normalized,        // normalize this or not
+                              layout.stride,            // byte offset between vertices
+                              (void*)(size_t)attrib.offset); // byte offset within a vertex to get this data
+    }
 
     // Unbind the buffers ( VAO, then the buffers)
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+    // Every geometry can be drawn instanced -- describe the per-instance attributes up front
+    attachInstanceLayout(newGeo.vao);
+
     // Return the geo
 
     return newGeo;
@@ -157,29 +262,104 @@ void freeGeometry(geometry& geo)
     geo = {};
 }
 
-texture loadTexture(const char* filePath)
+void computeBounds(const vertex* verts, size_t vertCount, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+    boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+    for (size_t i = 0; i < vertCount; ++i)
+    {
+        boundsMin = glm::min(boundsMin, glm::vec3(verts[i].pos));
+        boundsMax = glm::max(boundsMax, glm::vec3(verts[i].pos));
+    }
+}
+
+glm::mat4 positionTransform(const geometry& geo)
+{
+    return glm::scale(glm::translate(glm::identity<glm::mat4>(), geo.posOffset), geo.posScale);
+}
+
+texture loadTexture(const char* filePath, const textureLoadOptions& options)
 {
     assert(filePath != nullptr && "File path was invalid.");
 
-    // Variables to store data
+    // The storage format depends on the channel count, which stb can read from the header alone
     int imageWidth, imageHeight, imageFormat;
-    unsigned char* rawPixelData = nullptr;
+    int infoOK = stbi_info(filePath, &imageWidth, &imageHeight, &imageFormat);
+    assert(infoOK && "Image failed to load.");
+    if (!infoOK)
+    {
+        return {};
+    }
 
-    // Use stb to load image
-    stbi_set_flip_vertically_on_load(true);
-    rawPixelData = stbi_load(filePath, &imageWidth, &imageHeight, &imageFormat, STBI_default);
-    assert(rawPixelData != nullptr && "Image failed to load.");
+    textureCompression compression = chooseCompression(imageFormat, options);
 
-    // Pass image data to makeTexture
-    texture newTexture = makeTexture(imageWidth, imageHeight, imageFormat, rawPixelData);
+    // Use the built texture from the cache if the image hasn't changed
+    builtTexture built;
+    if (!openTextureCache(filePath, compression, options.mipmaps, built))
+    {
+        // Use stb to load image (always as RGBA -- the build stage works on 4 channels)
+        stbi_set_flip_vertically_on_load(true);
+        unsigned char* rawPixelData = stbi_load(filePath, &imageWidth, &imageHeight, &imageFormat, STBI_rgb_alpha);
+        assert(rawPixelData != nullptr && "Image failed to load.");
+        if (rawPixelData == nullptr)
+        {
+            return {};
+        }
 
-    // Free the image data
-    stbi_image_free(rawPixelData);
+        // Generate mips, compress, and save the result for next time
+        buildTexture(rawPixelData, imageWidth, imageHeight, imageFormat, compression, options.mipmaps, built);
+        writeTextureCache(filePath, options.mipmaps, built);
+
+        // Free the image data
+        stbi_image_free(rawPixelData);
+    }
+
+    texture newTexture = makeBuiltTexture(built);
+    freeBuiltTexture(built);
 
     // Return texture
     return newTexture;
 }
 
+texture makeBuiltTexture(const builtTexture& built, bool uploadLevels)
+{
+    PROFILE_GPU_SCOPE("upload texture");
+
+    texture retVal = { 0, built.width, built.height, built.channels };
+
+    glGenTextures(1, &retVal.handle);
+    glBindTexture(GL_TEXTURE_2D, retVal.handle);
+
+    // Immutable storage for the whole chain, then fill each level
+    glTexStorage2D(GL_TEXTURE_2D, built.levelCount, built.internalFormat, built.width, built.height);
+
+    for (unsigned l = 0; uploadLevels && l < built.levelCount; ++l)
+    {
+        const textureLevel& level = built.levels[l];
+        const unsigned char* levelData = built.data + level.offset;
+
+        if (built.compression == TEXTURE_RGBA8)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, level.width, level.height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, levelData);
+        }
+        else
+        {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, level.width, level.height,
+                                      built.internalFormat, (GLsizei)level.size, levelData);
+        }
+    }
+
+    // Trilinear filtering when there are mips to blend between
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, built.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return retVal;
+}
+
 texture makeTexture(unsigned width, unsigned height, unsigned channels, const unsigned char* pixels)
 {
     // Figure out OGL texture format to use
@@ -235,10 +415,19 @@ void freeTexture(texture& tex)
 
 shader makeShader(const char* vertSource, const char* fragSource)
 {
+    PROFILE_SCOPE("makeShader");
+
     // Make a shader program
     shader newShad = {};
     newShad.program = glCreateProgram(); // no parameters
 
+    // Skip compiling and linking entirely if this driver has seen these sources before
+    uint64_t cacheKey = shaderCacheKey(vertSource, fragSource);
+    if (loadProgramBinary(cacheKey, newShad.program))
+    {
+        return newShad;
+    }
+
     // Create the shaders
     GLuint vert = glCreateShader(GL_VERTEX_SHADER);     // this shader is a vertex shader
     GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);   // this shader is a fragment
@@ -259,49 +448,50 @@ shader makeShader(const char* vertSource, const char* fragSource)
     glAttachShader(newShad.program, vert);  // associate the vertex shader w/ the shader program
     glAttachShader(newShad.program, frag);  // associate the fragment shader w/ the shader program
 
-    // Link the shader program
+    // Link the shader program (keeping the binary around so it can be cached)
+    glProgramParameteri(newShad.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(newShad.program);
 
     // Delete the shaders
+    glDetachShader(newShad.program, vert);
+    glDetachShader(newShad.program, frag);
     glDeleteShader(vert);
     glDeleteShader(frag);
 
+    GLint linkStatus = GL_FALSE;
+    glGetProgramiv(newShad.program, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus != GL_TRUE)
+    {
+        GLchar message[1024];
+        glGetProgramInfoLog(newShad.program, 1024, nullptr, message);
+        fprintf(stderr, "\n[ERROR] Shader Link \n %s", message);
+        return newShad;
+    }
+
+    // Next launch links from this
+    saveProgramBinary(cacheKey, newShad.program);
+
     // Return the shader
     return newShad;
 }
 
 shader loadShader(const char* vertPath, const char* fragPath)
 {
-    // extract the text for vertex shader from the file
-    std::fstream vertFile(vertPath,         // path to the file
-        std::ios::in);    // the mode of operation (in == reading)
-
-    assert(vertFile.is_open() && "Failed to open vertex shader file.");
+    // Each file comes in with a single read
     std::string vertSource;
-    for (std::string line; std::getline(vertFile, line);)
-    {
-        vertSource += line + "\n";
-    }
-
-    vertFile.close();
+    bool vertOK = readFile(vertPath, vertSource);
+    assert(vertOK && "Failed to open vertex shader file.");
 
-    // extract the text for vertex shader from the file
-    std::fstream fragFile(fragPath,         // path to the file
-        std::ios::in);    // the mode of operation (in == reading)
-
-    assert(fragFile.is_open() && "Failed to open fragment shader file.");
     std::string fragSource;
-    for (std::string line; std::getline(fragFile, line);)
+    bool fragOK = readFile(fragPath, fragSource);
+    assert(fragOK && "Failed to open fragment shader file.");
+
+    if (!vertOK || !fragOK)
     {
-        fragSource += line + "\n";
+        return {};
     }
 
-    fragFile.close();
-
     return makeShader(vertSource.c_str(), fragSource.c_str());
-
-    // extract the text for fragment shader from the file
-    // pass it along to makeShader and return the final return value
 }
 
 void freeShader(shader& shad)
@@ -330,19 +520,54 @@ bool checkShader(GLuint target, const char* humanReadableName)
     return true;
 }
 
-void draw(const shader& shad, const geometry& geo)
+namespace
 {
+    drawCounters counters;
+}
+
+const drawCounters& getDrawCounters()
+{
+    return counters;
+}
+
+void resetDrawCounters()
+{
+    counters = {};
+}
+
+void countDraw(uint64_t indexCount, uint64_t instanceCount, unsigned calls)
+{
+    counters.drawCalls += calls;
+    counters.instances += instanceCount;
+    counters.triangles += indexCount / 3 * instanceCount;
+}
+
+void draw(const shader& shad, const geometry& geo, unsigned lod)
+{
+    assert(lod < geo.lodCount && "geometry has no such LOD");
+
+    PROFILE_GPU_SCOPE("draw");
+
     // Specify which shader
     glUseProgram(shad.program);
 
     // Specify which VAO
     glBindVertexArray(geo.vao);
 
+    // Geometry without vertex colors reads white from the generic attribute
+    if (geo.format.color == COLOR_NONE)
+    {
+        glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
     // Draw
-    glDrawElements(GL_TRIANGLES,    // primitive type
-                   geo.size,        // indices
-                   GL_UNSIGNED_INT, // index type
-                   0);
+    const meshLod& level = geo.lods[lod];
+    glDrawElements(GL_TRIANGLES,        // primitive type
+                   level.indexCount,    // indices
+                   geo.indexType,       // index type
+                   (void*)((size_t)level.firstIndex * indexTypeSize(geo.indexType)));
+
+    countDraw(level.indexCount);
 }
 
 void setUniform(const shader& shad, GLuint location, const glm::mat4& value)
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstdint>			// uint64_t
 #include <vector>			// vector
 
 #include "glew/GL/glew.h"	// glew (GLuint, etc.)
 #include "glm/glm.hpp"		// glm math types (vec4)
 
+#include "fileio.h"			// mappedFile
+#include "texturebuild.h"	// builtTexture, textureLoadOptions
+#include "vertexformat.h"	// vertexFormat
+
 // Define vertext structure
 struct vertex
 {
@@ -14,11 +19,33 @@ struct vertex
 	glm::vec4 normal; 
 };
 
+// Most detail levels a mesh can carry (the full-resolution one included)
+const unsigned MESH_MAX_LODS = 8;
+
+// One detail level -- a run of the shared index buffer drawn over the shared vertices
+struct meshLod
+{
+	uint32_t firstIndex, indexCount;
+	float error;	// object-space distance the surface may have moved from full detail
+};
+
 // An object to represent mesh
 struct geometry
 {
 	GLuint vao, vbo, ibo;	// buffers
-	GLuint size;			// index count
+	GLuint size;			// index count of the full-resolution level
+	GLenum indexType;		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+	vertexFormat format;	// layout of the vertex buffer
+	glm::vec3 posScale;		// maps stored positions back to object space
+	glm::vec3 posOffset;
+
+	glm::vec3 boundsMin, boundsMax;	// object-space AABB
+	glm::vec3 sphereCenter;			// object-space bounding sphere
+	float sphereRadius;
+
+	unsigned lodCount;				// levels in lods (always at least 1)
+	meshLod lods[MESH_MAX_LODS];	// every level lives in vbo/ibo
 };
 
 // An object to represent shader
@@ -39,13 +66,56 @@ struct light
 	glm::vec3 color;
 };
 
+// Options for processing meshes loaded from disk
+struct meshLoadOptions
+{
+	bool optimize = true;		// weld vertices and reorder for the vertex cache
+	bool reportStats = false;	// print before/after vertex counts and ACMR
+	vertexFormat format = VERTEX_FORMAT_FULL;	// layout of the uploaded vertices
+	unsigned lodCount = 1;		// detail levels to generate (1 = full resolution only)
+	float lodReduction = 0.5f;	// triangles each level keeps from the one before
+};
+
+// Mesh data decoded on the CPU and ready to upload
+struct meshData
+{
+	vertexFormat format;
+	const void* verts;		// packed vertices (into vertStorage or the mapped cache)
+	const void* indices;	// packed indices
+	size_t vertCount, indxCount;
+	GLenum indexType;
+	glm::vec3 boundsMin, boundsMax;
+	unsigned lodCount;				// indices holds every level back to back
+	meshLod lods[MESH_MAX_LODS];
+
+	std::vector<unsigned char> vertStorage, indexStorage;
+	mappedFile cacheFile;
+};
+
 // Functions to make and unmake above types
-geometry loadGeometry(const char* filePath);
-geometry makeGeometry(vertex* verts, size_t vertCount,
-	unsigned int* indices, size_t indxCount);
+geometry loadGeometry(const char* filePath, const meshLoadOptions& options = meshLoadOptions());
+geometry makeGeometry(const vertex* verts, size_t vertCount,
+	const unsigned int* indices, size_t indxCount,
+	const vertexFormat& format = VERTEX_FORMAT_FULL);
+// Uploads vertices/indices that are already in their final format
+geometry makePackedGeometry(const void* packedVerts, size_t vertCount, const vertexFormat& format,
+	const void* packedIndices, size_t indxCount, GLenum indexType,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	const meshLod* lods = nullptr, unsigned lodCount = 0);
 void freeGeometry(geometry& geo);
 
-texture loadTexture(const char* filePath);
+// Reads (or maps from the cache) and packs a mesh without touching GL -- safe to call from any thread
+bool decodeMesh(const char* filePath, const meshLoadOptions& options, meshData& mesh);
+void freeMeshData(meshData& mesh);
+
+void computeBounds(const vertex* verts, size_t vertCount, glm::vec3& boundsMin, glm::vec3& boundsMax);
+// Model-space transform that undoes position quantization -- multiply into the model matrix
+glm::mat4 positionTransform(const geometry& geo);
+
+texture loadTexture(const char* filePath, const textureLoadOptions& options = textureLoadOptions());
+// Uploads a texture built by the texture build stage into immutable storage.
+// Without uploadLevels only the storage is made, for the caller to fill.
+texture makeBuiltTexture(const builtTexture& built, bool uploadLevels = true);
 texture makeTexture(unsigned width, unsigned height, unsigned channels, const unsigned char* pixels);
 void freeTexture(texture& tex);
 
@@ -54,7 +124,20 @@ shader loadShader(const char* vertPath, const char* fragPath);
 void freeShader(shader& shad);
 bool checkShader(GLuint target, const char* humanReadableName = "");
 
-void draw(const shader& shad, const geometry& geo);
+void draw(const shader& shad, const geometry& geo, unsigned lod = 0);
+
+// Work submitted by every draw path since the last resetDrawCounters
+struct drawCounters
+{
+	unsigned drawCalls;		// API calls (a multi-draw counts once)
+	uint64_t instances;
+	uint64_t triangles;
+};
+
+const drawCounters& getDrawCounters();
+void resetDrawCounters();
+// Called by the draw paths themselves
+void countDraw(uint64_t indexCount, uint64_t instanceCount = 1, unsigned calls = 1);
 
 void setUniform(const shader& shad, GLuint location, const glm::mat4& value);
 void setUniform(const shader& shad, GLuint location, const texture& tex, int textureSlot);
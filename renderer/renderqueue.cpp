@@ -0,0 +1,344 @@
+#include "renderqueue.h"
+
+#include <cassert>  // assert
+#include <cstring>  // memcmp, memcpy
+
+#include "glm/ext.hpp"
+
+#include "instancing.h"
+#include "profiler.h"
+#include "render.h"
+#include "uniformblocks.h"
+
+namespace
+{
+    const unsigned LAYER_SHIFT = 62;
+
+    // Field widths -- handles wider than these only lose sort quality, never correctness
+    const uint64_t PROGRAM_MASK = 0xFFF;
+    const uint64_t TEXTURE_MASK = 0xFFF;
+    const uint64_t VAO_MASK = 0x3FFF;
+    const uint64_t DEPTH_MASK = 0xFFFFFF;
+
+    // Non-negative floats sort like their bit patterns; keep the top 24 bits below the sign
+    uint64_t quantizeDepth(float depth)
+    {
+        if (!(depth > 0.0f))
+        {
+            return 0;
+        }
+
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        return (bits >> 7) & DEPTH_MASK;
+    }
+
+    uint64_t hashTextureSet(const packetTexture* textures, unsigned textureCount)
+    {
+        uint64_t hash = 0;
+        for (unsigned i = 0; i < textureCount; ++i)
+        {
+            hash = (hash ^ textures[i].handle) * 0x9E3779B97F4A7C15ull;
+        }
+        return (hash >> 52) & TEXTURE_MASK;
+    }
+
+    void fillPacket(drawPacket& packet, const shader& shad, const geometry& geo, unsigned lod, const glm::mat4& model,
+                    const packetTexture* textures, unsigned textureCount)
+    {
+        assert(textureCount <= RENDER_MAX_TEXTURES && "too many textures for one packet");
+        assert(lod < geo.lodCount && "geometry has no such LOD");
+
+        packet.program = shad.program;
+        packet.vao = geo.vao;
+        packet.indexCount = (GLsizei)geo.lods[lod].indexCount;
+        packet.indexType = geo.indexType;
+        packet.firstIndex = geo.lods[lod].firstIndex;
+        packet.whiteColor = geo.format.color == COLOR_NONE;
+
+        packet.textureCount = textureCount < RENDER_MAX_TEXTURES ? textureCount : RENDER_MAX_TEXTURES;
+        for (unsigned i = 0; i < packet.textureCount; ++i)
+        {
+            packet.textures[i] = textures[i];
+        }
+
+        packet.model = model * positionTransform(geo);
+    }
+}
+
+uint64_t makeSortKey(renderLayer layer, GLuint program, const packetTexture* textures, unsigned textureCount,
+                     GLuint vao, float depth)
+{
+    uint64_t key = (uint64_t)layer << LAYER_SHIFT;
+    uint64_t programBits = program & PROGRAM_MASK;
+    uint64_t textureBits = hashTextureSet(textures, textureCount);
+    uint64_t vaoBits = vao & VAO_MASK;
+
+    switch (layer)
+    {
+    case RENDER_LAYER_OPAQUE:
+        // state first, then front to back within the same state
+        key |= programBits << 50 | textureBits << 38 | vaoBits << 24 | quantizeDepth(depth);
+        break;
+    case RENDER_LAYER_TRANSPARENT:
+        // back to front is required for blending -- state only breaks ties
+        key |= (DEPTH_MASK - quantizeDepth(depth)) << 38 | programBits << 26 | textureBits << 14 | vaoBits;
+        break;
+    default:
+        key |= programBits << 50 | textureBits << 38 | vaoBits << 24;
+        break;
+    }
+
+    return key;
+}
+
+void clearRenderQueue(renderQueue& queue)
+{
+    queue.packets.clear();
+    queue.order.clear();
+}
+
+void submitDraw(renderQueue& queue, renderLayer layer, const shader& shad, const geometry& geo,
+                const glm::mat4& model, const packetTexture* textures, unsigned textureCount, float depth,
+                unsigned lod)
+{
+    drawPacket packet = {};
+    fillPacket(packet, shad, geo, lod, model, textures, textureCount);
+    packet.key = makeSortKey(layer, packet.program, packet.textures, packet.textureCount, packet.vao, depth);
+
+    queue.packets.push_back(packet);
+}
+
+void submitInstanced(renderQueue& queue, renderLayer layer, const shader& shad, const geometry& geo,
+                     const instanceBuffer& instances, const packetTexture* textures, unsigned textureCount,
+                     float depth, size_t firstInstance, size_t instanceCount, unsigned lod)
+{
+    size_t available = instances.instances.size();
+    assert(firstInstance <= available && "first instance out of range");
+
+    if (instanceCount == 0)
+    {
+        instanceCount = available - firstInstance;
+    }
+    if (instanceCount == 0)
+    {
+        return;
+    }
+
+    // Instances carry their own transforms -- the model matrix only undoes quantization
+    drawPacket packet = {};
+    fillPacket(packet, shad, geo, lod, glm::identity<glm::mat4>(), textures, textureCount);
+    packet.key = makeSortKey(layer, packet.program, packet.textures, packet.textureCount, packet.vao, depth);
+
+    packet.instances = instances.handle;
+    packet.firstInstance = (GLuint)firstInstance;
+    packet.instanceCount = (GLsizei)instanceCount;
+
+    queue.packets.push_back(packet);
+}
+
+void sortRenderQueue(renderQueue& queue)
+{
+    PROFILE_SCOPE("sortRenderQueue");
+
+    size_t count = queue.packets.size();
+
+    queue.keys.resize(count);
+    queue.keyScratch.resize(count);
+    queue.order.resize(count);
+    queue.orderScratch.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        queue.keys[i] = queue.packets[i].key;
+        queue.order[i] = (uint32_t)i;
+    }
+
+    // Histogram every byte in one pass over the keys
+    size_t histograms[8][256] = {};
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t key = queue.keys[i];
+        for (unsigned pass = 0; pass < 8; ++pass)
+        {
+            ++histograms[pass][(key >> (pass * 8)) & 0xFF];
+        }
+    }
+
+    // LSD radix sort, 8 bits at a time -- stable, so equal keys keep submission order
+    uint64_t* keys = queue.keys.data();
+    uint64_t* keysOut = queue.keyScratch.data();
+    uint32_t* order = queue.order.data();
+    uint32_t* orderOut = queue.orderScratch.data();
+
+    for (unsigned pass = 0; pass < 8; ++pass)
+    {
+        size_t* histogram = histograms[pass];
+        unsigned shift = pass * 8;
+
+        // Every key has the same byte here -- this pass wouldn't move anything
+        if (count == 0 || histogram[(keys[0] >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (unsigned bucket = 0; bucket < 256; ++bucket)
+        {
+            size_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t destination = histogram[(keys[i] >> shift) & 0xFF]++;
+            keysOut[destination] = keys[i];
+            orderOut[destination] = order[i];
+        }
+
+        uint64_t* swapKeys = keys; keys = keysOut; keysOut = swapKeys;
+        uint32_t* swapOrder = order; order = orderOut; orderOut = swapOrder;
+    }
+
+    // An odd number of passes leaves the result in the scratch arrays
+    if (order != queue.order.data())
+    {
+        queue.order.swap(queue.orderScratch);
+        queue.keys.swap(queue.keyScratch);
+    }
+}
+
+void executeRenderQueue(renderQueue& queue, uniformRing* objects)
+{
+    PROFILE_GPU_SCOPE("executeRenderQueue");
+
+    renderQueueStats stats = {};
+
+    // Unsorted queues still draw, just in submission order
+    if (queue.order.size() != queue.packets.size())
+    {
+        queue.order.resize(queue.packets.size());
+        for (size_t i = 0; i < queue.order.size(); ++i)
+        {
+            queue.order[i] = (uint32_t)i;
+        }
+    }
+    stats.packets = (unsigned)queue.order.size();
+
+    // Start from "unknown" so the first packet binds everything
+    GLuint boundProgram = ~0u;
+    GLuint boundVao = ~0u;
+    GLuint boundInstances = 0;
+    GLuint boundTextures[RENDER_MAX_TEXTURES];
+    for (unsigned i = 0; i < RENDER_MAX_TEXTURES; ++i)
+    {
+        boundTextures[i] = ~0u;
+    }
+    const glm::mat4* lastModel = nullptr;
+
+    for (uint32_t packetIndex : queue.order)
+    {
+        const drawPacket& packet = queue.packets[packetIndex];
+
+        bool programChanged = packet.program != boundProgram;
+        if (programChanged)
+        {
+            glUseProgram(packet.program);
+            boundProgram = packet.program;
+            if (objects == nullptr)
+            {
+                lastModel = nullptr;    // uniforms belong to the program (a bound block doesn't)
+            }
+            ++stats.programBinds;
+        }
+        else
+        {
+            ++stats.programSkips;
+        }
+
+        if (packet.vao != boundVao)
+        {
+            glBindVertexArray(packet.vao);
+            boundVao = packet.vao;
+            boundInstances = 0;     // instance bindings are VAO state
+            ++stats.vaoBinds;
+        }
+        else
+        {
+            ++stats.vaoSkips;
+        }
+
+        for (unsigned slot = 0; slot < packet.textureCount; ++slot)
+        {
+            const packetTexture& tex = packet.textures[slot];
+            if (tex.handle != boundTextures[slot])
+            {
+                glActiveTexture(GL_TEXTURE0 + slot);
+                glBindTexture(GL_TEXTURE_2D, tex.handle);
+                boundTextures[slot] = tex.handle;
+                ++stats.textureBinds;
+            }
+            else
+            {
+                ++stats.textureSkips;
+            }
+
+            // Sampler uniforms are program state -- only needs setting when the program changes
+            if (programChanged)
+            {
+                glProgramUniform1i(packet.program, tex.location, (GLint)slot);
+            }
+        }
+
+        if (lastModel == nullptr || memcmp(lastModel, &packet.model, sizeof(glm::mat4)) != 0)
+        {
+            if (objects != nullptr)
+            {
+                // A full ring leaves the last block bound -- drawing would use another object's
+                // model, so skip the packet (the ring has already warned)
+                objectBlock block = { packet.model, glm::vec4(1.0f) };
+                if (!setObjectBlock(*objects, block))
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                glProgramUniformMatrix4fv(packet.program, RENDER_MODEL_LOCATION, 1, GL_FALSE, glm::value_ptr(packet.model));
+            }
+            lastModel = &packet.model;
+            ++stats.modelUploads;
+        }
+        else
+        {
+            ++stats.modelSkips;
+        }
+
+        // Geometry without vertex colors reads white from the generic attribute
+        if (packet.whiteColor)
+        {
+            glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+        }
+
+        const void* indexOffset = (const void*)((size_t)packet.firstIndex * indexTypeSize(packet.indexType));
+        if (packet.instances == 0)
+        {
+            glDrawElements(GL_TRIANGLES, packet.indexCount, packet.indexType, indexOffset);
+            countDraw(packet.indexCount);
+            continue;
+        }
+
+        if (packet.instances != boundInstances)
+        {
+            bindInstanceAttributes(packet.instances);
+            boundInstances = packet.instances;
+        }
+
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, packet.indexCount, packet.indexType, indexOffset,
+                                            packet.instanceCount, packet.firstInstance);
+        countDraw(packet.indexCount, packet.instanceCount);
+    }
+
+    queue.stats = stats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint64_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (mat4)
+
+struct geometry;
+struct instanceBuffer;
+struct shader;
+struct texture;
+struct uniformRing;
+
+const unsigned RENDER_MAX_TEXTURES = 4;
+const GLuint RENDER_MODEL_LOCATION = 2;		// uniform location packets write their model matrix to
+
+// Layers sort before anything else -- opaque draws front to back, transparent back to front
+enum renderLayer
+{
+	RENDER_LAYER_OPAQUE,
+	RENDER_LAYER_TRANSPARENT,
+	RENDER_LAYER_OVERLAY		// no depth ordering
+};
+
+// A texture and the sampler uniform that reads it
+struct packetTexture
+{
+	GLuint handle;
+	GLuint location;	// sampler uniform location
+};
+
+// Everything needed to issue one draw, captured at submit time
+struct drawPacket
+{
+	uint64_t key;
+
+	GLuint program;
+	GLuint vao;
+	GLsizei indexCount;
+	GLenum indexType;
+	GLuint firstIndex;		// start of the LOD within the index buffer
+	bool whiteColor;		// geometry has no vertex colors
+
+	packetTexture textures[RENDER_MAX_TEXTURES];	// bound to slots 0..textureCount-1
+	unsigned textureCount;
+
+	glm::mat4 model;		// includes the geometry's position transform
+
+	GLuint instances;		// instance buffer (0 for a plain draw)
+	GLuint firstInstance;
+	GLsizei instanceCount;
+};
+
+// Binds issued and skipped during the last executeRenderQueue
+struct renderQueueStats
+{
+	unsigned packets;
+
+	unsigned programBinds, programSkips;
+	unsigned vaoBinds, vaoSkips;
+	unsigned textureBinds, textureSkips;
+	unsigned modelUploads, modelSkips;
+};
+
+// A frame's draw list. Submit packets in any order, then sort and execute.
+struct renderQueue
+{
+	std::vector<drawPacket> packets;
+	std::vector<uint64_t> keys, keyScratch;		// radix sort working space
+	std::vector<uint32_t> order, orderScratch;	// packet indices -- in draw order after sorting
+
+	renderQueueStats stats;
+};
+
+// Packs layer, shader, texture set, geometry and depth into a 64-bit key (depth is view distance)
+uint64_t makeSortKey(renderLayer layer, GLuint program, const packetTexture* textures, unsigned textureCount,
+	GLuint vao, float depth);
+
+// Forgets last frame's packets (keeps the allocations)
+void clearRenderQueue(renderQueue& queue);
+
+void submitDraw(renderQueue& queue, renderLayer layer, const shader& shad, const geometry& geo,
+	const glm::mat4& model, const packetTexture* textures, unsigned textureCount, float depth,
+	unsigned lod = 0);
+void submitInstanced(renderQueue& queue, renderLayer layer, const shader& shad, const geometry& geo,
+	const instanceBuffer& instances, const packetTexture* textures, unsigned textureCount, float depth,
+	size_t firstInstance = 0, size_t instanceCount = 0, unsigned lod = 0);
+
+// Radix-sorts the packets by key
+void sortRenderQueue(renderQueue& queue);
+// Issues every packet in sorted order, skipping binds that would not change any state.
+// With an objects ring, model matrices go out as object blocks bound by offset (shared
+// by every program) instead of per-program uniforms.
+void executeRenderQueue(renderQueue& queue, uniformRing* objects = nullptr);
@@ -0,0 +1,204 @@
+#include "shadercache.h"
+
+#include <cstdio>   // fprintf, remove
+#include <cstring>  // memcpy, strlen
+#include <fstream>  // ofstream
+#include <vector>   // vector
+
+#include "fileio.h"
+
+namespace
+{
+    const uint32_t PROGRAM_CACHE_MAGIC = 0x47525053;    // "SPRG"
+    const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+    // Fixed-size header in front of every program binary
+    struct programCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;           // repeated so a renamed or colliding file is caught
+        uint32_t binaryFormat;
+        uint32_t binarySize;
+    };
+
+    std::string cacheDirectory = "shadercache";
+    bool cacheEnabled = true;
+    shaderCacheStats stats = {};
+
+    uint64_t driverHash = 0;
+    bool driverHashed = false;
+    bool driverSupportsBinaries = false;
+
+    uint64_t hashString(const char* text, uint64_t seed)
+    {
+        return text != nullptr ? hashBytes(text, strlen(text), seed) : seed;
+    }
+
+    // Vendor/renderer/version only change between runs, so look them up once
+    void hashDriver()
+    {
+        if (driverHashed)
+        {
+            return;
+        }
+
+        uint64_t hash = 0;
+        hash = hashString((const char*)glGetString(GL_VENDOR), hash);
+        hash = hashString((const char*)glGetString(GL_RENDERER), hash);
+        hash = hashString((const char*)glGetString(GL_VERSION), hash);
+        driverHash = hash;
+
+        // Some drivers link fine but have nowhere to put a binary
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        driverSupportsBinaries = formatCount > 0;
+
+        driverHashed = true;
+    }
+
+    std::string programCachePath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.progbin", (unsigned long long)key);
+        return cacheDirectory + "/" + name;
+    }
+}
+
+void setShaderCacheDirectory(const char* dirPath)
+{
+    cacheDirectory = dirPath;
+}
+
+void setShaderCacheEnabled(bool enabled)
+{
+    cacheEnabled = enabled;
+}
+
+bool isShaderCacheEnabled()
+{
+    hashDriver();
+    return cacheEnabled && driverSupportsBinaries;
+}
+
+const shaderCacheStats& getShaderCacheStats()
+{
+    return stats;
+}
+
+uint64_t shaderCacheKey(const char* vertSource, const char* fragSource)
+{
+    hashDriver();
+
+    // Stage boundaries matter -- a line moved between stages is a different program
+    uint64_t key = hashString(vertSource, driverHash);
+    key = hashString(fragSource, key ^ 0x9E3779B97F4A7C15ull);
+    return key;
+}
+
+bool loadProgramBinary(uint64_t key, GLuint program)
+{
+    if (!isShaderCacheEnabled())
+    {
+        return false;
+    }
+
+    std::string path = programCachePath(key);
+    mappedFile file = mapFile(path.c_str());
+    if (file.data == nullptr)
+    {
+        ++stats.misses;
+        return false;
+    }
+
+    programCacheHeader header;
+    bool valid = file.size >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, file.data, sizeof(header));
+        valid = header.magic == PROGRAM_CACHE_MAGIC &&
+                header.version == PROGRAM_CACHE_VERSION &&
+                header.key == key &&
+                file.size - sizeof(header) >= header.binarySize;
+    }
+
+    GLint linked = GL_FALSE;
+    if (valid)
+    {
+        // The driver re-validates the binary and fails the "link" if it can't use it
+        glProgramBinary(program, header.binaryFormat, file.data + sizeof(header), header.binarySize);
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+
+    unmapFile(file);
+
+    if (linked != GL_TRUE)
+    {
+        // Stale after a driver update, or corrupt -- drop it and let the caller recompile
+        remove(path.c_str());
+        ++stats.rejected;
+        return false;
+    }
+
+    ++stats.hits;
+    return true;
+}
+
+bool saveProgramBinary(uint64_t key, GLuint program)
+{
+    if (!isShaderCacheEnabled())
+    {
+        return false;
+    }
+
+    GLint binaryLength = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    if (binaryLength <= 0)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> binary((size_t)binaryLength);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, binaryLength, nullptr, &binaryFormat, binary.data());
+
+    programCacheHeader header = {};
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binarySize = (uint32_t)binaryLength;
+
+    if (!makeDirectory(cacheDirectory.c_str()))
+    {
+        fprintf(stderr, "[WARNING] could not create shader cache directory %s\n", cacheDirectory.c_str());
+        return false;
+    }
+
+    // Write to a temp file first so a crash never leaves a half-written binary behind
+    std::string cachePath = programCachePath(key);
+    std::string tempPath = uniqueTempPath(cachePath);
+
+    std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        fprintf(stderr, "[WARNING] could not write shader cache %s\n", cachePath.c_str());
+        return false;
+    }
+
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)binary.data(), binary.size());
+
+    bool ok = out.good();
+    out.close();
+
+    if (!ok || !replaceFile(tempPath.c_str(), cachePath.c_str()))
+    {
+        fprintf(stderr, "[WARNING] could not write shader cache %s\n", cachePath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    ++stats.writes;
+    return true;
+}
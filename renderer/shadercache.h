@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>			// uint64_t
+#include <string>			// std::string
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+
+// Outcome counts for every program makeShader has built
+struct shaderCacheStats
+{
+	unsigned hits;		// linked straight from a cached binary
+	unsigned misses;	// no cached binary -- compiled from source
+	unsigned rejected;	// a cached binary existed but the driver refused it (then compiled)
+	unsigned writes;	// binaries saved after compiling
+};
+
+// Where program binaries are kept (created on first write) -- "shadercache" by default
+void setShaderCacheDirectory(const char* dirPath);
+void setShaderCacheEnabled(bool enabled);
+bool isShaderCacheEnabled();
+
+const shaderCacheStats& getShaderCacheStats();
+
+// Identifies a program: both stages' sources plus the driver's vendor, renderer
+// and version strings (binaries are only valid for the driver that made them)
+uint64_t shaderCacheKey(const char* vertSource, const char* fragSource);
+
+// Links program from the cached binary for key -- false means compile it instead
+// (counted as a miss, or a rejection if the driver refused the binary)
+bool loadProgramBinary(uint64_t key, GLuint program);
+// Saves a linked program (link it with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set)
+bool saveProgramBinary(uint64_t key, GLuint program);
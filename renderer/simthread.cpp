@@ -0,0 +1,129 @@
+#include "simthread.h"
+
+#include <cassert>      // assert
+#include <cstdio>       // fprintf
+
+#include "profiler.h"   // PROFILE_SCOPE, profilerNow, sleepUntil
+
+namespace
+{
+    const uint32_t SLOT_MASK = TRIPLE_BUFFER_FRESH - 1;
+
+    void runSimThread(simThread* sim)
+    {
+        int64_t tickLength = (int64_t)(sim->options.tickSeconds * 1000000000.0);
+        uint64_t tick = 0;
+
+        while (sim->running.load(std::memory_order_acquire))
+        {
+            // Tick n is due once the clock passes the end of it
+            int64_t deadline = sim->start.load() + (int64_t)(tick + 1) * tickLength;
+            int64_t now = profilerNow();
+            if (now < deadline)
+            {
+                sleepUntil(deadline);
+                continue;
+            }
+
+            // Behind -- catch up with ticks back to back, up to a point
+            unsigned ran = 0;
+            while (now >= deadline && ran < sim->options.maxCatchUpTicks && sim->running.load(std::memory_order_acquire))
+            {
+                int64_t begin = profilerNow();
+                {
+                    PROFILE_SCOPE("sim tick");
+                    sim->tick(sim->options.tickSeconds, (double)(tick + 1) * sim->options.tickSeconds, tick, sim->user);
+                }
+                int64_t spent = profilerNow() - begin;
+
+                sim->stats.ticks.fetch_add(1);
+                sim->stats.tickNanoseconds.fetch_add((uint64_t)spent);
+                if ((uint64_t)spent > sim->stats.maxTickNanoseconds.load())
+                {
+                    sim->stats.maxTickNanoseconds.store((uint64_t)spent);
+                }
+
+                ++tick;
+                ++ran;
+                deadline += tickLength;
+                now = profilerNow();
+            }
+
+            // Still behind -- the simulation runs slow for a moment rather than spiralling
+            if (now >= deadline && ran == sim->options.maxCatchUpTicks)
+            {
+                int64_t dropped = (now - deadline) / tickLength + 1;
+                sim->start.fetch_add(dropped * tickLength);
+                sim->stats.droppedTicks.fetch_add((uint64_t)dropped);
+            }
+        }
+    }
+}
+
+void initTripleBuffer(tripleBufferSlots& slots)
+{
+    slots.writing = 0;
+    slots.waiting.store(1);
+    slots.reading = 2;
+}
+
+uint32_t publishSlot(tripleBufferSlots& slots)
+{
+    uint32_t previous = slots.waiting.exchange(slots.writing | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel);
+    slots.writing = previous & SLOT_MASK;
+    return slots.writing;
+}
+
+bool acquireSlot(tripleBufferSlots& slots)
+{
+    if ((slots.waiting.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0)
+    {
+        return false;
+    }
+
+    uint32_t previous = slots.waiting.exchange(slots.reading, std::memory_order_acq_rel);
+    slots.reading = previous & SLOT_MASK;
+    return true;
+}
+
+bool startSimThread(simThread& sim, simTickFn tick, void* user, const simThreadOptions& options)
+{
+    assert(!sim.thread.joinable() && "simulation thread is already running");
+    if (tick == nullptr || options.tickSeconds <= 0.0)
+    {
+        fprintf(stderr, "[ERROR] simulation thread needs a tick function and a positive tick length\n");
+        return false;
+    }
+
+    sim.tick = tick;
+    sim.user = user;
+    sim.options = options;
+    sim.options.maxCatchUpTicks = options.maxCatchUpTicks > 0 ? options.maxCatchUpTicks : 1;
+    sim.stats.ticks.store(0);
+    sim.stats.droppedTicks.store(0);
+    sim.stats.tickNanoseconds.store(0);
+    sim.stats.maxTickNanoseconds.store(0);
+    sim.start.store(profilerNow());
+    sim.running.store(true, std::memory_order_release);
+    sim.thread = std::thread(runSimThread, &sim);
+    return true;
+}
+
+void stopSimThread(simThread& sim)
+{
+    sim.running.store(false, std::memory_order_release);
+    if (sim.thread.joinable())
+    {
+        sim.thread.join();
+    }
+}
+
+double simClock(const simThread& sim)
+{
+    return (profilerNow() - sim.start.load()) / 1000000000.0;
+}
+
+double simRenderTime(const simThread& sim)
+{
+    return simClock(sim) - sim.options.tickSeconds;
+}
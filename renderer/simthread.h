@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>			// atomic
+#include <cstdint>			// int64_t, uint32_t, uint64_t
+#include <thread>			// thread
+
+// Slot bookkeeping for a lock-free triple buffer. The writer fills its slot and swaps it
+// with the waiting one; the reader swaps its slot for the waiting one when that is newer.
+// Neither side ever waits, and the reader always gets the newest complete slot.
+struct tripleBufferSlots
+{
+	std::atomic<uint32_t> waiting;	// slot index, plus TRIPLE_BUFFER_FRESH until the reader takes it
+	uint32_t writing;				// only touched by the writer
+	uint32_t reading;				// only touched by the reader
+};
+
+const uint32_t TRIPLE_BUFFER_FRESH = 4;
+
+void initTripleBuffer(tripleBufferSlots& slots);
+// Writer: publishes the slot just written and returns the one to write next
+uint32_t publishSlot(tripleBufferSlots& slots);
+// Reader: takes the newest published slot if there is one -- returns true if reading changed
+bool acquireSlot(tripleBufferSlots& slots);
+
+// Three copies of T. T should be plain data: slots are reused, not reconstructed.
+template<typename T>
+struct tripleBuffer
+{
+	T data[3];
+	tripleBufferSlots slots;
+};
+
+template<typename T>
+void initTripleBuffer(tripleBuffer<T>& buffer)
+{
+	initTripleBuffer(buffer.slots);
+}
+
+// Simulation side -- write into writeSlot, then publish
+template<typename T>
+T& writeSlot(tripleBuffer<T>& buffer)
+{
+	return buffer.data[buffer.slots.writing];
+}
+
+template<typename T>
+void publish(tripleBuffer<T>& buffer)
+{
+	publishSlot(buffer.slots);
+}
+
+// Render side -- the newest published copy (the initial contents until the first publish).
+// Stays valid and unchanged until the next call.
+template<typename T>
+const T& readLatest(tripleBuffer<T>& buffer)
+{
+	acquireSlot(buffer.slots);
+	return buffer.data[buffer.slots.reading];
+}
+
+// What the simulation hands the renderer each tick: the last two states, so the renderer
+// can interpolate without keeping history of its own
+template<typename State>
+struct simSnapshot
+{
+	State previous, current;
+	double previousTime, currentTime;	// simulation clock seconds of each state
+	uint64_t tick;						// ticks run when current was made
+};
+
+// How far renderTime lies from the snapshot's previous state to its current one, clamped to [0, 1]
+template<typename State>
+float snapshotAlpha(const simSnapshot<State>& snapshot, double renderTime)
+{
+	double span = snapshot.currentTime - snapshot.previousTime;
+	double alpha = span > 0.0 ? (renderTime - snapshot.previousTime) / span : 1.0;
+	return (float)(alpha < 0.0 ? 0.0 : (alpha > 1.0 ? 1.0 : alpha));
+}
+
+// Advances the simulation one tick -- time is the simulation clock at the end of the tick.
+// Runs on the simulation thread, which is not a job thread and must not touch GL.
+typedef void (*simTickFn)(double tickSeconds, double time, uint64_t tick, void* user);
+
+struct simThreadOptions
+{
+	double tickSeconds = 1.0 / 60.0;
+	unsigned maxCatchUpTicks = 8;	// ticks run back to back after a stall before the rest is dropped
+};
+
+// Telemetry, safe to read from any thread
+struct simThreadStats
+{
+	std::atomic<uint64_t> ticks;
+	std::atomic<uint64_t> droppedTicks;		// skipped to catch up after stalls
+	std::atomic<uint64_t> tickNanoseconds;	// total time spent inside the tick function
+	std::atomic<uint64_t> maxTickNanoseconds;
+};
+
+// Runs a tick function at a fixed rate on its own thread. Ticks are scheduled on absolute
+// deadlines, so the rate doesn't drift, and a slow tick is made up by running the next
+// ones back to back.
+struct simThread
+{
+	std::thread thread;
+	std::atomic<bool> running;
+
+	simTickFn tick;
+	void* user;
+	simThreadOptions options;
+	std::atomic<int64_t> start;	// profiler clock at tick 0 -- moves forward when ticks are dropped
+
+	simThreadStats stats;
+};
+
+bool startSimThread(simThread& sim, simTickFn tick, void* user, const simThreadOptions& options = simThreadOptions());
+// Finishes the tick in progress and joins the thread
+void stopSimThread(simThread& sim);
+
+// Seconds on the simulation clock -- the time ticks are stamped with
+double simClock(const simThread& sim);
+// Where the renderer should sample: one tick behind the clock, so the newest snapshot's
+// previous and current states normally bracket it
+double simRenderTime(const simThread& sim);
@@ -0,0 +1,834 @@
+#include "softraster.h"
+
+#include <algorithm>    // min, max, fill
+#include <cassert>      // assert
+#include <cmath>        // floorf, ceilf, sqrtf
+#include <cstdio>       // fprintf
+#include <cstring>      // memcpy
+
+#include "stb/stb_image.h"
+
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE, profilerNow
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#endif
+
+namespace
+{
+    // Vertices are transformed and triangles binned in fixed-size jobs -- the split never
+    // depends on the thread count, so neither does the output
+    const size_t TRANSFORM_JOB_SIZE = 4096;
+    const size_t BIN_JOB_SIZE = 2048;
+
+    // Positions snap to 1/16 pixel before setup
+    const float SUBPIXEL_STEPS = 16.0f;
+
+    // Four floats processed together -- SSE2 where we have it, plain arrays otherwise
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+    struct lane4
+    {
+        __m128 v;
+    };
+
+    inline lane4 splat(float x) { return { _mm_set1_ps(x) }; }
+    inline lane4 set4(float a, float b, float c, float d) { return { _mm_setr_ps(a, b, c, d) }; }
+    inline lane4 load4(const float* p) { return { _mm_loadu_ps(p) }; }
+    inline void store4(float* p, lane4 a) { _mm_storeu_ps(p, a.v); }
+    inline lane4 operator+(lane4 a, lane4 b) { return { _mm_add_ps(a.v, b.v) }; }
+    inline lane4 operator-(lane4 a, lane4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+    inline lane4 operator*(lane4 a, lane4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+    inline lane4 operator/(lane4 a, lane4 b) { return { _mm_div_ps(a.v, b.v) }; }
+    inline lane4 operator&(lane4 a, lane4 b) { return { _mm_and_ps(a.v, b.v) }; }
+    inline lane4 operator|(lane4 a, lane4 b) { return { _mm_or_ps(a.v, b.v) }; }
+    inline lane4 greater(lane4 a, lane4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    inline lane4 lessEqual(lane4 a, lane4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    inline lane4 equal(lane4 a, lane4 b) { return { _mm_cmpeq_ps(a.v, b.v) }; }
+    inline lane4 select(lane4 mask, lane4 a, lane4 b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+    inline int laneMask(lane4 mask) { return _mm_movemask_ps(mask.v); }
+#else
+    struct lane4
+    {
+        float v[4];
+    };
+
+    inline uint32_t bits(float x) { uint32_t u; memcpy(&u, &x, 4); return u; }
+    inline float fromBits(uint32_t u) { float x; memcpy(&x, &u, 4); return x; }
+    inline float maskOf(bool b) { return fromBits(b ? ~0u : 0u); }
+
+    template<typename Fn>
+    inline lane4 each(Fn fn) { lane4 r; for (int i = 0; i < 4; ++i) r.v[i] = fn(i); return r; }
+
+    inline lane4 splat(float x) { return { { x, x, x, x } }; }
+    inline lane4 set4(float a, float b, float c, float d) { return { { a, b, c, d } }; }
+    inline lane4 load4(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    inline void store4(float* p, lane4 a) { memcpy(p, a.v, sizeof(a.v)); }
+    inline lane4 operator+(lane4 a, lane4 b) { return each([&](int i) { return a.v[i] + b.v[i]; }); }
+    inline lane4 operator-(lane4 a, lane4 b) { return each([&](int i) { return a.v[i] - b.v[i]; }); }
+    inline lane4 operator*(lane4 a, lane4 b) { return each([&](int i) { return a.v[i] * b.v[i]; }); }
+    inline lane4 operator/(lane4 a, lane4 b) { return each([&](int i) { return a.v[i] / b.v[i]; }); }
+    inline lane4 operator&(lane4 a, lane4 b) { return each([&](int i) { return fromBits(bits(a.v[i]) & bits(b.v[i])); }); }
+    inline lane4 operator|(lane4 a, lane4 b) { return each([&](int i) { return fromBits(bits(a.v[i]) | bits(b.v[i])); }); }
+    inline lane4 greater(lane4 a, lane4 b) { return each([&](int i) { return maskOf(a.v[i] > b.v[i]); }); }
+    inline lane4 lessEqual(lane4 a, lane4 b) { return each([&](int i) { return maskOf(a.v[i] <= b.v[i]); }); }
+    inline lane4 equal(lane4 a, lane4 b) { return each([&](int i) { return maskOf(a.v[i] == b.v[i]); }); }
+    inline lane4 select(lane4 mask, lane4 a, lane4 b) { return each([&](int i) { return bits(mask.v[i]) ? a.v[i] : b.v[i]; }); }
+    inline int laneMask(lane4 mask)
+    {
+        int result = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            result |= (bits(mask.v[i]) >> 31) << i;
+        }
+        return result;
+    }
+#endif
+
+    // A range of one draw's vertices or triangles
+    struct softJob
+    {
+        uint32_t draw;
+        size_t first, count;
+    };
+
+    // A vertex in clip space carrying everything the triangle setup needs
+    struct clipVertex
+    {
+        float x, y, z, w;
+        float u, v;
+        float nx, ny, nz;
+    };
+
+    clipVertex lerpVertex(const clipVertex& a, const clipVertex& b, float t)
+    {
+        clipVertex r;
+        r.x = a.x + (b.x - a.x) * t;
+        r.y = a.y + (b.y - a.y) * t;
+        r.z = a.z + (b.z - a.z) * t;
+        r.w = a.w + (b.w - a.w) * t;
+        r.u = a.u + (b.u - a.u) * t;
+        r.v = a.v + (b.v - a.v) * t;
+        r.nx = a.nx + (b.nx - a.nx) * t;
+        r.ny = a.ny + (b.ny - a.ny) * t;
+        r.nz = a.nz + (b.nz - a.nz) * t;
+        return r;
+    }
+
+    uint32_t packColor(float r, float g, float b, float a)
+    {
+        auto channel = [](float value)
+        {
+            value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+            return (uint32_t)(value * 255.0f + 0.5f);
+        };
+        return channel(r) | channel(g) << 8 | channel(b) << 16 | channel(a) << 24;
+    }
+
+    // Bilinear with repeat wrapping, texel centers at half coordinates (like GL_LINEAR)
+    glm::vec3 sampleBilinear(const softTexture& tex, float u, float v)
+    {
+        float x = u * tex.width - 0.5f;
+        float y = v * tex.height - 0.5f;
+        float fx = floorf(x), fy = floorf(y);
+        float tx = x - fx, ty = y - fy;
+
+        auto wrap = [](int i, int size) { i %= size; return i < 0 ? i + size : i; };
+        int x0 = wrap((int)fx, tex.width), x1 = wrap((int)fx + 1, tex.width);
+        int y0 = wrap((int)fy, tex.height), y1 = wrap((int)fy + 1, tex.height);
+
+        auto texel = [&](int tx_, int ty_)
+        {
+            uint32_t c = tex.texels[(size_t)ty_ * tex.width + tx_];
+            return glm::vec3((float)(c & 0xFF), (float)(c >> 8 & 0xFF), (float)(c >> 16 & 0xFF)) * (1.0f / 255.0f);
+        };
+
+        glm::vec3 bottom = texel(x0, y0) * (1.0f - tx) + texel(x1, y0) * tx;
+        glm::vec3 top = texel(x0, y1) * (1.0f - tx) + texel(x1, y1) * tx;
+        return bottom * (1.0f - ty) + top * ty;
+    }
+
+    // Transforms a run of one draw's vertices, four at a time
+    void transformVertices(softRasterizer& raster, const softDrawCall& draw, size_t first, size_t count)
+    {
+        const vertex* verts = draw.mesh->vertices.data();
+        const glm::mat4& m = draw.modelViewProj;
+        const glm::mat4& n = draw.model;    // normals go through the model's upper 3x3, like the GL shaders
+
+        size_t end = first + count;
+        size_t i = first;
+        for (; i + 4 <= end; i += 4)
+        {
+            const vertex* v = verts + i;
+            lane4 x = set4(v[0].pos.x, v[1].pos.x, v[2].pos.x, v[3].pos.x);
+            lane4 y = set4(v[0].pos.y, v[1].pos.y, v[2].pos.y, v[3].pos.y);
+            lane4 z = set4(v[0].pos.z, v[1].pos.z, v[2].pos.z, v[3].pos.z);
+            lane4 w = set4(v[0].pos.w, v[1].pos.w, v[2].pos.w, v[3].pos.w);
+
+            size_t out = draw.firstVertex + i;
+            store4(&raster.clipX[out], splat(m[0][0]) * x + splat(m[1][0]) * y + splat(m[2][0]) * z + splat(m[3][0]) * w);
+            store4(&raster.clipY[out], splat(m[0][1]) * x + splat(m[1][1]) * y + splat(m[2][1]) * z + splat(m[3][1]) * w);
+            store4(&raster.clipZ[out], splat(m[0][2]) * x + splat(m[1][2]) * y + splat(m[2][2]) * z + splat(m[3][2]) * w);
+            store4(&raster.clipW[out], splat(m[0][3]) * x + splat(m[1][3]) * y + splat(m[2][3]) * z + splat(m[3][3]) * w);
+
+            lane4 nx = set4(v[0].normal.x, v[1].normal.x, v[2].normal.x, v[3].normal.x);
+            lane4 ny = set4(v[0].normal.y, v[1].normal.y, v[2].normal.y, v[3].normal.y);
+            lane4 nz = set4(v[0].normal.z, v[1].normal.z, v[2].normal.z, v[3].normal.z);
+
+            store4(&raster.normalX[out], splat(n[0][0]) * nx + splat(n[1][0]) * ny + splat(n[2][0]) * nz);
+            store4(&raster.normalY[out], splat(n[0][1]) * nx + splat(n[1][1]) * ny + splat(n[2][1]) * nz);
+            store4(&raster.normalZ[out], splat(n[0][2]) * nx + splat(n[1][2]) * ny + splat(n[2][2]) * nz);
+        }
+
+        // leftovers
+        for (; i < end; ++i)
+        {
+            glm::vec4 clip = m * verts[i].pos;
+            glm::vec3 normal = glm::mat3(n) * glm::vec3(verts[i].normal);
+
+            size_t out = draw.firstVertex + i;
+            raster.clipX[out] = clip.x;
+            raster.clipY[out] = clip.y;
+            raster.clipZ[out] = clip.z;
+            raster.clipW[out] = clip.w;
+            raster.normalX[out] = normal.x;
+            raster.normalY[out] = normal.y;
+            raster.normalZ[out] = normal.z;
+        }
+    }
+
+    // Projects a clipped triangle and builds its edge and attribute planes. Back faces
+    // (clockwise on screen, as GL_CULL_FACE removes them) and empty triangles are dropped.
+    bool setupTriangle(const clipVertex* v, uint32_t draw, const softTarget& target, softTriangle& tri)
+    {
+        float sx[3], sy[3], sz[3], invW[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            invW[i] = 1.0f / v[i].w;
+            sx[i] = floorf((v[i].x * invW[i] * 0.5f + 0.5f) * target.width * SUBPIXEL_STEPS + 0.5f) / SUBPIXEL_STEPS;
+            sy[i] = floorf((v[i].y * invW[i] * 0.5f + 0.5f) * target.height * SUBPIXEL_STEPS + 0.5f) / SUBPIXEL_STEPS;
+            sz[i] = v[i].z * invW[i] * 0.5f + 0.5f;
+        }
+
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if (!(area > 0.0f))
+        {
+            return false;
+        }
+
+        // Pixels whose centers can be inside
+        float minX = std::min(sx[0], std::min(sx[1], sx[2]));
+        float maxX = std::max(sx[0], std::max(sx[1], sx[2]));
+        float minY = std::min(sy[0], std::min(sy[1], sy[2]));
+        float maxY = std::max(sy[0], std::max(sy[1], sy[2]));
+        tri.minX = std::max(0, (int)ceilf(minX - 0.5f));
+        tri.maxX = std::min(target.width - 1, (int)floorf(maxX - 0.5f));
+        tri.minY = std::max(0, (int)ceilf(minY - 0.5f));
+        tri.maxY = std::min(target.height - 1, (int)floorf(maxY - 0.5f));
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+        {
+            return false;
+        }
+
+        // Edge i is opposite vertex i, so E_i / area is vertex i's barycentric
+        for (int i = 0; i < 3; ++i)
+        {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            tri.edgeA[i] = sy[a] - sy[b];
+            tri.edgeB[i] = sx[b] - sx[a];
+            tri.edgeC[i] = sx[a] * sy[b] - sy[a] * sx[b];
+        }
+        tri.invArea = 1.0f / area;
+
+        // Depth is linear in screen space, everything else is divided by w for perspective
+        float values[7][3];
+        for (int i = 0; i < 3; ++i)
+        {
+            values[0][i] = sz[i];
+            values[1][i] = invW[i];
+            values[2][i] = v[i].u * invW[i];
+            values[3][i] = v[i].v * invW[i];
+            values[4][i] = v[i].nx * invW[i];
+            values[5][i] = v[i].ny * invW[i];
+            values[6][i] = v[i].nz * invW[i];
+        }
+        for (int p = 0; p < 7; ++p)
+        {
+            tri.planes[p][0] = values[p][0];
+            tri.planes[p][1] = values[p][1] - values[p][0];
+            tri.planes[p][2] = values[p][2] - values[p][0];
+        }
+
+        tri.minDepth = std::min(sz[0], std::min(sz[1], sz[2]));
+        tri.draw = draw;
+
+        return true;
+    }
+
+    // Largest value an edge function takes over a rectangle of pixel centers
+    float edgeMax(const softTriangle& tri, int edge, float x0, float y0, float x1, float y1)
+    {
+        float a = tri.edgeA[edge], b = tri.edgeB[edge];
+        return a * (a > 0.0f ? x1 : x0) + b * (b > 0.0f ? y1 : y0) + tri.edgeC[edge];
+    }
+
+    // Sets up one triangle and records every tile it touches
+    void binPiece(const clipVertex* corners, uint32_t draw, const softTarget& target,
+                  std::vector<softTriangle>& triangles, std::vector<softBinEntry>& entries)
+    {
+        softTriangle tri;
+        if (!setupTriangle(corners, draw, target, tri))
+        {
+            return;
+        }
+
+        uint32_t triangleIndex = (uint32_t)triangles.size();
+        triangles.push_back(tri);
+
+        int tileX0 = tri.minX / SOFT_TILE_SIZE, tileX1 = tri.maxX / SOFT_TILE_SIZE;
+        int tileY0 = tri.minY / SOFT_TILE_SIZE, tileY1 = tri.maxY / SOFT_TILE_SIZE;
+
+        // Most triangles sit in one tile
+        if (tileX0 == tileX1 && tileY0 == tileY1)
+        {
+            entries.push_back({ (uint32_t)(tileY0 * target.tilesX + tileX0), triangleIndex });
+            return;
+        }
+
+        for (int ty = tileY0; ty <= tileY1; ++ty)
+        {
+            for (int tx = tileX0; tx <= tileX1; ++tx)
+            {
+                // Big triangles cover many tiles their edges exclude -- skip those (with a pixel of slack)
+                float x0 = tx * SOFT_TILE_SIZE - 0.5f, x1 = (tx + 1) * SOFT_TILE_SIZE + 0.5f;
+                float y0 = ty * SOFT_TILE_SIZE - 0.5f, y1 = (ty + 1) * SOFT_TILE_SIZE + 0.5f;
+                if (edgeMax(tri, 0, x0, y0, x1, y1) < 0.0f || edgeMax(tri, 1, x0, y0, x1, y1) < 0.0f ||
+                    edgeMax(tri, 2, x0, y0, x1, y1) < 0.0f)
+                {
+                    continue;
+                }
+
+                entries.push_back({ (uint32_t)(ty * target.tilesX + tx), triangleIndex });
+            }
+        }
+    }
+
+    // Bins one job's triangles, clipping the ones that cross the near plane
+    void binTriangles(softRasterizer& raster, const softJob& job, size_t jobIndex)
+    {
+        const softDrawCall& draw = raster.draws[job.draw];
+        const softMesh& mesh = *draw.mesh;
+        const softTarget& target = *raster.target;
+        const meshLod& lod = mesh.lods[draw.lod];
+
+        std::vector<softTriangle>& triangles = raster.jobTriangles[jobIndex];
+        std::vector<softBinEntry>& entries = raster.jobEntries[jobIndex];
+        triangles.clear();
+        entries.clear();
+
+        for (size_t t = job.first; t < job.first + job.count; ++t)
+        {
+            clipVertex corners[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned index = mesh.indices[lod.firstIndex + t * 3 + c];
+                size_t at = draw.firstVertex + index;
+                corners[c] = { raster.clipX[at], raster.clipY[at], raster.clipZ[at], raster.clipW[at],
+                               mesh.vertices[index].uv.x, mesh.vertices[index].uv.y,
+                               raster.normalX[at], raster.normalY[at], raster.normalZ[at] };
+            }
+
+            // Entirely outside one clip plane -- nothing to do
+            uint32_t outside = ~0u;
+            bool crossesNear = false;
+            for (int c = 0; c < 3; ++c)
+            {
+                const clipVertex& v = corners[c];
+                outside &= (v.x < -v.w) | (v.x > v.w) << 1 | (v.y < -v.w) << 2 | (v.y > v.w) << 3 |
+                           (v.z < -v.w) << 4 | (v.z > v.w) << 5;
+                crossesNear |= v.z < -v.w;
+            }
+            if (outside != 0)
+            {
+                continue;
+            }
+
+            // The usual case -- nothing to clip
+            if (!crossesNear)
+            {
+                binPiece(corners, job.draw, target, triangles, entries);
+                continue;
+            }
+
+            // Clip against the near plane (z >= -w) -- the other planes are handled by the bounds
+            clipVertex polygon[4];
+            int polygonSize = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                const clipVertex& a = corners[c];
+                const clipVertex& b = corners[(c + 1) % 3];
+                float da = a.z + a.w, db = b.z + b.w;
+
+                if (da >= 0.0f)
+                {
+                    polygon[polygonSize++] = a;
+                }
+                if ((da >= 0.0f) != (db >= 0.0f))
+                {
+                    polygon[polygonSize++] = lerpVertex(a, b, da / (da - db));
+                }
+            }
+
+            // Fan out whatever is left and bin each piece
+            for (int p = 1; p + 1 < polygonSize; ++p)
+            {
+                clipVertex piece[3] = { polygon[0], polygon[p], polygon[p + 1] };
+                binPiece(piece, job.draw, target, triangles, entries);
+            }
+        }
+    }
+
+    // Rasterizes every triangle binned to one tile, in submission order
+    void rasterTile(softRasterizer& raster, uint32_t tile)
+    {
+        softTarget& target = *raster.target;
+
+        int tileX = (int)(tile % target.tilesX) * SOFT_TILE_SIZE;
+        int tileY = (int)(tile / target.tilesX) * SOFT_TILE_SIZE;
+        int tileMaxX = std::min(tileX + SOFT_TILE_SIZE, target.width) - 1;
+        int tileMaxY = std::min(tileY + SOFT_TILE_SIZE, target.height) - 1;
+
+        lane4 ramp = set4(0.0f, 1.0f, 2.0f, 3.0f);
+        lane4 zero = splat(0.0f);
+        lane4 one = splat(1.0f);
+        size_t rejected = 0;
+
+        for (uint32_t i = raster.tileStart[tile]; i < raster.tileStart[tile + 1]; ++i)
+        {
+            const softTriangle& tri = *raster.tileTriangles[i];
+            const softDrawCall& draw = raster.draws[tri.draw];
+
+            int x0 = std::max(tri.minX, tileX), x1 = std::min(tri.maxX, tileMaxX);
+            int y0 = std::max(tri.minY, tileY), y1 = std::min(tri.maxY, tileMaxY);
+
+            // Edge values at the tile's first pixel center -- every pixel steps from here the same
+            // way for every triangle, so a shared edge gives exactly opposite values on both sides
+            float originX = tileX + 0.5f, originY = tileY + 0.5f;
+            float edgeOrigin[3];
+            lane4 tieBreak[3];
+            for (int e = 0; e < 3; ++e)
+            {
+                edgeOrigin[e] = tri.edgeA[e] * originX + tri.edgeB[e] * originY + tri.edgeC[e];
+
+                // A pixel exactly on an edge belongs to only one of the two triangles sharing it
+                bool owns = tri.edgeA[e] > 0.0f || (tri.edgeA[e] == 0.0f && tri.edgeB[e] < 0.0f);
+                tieBreak[e] = owns ? equal(zero, zero) : zero;
+            }
+
+            for (int blockY = y0 & ~(SOFT_BLOCK_SIZE - 1); blockY <= y1; blockY += SOFT_BLOCK_SIZE)
+            {
+                for (int blockX = x0 & ~(SOFT_BLOCK_SIZE - 1); blockX <= x1; blockX += SOFT_BLOCK_SIZE)
+                {
+                    // Hierarchical depth -- the whole block already has something nearer
+                    float& blockMax = target.blockMaxDepth[(blockY / SOFT_BLOCK_SIZE) * target.blocksX + blockX / SOFT_BLOCK_SIZE];
+                    if (tri.minDepth > blockMax)
+                    {
+                        ++rejected;
+                        continue;
+                    }
+
+                    // The block is outside one of the edges
+                    float bx0 = blockX + 0.5f, by0 = blockY + 0.5f;
+                    float bx1 = bx0 + SOFT_BLOCK_SIZE - 1, by1 = by0 + SOFT_BLOCK_SIZE - 1;
+                    if (edgeMax(tri, 0, bx0, by0, bx1, by1) < 0.0f || edgeMax(tri, 1, bx0, by0, bx1, by1) < 0.0f ||
+                        edgeMax(tri, 2, bx0, by0, bx1, by1) < 0.0f)
+                    {
+                        continue;
+                    }
+
+                    bool written = false;
+                    int rowEnd = std::min(blockY + SOFT_BLOCK_SIZE - 1, y1);
+                    for (int y = std::max(blockY, y0); y <= rowEnd; ++y)
+                    {
+                        float dy = (float)(y - tileY);
+                        float edgeRow[3];
+                        for (int e = 0; e < 3; ++e)
+                        {
+                            edgeRow[e] = edgeOrigin[e] + tri.edgeB[e] * dy;
+                        }
+
+                        for (int x = blockX; x < blockX + SOFT_BLOCK_SIZE; x += 4)
+                        {
+                            if (x > x1 || x + 3 < x0)
+                            {
+                                continue;
+                            }
+
+                            lane4 dx = splat((float)(x - tileX)) + ramp;
+
+                            // Inside all three edges, and inside the bounds (which also keeps us on the target)
+                            lane4 pixelX = splat((float)x) + ramp;
+                            lane4 inside = greater(pixelX, splat(x0 - 0.5f)) & lessEqual(pixelX, splat((float)x1));
+                            lane4 edge[3];
+                            for (int e = 0; e < 3; ++e)
+                            {
+                                edge[e] = splat(edgeRow[e]) + splat(tri.edgeA[e]) * dx;
+                                inside = inside & (greater(edge[e], zero) | (equal(edge[e], zero) & tieBreak[e]));
+                            }
+                            if (laneMask(inside) == 0)
+                            {
+                                continue;
+                            }
+
+                            lane4 b1 = edge[1] * splat(tri.invArea);
+                            lane4 b2 = edge[2] * splat(tri.invArea);
+                            auto interpolate = [&](int p)
+                            {
+                                return splat(tri.planes[p][0]) + b1 * splat(tri.planes[p][1]) + b2 * splat(tri.planes[p][2]);
+                            };
+
+                            // Depth test (GL_LEQUAL), then write the depths that passed
+                            size_t pixel = (size_t)y * target.stride + x;
+                            lane4 depth = interpolate(0);
+                            lane4 stored = load4(&target.depth[pixel]);
+                            lane4 pass = inside & lessEqual(depth, stored) & lessEqual(depth, one);
+                            int passMask = laneMask(pass);
+                            if (passMask == 0)
+                            {
+                                continue;
+                            }
+                            store4(&target.depth[pixel], select(pass, depth, stored));
+                            written = true;
+
+                            // Perspective-correct attributes
+                            lane4 w = one / interpolate(1);
+                            softFragments fragments;
+                            store4(fragments.u, interpolate(2) * w);
+                            store4(fragments.v, interpolate(3) * w);
+                            store4(fragments.nx, interpolate(4) * w);
+                            store4(fragments.ny, interpolate(5) * w);
+                            store4(fragments.nz, interpolate(6) * w);
+                            fragments.tint = draw.tint;
+
+                            uint32_t colors[4];
+                            draw.shader.shade(fragments, draw.shader.uniforms, colors);
+                            for (int lane = 0; lane < 4; ++lane)
+                            {
+                                if (passMask & (1 << lane))
+                                {
+                                    target.color[pixel + lane] = colors[lane];
+                                }
+                            }
+                        }
+                    }
+
+                    // Keep the block's farthest depth current for the next triangles
+                    if (written)
+                    {
+                        float farthest = 0.0f;
+                        for (int y = blockY; y < blockY + SOFT_BLOCK_SIZE; ++y)
+                        {
+                            const float* row = &target.depth[(size_t)y * target.stride + blockX];
+                            for (int x = 0; x < SOFT_BLOCK_SIZE; ++x)
+                            {
+                                farthest = std::max(farthest, row[x]);
+                            }
+                        }
+                        blockMax = farthest;
+                    }
+                }
+            }
+        }
+
+        raster.tileRejected[tile] = rejected;
+    }
+}
+
+softTarget makeSoftTarget(int width, int height)
+{
+    softTarget target = {};
+    target.width = width;
+    target.height = height;
+    target.tilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    target.tilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    target.stride = target.tilesX * SOFT_TILE_SIZE;
+    target.blocksX = target.stride / SOFT_BLOCK_SIZE;
+    target.blocksY = target.tilesY * SOFT_TILE_SIZE / SOFT_BLOCK_SIZE;
+
+    // Whole tiles -- the padding is never shown but keeps every 4-wide access in bounds
+    size_t pixels = (size_t)target.stride * target.tilesY * SOFT_TILE_SIZE;
+    target.color.resize(pixels);
+    target.depth.resize(pixels);
+    target.blockMaxDepth.resize((size_t)target.blocksX * target.blocksY);
+
+    clearSoftTarget(target, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    return target;
+}
+
+void clearSoftTarget(softTarget& target, const glm::vec4& color, float depth)
+{
+    std::fill(target.color.begin(), target.color.end(), packColor(color.x, color.y, color.z, color.w));
+    std::fill(target.depth.begin(), target.depth.end(), depth);
+    std::fill(target.blockMaxDepth.begin(), target.blockMaxDepth.end(), depth);
+}
+
+void readSoftTarget(const softTarget& target, std::vector<unsigned char>& pixels)
+{
+    pixels.resize((size_t)target.width * target.height * 4);
+    for (int y = 0; y < target.height; ++y)
+    {
+        memcpy(&pixels[(size_t)y * target.width * 4], &target.color[(size_t)y * target.stride], (size_t)target.width * 4);
+    }
+}
+
+softTexture loadSoftTexture(const char* filePath)
+{
+    assert(filePath != nullptr && "File path was invalid.");
+
+    // Same orientation as loadTexture so UVs mean the same thing
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char* pixels = stbi_load(filePath, &width, &height, &channels, STBI_rgb_alpha);
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "[ERROR] could not load texture %s\n", filePath);
+        return {};
+    }
+
+    softTexture tex = makeSoftTexture(width, height, pixels);
+    stbi_image_free(pixels);
+
+    return tex;
+}
+
+softTexture makeSoftTexture(int width, int height, const unsigned char* rgba)
+{
+    softTexture tex;
+    tex.width = width;
+    tex.height = height;
+    tex.texels.resize((size_t)width * height);
+    memcpy(tex.texels.data(), rgba, tex.texels.size() * 4);
+    return tex;
+}
+
+softMesh makeSoftMesh(const vertex* verts, size_t vertCount, const unsigned int* indices, size_t indxCount)
+{
+    softMesh mesh;
+    mesh.vertices.assign(verts, verts + vertCount);
+    mesh.indices.assign(indices, indices + indxCount);
+    computeBounds(verts, vertCount, mesh.boundsMin, mesh.boundsMax);
+    mesh.lodCount = 1;
+    mesh.lods[0] = { 0, (uint32_t)indxCount, 0.0f };
+    return mesh;
+}
+
+softMesh loadSoftMesh(const char* filePath, const meshLoadOptions& options)
+{
+    // The full format is the vertex struct, so the decoded vertices can be used as-is
+    meshLoadOptions fullOptions = options;
+    fullOptions.format = VERTEX_FORMAT_FULL;
+
+    meshData data;
+    if (!decodeMesh(filePath, fullOptions, data))
+    {
+        return {};
+    }
+
+    softMesh mesh;
+    const vertex* verts = (const vertex*)data.verts;
+    mesh.vertices.assign(verts, verts + data.vertCount);
+
+    mesh.indices.resize(data.indxCount);
+    for (size_t i = 0; i < data.indxCount; ++i)
+    {
+        mesh.indices[i] = data.indexType == GL_UNSIGNED_SHORT ? ((const uint16_t*)data.indices)[i]
+                                                               : ((const uint32_t*)data.indices)[i];
+    }
+
+    mesh.boundsMin = data.boundsMin;
+    mesh.boundsMax = data.boundsMax;
+    mesh.lodCount = data.lodCount;
+    for (unsigned i = 0; i < data.lodCount; ++i)
+    {
+        mesh.lods[i] = data.lods[i];
+    }
+
+    freeMeshData(data);
+
+    return mesh;
+}
+
+void shadeSoftLambert(const softFragments& in, const void* uniforms, uint32_t out[4])
+{
+    const softLambertUniforms& lambert = *(const softLambertUniforms*)uniforms;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        glm::vec3 normal(in.nx[i], in.ny[i], in.nz[i]);
+        float length = sqrtf(glm::dot(normal, normal));
+        normal = length > 0.0f ? normal / length : normal;
+
+        float diffuse = std::max(0.0f, glm::dot(normal, -lambert.lightDirection));
+        glm::vec3 albedo = lambert.texture != nullptr ? sampleBilinear(*lambert.texture, in.u[i], in.v[i]) : glm::vec3(1.0f);
+        glm::vec3 color = lambert.ambient + albedo * glm::vec3(in.tint) * lambert.lightDiffuse * diffuse;
+
+        out[i] = packColor(color.x, color.y, color.z, 1.0f);
+    }
+}
+
+softShader makeSoftLambertShader(const softLambertUniforms& uniforms)
+{
+    return { shadeSoftLambert, &uniforms };
+}
+
+softRasterizer makeSoftRasterizer(unsigned threadCount)
+{
+    softRasterizer raster;
+    raster.threadCount = threadCount;
+    raster.target = nullptr;
+    raster.stats = {};
+    return raster;
+}
+
+void beginSoftFrame(softRasterizer& raster, softTarget& target)
+{
+    raster.target = &target;
+    raster.draws.clear();
+}
+
+void softDraw(softRasterizer& raster, const softMesh& mesh, const glm::mat4& model, const glm::mat4& viewProj,
+              const softShader& shader, const glm::vec4& tint, unsigned lod)
+{
+    assert(raster.target != nullptr && "softDraw outside beginSoftFrame/endSoftFrame");
+    assert(lod < mesh.lodCount && "mesh has no such LOD");
+
+    softDrawCall draw;
+    draw.mesh = &mesh;
+    draw.model = model;
+    draw.modelViewProj = viewProj * model;
+    draw.shader = shader;
+    draw.tint = tint;
+    draw.lod = lod;
+    draw.firstVertex = 0;   // assigned in endSoftFrame
+
+    raster.draws.push_back(draw);
+}
+
+void endSoftFrame(softRasterizer& raster)
+{
+    PROFILE_SCOPE("endSoftFrame");
+
+    softTarget& target = *raster.target;
+    softStats stats = {};
+    stats.draws = raster.draws.size();
+
+    // Vertices -- every draw gets its own slice of the transformed arrays
+    int64_t start = profilerNow();
+
+    std::vector<softJob> jobs;
+    size_t vertexCount = 0;
+    for (uint32_t d = 0; d < raster.draws.size(); ++d)
+    {
+        softDrawCall& draw = raster.draws[d];
+        draw.firstVertex = vertexCount;
+
+        size_t count = draw.mesh->vertices.size();
+        for (size_t first = 0; first < count; first += TRANSFORM_JOB_SIZE)
+        {
+            jobs.push_back({ d, first, std::min(TRANSFORM_JOB_SIZE, count - first) });
+        }
+        vertexCount += count;
+    }
+
+    raster.clipX.resize(vertexCount);
+    raster.clipY.resize(vertexCount);
+    raster.clipZ.resize(vertexCount);
+    raster.clipW.resize(vertexCount);
+    raster.normalX.resize(vertexCount);
+    raster.normalY.resize(vertexCount);
+    raster.normalZ.resize(vertexCount);
+
+    parallelFor(jobs.size(), [&](size_t i)
+    {
+        transformVertices(raster, raster.draws[jobs[i].draw], jobs[i].first, jobs[i].count);
+    }, raster.threadCount);
+
+    int64_t transformed = profilerNow();
+
+    // Triangles -- clip, set up and bin
+    jobs.clear();
+    for (uint32_t d = 0; d < raster.draws.size(); ++d)
+    {
+        const softDrawCall& draw = raster.draws[d];
+        size_t count = draw.mesh->lods[draw.lod].indexCount / 3;
+        for (size_t first = 0; first < count; first += BIN_JOB_SIZE)
+        {
+            jobs.push_back({ d, first, std::min(BIN_JOB_SIZE, count - first) });
+        }
+        stats.trianglesIn += count;
+    }
+
+    if (raster.jobTriangles.size() < jobs.size())
+    {
+        raster.jobTriangles.resize(jobs.size());
+        raster.jobEntries.resize(jobs.size());
+    }
+
+    parallelFor(jobs.size(), [&](size_t i)
+    {
+        binTriangles(raster, jobs[i], i);
+    }, raster.threadCount);
+
+    // Gather the bins into one list per tile, keeping submission order
+    size_t tileCount = (size_t)target.tilesX * target.tilesY;
+    raster.tileStart.assign(tileCount + 1, 0);
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        stats.trianglesBinned += raster.jobTriangles[j].size();
+        for (const softBinEntry& entry : raster.jobEntries[j])
+        {
+            ++raster.tileStart[entry.tile + 1];
+        }
+    }
+    for (size_t t = 0; t < tileCount; ++t)
+    {
+        raster.tileStart[t + 1] += raster.tileStart[t];
+    }
+
+    stats.binEntries = raster.tileStart[tileCount];
+    raster.tileTriangles.resize(stats.binEntries);
+
+    std::vector<uint32_t> fill(raster.tileStart.begin(), raster.tileStart.end() - 1);
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        const std::vector<softTriangle>& triangles = raster.jobTriangles[j];
+        for (const softBinEntry& entry : raster.jobEntries[j])
+        {
+            raster.tileTriangles[fill[entry.tile]++] = &triangles[entry.triangle];
+        }
+    }
+
+    int64_t binned = profilerNow();
+
+    // Tiles -- each one is independent, so they go wide
+    raster.tileRejected.assign(tileCount, 0);
+    parallelFor(tileCount, [&](size_t tile)
+    {
+        rasterTile(raster, (uint32_t)tile);
+    }, raster.threadCount);
+
+    for (size_t rejected : raster.tileRejected)
+    {
+        stats.blocksRejected += rejected;
+    }
+
+    int64_t finished = profilerNow();
+    stats.transformMs = (transformed - start) / 1000000.0;
+    stats.binMs = (binned - transformed) / 1000000.0;
+    stats.rasterMs = (finished - binned) / 1000000.0;
+
+    raster.stats = stats;
+    raster.draws.clear();
+    raster.target = nullptr;
+}
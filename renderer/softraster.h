@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t
+#include <vector>			// vector
+
+#include "glm/glm.hpp"		// glm math types (vec3, vec4, mat4)
+
+#include "render.h"			// vertex, meshLod, meshLoadOptions
+
+// CPU rasterizer -- draws into memory, with no GL context needed. It is not a backend
+// for draw(): geometry, shader and texture are GL objects whose data lives on the GPU,
+// so it has CPU-side counterparts (softMesh, softShader, softTexture) that load from the
+// same files and decode paths. Triangles are binned to SOFT_TILE_SIZE tiles and every
+// tile is rasterized on its own thread, so the output is the same whatever the thread count.
+const int SOFT_TILE_SIZE = 64;
+const int SOFT_BLOCK_SIZE = 8;	// granularity of the hierarchical depth test
+
+// Color and depth in memory, bottom row first like glReadPixels. Rows are padded
+// to whole tiles so no two threads ever write the same cache line.
+struct softTarget
+{
+	int width, height;
+	int stride;							// pixels per row (a multiple of SOFT_TILE_SIZE)
+	std::vector<uint32_t> color;		// RGBA8
+	std::vector<float> depth;			// window depth, 1 = far plane
+	int tilesX, tilesY;
+	int blocksX, blocksY;
+	std::vector<float> blockMaxDepth;	// farthest depth in each 8x8 block
+};
+
+softTarget makeSoftTarget(int width, int height);
+void clearSoftTarget(softTarget& target, const glm::vec4& color, float depth = 1.0f);
+// Tightly packed RGBA8 rows, bottom first -- the same layout as context::readPixels
+void readSoftTarget(const softTarget& target, std::vector<unsigned char>& pixels);
+
+// RGBA8 texels, bottom row first (matching loadTexture)
+struct softTexture
+{
+	int width, height;
+	std::vector<uint32_t> texels;
+};
+
+softTexture loadSoftTexture(const char* filePath);
+softTexture makeSoftTexture(int width, int height, const unsigned char* rgba);
+
+// Vertices and indices kept on the CPU, with the same LOD chain loadGeometry builds
+struct softMesh
+{
+	std::vector<vertex> vertices;
+	std::vector<unsigned int> indices;
+	glm::vec3 boundsMin, boundsMax;
+	unsigned lodCount;
+	meshLod lods[MESH_MAX_LODS];
+};
+
+softMesh makeSoftMesh(const vertex* verts, size_t vertCount, const unsigned int* indices, size_t indxCount);
+// Decodes through the same path (and mesh cache) as loadGeometry, always in the full vertex format
+softMesh loadSoftMesh(const char* filePath, const meshLoadOptions& options = meshLoadOptions());
+
+// Perspective-correct inputs for four pixels, structure-of-arrays
+struct softFragments
+{
+	float u[4], v[4];
+	float nx[4], ny[4], nz[4];	// world-space normal (not renormalized)
+	glm::vec4 tint;				// per-draw color
+};
+
+// Shading stage -- writes RGBA8 for all four pixels (masked-off ones are thrown away)
+typedef void (*softShadeFn)(const softFragments& in, const void* uniforms, uint32_t out[4]);
+
+struct softShader
+{
+	softShadeFn shade;
+	const void* uniforms;	// must stay alive until endSoftFrame
+};
+
+// The Lambert lighting of the GL light shader: ambient + texture * tint * diffuse * N.L
+struct softLambertUniforms
+{
+	const softTexture* texture;	// null samples white
+	glm::vec3 ambient;
+	glm::vec3 lightDiffuse;
+	glm::vec3 lightDirection;	// should be normalized
+};
+
+void shadeSoftLambert(const softFragments& in, const void* uniforms, uint32_t out[4]);
+softShader makeSoftLambertShader(const softLambertUniforms& uniforms);
+
+// One queued draw
+struct softDrawCall
+{
+	const softMesh* mesh;
+	glm::mat4 model;
+	glm::mat4 modelViewProj;
+	softShader shader;
+	glm::vec4 tint;
+	unsigned lod;
+	size_t firstVertex;		// into the transformed vertex arrays
+};
+
+// A clipped, culled triangle ready to rasterize
+struct softTriangle
+{
+	float edgeA[3], edgeB[3], edgeC[3];	// E(x, y) = A x + B y + C, positive inside
+	float planes[7][3];					// z, 1/w, u/w, v/w, n/w -- value at v0, change towards v1 and v2
+	float invArea;
+	float minDepth;
+	int minX, minY, maxX, maxY;			// pixel bounds, clipped to the target
+	uint32_t draw;
+};
+
+// A triangle that overlaps a tile
+struct softBinEntry
+{
+	uint32_t tile;
+	uint32_t triangle;	// within its job
+};
+
+// Work from the last endSoftFrame
+struct softStats
+{
+	size_t draws;
+	size_t trianglesIn;
+	size_t trianglesBinned;		// survived clipping and back-face culling
+	size_t binEntries;			// triangle/tile pairs
+	size_t blocksRejected;		// 8x8 blocks skipped by the hierarchical depth test
+	double transformMs, binMs, rasterMs;
+};
+
+struct softRasterizer
+{
+	unsigned threadCount;	// 1 = all on the calling thread, anything else uses the job system
+	softTarget* target;
+	std::vector<softDrawCall> draws;
+
+	// Transformed vertices for every draw (clip position and world normal)
+	std::vector<float> clipX, clipY, clipZ, clipW;
+	std::vector<float> normalX, normalY, normalZ;
+
+	// Binning output, one list per fixed-size job so the order never depends on the threads
+	std::vector<std::vector<softTriangle>> jobTriangles;
+	std::vector<std::vector<softBinEntry>> jobEntries;
+	std::vector<uint32_t> tileStart;
+	std::vector<const softTriangle*> tileTriangles;
+	std::vector<size_t> tileRejected;
+
+	softStats stats;
+};
+
+softRasterizer makeSoftRasterizer(unsigned threadCount = 0);
+
+// Queues draws for target -- nothing is rasterized until endSoftFrame
+void beginSoftFrame(softRasterizer& raster, softTarget& target);
+void softDraw(softRasterizer& raster, const softMesh& mesh, const glm::mat4& model, const glm::mat4& viewProj,
+	const softShader& shader, const glm::vec4& tint = glm::vec4(1.0f), unsigned lod = 0);
+// Transforms, bins and rasterizes everything queued, in submission order
+void endSoftFrame(softRasterizer& raster);
@@ -0,0 +1,101 @@
+#include "streambuffer.h"
+
+#include <cassert>  // assert
+
+streamBuffer makeStreamBuffer(GLenum target, size_t regionSize, unsigned regionCount)
+{
+    assert(regionCount > 0 && regionCount <= STREAM_MAX_REGIONS && "unsupported region count");
+
+    streamBuffer newBuffer = {};
+    newBuffer.target = target;
+    newBuffer.regionSize = regionSize;
+    newBuffer.regionCount = regionCount;
+
+    // Immutable storage that stays mapped for the buffer's whole life
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &newBuffer.handle);
+    glBindBuffer(target, newBuffer.handle);
+    glBufferStorage(target, regionSize * regionCount, nullptr, flags);
+    newBuffer.mapped = (unsigned char*)glMapBufferRange(target, 0, regionSize * regionCount, flags);
+    glBindBuffer(target, 0);
+
+    assert(newBuffer.mapped != nullptr && "Failed to map stream buffer.");
+
+    // Start on the last region so the first beginStreamRegion lands on region 0
+    newBuffer.region = regionCount - 1;
+
+    return newBuffer;
+}
+
+void freeStreamBuffer(streamBuffer& buffer)
+{
+    for (unsigned i = 0; i < buffer.regionCount; ++i)
+    {
+        if (buffer.fences[i] != nullptr)
+        {
+            glDeleteSync(buffer.fences[i]);
+        }
+    }
+
+    glBindBuffer(buffer.target, buffer.handle);
+    glUnmapBuffer(buffer.target);
+    glBindBuffer(buffer.target, 0);
+    glDeleteBuffers(1, &buffer.handle);
+
+    buffer = {};
+}
+
+void beginStreamRegion(streamBuffer& buffer)
+{
+    buffer.region = (buffer.region + 1) % buffer.regionCount;
+    buffer.used = 0;
+    ++buffer.regionsBegun;
+
+    GLsync& fence = buffer.fences[buffer.region];
+    if (fence == nullptr)
+    {
+        return; // never used -- nothing to wait for
+    }
+
+    // Cheap check first, then block (flushing so the fence is sure to signal)
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        ++buffer.fenceWaits;
+        do
+        {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void endStreamRegion(streamBuffer& buffer)
+{
+    GLsync& fence = buffer.fences[buffer.region];
+    if (fence != nullptr)
+    {
+        glDeleteSync(fence);
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t allocateStream(streamBuffer& buffer, size_t bytes, size_t alignment)
+{
+    size_t start = (buffer.used + alignment - 1) / alignment * alignment;
+    if (start + bytes > buffer.regionSize)
+    {
+        return STREAM_ALLOC_FAILED;
+    }
+
+    buffer.used = start + bytes;
+    return buffer.region * buffer.regionSize + start;
+}
+
+size_t streamSpaceLeft(const streamBuffer& buffer)
+{
+    return buffer.regionSize - buffer.used;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>			// size_t
+
+#include "glew/GL/glew.h"	// glew (GLuint, GLsync, etc.)
+
+const unsigned STREAM_MAX_REGIONS = 4;
+const size_t STREAM_ALLOC_FAILED = ~(size_t)0;
+
+// A persistently mapped buffer split into per-frame regions. Each region is
+// fenced when the frame is done with it, so the CPU only writes into memory
+// the GPU has finished reading.
+struct streamBuffer
+{
+	GLuint handle;
+	GLenum target;			// GL_ARRAY_BUFFER, GL_PIXEL_UNPACK_BUFFER, etc.
+	unsigned char* mapped;	// CPU pointer to the whole buffer
+
+	size_t regionSize;
+	unsigned regionCount;
+	unsigned region;		// region being written this frame
+	size_t used;			// bytes handed out from the current region
+
+	GLsync fences[STREAM_MAX_REGIONS];
+
+	// telemetry
+	unsigned regionsBegun;	// number of beginStreamRegion calls
+	unsigned fenceWaits;	// how many of those had to block on the GPU
+};
+
+streamBuffer makeStreamBuffer(GLenum target, size_t regionSize, unsigned regionCount);
+void freeStreamBuffer(streamBuffer& buffer);
+
+// Starts writing the next region, blocking if the GPU is still reading from it
+void beginStreamRegion(streamBuffer& buffer);
+// Fences the current region so it is not overwritten while in flight
+void endStreamRegion(streamBuffer& buffer);
+
+// Reserves bytes in the current region -- returns the byte offset from the
+// start of the buffer, or STREAM_ALLOC_FAILED if the region is full
+size_t allocateStream(streamBuffer& buffer, size_t bytes, size_t alignment = 4);
+size_t streamSpaceLeft(const streamBuffer& buffer);
@@ -0,0 +1,731 @@
+#include "texturebuild.h"
+
+#include <cassert>  // assert
+#include <cstdio>   // fprintf, remove
+#include <cstring>  // memcpy, memset
+#include <fstream>  // ofstream
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define TEXTURE_BUILD_SSE2 1
+#endif
+
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE
+
+namespace
+{
+    const uint32_t TEXTURE_CACHE_MAGIC = 0x58455454;    // "TTEX"
+    const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+    // Fixed-size header at the start of every texture cache file
+    struct textureCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+
+        uint64_t sourceTime;
+        uint64_t sourceSize;
+        uint64_t sourceHash;
+
+        uint32_t compression;
+        uint32_t internalFormat;
+        uint32_t width, height;
+        uint32_t channels;
+        uint32_t levelCount;
+        uint32_t mipmaps;
+        uint32_t reserved;
+
+        uint64_t dataOffset;    // level offsets are relative to this
+        uint64_t dataSize;
+        textureLevel levels[TEXTURE_MAX_LEVELS];
+    };
+
+    // BC7 interpolation weights for 4-bit indices
+    const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    bool isBlockCompressed(textureCompression compression)
+    {
+        return compression != TEXTURE_RGBA8;
+    }
+
+    size_t blockBytes(textureCompression compression)
+    {
+        return (compression == TEXTURE_BC1 || compression == TEXTURE_BC4) ? 8 : 16;
+    }
+
+    size_t levelBytes(textureCompression compression, unsigned width, unsigned height)
+    {
+        if (!isBlockCompressed(compression))
+        {
+            return (size_t)width * height * 4;
+        }
+
+        size_t blocksX = (width + 3) / 4;
+        size_t blocksY = (height + 3) / 4;
+        return blocksX * blocksY * blockBytes(compression);
+    }
+
+    // Copies a 4x4 block of RGBA texels, clamping at the image edges
+    void fetchBlock(const unsigned char* rgba, unsigned width, unsigned height,
+                    unsigned blockX, unsigned blockY, unsigned char block[64])
+    {
+        for (unsigned y = 0; y < 4; ++y)
+        {
+            unsigned srcY = blockY * 4 + y < height ? blockY * 4 + y : height - 1;
+            for (unsigned x = 0; x < 4; ++x)
+            {
+                unsigned srcX = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+                memcpy(&block[(y * 4 + x) * 4], &rgba[((size_t)srcY * width + srcX) * 4], 4);
+            }
+        }
+    }
+
+    uint16_t to565(int r, int g, int b)
+    {
+        return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+    }
+
+    void from565(uint16_t c, int rgb[3])
+    {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC1 -- inset bounding box along the block's dominant color direction
+    void encodeBC1(const unsigned char block[64], unsigned char out[8])
+    {
+        int lo[3] = { 255, 255, 255 };
+        int hi[3] = { 0, 0, 0 };
+        int mean[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                int v = block[i * 4 + c];
+                lo[c] = v < lo[c] ? v : lo[c];
+                hi[c] = v > hi[c] ? v : hi[c];
+                mean[c] += v;
+            }
+        }
+
+        // flip the box diagonal for red/blue when they run against green
+        int covRG = 0, covBG = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int g = block[i * 4 + 1] * 16 - mean[1];
+            covRG += (block[i * 4 + 0] * 16 - mean[0]) * g / 16;
+            covBG += (block[i * 4 + 2] * 16 - mean[2]) * g / 16;
+        }
+
+        // pull the endpoints in a little -- the extremes are rarely worth hitting exactly
+        int e0[3], e1[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            int inset = (hi[c] - lo[c]) >> 4;
+            e0[c] = hi[c] - inset;
+            e1[c] = lo[c] + inset;
+        }
+        if (covRG < 0)
+        {
+            int t = e0[0]; e0[0] = e1[0]; e1[0] = t;
+        }
+        if (covBG < 0)
+        {
+            int t = e0[2]; e0[2] = e1[2]; e1[2] = t;
+        }
+
+        uint16_t c0 = to565(e0[0], e0[1], e0[2]);
+        uint16_t c1 = to565(e1[0], e1[1], e1[2]);
+
+        // c0 > c1 selects 4-color mode
+        if (c0 < c1)
+        {
+            uint16_t t = c0; c0 = c1; c1 = t;
+        }
+
+        uint32_t indices = 0;
+        if (c0 != c1)
+        {
+            int palette[4][3];
+            from565(c0, palette[0]);
+            from565(c1, palette[1]);
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0, bestError = 0x7FFFFFFF;
+                for (int p = 0; p < 4; ++p)
+                {
+                    int dr = block[i * 4 + 0] - palette[p][0];
+                    int dg = block[i * 4 + 1] - palette[p][1];
+                    int db = block[i * 4 + 2] - palette[p][2];
+                    int error = dr * dr + dg * dg + db * db;
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (uint32_t)best << (i * 2);
+            }
+        }
+
+        out[0] = (unsigned char)(c0 & 0xFF);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xFF);
+        out[3] = (unsigned char)(c1 >> 8);
+        memcpy(out + 4, &indices, 4);
+    }
+
+    // BC4 -- one channel (0 = R, 1 = G, 3 = A) in 8-value interpolated mode
+    void encodeBC4(const unsigned char block[64], int channel, unsigned char out[8])
+    {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int v = block[i * 4 + channel];
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+
+        out[0] = (unsigned char)hi;
+        out[1] = (unsigned char)lo;
+
+        uint64_t indices = 0;
+        if (hi != lo)
+        {
+            int range = hi - lo;
+            for (int i = 0; i < 16; ++i)
+            {
+                // position between lo (0) and hi (7), then into BC4 palette order
+                int t = ((block[i * 4 + channel] - lo) * 14 + range) / (range * 2);
+                uint64_t index = t == 7 ? 0 : (t == 0 ? 1 : 8 - t);
+                indices |= index << (i * 3);
+            }
+        }
+
+        for (int b = 0; b < 6; ++b)
+        {
+            out[2 + b] = (unsigned char)(indices >> (b * 8));
+        }
+    }
+
+    // Writes bits LSB-first into a 128-bit block
+    struct bitWriter
+    {
+        unsigned char* out;
+        unsigned position;
+
+        void write(uint32_t value, unsigned count)
+        {
+            for (unsigned i = 0; i < count; ++i, ++position)
+            {
+                if (value & (1u << i))
+                {
+                    out[position >> 3] |= (unsigned char)(1u << (position & 7));
+                }
+            }
+        }
+    };
+
+    // Quantizes an endpoint to 7 bits + a shared p-bit, picking the p-bit with less error
+    void quantizeBC7Endpoint(const int color[4], int quantized[4], int& pbit)
+    {
+        int bestError = 0x7FFFFFFF;
+        for (int p = 0; p < 2; ++p)
+        {
+            int candidate[4];
+            int error = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int q = (color[c] - p + 1) >> 1;
+                q = q < 0 ? 0 : (q > 127 ? 127 : q);
+                candidate[c] = q;
+
+                int d = ((q << 1) | p) - color[c];
+                error += d * d;
+            }
+
+            if (error < bestError)
+            {
+                bestError = error;
+                pbit = p;
+                memcpy(quantized, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    // Picks the best of the 16 interpolated colors for every texel -- returns the total error
+    int selectBC7Indices(const unsigned char block[64], const int q0[4], int p0, const int q1[4], int p1,
+                         int indices[16])
+    {
+        int e0[4], e1[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            e0[c] = (q0[c] << 1) | p0;
+            e1[c] = (q1[c] << 1) | p1;
+        }
+
+        int total = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 0x7FFFFFFF;
+            for (int w = 0; w < 16; ++w)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; ++c)
+                {
+                    int value = (e0[c] * (64 - BC7_WEIGHTS4[w]) + e1[c] * BC7_WEIGHTS4[w] + 32) >> 6;
+                    int d = value - block[i * 4 + c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = w;
+                }
+            }
+            indices[i] = best;
+            total += bestError;
+        }
+        return total;
+    }
+
+    // BC7 mode 6 -- one subset, RGBA 7.7.7.7 endpoints with p-bits, 4-bit indices
+    void encodeBC7(const unsigned char block[64], unsigned char out[16])
+    {
+        int lo[4] = { 255, 255, 255, 255 };
+        int hi[4] = { 0, 0, 0, 0 };
+        int mean[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                int v = block[i * 4 + c];
+                lo[c] = v < lo[c] ? v : lo[c];
+                hi[c] = v > hi[c] ? v : hi[c];
+                mean[c] += v;
+            }
+        }
+
+        // line up the box diagonal with the channel that varies most
+        int axis = 0;
+        for (int c = 1; c < 4; ++c)
+        {
+            axis = hi[c] - lo[c] > hi[axis] - lo[axis] ? c : axis;
+        }
+        for (int c = 0; c < 4; ++c)
+        {
+            int covariance = 0;
+            for (int i = 0; i < 16; ++i)
+            {
+                covariance += (block[i * 4 + c] * 16 - mean[c]) * (block[i * 4 + axis] * 16 - mean[axis]) / 16;
+            }
+            if (covariance < 0)
+            {
+                int t = lo[c]; lo[c] = hi[c]; hi[c] = t;
+            }
+        }
+
+        int q0[4], q1[4], p0 = 0, p1 = 0;
+        quantizeBC7Endpoint(lo, q0, p0);
+        quantizeBC7Endpoint(hi, q1, p1);
+
+        int indices[16];
+        int error = selectBC7Indices(block, q0, p0, q1, p1, indices);
+
+        // one least-squares refit of the endpoints to the chosen weights
+        float a = 0, b = 0, c2 = 0, x0[4] = {}, x1[4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            float w = BC7_WEIGHTS4[indices[i]] / 64.0f;
+            a += (1 - w) * (1 - w);
+            b += (1 - w) * w;
+            c2 += w * w;
+            for (int c = 0; c < 4; ++c)
+            {
+                x0[c] += (1 - w) * block[i * 4 + c];
+                x1[c] += w * block[i * 4 + c];
+            }
+        }
+
+        float det = a * c2 - b * b;
+        if (det > 1e-4f)
+        {
+            int fit0[4], fit1[4];
+            for (int c = 0; c < 4; ++c)
+            {
+                float v0 = (c2 * x0[c] - b * x1[c]) / det;
+                float v1 = (a * x1[c] - b * x0[c]) / det;
+                fit0[c] = v0 < 0 ? 0 : (v0 > 255 ? 255 : (int)(v0 + 0.5f));
+                fit1[c] = v1 < 0 ? 0 : (v1 > 255 ? 255 : (int)(v1 + 0.5f));
+            }
+
+            int r0[4], r1[4], rp0 = 0, rp1 = 0, refit[16];
+            quantizeBC7Endpoint(fit0, r0, rp0);
+            quantizeBC7Endpoint(fit1, r1, rp1);
+            if (selectBC7Indices(block, r0, rp0, r1, rp1, refit) < error)
+            {
+                memcpy(q0, r0, sizeof(q0));
+                memcpy(q1, r1, sizeof(q1));
+                memcpy(indices, refit, sizeof(indices));
+                p0 = rp0;
+                p1 = rp1;
+            }
+        }
+
+        // the anchor texel's index has an implicit 0 high bit -- swap the endpoints if needed
+        if (indices[0] >= 8)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                int t = q0[c]; q0[c] = q1[c]; q1[c] = t;
+            }
+            int t = p0; p0 = p1; p1 = t;
+            for (int i = 0; i < 16; ++i)
+            {
+                indices[i] = 15 - indices[i];
+            }
+        }
+
+        memset(out, 0, 16);
+        bitWriter bits = { out, 0 };
+        bits.write(1u << 6, 7);     // mode 6
+        for (int c = 0; c < 4; ++c)
+        {
+            bits.write(q0[c], 7);
+            bits.write(q1[c], 7);
+        }
+        bits.write(p0, 1);
+        bits.write(p1, 1);
+        bits.write(indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+        {
+            bits.write(indices[i], 4);
+        }
+    }
+
+    void encodeBlock(textureCompression compression, const unsigned char block[64], unsigned char* out)
+    {
+        switch (compression)
+        {
+        case TEXTURE_BC1:
+            encodeBC1(block, out);
+            break;
+        case TEXTURE_BC3:
+            encodeBC4(block, 3, out);
+            encodeBC1(block, out + 8);
+            break;
+        case TEXTURE_BC4:
+            encodeBC4(block, 0, out);
+            break;
+        case TEXTURE_BC5:
+            encodeBC4(block, 0, out);
+            encodeBC4(block, 1, out + 8);
+            break;
+        case TEXTURE_BC7:
+            encodeBC7(block, out);
+            break;
+        case TEXTURE_RGBA8:
+            assert(false && "not a block format");
+            break;
+        }
+    }
+}
+
+textureCompression chooseCompression(unsigned channels, const textureLoadOptions& options)
+{
+    if (!options.compress)
+    {
+        return TEXTURE_RGBA8;
+    }
+
+    switch (channels)
+    {
+    case 1:
+        return TEXTURE_BC4;
+    case 2:
+        return TEXTURE_BC5;
+    case 3:
+        return options.highQuality ? TEXTURE_BC7 : TEXTURE_BC1;
+    default:
+        return options.highQuality ? TEXTURE_BC7 : TEXTURE_BC3;
+    }
+}
+
+GLenum compressionInternalFormat(textureCompression compression)
+{
+    switch (compression)
+    {
+    case TEXTURE_BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXTURE_BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TEXTURE_BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case TEXTURE_BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    case TEXTURE_BC7:
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default:
+        return GL_RGBA8;
+    }
+}
+
+void downsampleRGBA(const unsigned char* src, unsigned srcWidth, unsigned srcHeight,
+                    unsigned char* dst, unsigned dstWidth, unsigned dstHeight)
+{
+    for (unsigned y = 0; y < dstHeight; ++y)
+    {
+        // clamp so 1-texel-high sources just average horizontally
+        const unsigned char* row0 = src + (size_t)(y * 2 < srcHeight ? y * 2 : srcHeight - 1) * srcWidth * 4;
+        const unsigned char* row1 = src + (size_t)(y * 2 + 1 < srcHeight ? y * 2 + 1 : srcHeight - 1) * srcWidth * 4;
+        unsigned char* out = dst + (size_t)y * dstWidth * 4;
+
+        unsigned x = 0;
+
+#ifdef TEXTURE_BUILD_SSE2
+        // two output texels (four source texels per row) at a time
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rounding = _mm_set1_epi16(2);
+        for (; x + 1 < dstWidth && x * 2 + 3 < srcWidth; x += 2)
+        {
+            __m128i top = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+            __m128i bottom = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+
+            // widen to 16 bits and add the rows
+            __m128i sumLo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+            __m128i sumHi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+
+            // add horizontal neighbours (texel 0 + 1, texel 2 + 3)
+            __m128i sum01 = _mm_add_epi16(sumLo, _mm_srli_si128(sumLo, 8));
+            __m128i sum23 = _mm_add_epi16(sumHi, _mm_srli_si128(sumHi, 8));
+            __m128i sum = _mm_unpacklo_epi64(sum01, sum23);
+
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+            _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(sum, zero));
+        }
+#endif
+
+        for (; x < dstWidth; ++x)
+        {
+            unsigned x0 = x * 2 < srcWidth ? x * 2 : srcWidth - 1;
+            unsigned x1 = x * 2 + 1 < srcWidth ? x * 2 + 1 : srcWidth - 1;
+            for (unsigned c = 0; c < 4; ++c)
+            {
+                unsigned sum = row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c];
+                out[x * 4 + c] = (unsigned char)((sum + 2) >> 2);
+            }
+        }
+    }
+}
+
+void buildTexture(const unsigned char* rgba, unsigned width, unsigned height, unsigned channels,
+                  textureCompression compression, bool mipmaps, builtTexture& built, unsigned threadCount)
+{
+    PROFILE_SCOPE("buildTexture");
+
+    built = {};
+    built.compression = compression;
+    built.internalFormat = compressionInternalFormat(compression);
+    built.width = width;
+    built.height = height;
+    built.channels = channels;
+
+    // Lay out the chain: every level down to 1x1
+    unsigned levelWidth = width, levelHeight = height;
+    uint64_t total = 0;
+    for (;;)
+    {
+        textureLevel& level = built.levels[built.levelCount++];
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.offset = total;
+        level.size = levelBytes(compression, levelWidth, levelHeight);
+        total += level.size;
+
+        if (!mipmaps || (levelWidth == 1 && levelHeight == 1) || built.levelCount == TEXTURE_MAX_LEVELS)
+        {
+            break;
+        }
+        levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+        levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+    }
+
+    built.storage.resize(total);
+    built.data = built.storage.data();
+
+    // Filter each level from the previous one
+    std::vector<unsigned char> current(rgba, rgba + (size_t)width * height * 4);
+    std::vector<unsigned char> next;
+
+    for (unsigned l = 0; l < built.levelCount; ++l)
+    {
+        const textureLevel& level = built.levels[l];
+        unsigned char* out = built.storage.data() + level.offset;
+
+        if (!isBlockCompressed(compression))
+        {
+            memcpy(out, current.data(), level.size);
+        }
+        else
+        {
+            // encode rows of blocks in parallel
+            unsigned blocksX = (level.width + 3) / 4;
+            unsigned blocksY = (level.height + 3) / 4;
+            size_t bytesPerBlock = blockBytes(compression);
+            const unsigned char* pixels = current.data();
+
+            parallelFor(blocksY, [&](size_t blockY)
+            {
+                unsigned char block[64];
+                for (unsigned blockX = 0; blockX < blocksX; ++blockX)
+                {
+                    fetchBlock(pixels, level.width, level.height, blockX, (unsigned)blockY, block);
+                    encodeBlock(compression, block, out + (blockY * blocksX + blockX) * bytesPerBlock);
+                }
+            }, threadCount);
+        }
+
+        if (l + 1 < built.levelCount)
+        {
+            const textureLevel& smaller = built.levels[l + 1];
+            next.resize((size_t)smaller.width * smaller.height * 4);
+            downsampleRGBA(current.data(), level.width, level.height, next.data(), smaller.width, smaller.height);
+            current.swap(next);
+        }
+    }
+}
+
+void freeBuiltTexture(builtTexture& built)
+{
+    unmapFile(built.cacheFile);
+    built = {};
+}
+
+std::string textureCachePath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".texcache";
+}
+
+bool openTextureCache(const char* sourcePath, textureCompression compression, bool mipmaps, builtTexture& built)
+{
+    built = {};
+
+    fileStamp sourceStamp = {};
+    if (!getFileStamp(sourcePath, sourceStamp))
+    {
+        return false;
+    }
+
+    std::string cachePath = textureCachePath(sourcePath);
+    mappedFile file = mapFile(cachePath.c_str());
+    if (file.data == nullptr)
+    {
+        return false;   // no cache yet
+    }
+
+    // Validate the header before trusting any of it
+    const textureCacheHeader* header = (const textureCacheHeader*)file.data;
+    bool valid = file.size >= sizeof(textureCacheHeader) &&
+                 header->magic == TEXTURE_CACHE_MAGIC &&
+                 header->version == TEXTURE_CACHE_VERSION &&
+                 header->sourceTime == sourceStamp.modifiedTime &&
+                 header->sourceSize == sourceStamp.size &&
+                 header->compression == (uint32_t)compression &&
+                 header->mipmaps == (uint32_t)mipmaps &&
+                 header->levelCount > 0 && header->levelCount <= TEXTURE_MAX_LEVELS &&
+                 header->dataOffset + header->dataSize <= file.size;
+
+    for (uint32_t l = 0; valid && l < header->levelCount; ++l)
+    {
+        valid = header->levels[l].offset + header->levels[l].size <= header->dataSize;
+    }
+
+    uint64_t sourceHash = 0;
+    if (valid)
+    {
+        valid = hashFile(sourcePath, sourceHash) && sourceHash == header->sourceHash;
+    }
+
+    if (!valid)
+    {
+        unmapFile(file);
+        return false;
+    }
+
+    built.compression = compression;
+    built.internalFormat = header->internalFormat;
+    built.width = header->width;
+    built.height = header->height;
+    built.channels = header->channels;
+    built.levelCount = header->levelCount;
+    memcpy(built.levels, header->levels, sizeof(built.levels));
+    built.data = file.data + header->dataOffset;
+    built.cacheFile = file;
+
+    return true;
+}
+
+bool writeTextureCache(const char* sourcePath, bool mipmaps, const builtTexture& built)
+{
+    textureCacheHeader header = {};
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_CACHE_VERSION;
+
+    fileStamp sourceStamp = {};
+    if (!getFileStamp(sourcePath, sourceStamp) || !hashFile(sourcePath, header.sourceHash))
+    {
+        return false;
+    }
+    header.sourceTime = sourceStamp.modifiedTime;
+    header.sourceSize = sourceStamp.size;
+
+    header.compression = built.compression;
+    header.internalFormat = built.internalFormat;
+    header.width = built.width;
+    header.height = built.height;
+    header.channels = built.channels;
+    header.levelCount = built.levelCount;
+    header.mipmaps = mipmaps;
+    memcpy(header.levels, built.levels, sizeof(header.levels));
+
+    const textureLevel& last = built.levels[built.levelCount - 1];
+    header.dataOffset = (sizeof(header) + 15) & ~(uint64_t)15;
+    header.dataSize = last.offset + last.size;
+
+    // Write to a temp file first so a crash never leaves a half-written cache behind
+    std::string cachePath = textureCachePath(sourcePath);
+    std::string tempPath = uniqueTempPath(cachePath);
+
+    std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        fprintf(stderr, "[WARNING] could not write texture cache %s\n", cachePath.c_str());
+        return false;
+    }
+
+    const char padding[16] = {};
+    out.write((const char*)&header, sizeof(header));
+    out.write(padding, header.dataOffset - sizeof(header));
+    out.write((const char*)built.data, header.dataSize);
+
+    bool ok = out.good();
+    out.close();
+
+    if (!ok || !replaceFile(tempPath.c_str(), cachePath.c_str()))
+    {
+        fprintf(stderr, "[WARNING] could not write texture cache %s\n", cachePath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>			// uint32_t, uint64_t
+#include <string>			// std::string
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLenum, etc.)
+
+#include "fileio.h"			// mappedFile
+
+const unsigned TEXTURE_MAX_LEVELS = 16;
+
+// Storage formats the texture build stage can produce
+enum textureCompression
+{
+	TEXTURE_RGBA8,	// uncompressed, 4 bytes per texel
+	TEXTURE_BC1,	// RGB, 0.5 bytes per texel
+	TEXTURE_BC3,	// RGBA (BC1 color + BC4 alpha), 1 byte per texel
+	TEXTURE_BC4,	// R, 0.5 bytes per texel
+	TEXTURE_BC5,	// RG (two BC4 blocks), 1 byte per texel -- good for normal maps
+	TEXTURE_BC7		// RGBA at higher quality (mode 6), 1 byte per texel
+};
+
+// Options for processing textures loaded from disk
+struct textureLoadOptions
+{
+	bool mipmaps = true;		// build the full mip chain
+	bool compress = true;		// block-compress every level
+	bool highQuality = false;	// prefer BC7 over BC1/BC3 for color textures
+};
+
+// One mip level within a builtTexture's data
+struct textureLevel
+{
+	unsigned width, height;
+	uint64_t offset;	// from the start of data
+	uint64_t size;		// in bytes
+};
+
+// A texture with its mip chain in final GPU format, ready for glTexStorage2D
+struct builtTexture
+{
+	textureCompression compression;
+	GLenum internalFormat;
+	unsigned width, height;
+	unsigned channels;		// channels in the source image
+
+	unsigned levelCount;
+	textureLevel levels[TEXTURE_MAX_LEVELS];
+
+	const unsigned char* data;	// points into storage or the mapped cache
+	std::vector<unsigned char> storage;
+	mappedFile cacheFile;
+};
+
+// Picks the block format for an image with the given channel count
+textureCompression chooseCompression(unsigned channels, const textureLoadOptions& options);
+GLenum compressionInternalFormat(textureCompression compression);
+
+// Halves an RGBA8 image with a 2x2 box filter (SSE2 where available)
+void downsampleRGBA(const unsigned char* src, unsigned srcWidth, unsigned srcHeight,
+	unsigned char* dst, unsigned dstWidth, unsigned dstHeight);
+
+// Builds the mip chain from RGBA8 pixels and encodes every level across threadCount threads
+void buildTexture(const unsigned char* rgba, unsigned width, unsigned height, unsigned channels,
+	textureCompression compression, bool mipmaps, builtTexture& built, unsigned threadCount = 0);
+void freeBuiltTexture(builtTexture& built);
+
+// Texture cache -- a built texture stored next to its source image
+std::string textureCachePath(const char* sourcePath);
+bool openTextureCache(const char* sourcePath, textureCompression compression, bool mipmaps, builtTexture& built);
+bool writeTextureCache(const char* sourcePath, bool mipmaps, const builtTexture& built);
@@ -0,0 +1,457 @@
+#include "texturepack.h"
+
+#include <algorithm>    // sort, max
+#include <cassert>      // assert
+#include <cstdio>       // fprintf
+#include <cstring>      // memcpy
+
+#include "stb/stb_image.h"
+
+#include "parallel.h"   // parallelFor
+#include "profiler.h"   // PROFILE_SCOPE
+
+const char* MATERIAL_RECORD_GLSL =
+    "struct materialRecord { uint page; uint layer; uvec2 reserved; vec4 uvRect; };\n"
+    "layout (std430, binding = 3) readonly buffer materialBuffer { materialRecord materials[]; };\n"
+    "vec3 materialCoord(materialRecord m, vec2 uv) { return vec3(m.uvRect.xy + uv * m.uvRect.zw, float(m.layer)); }\n";
+
+static_assert(sizeof(materialRecord) == 32, "materialRecord must match its std430 layout");
+
+namespace
+{
+    // A decoded source image
+    struct sourceImage
+    {
+        unsigned char* pixels;  // RGBA8 from stb
+        int width, height, channels;
+        std::vector<unsigned char> shrunk;  // replaces pixels when the image had to be scaled down
+    };
+
+    const unsigned char* imageTexels(const sourceImage& image)
+    {
+        return image.shrunk.empty() ? image.pixels : image.shrunk.data();
+    }
+
+    // Halves an image until it fits maxWidth x maxHeight
+    void shrinkToFit(sourceImage& image, unsigned maxWidth, unsigned maxHeight)
+    {
+        std::vector<unsigned char> half;
+        while ((unsigned)image.width > maxWidth || (unsigned)image.height > maxHeight)
+        {
+            unsigned width = image.width > 1 ? image.width / 2 : 1;
+            unsigned height = image.height > 1 ? image.height / 2 : 1;
+            half.resize((size_t)width * height * 4);
+            downsampleRGBA(imageTexels(image), image.width, image.height, half.data(), width, height);
+
+            image.shrunk.swap(half);
+            image.width = (int)width;
+            image.height = (int)height;
+        }
+    }
+
+    // An atlas entry, padded and rounded up to whole 4x4 blocks
+    struct atlasEntry
+    {
+        size_t image;
+        unsigned width, height;
+        unsigned x, y, layer;
+    };
+
+    unsigned alignUp4(unsigned value)
+    {
+        return (value + 3) & ~3u;
+    }
+
+    unsigned floorLog2(unsigned value)
+    {
+        unsigned log = 0;
+        while (value > 1)
+        {
+            value >>= 1;
+            ++log;
+        }
+        return log;
+    }
+
+    // Copies an image into an atlas layer, smearing its border pixels out across the padding
+    void blitExtruded(const sourceImage& image, unsigned char* atlas, unsigned atlasSize,
+                      unsigned x, unsigned y, unsigned padding)
+    {
+        int width = image.width, height = image.height;
+        int pad = (int)padding;
+
+        for (int row = -pad; row < height + pad; ++row)
+        {
+            int srcRow = row < 0 ? 0 : (row >= height ? height - 1 : row);
+            unsigned char* dst = atlas + ((size_t)(y + pad + row) * atlasSize + (x + pad)) * 4;
+            const unsigned char* src = imageTexels(image) + (size_t)srcRow * width * 4;
+
+            // left edge, the row itself, right edge
+            for (int col = -pad; col < 0; ++col)
+            {
+                memcpy(dst + col * 4, src, 4);
+            }
+            memcpy(dst, src, (size_t)width * 4);
+            for (int col = width; col < width + pad; ++col)
+            {
+                memcpy(dst + col * 4, src + (width - 1) * 4, 4);
+            }
+        }
+    }
+
+    // Uploads built layers (same size, format and level count) into a new array texture
+    texturePage uploadPage(const std::vector<builtTexture*>& layers, unsigned levels)
+    {
+        PROFILE_GPU_SCOPE("upload texture page");
+
+        const builtTexture& first = *layers.front();
+
+        texturePage page = {};
+        page.width = first.width;
+        page.height = first.height;
+        page.layers = (unsigned)layers.size();
+        page.levels = levels < first.levelCount ? levels : first.levelCount;
+        page.compression = first.compression;
+
+        glGenTextures(1, &page.handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, page.handle);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, page.levels, first.internalFormat, page.width, page.height, page.layers);
+
+        for (unsigned layer = 0; layer < page.layers; ++layer)
+        {
+            const builtTexture& built = *layers[layer];
+            for (unsigned l = 0; l < page.levels; ++l)
+            {
+                const textureLevel& level = built.levels[l];
+                const unsigned char* levelData = built.data + level.offset;
+
+                if (built.compression == TEXTURE_RGBA8)
+                {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, level.width, level.height, 1,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, levelData);
+                }
+                else
+                {
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, level.width, level.height, 1,
+                                              built.internalFormat, (GLsizei)level.size, levelData);
+                }
+            }
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, page.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)page.levels - 1);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        return page;
+    }
+}
+
+skylinePacker makeSkylinePacker(unsigned width, unsigned height)
+{
+    skylinePacker packer;
+    packer.width = width;
+    packer.height = height;
+    packer.skyline.push_back({ 0, 0, width });
+    return packer;
+}
+
+bool packRect(skylinePacker& packer, unsigned w, unsigned h, unsigned& x, unsigned& y)
+{
+    std::vector<skylineNode>& skyline = packer.skyline;
+
+    // Bottom-left: lowest top edge wins, then the narrowest resting node
+    size_t bestNode = skyline.size();
+    unsigned bestTop = ~0u, bestWidth = ~0u;
+    for (size_t i = 0; i < skyline.size(); ++i)
+    {
+        if (skyline[i].x + w > packer.width)
+        {
+            break;  // nodes are in x order -- the rest start further right
+        }
+
+        // The rectangle rests on the highest node it spans
+        unsigned restY = 0;
+        unsigned widthLeft = w;
+        for (size_t j = i; widthLeft > 0; ++j)
+        {
+            restY = std::max(restY, skyline[j].y);
+            widthLeft -= std::min(widthLeft, skyline[j].width);
+        }
+
+        if (restY + h <= packer.height &&
+            (restY + h < bestTop || (restY + h == bestTop && skyline[i].width < bestWidth)))
+        {
+            bestNode = i;
+            bestTop = restY + h;
+            bestWidth = skyline[i].width;
+        }
+    }
+
+    if (bestNode == skyline.size())
+    {
+        return false;
+    }
+
+    x = skyline[bestNode].x;
+    y = bestTop - h;
+
+    // Raise the skyline under the new rectangle
+    skyline.insert(skyline.begin() + bestNode, { x, bestTop, w });
+    for (size_t i = bestNode + 1; i < skyline.size();)
+    {
+        const skylineNode& previous = skyline[i - 1];
+        unsigned previousEnd = previous.x + previous.width;
+        if (skyline[i].x >= previousEnd)
+        {
+            break;
+        }
+
+        unsigned shrink = previousEnd - skyline[i].x;
+        if (skyline[i].width <= shrink)
+        {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+
+        skyline[i].x += shrink;
+        skyline[i].width -= shrink;
+        break;
+    }
+
+    // Merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline.size();)
+    {
+        if (skyline[i].y == skyline[i + 1].y)
+        {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+bool buildTexturePack(const char* const* filePaths, size_t count, const texturePackOptions& options, texturePack& pack)
+{
+    PROFILE_SCOPE("buildTexturePack");
+
+    pack = {};
+
+    // A pack needs at least one record -- GL rejects an empty record buffer
+    assert(count > 0 && "texture pack needs at least one image");
+    if (count == 0)
+    {
+        fprintf(stderr, "[ERROR] texture pack needs at least one image\n");
+        return false;
+    }
+
+    pack.records.resize(count);
+
+    // Decode every image in parallel (always RGBA -- the build stage works on 4 channels)
+    std::vector<sourceImage> images(count);
+    stbi_set_flip_vertically_on_load(true);
+    parallelFor(count, [&](size_t i)
+    {
+        sourceImage& image = images[i];
+        image.pixels = stbi_load(filePaths[i], &image.width, &image.height, &image.channels, STBI_rgb_alpha);
+    });
+
+    bool loaded = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (images[i].pixels == nullptr)
+        {
+            fprintf(stderr, "[ERROR] texture pack could not load %s\n", filePaths[i]);
+            loaded = false;
+        }
+    }
+    if (!loaded)
+    {
+        for (sourceImage& image : images)
+        {
+            stbi_image_free(image.pixels);
+        }
+        return false;
+    }
+
+    std::vector<size_t> arrayImages;    // images that go into arrays as whole layers
+
+    if (options.mode == TEXTURE_PACK_ATLAS)
+    {
+        unsigned padding = options.padding;
+        unsigned atlasSize = options.atlasSize;
+
+        assert((atlasSize & ~3u) > alignUp4(2 * padding) && "atlas pages must be bigger than their padding");
+
+        // One format for the whole atlas -- enough channels for every member
+        std::vector<atlasEntry> entries;
+        int maxChannels = 1;
+        for (size_t i = 0; i < count; ++i)
+        {
+            // Too big for a layer -- scaled down, so every material still lands on the one page
+            unsigned fit = (atlasSize & ~3u) - alignUp4(2 * padding);
+            shrinkToFit(images[i], fit, fit);
+
+            unsigned width = alignUp4(images[i].width + 2 * padding);
+            unsigned height = alignUp4(images[i].height + 2 * padding);
+            entries.push_back({ i, width, height, 0, 0, 0 });
+            maxChannels = std::max(maxChannels, images[i].channels);
+        }
+
+        if (!entries.empty())
+        {
+            // Tallest first packs tighter
+            std::sort(entries.begin(), entries.end(),
+                      [](const atlasEntry& a, const atlasEntry& b) { return a.height > b.height; });
+
+            std::vector<skylinePacker> layers;
+            for (atlasEntry& entry : entries)
+            {
+                bool placed = false;
+                for (size_t layer = 0; layer < layers.size() && !placed; ++layer)
+                {
+                    placed = packRect(layers[layer], entry.width, entry.height, entry.x, entry.y);
+                    entry.layer = (unsigned)layer;
+                }
+                if (!placed)
+                {
+                    layers.push_back(makeSkylinePacker(atlasSize, atlasSize));
+                    entry.layer = (unsigned)layers.size() - 1;
+                    placed = packRect(layers.back(), entry.width, entry.height, entry.x, entry.y);
+                    assert(placed && "entry should always fit an empty page");
+                }
+            }
+
+            // Compose the layers, then mip and compress them like any other texture
+            std::vector<std::vector<unsigned char>> atlasPixels(layers.size());
+            for (auto& pixels : atlasPixels)
+            {
+                pixels.assign((size_t)atlasSize * atlasSize * 4, 0);
+            }
+
+            unsigned pageIndex = 0;   // atlas is always the first page
+            for (const atlasEntry& entry : entries)
+            {
+                const sourceImage& image = images[entry.image];
+                blitExtruded(image, atlasPixels[entry.layer].data(), atlasSize, entry.x, entry.y, padding);
+
+                materialRecord& record = pack.records[entry.image];
+                record.page = pageIndex;
+                record.layer = entry.layer;
+                record.uvRect = glm::vec4((float)(entry.x + padding) / atlasSize, (float)(entry.y + padding) / atlasSize,
+                                          (float)image.width / atlasSize, (float)image.height / atlasSize);
+            }
+
+            textureCompression compression = chooseCompression(maxChannels, options.load);
+            std::vector<builtTexture> built(layers.size());
+            std::vector<builtTexture*> builtLayers;
+            for (size_t layer = 0; layer < layers.size(); ++layer)
+            {
+                buildTexture(atlasPixels[layer].data(), atlasSize, atlasSize, maxChannels, compression,
+                             options.load.mipmaps, built[layer]);
+                builtLayers.push_back(&built[layer]);
+            }
+
+            // Stop mipping once the padding would shrink below a texel and neighbours bleed together
+            unsigned levels = floorLog2(padding > 0 ? padding : 1) + 1;
+            pack.pages.push_back(uploadPage(builtLayers, levels));
+
+            for (builtTexture& layer : built)
+            {
+                freeBuiltTexture(layer);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            arrayImages.push_back(i);
+        }
+    }
+
+    // Group whole images by size and format -- each group becomes one array
+    std::vector<builtTexture> built(arrayImages.size());
+    parallelFor(arrayImages.size(), [&](size_t i)
+    {
+        const sourceImage& image = images[arrayImages[i]];
+        textureCompression compression = chooseCompression(image.channels, options.load);
+        buildTexture(image.pixels, image.width, image.height, image.channels, compression,
+                     options.load.mipmaps, built[i], 1);
+    });
+
+    std::vector<bool> grouped(arrayImages.size(), false);
+    for (size_t i = 0; i < arrayImages.size(); ++i)
+    {
+        if (grouped[i])
+        {
+            continue;
+        }
+
+        std::vector<builtTexture*> layers;
+        unsigned pageIndex = (unsigned)pack.pages.size();
+        for (size_t j = i; j < arrayImages.size(); ++j)
+        {
+            if (grouped[j] || built[j].width != built[i].width || built[j].height != built[i].height ||
+                built[j].compression != built[i].compression)
+            {
+                continue;
+            }
+
+            materialRecord& record = pack.records[arrayImages[j]];
+            record.page = pageIndex;
+            record.layer = (unsigned)layers.size();
+            record.uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+            layers.push_back(&built[j]);
+            grouped[j] = true;
+        }
+
+        pack.pages.push_back(uploadPage(layers, TEXTURE_MAX_LEVELS));
+    }
+
+    for (builtTexture& layer : built)
+    {
+        freeBuiltTexture(layer);
+    }
+    for (sourceImage& image : images)
+    {
+        stbi_image_free(image.pixels);
+    }
+
+    // Records go to the GPU so shaders can look materials up by index
+    glGenBuffers(1, &pack.recordBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pack.recordBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, pack.records.size() * sizeof(materialRecord), pack.records.data(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void freeTexturePack(texturePack& pack)
+{
+    for (texturePage& page : pack.pages)
+    {
+        glDeleteTextures(1, &page.handle);
+    }
+    glDeleteBuffers(1, &pack.recordBuffer);
+
+    pack = {};
+}
+
+void bindTexturePack(const texturePack& pack, GLuint firstUnit)
+{
+    for (size_t i = 0; i < pack.pages.size(); ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + (GLuint)i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pack.pages[i].handle);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BUFFER_BINDING, pack.recordBuffer);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (vec4)
+
+#include "texturebuild.h"	// textureCompression, textureLoadOptions
+
+// Storage binding the material records are read from
+const GLuint MATERIAL_BUFFER_BINDING = 3;
+
+// GLSL declarations for the material records and the UV remap
+extern const char* MATERIAL_RECORD_GLSL;
+
+enum texturePackMode
+{
+	TEXTURE_PACK_ARRAYS,	// same-sized textures become layers of one array (one page per size and format)
+	TEXTURE_PACK_ATLAS		// every texture is packed into the layers of a single page -- ones too big
+							// for a layer are halved until they fit
+};
+
+struct texturePackOptions
+{
+	texturePackMode mode = TEXTURE_PACK_ATLAS;
+	unsigned atlasSize = 2048;	// atlas page width and height
+	unsigned padding = 8;		// texels of edge extrusion around every atlas entry
+	textureLoadOptions load;	// mips and compression, as for loadTexture
+};
+
+// Where one source texture ended up (std430 layout, 32 bytes)
+struct materialRecord
+{
+	uint32_t page;			// index into texturePack::pages
+	uint32_t layer;			// array layer within the page
+	uint32_t reserved[2];
+	glm::vec4 uvRect;		// xy = offset, zw = scale -- uv' = uvRect.xy + uv * uvRect.zw
+};
+
+// A GL_TEXTURE_2D_ARRAY holding one group of compatible textures
+struct texturePage
+{
+	GLuint handle;
+	unsigned width, height, layers, levels;
+	textureCompression compression;
+};
+
+// Every page plus one material record per source texture, in input order.
+// GLSL can only index a sampler array with a dynamically uniform value, so a batch whose
+// materials come from several pages can't pick the page per material -- keep each batch on
+// one page, or use TEXTURE_PACK_ATLAS, which always makes exactly one.
+struct texturePack
+{
+	std::vector<texturePage> pages;
+	std::vector<materialRecord> records;
+	GLuint recordBuffer;	// SSBO with the records
+};
+
+// Bottom-left skyline rectangle packer
+struct skylineNode
+{
+	unsigned x, y, width;
+};
+
+struct skylinePacker
+{
+	unsigned width, height;
+	std::vector<skylineNode> skyline;
+};
+
+skylinePacker makeSkylinePacker(unsigned width, unsigned height);
+// Finds room for a w x h rectangle -- false if it no longer fits
+bool packRect(skylinePacker& packer, unsigned w, unsigned h, unsigned& x, unsigned& y);
+
+// Loads every image and packs them into pages. Returns false if there are no images or any fails to load.
+bool buildTexturePack(const char* const* filePaths, size_t count, const texturePackOptions& options, texturePack& pack);
+void freeTexturePack(texturePack& pack);
+
+// Binds page i to texture unit firstUnit + i and the records to MATERIAL_BUFFER_BINDING
+void bindTexturePack(const texturePack& pack, GLuint firstUnit);
@@ -1,3 +0,0 @@
-// this is the only location where this macro should be defined
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tinyobjloader/tiny_obj_loader.h"
\ No newline at end of file
@@ -0,0 +1,571 @@
+#include "transforms.h"
+
+#include <algorithm>    // upper_bound
+#include <cassert>  // assert
+#include <vector>   // vector
+
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>  // SSE2
+#define TRANSFORMS_SSE2 1
+#endif
+
+namespace
+{
+    const uint32_t NO_PARENT = ~0u;
+    const size_t UPDATE_JOB_SIZE = 1024;    // nodes per job within a level (a multiple of 4)
+
+    uint32_t indexOf(const transformHierarchy& hierarchy, transformHandle handle)
+    {
+        assert(handle < hierarchy.indexOf.size() && hierarchy.indexOf[handle] != NO_PARENT && "invalid transform handle");
+        return hierarchy.indexOf[handle];
+    }
+
+    void markDirty(transformHierarchy& hierarchy, uint32_t index)
+    {
+        if (!hierarchy.dirty[index])
+        {
+            hierarchy.dirty[index] = 1;
+            ++hierarchy.dirtyCount;
+        }
+    }
+
+    // Local matrices for four consecutive nodes, one column per register, lanes are nodes
+    struct localGroup
+    {
+        float m[12][4];     // columns 0-2 (rotation * scale), then the translation
+    };
+
+    void composeLocals(const transformHierarchy& h, size_t first, localGroup& out)
+    {
+#if TRANSFORMS_SSE2
+        __m128 x = _mm_loadu_ps(&h.rotationX[first]), y = _mm_loadu_ps(&h.rotationY[first]);
+        __m128 z = _mm_loadu_ps(&h.rotationZ[first]), w = _mm_loadu_ps(&h.rotationW[first]);
+        __m128 sx = _mm_loadu_ps(&h.scaleX[first]), sy = _mm_loadu_ps(&h.scaleY[first]), sz = _mm_loadu_ps(&h.scaleZ[first]);
+
+        __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        _mm_storeu_ps(out.m[0], _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx));
+        _mm_storeu_ps(out.m[1], _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx));
+        _mm_storeu_ps(out.m[2], _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx));
+
+        _mm_storeu_ps(out.m[3], _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy));
+        _mm_storeu_ps(out.m[4], _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy));
+        _mm_storeu_ps(out.m[5], _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy));
+
+        _mm_storeu_ps(out.m[6], _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz));
+        _mm_storeu_ps(out.m[7], _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz));
+        _mm_storeu_ps(out.m[8], _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz));
+
+        _mm_storeu_ps(out.m[9], _mm_loadu_ps(&h.positionX[first]));
+        _mm_storeu_ps(out.m[10], _mm_loadu_ps(&h.positionY[first]));
+        _mm_storeu_ps(out.m[11], _mm_loadu_ps(&h.positionZ[first]));
+#else
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            size_t i = first + lane;
+            float x = h.rotationX[i], y = h.rotationY[i], z = h.rotationZ[i], w = h.rotationW[i];
+            float sx = h.scaleX[i], sy = h.scaleY[i], sz = h.scaleZ[i];
+
+            out.m[0][lane] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+            out.m[1][lane] = 2.0f * (x * y + w * z) * sx;
+            out.m[2][lane] = 2.0f * (x * z - w * y) * sx;
+
+            out.m[3][lane] = 2.0f * (x * y - w * z) * sy;
+            out.m[4][lane] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+            out.m[5][lane] = 2.0f * (y * z + w * x) * sy;
+
+            out.m[6][lane] = 2.0f * (x * z + w * y) * sz;
+            out.m[7][lane] = 2.0f * (y * z - w * x) * sz;
+            out.m[8][lane] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+
+            out.m[9][lane] = h.positionX[i];
+            out.m[10][lane] = h.positionY[i];
+            out.m[11][lane] = h.positionZ[i];
+        }
+#endif
+    }
+
+    // world = parentWorld * local, where local is affine
+    void composeWorld(const glm::mat4* parentWorld, const localGroup& local, size_t lane, glm::mat4& world)
+    {
+        if (parentWorld == nullptr)
+        {
+            for (int column = 0; column < 3; ++column)
+            {
+                world[column] = glm::vec4(local.m[column * 3][lane], local.m[column * 3 + 1][lane],
+                                          local.m[column * 3 + 2][lane], 0.0f);
+            }
+            world[3] = glm::vec4(local.m[9][lane], local.m[10][lane], local.m[11][lane], 1.0f);
+            return;
+        }
+
+#if TRANSFORMS_SSE2
+        const float* p = &(*parentWorld)[0][0];
+        __m128 p0 = _mm_loadu_ps(p), p1 = _mm_loadu_ps(p + 4), p2 = _mm_loadu_ps(p + 8), p3 = _mm_loadu_ps(p + 12);
+        float* out = &world[0][0];
+        for (int column = 0; column < 4; ++column)
+        {
+            __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(local.m[column * 3][lane])),
+                                                  _mm_mul_ps(p1, _mm_set1_ps(local.m[column * 3 + 1][lane]))),
+                                       _mm_mul_ps(p2, _mm_set1_ps(local.m[column * 3 + 2][lane])));
+            if (column == 3)
+            {
+                result = _mm_add_ps(result, p3);
+            }
+            _mm_storeu_ps(out + column * 4, result);
+        }
+#else
+        const glm::mat4& p = *parentWorld;
+        for (int column = 0; column < 4; ++column)
+        {
+            world[column] = p[0] * local.m[column * 3][lane] + p[1] * local.m[column * 3 + 1][lane] +
+                            p[2] * local.m[column * 3 + 2][lane] + (column == 3 ? p[3] : glm::vec4(0.0f));
+        }
+#endif
+    }
+
+    // Recomputes the dirty nodes in [begin, end) of one level. Returns how many there were.
+    size_t updateRange(transformHierarchy& h, size_t begin, size_t end)
+    {
+        size_t updated = 0;
+        for (size_t group = begin; group < end; group += 4)
+        {
+            // A node is dirty if it or its parent was -- parents are a level up, so already settled
+            size_t lanes = end - group < 4 ? end - group : 4;
+            bool any = false;
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                size_t i = group + lane;
+                uint32_t parent = h.parent[i];
+                h.changed[i] = h.dirty[i] | (parent != NO_PARENT ? h.changed[parent] : 0);
+                any = any || h.changed[i];
+            }
+            if (!any)
+            {
+                continue;
+            }
+
+            // The arrays are padded, so whole groups can always be loaded
+            localGroup local;
+            composeLocals(h, group, local);
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                size_t i = group + lane;
+                if (h.changed[i])
+                {
+                    uint32_t parent = h.parent[i];
+                    composeWorld(parent != NO_PARENT ? &h.world[parent] : nullptr, local, lane, h.world[i]);
+                    ++updated;
+                }
+            }
+        }
+        return updated;
+    }
+
+    // Groups of four can start on any node, so keep three spare lanes past the last one
+    void padArrays(transformHierarchy& h, size_t count)
+    {
+        size_t padded = count + 3;
+        h.positionX.resize(padded, 0.0f);
+        h.positionY.resize(padded, 0.0f);
+        h.positionZ.resize(padded, 0.0f);
+        h.rotationX.resize(padded, 0.0f);
+        h.rotationY.resize(padded, 0.0f);
+        h.rotationZ.resize(padded, 0.0f);
+        h.rotationW.resize(padded, 1.0f);
+        h.scaleX.resize(padded, 1.0f);
+        h.scaleY.resize(padded, 1.0f);
+        h.scaleZ.resize(padded, 1.0f);
+    }
+
+    template<typename T>
+    void permute(std::vector<T>& values, const std::vector<uint32_t>& order, std::vector<T>& scratch)
+    {
+        scratch.resize(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            scratch[i] = values[order[i]];
+        }
+        values.swap(scratch);
+    }
+
+    // Drops removed subtrees and orders what is left by depth
+    void sortHierarchy(transformHierarchy& h)
+    {
+        PROFILE_SCOPE("sortTransforms");
+
+        size_t count = h.parent.size();
+
+        // Depths (and removal, which children inherit) -- parents may sit anywhere after a reparent
+        const uint32_t UNKNOWN = ~0u, DROPPED = ~0u - 1;
+        std::vector<uint32_t> depth(count, UNKNOWN);
+        std::vector<uint32_t> chain;
+        for (size_t start = 0; start < count; ++start)
+        {
+            // Walk up to something already resolved, then assign on the way back down
+            uint32_t node = (uint32_t)start;
+            while (node != NO_PARENT && depth[node] == UNKNOWN)
+            {
+                chain.push_back(node);
+                node = h.parent[node];
+            }
+
+            uint32_t above = node == NO_PARENT ? UNKNOWN : depth[node];
+            while (!chain.empty())
+            {
+                uint32_t current = chain.back();
+                chain.pop_back();
+
+                if (h.removed[current] || above == DROPPED)
+                {
+                    depth[current] = DROPPED;
+                }
+                else
+                {
+                    depth[current] = above == UNKNOWN ? 0 : above + 1;
+                }
+                above = depth[current];
+            }
+        }
+
+        // Counting sort by depth keeps siblings in their current relative order
+        std::vector<uint32_t> levelCount;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (depth[i] != DROPPED)
+            {
+                if (depth[i] >= levelCount.size())
+                {
+                    levelCount.resize(depth[i] + 1, 0);
+                }
+                ++levelCount[depth[i]];
+            }
+        }
+
+        h.levelStart.assign(levelCount.size() + 1, 0);
+        for (size_t level = 0; level < levelCount.size(); ++level)
+        {
+            h.levelStart[level + 1] = h.levelStart[level] + levelCount[level];
+        }
+
+        std::vector<uint32_t> order(h.levelStart.back());
+        std::vector<uint32_t> cursor(h.levelStart.begin(), h.levelStart.end() - 1);
+        std::vector<uint32_t> newIndex(count, NO_PARENT);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (depth[i] != DROPPED)
+            {
+                newIndex[i] = cursor[depth[i]]++;
+                order[newIndex[i]] = (uint32_t)i;
+            }
+            else
+            {
+                // Free the handle
+                h.indexOf[h.handleOf[i]] = NO_PARENT;
+                h.freeHandles.push_back(h.handleOf[i]);
+            }
+        }
+
+        std::vector<float> floats;
+        permute(h.positionX, order, floats);
+        permute(h.positionY, order, floats);
+        permute(h.positionZ, order, floats);
+        permute(h.rotationX, order, floats);
+        permute(h.rotationY, order, floats);
+        permute(h.rotationZ, order, floats);
+        permute(h.rotationW, order, floats);
+        permute(h.scaleX, order, floats);
+        permute(h.scaleY, order, floats);
+        permute(h.scaleZ, order, floats);
+
+        std::vector<glm::mat4> matrices;
+        permute(h.world, order, matrices);
+
+        std::vector<uint8_t> flags;
+        permute(h.dirty, order, flags);
+        permute(h.removed, order, flags);
+
+        std::vector<uint32_t> indices;
+        permute(h.handleOf, order, indices);
+        permute(h.parent, order, indices);
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (h.parent[i] != NO_PARENT)
+            {
+                h.parent[i] = newIndex[h.parent[i]];
+            }
+            h.indexOf[h.handleOf[i]] = (uint32_t)i;
+        }
+
+        h.changed.assign(order.size(), 0);
+        h.dirtyCount = 0;
+        for (uint8_t flag : h.dirty)
+        {
+            h.dirtyCount += flag;
+        }
+
+        padArrays(h, order.size());
+        h.needsSort = false;
+    }
+}
+
+transformHierarchy makeTransformHierarchy(size_t reserve)
+{
+    transformHierarchy hierarchy = {};
+
+    hierarchy.parent.reserve(reserve);
+    hierarchy.positionX.reserve(reserve + 3);
+    hierarchy.positionY.reserve(reserve + 3);
+    hierarchy.positionZ.reserve(reserve + 3);
+    hierarchy.rotationX.reserve(reserve + 3);
+    hierarchy.rotationY.reserve(reserve + 3);
+    hierarchy.rotationZ.reserve(reserve + 3);
+    hierarchy.rotationW.reserve(reserve + 3);
+    hierarchy.scaleX.reserve(reserve + 3);
+    hierarchy.scaleY.reserve(reserve + 3);
+    hierarchy.scaleZ.reserve(reserve + 3);
+    hierarchy.world.reserve(reserve);
+    hierarchy.dirty.reserve(reserve);
+    hierarchy.changed.reserve(reserve);
+    hierarchy.handleOf.reserve(reserve);
+    hierarchy.removed.reserve(reserve);
+    hierarchy.levelStart.assign(1, 0);
+
+    return hierarchy;
+}
+
+transformHandle addTransform(transformHierarchy& hierarchy, transformHandle parent,
+                             const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    uint32_t parentIndex = parent != INVALID_TRANSFORM ? indexOf(hierarchy, parent) : NO_PARENT;
+
+    transformHandle handle;
+    if (!hierarchy.freeHandles.empty())
+    {
+        handle = hierarchy.freeHandles.back();
+        hierarchy.freeHandles.pop_back();
+    }
+    else
+    {
+        handle = (transformHandle)hierarchy.indexOf.size();
+        hierarchy.indexOf.push_back(NO_PARENT);
+    }
+
+    // Appended, so the parent is still in front -- but the node may not be in its level yet
+    uint32_t index = (uint32_t)hierarchy.parent.size();
+    hierarchy.indexOf[handle] = index;
+    hierarchy.parent.push_back(parentIndex);
+    hierarchy.handleOf.push_back(handle);
+    hierarchy.world.push_back(glm::mat4(1.0f));
+    hierarchy.dirty.push_back(0);
+    hierarchy.changed.push_back(0);
+    hierarchy.removed.push_back(0);
+
+    // Overwrite the padding slot (if any), then pad again
+    hierarchy.positionX.resize(index);
+    hierarchy.positionY.resize(index);
+    hierarchy.positionZ.resize(index);
+    hierarchy.rotationX.resize(index);
+    hierarchy.rotationY.resize(index);
+    hierarchy.rotationZ.resize(index);
+    hierarchy.rotationW.resize(index);
+    hierarchy.scaleX.resize(index);
+    hierarchy.scaleY.resize(index);
+    hierarchy.scaleZ.resize(index);
+    hierarchy.positionX.push_back(position.x);
+    hierarchy.positionY.push_back(position.y);
+    hierarchy.positionZ.push_back(position.z);
+    hierarchy.rotationX.push_back(rotation.x);
+    hierarchy.rotationY.push_back(rotation.y);
+    hierarchy.rotationZ.push_back(rotation.z);
+    hierarchy.rotationW.push_back(rotation.w);
+    hierarchy.scaleX.push_back(scale.x);
+    hierarchy.scaleY.push_back(scale.y);
+    hierarchy.scaleZ.push_back(scale.z);
+    padArrays(hierarchy, index + 1);
+
+    markDirty(hierarchy, index);
+
+    // Appending keeps the order only if the node belongs in the last level (or starts a new one)
+    if (!hierarchy.needsSort)
+    {
+        std::vector<uint32_t>& levelStart = hierarchy.levelStart;
+        size_t levels = levelStart.size() - 1;
+        size_t depth = 0;
+        if (parentIndex != NO_PARENT)
+        {
+            depth = (size_t)(std::upper_bound(levelStart.begin(), levelStart.end(), parentIndex) - levelStart.begin());
+        }
+
+        if (levels > 0 && depth == levels - 1)
+        {
+            ++levelStart.back();
+        }
+        else if (depth == levels)
+        {
+            levelStart.push_back(index + 1);
+        }
+        else
+        {
+            hierarchy.needsSort = true;
+        }
+    }
+
+    return handle;
+}
+
+void removeTransform(transformHierarchy& hierarchy, transformHandle handle)
+{
+    // Children go at the next sort, when the whole subtree is known
+    hierarchy.removed[indexOf(hierarchy, handle)] = 1;
+    hierarchy.needsSort = true;
+}
+
+void setTransformParent(transformHierarchy& hierarchy, transformHandle handle, transformHandle parent)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    uint32_t parentIndex = parent != INVALID_TRANSFORM ? indexOf(hierarchy, parent) : NO_PARENT;
+
+#ifndef NDEBUG
+    for (uint32_t above = parentIndex; above != NO_PARENT; above = hierarchy.parent[above])
+    {
+        assert(above != index && "a transform can't be parented to its own descendant");
+    }
+#endif
+
+    hierarchy.parent[index] = parentIndex;
+    markDirty(hierarchy, index);
+    hierarchy.needsSort = true;
+}
+
+void setLocalPosition(transformHierarchy& hierarchy, transformHandle handle, const glm::vec3& position)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    hierarchy.positionX[index] = position.x;
+    hierarchy.positionY[index] = position.y;
+    hierarchy.positionZ[index] = position.z;
+    markDirty(hierarchy, index);
+}
+
+void setLocalRotation(transformHierarchy& hierarchy, transformHandle handle, const glm::quat& rotation)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    hierarchy.rotationX[index] = rotation.x;
+    hierarchy.rotationY[index] = rotation.y;
+    hierarchy.rotationZ[index] = rotation.z;
+    hierarchy.rotationW[index] = rotation.w;
+    markDirty(hierarchy, index);
+}
+
+void setLocalScale(transformHierarchy& hierarchy, transformHandle handle, const glm::vec3& scale)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    hierarchy.scaleX[index] = scale.x;
+    hierarchy.scaleY[index] = scale.y;
+    hierarchy.scaleZ[index] = scale.z;
+    markDirty(hierarchy, index);
+}
+
+void setLocalTransform(transformHierarchy& hierarchy, transformHandle handle,
+                       const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    setLocalPosition(hierarchy, handle, position);
+    setLocalRotation(hierarchy, handle, rotation);
+    setLocalScale(hierarchy, handle, scale);
+}
+
+glm::vec3 getLocalPosition(const transformHierarchy& hierarchy, transformHandle handle)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    return glm::vec3(hierarchy.positionX[index], hierarchy.positionY[index], hierarchy.positionZ[index]);
+}
+
+glm::quat getLocalRotation(const transformHierarchy& hierarchy, transformHandle handle)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    return glm::quat(hierarchy.rotationW[index], hierarchy.rotationX[index], hierarchy.rotationY[index], hierarchy.rotationZ[index]);
+}
+
+glm::vec3 getLocalScale(const transformHierarchy& hierarchy, transformHandle handle)
+{
+    uint32_t index = indexOf(hierarchy, handle);
+    return glm::vec3(hierarchy.scaleX[index], hierarchy.scaleY[index], hierarchy.scaleZ[index]);
+}
+
+const glm::mat4& getWorldMatrix(const transformHierarchy& hierarchy, transformHandle handle)
+{
+    return hierarchy.world[indexOf(hierarchy, handle)];
+}
+
+bool worldChanged(const transformHierarchy& hierarchy, transformHandle handle)
+{
+    return hierarchy.changed[indexOf(hierarchy, handle)] != 0;
+}
+
+size_t updateTransforms(transformHierarchy& hierarchy)
+{
+    PROFILE_SCOPE("updateTransforms");
+    int64_t begin = profilerNow();
+
+    transformStats& stats = hierarchy.stats;
+    stats.resorted = hierarchy.needsSort;
+    if (hierarchy.needsSort)
+    {
+        sortHierarchy(hierarchy);
+    }
+
+    size_t count = hierarchy.parent.size();
+    size_t levels = hierarchy.levelStart.size() - 1;
+    stats.nodes = count;
+    stats.levels = (unsigned)levels;
+    stats.updated = 0;
+
+    // Nothing moved -- the last update's changed flags no longer apply
+    if (hierarchy.dirtyCount == 0)
+    {
+        std::fill(hierarchy.changed.begin(), hierarchy.changed.end(), 0);
+        stats.updateMs = (profilerNow() - begin) / 1000000.0;
+        return 0;
+    }
+
+    // Level by level -- every node in a level only reads the one above, so a level splits freely
+    for (size_t level = 0; level < levels; ++level)
+    {
+        size_t levelBegin = hierarchy.levelStart[level];
+        size_t levelEnd = hierarchy.levelStart[level + 1];
+        size_t levelSize = levelEnd - levelBegin;
+
+        if (levelSize <= UPDATE_JOB_SIZE)
+        {
+            stats.updated += updateRange(hierarchy, levelBegin, levelEnd);
+            continue;
+        }
+
+        size_t jobCount = (levelSize + UPDATE_JOB_SIZE - 1) / UPDATE_JOB_SIZE;
+        std::vector<size_t> jobUpdated(jobCount);
+        parallelFor(jobCount, [&](size_t job)
+        {
+            size_t jobBegin = levelBegin + job * UPDATE_JOB_SIZE;
+            size_t jobEnd = jobBegin + UPDATE_JOB_SIZE < levelEnd ? jobBegin + UPDATE_JOB_SIZE : levelEnd;
+            jobUpdated[job] = updateRange(hierarchy, jobBegin, jobEnd);
+        });
+
+        for (size_t updated : jobUpdated)
+        {
+            stats.updated += updated;
+        }
+    }
+
+    std::fill(hierarchy.dirty.begin(), hierarchy.dirty.end(), 0);
+    hierarchy.dirtyCount = 0;
+
+    stats.updateMs = (profilerNow() - begin) / 1000000.0;
+    return stats.updated;
+}
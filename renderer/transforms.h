@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t
+#include <vector>			// vector
+
+#include "glm/glm.hpp"		// glm math types (vec3, mat4)
+#include "glm/gtc/quaternion.hpp"	// quat
+
+// Refers to a node for as long as it lives -- indices move when the hierarchy is re-sorted
+typedef uint32_t transformHandle;
+const transformHandle INVALID_TRANSFORM = ~0u;
+
+// Work done by the last updateTransforms
+struct transformStats
+{
+	size_t nodes;
+	size_t updated;			// world matrices recomputed
+	unsigned levels;		// depth of the deepest node + 1
+	bool resorted;			// parents changed, nodes were removed, or new nodes needed a level
+	double updateMs;
+};
+
+// Local translation/rotation/scale and world matrices for a whole scene, structure-of-arrays.
+// Nodes are kept sorted by depth, so every parent comes before its children and a level's
+// nodes only depend on the level above -- each level is split across the job threads.
+// Only dirty nodes and their descendants are recomputed.
+struct transformHierarchy
+{
+	// Indexed by position in the sorted order
+	std::vector<uint32_t> parent;			// index of the parent, ~0u for roots
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<glm::mat4> world;
+	std::vector<uint8_t> dirty;				// local changed since the last update
+	std::vector<uint8_t> changed;			// world recomputed by the last update
+	std::vector<transformHandle> handleOf;
+
+	std::vector<uint32_t> levelStart;		// first index of each depth, plus one past the end
+
+	// Handle -> index, ~0u for free handles
+	std::vector<uint32_t> indexOf;
+	std::vector<transformHandle> freeHandles;
+
+	std::vector<uint8_t> removed;			// waiting for the next re-sort to drop them
+	bool needsSort;
+	size_t dirtyCount;
+
+	transformStats stats;
+};
+
+transformHierarchy makeTransformHierarchy(size_t reserve = 0);
+
+// New nodes start dirty. The parent must already exist.
+transformHandle addTransform(transformHierarchy& hierarchy, transformHandle parent = INVALID_TRANSFORM,
+	const glm::vec3& position = glm::vec3(0.0f), const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+	const glm::vec3& scale = glm::vec3(1.0f));
+// Removes the node and everything below it (the handles are freed at the next update)
+void removeTransform(transformHierarchy& hierarchy, transformHandle handle);
+// parent may be INVALID_TRANSFORM to make the node a root. Keeps the local transform, not the world one.
+void setTransformParent(transformHierarchy& hierarchy, transformHandle handle, transformHandle parent);
+
+void setLocalPosition(transformHierarchy& hierarchy, transformHandle handle, const glm::vec3& position);
+void setLocalRotation(transformHierarchy& hierarchy, transformHandle handle, const glm::quat& rotation);
+void setLocalScale(transformHierarchy& hierarchy, transformHandle handle, const glm::vec3& scale);
+void setLocalTransform(transformHierarchy& hierarchy, transformHandle handle,
+	const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+glm::vec3 getLocalPosition(const transformHierarchy& hierarchy, transformHandle handle);
+glm::quat getLocalRotation(const transformHierarchy& hierarchy, transformHandle handle);
+glm::vec3 getLocalScale(const transformHierarchy& hierarchy, transformHandle handle);
+// As of the last updateTransforms
+const glm::mat4& getWorldMatrix(const transformHierarchy& hierarchy, transformHandle handle);
+// True if the last updateTransforms recomputed this node's world matrix
+bool worldChanged(const transformHierarchy& hierarchy, transformHandle handle);
+
+// Re-sorts if the structure changed, then recomputes world matrices for dirty subtrees.
+// Returns the number recomputed.
+size_t updateTransforms(transformHierarchy& hierarchy);
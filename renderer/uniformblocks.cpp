@@ -0,0 +1,120 @@
+#include "uniformblocks.h"
+
+#include <cassert>  // assert
+#include <cstdio>   // fprintf
+#include <cstring>  // memcpy
+
+const char* UNIFORM_BLOCKS_GLSL =
+    "layout (std140, binding = 0) uniform cameraBlock { mat4 proj; mat4 view; mat4 viewProj; vec4 position; } camera;\n"
+    "layout (std140, binding = 1) uniform frameBlock { vec4 ambient; vec4 lightDiffuse; vec4 lightDirection; vec4 time; } frame;\n"
+    "layout (std140, binding = 2) uniform objectBlock { mat4 model; vec4 color; } object;\n";
+
+static_assert(sizeof(cameraBlock) == 208, "cameraBlock must match its std140 layout");
+static_assert(sizeof(frameBlock) == 64, "frameBlock must match its std140 layout");
+static_assert(sizeof(objectBlock) == 80, "objectBlock must match its std140 layout");
+
+uniformRing makeUniformRing(size_t bytesPerFrame)
+{
+    uniformRing ring = {};
+
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ring.alignment = alignment > 0 ? (size_t)alignment : 256;
+
+    // Every region has to start on an aligned offset too
+    size_t regionSize = (bytesPerFrame + ring.alignment - 1) / ring.alignment * ring.alignment;
+    ring.buffer = makeStreamBuffer(GL_UNIFORM_BUFFER, regionSize, UNIFORM_RING_FRAMES);
+
+    return ring;
+}
+
+void freeUniformRing(uniformRing& ring)
+{
+    freeStreamBuffer(ring.buffer);
+
+    ring = {};
+}
+
+void beginUniformFrame(uniformRing& ring)
+{
+    beginStreamRegion(ring.buffer);
+    ring.blocksPushed = 0;
+    ring.overflows = 0;
+}
+
+void endUniformFrame(uniformRing& ring)
+{
+    endStreamRegion(ring.buffer);
+}
+
+size_t pushUniforms(uniformRing& ring, const void* data, size_t size)
+{
+    size_t offset = allocateStream(ring.buffer, size, ring.alignment);
+    if (offset == STREAM_ALLOC_FAILED)
+    {
+        // Report once per frame -- the region needs to be bigger
+        if (ring.overflows++ == 0)
+        {
+            fprintf(stderr, "[WARNING] uniform ring is full (%u blocks this frame)\n", ring.blocksPushed);
+        }
+        return STREAM_ALLOC_FAILED;
+    }
+
+    // Coherent mapping -- visible to the GPU without a flush
+    memcpy(ring.buffer.mapped + offset, data, size);
+    ++ring.blocksPushed;
+
+    return offset;
+}
+
+void bindUniforms(const uniformRing& ring, GLuint binding, size_t offset, size_t size)
+{
+    assert(offset != STREAM_ALLOC_FAILED && "binding a block that was never pushed");
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring.buffer.handle, (GLintptr)offset, (GLsizeiptr)size);
+}
+
+namespace
+{
+    template <typename block>
+    bool setBlock(uniformRing& ring, GLuint binding, const block& data)
+    {
+        size_t offset = pushUniforms(ring, &data, sizeof(block));
+        if (offset == STREAM_ALLOC_FAILED)
+        {
+            return false;
+        }
+
+        bindUniforms(ring, binding, offset, sizeof(block));
+        return true;
+    }
+}
+
+bool setCameraBlock(uniformRing& ring, const cameraBlock& block)
+{
+    return setBlock(ring, CAMERA_BLOCK_BINDING, block);
+}
+
+bool setFrameBlock(uniformRing& ring, const frameBlock& block)
+{
+    return setBlock(ring, FRAME_BLOCK_BINDING, block);
+}
+
+bool setObjectBlock(uniformRing& ring, const objectBlock& block)
+{
+    return setBlock(ring, OBJECT_BLOCK_BINDING, block);
+}
+
+cameraBlock makeCameraBlock(const glm::mat4& proj, const glm::mat4& view)
+{
+    cameraBlock block;
+    block.proj = proj;
+    block.view = view;
+    block.viewProj = proj * view;
+
+    // The camera sits at the view matrix's inverse translation
+    glm::mat4 inverseView = glm::inverse(view);
+    block.position = glm::vec4(glm::vec3(inverseView[3]), 1.0f);
+
+    return block;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>			// size_t
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (mat4, vec4)
+
+#include "streambuffer.h"	// streamBuffer
+
+// Binding points shared by every program
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint FRAME_BLOCK_BINDING = 1;
+const GLuint OBJECT_BLOCK_BINDING = 2;
+
+// Frames the CPU may run ahead of the GPU before waiting on a fence
+const unsigned UNIFORM_RING_FRAMES = 3;
+
+// GLSL declarations matching the blocks below
+extern const char* UNIFORM_BLOCKS_GLSL;
+
+// std140 layouts -- only mat4/vec4 members so C++ and GLSL agree without padding rules
+struct cameraBlock
+{
+	glm::mat4 proj;
+	glm::mat4 view;
+	glm::mat4 viewProj;
+	glm::vec4 position;			// xyz = camera position in world space
+};
+
+struct frameBlock
+{
+	glm::vec4 ambient;			// xyz
+	glm::vec4 lightDiffuse;		// xyz
+	glm::vec4 lightDirection;	// xyz, normalized
+	glm::vec4 time;				// x = seconds since start
+};
+
+struct objectBlock
+{
+	glm::mat4 model;
+	glm::vec4 color;
+};
+
+// A persistently mapped uniform buffer split into one region per in-flight frame.
+// Blocks are copied in once and bound by offset with glBindBufferRange.
+struct uniformRing
+{
+	streamBuffer buffer;
+	size_t alignment;			// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+	unsigned blocksPushed;		// this frame
+	unsigned overflows;			// pushes that didn't fit this frame
+};
+
+uniformRing makeUniformRing(size_t bytesPerFrame);
+void freeUniformRing(uniformRing& ring);
+
+// Waits until the GPU is done with this frame's region (rarely blocks)
+void beginUniformFrame(uniformRing& ring);
+// Fences the region -- call after the frame's last draw
+void endUniformFrame(uniformRing& ring);
+
+// Copies a block into the ring and returns its offset, or STREAM_ALLOC_FAILED if the frame is full
+size_t pushUniforms(uniformRing& ring, const void* data, size_t size);
+void bindUniforms(const uniformRing& ring, GLuint binding, size_t offset, size_t size);
+
+// Push + bind in one go -- returns false if the frame's region is full
+bool setCameraBlock(uniformRing& ring, const cameraBlock& block);
+bool setFrameBlock(uniformRing& ring, const frameBlock& block);
+bool setObjectBlock(uniformRing& ring, const objectBlock& block);
+
+// Fills a camera block from the usual matrices
+cameraBlock makeCameraBlock(const glm::mat4& proj, const glm::mat4& view);
@@ -0,0 +1,259 @@
+#include "vertexformat.h"
+
+#include <cassert>  // assert
+#include <cmath>    // fabsf
+#include <cstdint>  // uint16_t, uint32_t
+#include <cstring>  // memcpy
+
+#include "glm/gtc/packing.hpp"  // packHalf1x16, packSnorm3x10_1x2, etc.
+
+#include "render.h" // vertex
+
+const char* OCTAHEDRAL_DECODE_GLSL =
+    "vec3 octDecode(vec2 e)\n"
+    "{\n"
+    "    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));\n"
+    "    float t = max(-n.z, 0.0);\n"
+    "    n.x += n.x >= 0.0 ? -t : t;\n"
+    "    n.y += n.y >= 0.0 ? -t : t;\n"
+    "    return normalize(n);\n"
+    "}\n";
+
+namespace
+{
+    // Appends the raw bytes of a value to a buffer
+    template<typename T>
+    void append(std::vector<unsigned char>& packed, const T& value)
+    {
+        size_t at = packed.size();
+        packed.resize(at + sizeof(T));
+        memcpy(&packed[at], &value, sizeof(T));
+    }
+
+    // Avoid dividing by zero on flat meshes (e.g. a quad has no depth)
+    glm::vec3 safeExtent(const glm::vec3& extent)
+    {
+        return glm::vec3(extent.x > 0.0f ? extent.x : 1.0f,
+                         extent.y > 0.0f ? extent.y : 1.0f,
+                         extent.z > 0.0f ? extent.z : 1.0f);
+    }
+
+    glm::vec2 octEncode(glm::vec3 n)
+    {
+        n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f)
+        {
+            // fold the lower hemisphere over the diagonals
+            e = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                          (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+        }
+        return e;
+    }
+}
+
+vertexLayout describeVertexFormat(const vertexFormat& format)
+{
+    vertexLayout layout = {};
+    GLuint offset = 0;
+
+    // position
+    switch (format.position)
+    {
+    case POSITION_FLOAT:
+        layout.attributes[layout.attributeCount++] = { 0, 4, GL_FLOAT, GL_FALSE, offset };
+        offset += 4 * sizeof(float);
+        break;
+    case POSITION_HALF:
+        layout.attributes[layout.attributeCount++] = { 0, 4, GL_HALF_FLOAT, GL_FALSE, offset };
+        offset += 4 * sizeof(uint16_t);
+        break;
+    case POSITION_UNORM16:
+        layout.attributes[layout.attributeCount++] = { 0, 4, GL_UNSIGNED_SHORT, GL_TRUE, offset };
+        offset += 4 * sizeof(uint16_t);
+        break;
+    }
+
+    // vertex color
+    switch (format.color)
+    {
+    case COLOR_NONE:
+        break;
+    case COLOR_FLOAT:
+        layout.attributes[layout.attributeCount++] = { 1, 4, GL_FLOAT, GL_FALSE, offset };
+        offset += 4 * sizeof(float);
+        break;
+    case COLOR_UNORM8:
+        layout.attributes[layout.attributeCount++] = { 1, 4, GL_UNSIGNED_BYTE, GL_TRUE, offset };
+        offset += 4 * sizeof(uint8_t);
+        break;
+    }
+
+    // uv
+    switch (format.uv)
+    {
+    case UV_FLOAT:
+        layout.attributes[layout.attributeCount++] = { 2, 2, GL_FLOAT, GL_FALSE, offset };
+        offset += 2 * sizeof(float);
+        break;
+    case UV_HALF:
+        layout.attributes[layout.attributeCount++] = { 2, 2, GL_HALF_FLOAT, GL_FALSE, offset };
+        offset += 2 * sizeof(uint16_t);
+        break;
+    }
+
+    // normal
+    switch (format.normal)
+    {
+    case NORMAL_FLOAT:
+        layout.attributes[layout.attributeCount++] = { 3, 4, GL_FLOAT, GL_FALSE, offset };
+        offset += 4 * sizeof(float);
+        break;
+    case NORMAL_INT_2_10_10_10:
+        layout.attributes[layout.attributeCount++] = { 3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offset };
+        offset += sizeof(uint32_t);
+        break;
+    case NORMAL_OCTAHEDRAL:
+        layout.attributes[layout.attributeCount++] = { 3, 2, GL_SHORT, GL_TRUE, offset };
+        offset += 2 * sizeof(int16_t);
+        break;
+    }
+
+    layout.stride = offset;
+    return layout;
+}
+
+bool operator==(const vertexFormat& a, const vertexFormat& b)
+{
+    return a.position == b.position && a.color == b.color && a.uv == b.uv && a.normal == b.normal;
+}
+
+void computeQuantization(const vertexFormat& format, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                         glm::vec3& posScale, glm::vec3& posOffset)
+{
+    switch (format.position)
+    {
+    case POSITION_FLOAT:
+        posScale = glm::vec3(1.0f);
+        posOffset = glm::vec3(0.0f);
+        break;
+    case POSITION_HALF:
+        // stored in [-1, 1] around the center of the bounds
+        posScale = safeExtent(boundsMax - boundsMin) * 0.5f;
+        posOffset = (boundsMin + boundsMax) * 0.5f;
+        break;
+    case POSITION_UNORM16:
+        // stored in [0, 1] from the minimum corner
+        posScale = safeExtent(boundsMax - boundsMin);
+        posOffset = boundsMin;
+        break;
+    }
+}
+
+void packVertices(const vertex* verts, size_t vertCount, const vertexFormat& format,
+                  const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<unsigned char>& packed)
+{
+    // the full format is the vertex struct itself
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        const unsigned char* bytes = (const unsigned char*)verts;
+        packed.insert(packed.end(), bytes, bytes + vertCount * sizeof(vertex));
+        return;
+    }
+
+    glm::vec3 posScale, posOffset;
+    computeQuantization(format, boundsMin, boundsMax, posScale, posOffset);
+
+    packed.reserve(packed.size() + vertCount * describeVertexFormat(format).stride);
+
+    for (size_t i = 0; i < vertCount; ++i)
+    {
+        const vertex& vert = verts[i];
+
+        // position (w is always 1)
+        glm::vec3 local = (glm::vec3(vert.pos) - posOffset) / posScale;
+        switch (format.position)
+        {
+        case POSITION_FLOAT:
+            append(packed, vert.pos);
+            break;
+        case POSITION_HALF:
+            append(packed, glm::packHalf1x16(local.x));
+            append(packed, glm::packHalf1x16(local.y));
+            append(packed, glm::packHalf1x16(local.z));
+            append(packed, glm::packHalf1x16(1.0f));
+            break;
+        case POSITION_UNORM16:
+            append(packed, glm::packUnorm1x16(local.x));
+            append(packed, glm::packUnorm1x16(local.y));
+            append(packed, glm::packUnorm1x16(local.z));
+            append(packed, glm::packUnorm1x16(1.0f));
+            break;
+        }
+
+        // vertex color
+        switch (format.color)
+        {
+        case COLOR_NONE:
+            break;
+        case COLOR_FLOAT:
+            append(packed, vert.color);
+            break;
+        case COLOR_UNORM8:
+            append(packed, glm::packUnorm4x8(vert.color));
+            break;
+        }
+
+        // uv
+        switch (format.uv)
+        {
+        case UV_FLOAT:
+            append(packed, vert.uv);
+            break;
+        case UV_HALF:
+            append(packed, glm::packHalf1x16(vert.uv.x));
+            append(packed, glm::packHalf1x16(vert.uv.y));
+            break;
+        }
+
+        // normal
+        switch (format.normal)
+        {
+        case NORMAL_FLOAT:
+            append(packed, vert.normal);
+            break;
+        case NORMAL_INT_2_10_10_10:
+            append(packed, glm::packSnorm3x10_1x2(glm::vec4(glm::vec3(vert.normal), 0.0f)));
+            break;
+        case NORMAL_OCTAHEDRAL:
+            append(packed, glm::packSnorm2x16(octEncode(glm::vec3(vert.normal))));
+            break;
+        }
+    }
+}
+
+GLenum packIndices(const unsigned int* indices, size_t indxCount, size_t vertCount,
+                   std::vector<unsigned char>& packed)
+{
+    // every index fits in 16 bits
+    if (vertCount <= 0x10000)
+    {
+        packed.resize(indxCount * sizeof(uint16_t));
+        uint16_t* narrow = (uint16_t*)packed.data();
+        for (size_t i = 0; i < indxCount; ++i)
+        {
+            assert(indices[i] < vertCount && "index out of range");
+            narrow[i] = (uint16_t)indices[i];
+        }
+        return GL_UNSIGNED_SHORT;
+    }
+
+    const unsigned char* bytes = (const unsigned char*)indices;
+    packed.assign(bytes, bytes + indxCount * sizeof(unsigned int));
+    return GL_UNSIGNED_INT;
+}
+
+size_t indexTypeSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>			// size_t
+#include <vector>			// vector
+
+#include "glew/GL/glew.h"	// glew (GLuint, etc.)
+#include "glm/glm.hpp"		// glm math types (vec3)
+
+struct vertex;
+
+// How each attribute is stored in a vertex buffer
+enum positionFormat
+{
+	POSITION_FLOAT,		// 4 x float
+	POSITION_HALF,		// 4 x half, relative to the center of the mesh bounds
+	POSITION_UNORM16	// 4 x 16-bit normalized, relative to the mesh bounds
+};
+
+enum colorFormat
+{
+	COLOR_NONE,			// not stored -- shaders read white
+	COLOR_FLOAT,		// 4 x float
+	COLOR_UNORM8		// 4 x 8-bit normalized
+};
+
+enum uvFormat
+{
+	UV_FLOAT,			// 2 x float
+	UV_HALF				// 2 x half
+};
+
+enum normalFormat
+{
+	NORMAL_FLOAT,		// 4 x float
+	NORMAL_INT_2_10_10_10,	// xyz in 10-bit signed normalized, w = 0
+	NORMAL_OCTAHEDRAL	// 2 x 16-bit signed normalized -- decode with OCTAHEDRAL_DECODE_GLSL
+};
+
+// Describes the layout of a geometry's vertex buffer
+struct vertexFormat
+{
+	positionFormat position;
+	colorFormat color;
+	uvFormat uv;
+	normalFormat normal;
+};
+
+// Same layout as the vertex struct (56 bytes)
+const vertexFormat VERTEX_FORMAT_FULL = { POSITION_FLOAT, COLOR_FLOAT, UV_FLOAT, NORMAL_FLOAT };
+// Quantized layout for dense meshes (16 bytes)
+const vertexFormat VERTEX_FORMAT_COMPACT = { POSITION_UNORM16, COLOR_NONE, UV_HALF, NORMAL_INT_2_10_10_10 };
+
+// GLSL function for unpacking NORMAL_OCTAHEDRAL normals in a vertex shader
+extern const char* OCTAHEDRAL_DECODE_GLSL;
+
+// One attribute as handed to glVertexAttribPointer
+struct vertexAttribute
+{
+	GLuint location;
+	GLint components;
+	GLenum type;
+	GLboolean normalized;
+	GLuint offset;
+};
+
+// Every attribute in a format (locations 0-3 match the vertex struct)
+struct vertexLayout
+{
+	vertexAttribute attributes[4];
+	GLuint attributeCount;
+	GLuint stride;
+};
+
+vertexLayout describeVertexFormat(const vertexFormat& format);
+bool operator==(const vertexFormat& a, const vertexFormat& b);
+
+// Scale/offset that maps stored positions back to object space
+void computeQuantization(const vertexFormat& format, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	glm::vec3& posScale, glm::vec3& posOffset);
+
+// Converts vertices into the given format, appending to packed
+void packVertices(const vertex* verts, size_t vertCount, const vertexFormat& format,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<unsigned char>& packed);
+
+// Converts indices to 16-bit when every vertex can be addressed with them --
+// returns GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+GLenum packIndices(const unsigned int* indices, size_t indxCount, size_t vertCount,
+	std::vector<unsigned char>& packed);
+
+size_t indexTypeSize(GLenum indexType);